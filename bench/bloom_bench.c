@@ -0,0 +1,104 @@
+/*
+   This is the bloom_bench.c file that measures the false-positive rate and the
+   probe throughput of the standard, the blocked and the counting bloom filter layouts.
+
+   usage: bloomBench [records] [fp_rate]
+   setting BLOOM_SCALAR=1 in the environment measures the portable blocked kernel
+*/
+
+// including relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/bloom_filter.h"
+
+#define KEY_LEN 24 // room for a 20-digit citizen ID and its terminator
+
+// now_seconds(...) reads a monotonic clock in seconds
+static double now_seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// next_random(...) is a small xorshift generator so runs are reproducible
+static uint64_t next_random(uint64_t *state)
+{
+   uint64_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+// run(...) inserts the present keys, then probes present and absent keys
+static void run(BloomLayout layout, char (*present)[KEY_LEN], char (*absent)[KEY_LEN],
+                uint64_t n, double fp_rate)
+{
+   BloomFilter *filter = bloom_create(n, fp_rate, layout);
+   volatile uint64_t sink = 0; // keeps the compiler from dropping the probes
+
+   double start = now_seconds();
+   for (uint64_t i = 0; i < n; i++)
+   {
+      bloom_insert(filter, present[i], strlen(present[i]));
+   }
+   double insert_time = now_seconds() - start;
+
+   start = now_seconds();
+   for (uint64_t i = 0; i < n; i++)
+   {
+      sink += bloom_check(filter, present[i], strlen(present[i]));
+   }
+   double hit_time = now_seconds() - start;
+
+   uint64_t false_positives = 0;
+   start = now_seconds();
+   for (uint64_t i = 0; i < n; i++)
+   {
+      false_positives += bloom_check(filter, absent[i], strlen(absent[i]));
+   }
+   double miss_time = now_seconds() - start;
+
+   printf("%-8s  k=%-2d  bits=%-11llu  fpr=%.5f  insert=%7.2f M/s  hit=%7.2f M/s  miss=%7.2f M/s\n",
+          bloom_layout_name(layout), filter->num_hashes, (unsigned long long)filter->size,
+          (double)false_positives / n, n / insert_time / 1e6, n / hit_time / 1e6, n / miss_time / 1e6);
+
+   bloom_delete(filter);
+}
+
+// driver function
+int main(int argc, char *argv[])
+{
+   uint64_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+   double fp_rate = argc > 2 ? strtod(argv[2], NULL) : BLOOM_DEFAULT_FP_RATE;
+   uint64_t state = 88172645463325252ULL;
+
+   char (*present)[KEY_LEN] = malloc(n * KEY_LEN);
+   char (*absent)[KEY_LEN] = malloc(n * KEY_LEN);
+   if (present == NULL || absent == NULL)
+   {
+      printf("Error while allocating keys\n");
+      return 1;
+   }
+
+   // odd IDs are inserted, even IDs are only ever probed, so they never collide
+   for (uint64_t i = 0; i < n; i++)
+   {
+      uint64_t id = next_random(&state) % 10000000000000ULL;
+      snprintf(present[i], KEY_LEN, "%llu", (unsigned long long)(id | 1));
+      snprintf(absent[i], KEY_LEN, "%llu", (unsigned long long)(id & ~1ULL));
+   }
+
+   printf("%llu records, target fpr %.4f, blocked kernel %s\n",
+          (unsigned long long)n, fp_rate, bloom_probe_kernel());
+   run(BLOOM_STANDARD, present, absent, n, fp_rate);
+   run(BLOOM_BLOCKED, present, absent, n, fp_rate);
+   run(BLOOM_COUNTING, present, absent, n, fp_rate);
+
+   free(present);
+   free(absent);
+   return 0;
+}
@@ -0,0 +1,318 @@
+/*
+   This is the generate_records.c file that writes synthetic input files in the
+   format the program loads, fast enough for 10^8 records (generate_data.sh
+   forks a printf per line and tops out at a few thousand).
+
+   usage: generateRecords [-n records] [-v viruses] [-c countries] [-z skew]
+                          [-d duplicate_rate] [-y vaccinated_rate] [-k citizens] [-x seed] [-s] [-o file]
+
+   -z is the exponent of a Zipf distribution over viruses and countries (0 is
+   uniform, 1 makes the first virus about ten times as common as the tenth),
+   -d is the share of records that repeat the citizen ID and virus of a recent
+   record, and -s writes the citizen IDs in ascending order. -k draws every
+   record's citizen from that many people, each with the same name, country
+   and age on all of their lines, so citizens have records for several viruses
+   (without it every record is a new person). Citizen IDs are always even, so
+   any odd ID is a guaranteed miss for a benchmark. The same options and seed
+   always give the same file.
+*/
+
+// including relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#define RECENT_RECORDS 65536   // duplicates repeat one of this many recent records (a power of two)
+#define OUTPUT_BUFFER (1 << 20) // bytes formatted before every fwrite(...)
+#define MAX_LINE 160           // longest line a record can format to
+
+// defining the names the generated records draw from
+static const char *first_names[] = {"John", "Mary", "Michael", "William", "David", "Susan", "Paul",
+                                    "Linda", "James", "Maria", "Ahmed", "Yuki", "Olga", "Chen"};
+static const char *last_names[] = {"Smith", "Johnson", "Williams", "Jones", "Davis", "Wilson", "Miller",
+                                   "Garcia", "Tanaka", "Ivanova", "Okafor", "Haddad", "Kumar", "Wang"};
+static const char *known_countries[] = {"USA", "UK", "Canada", "Australia", "Spain", "Japan", "China",
+                                        "India", "Ethiopia"};
+static const char *known_viruses[] = {"COVID-19", "Influenza", "Measles", "Polio", "Rabies", "Cholera",
+                                      "Malaria", "Yellowfever", "HepatitisB"};
+
+// defining a record a duplicate can repeat
+typedef struct
+{
+   uint64_t citizen_id;
+   int virus;
+} Recent;
+
+// next_random(...) is a small xorshift generator so runs are reproducible
+static uint64_t next_random(uint64_t *state)
+{
+   uint64_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+// next_unit(...) draws a double in [0, 1)
+static double next_unit(uint64_t *state)
+{
+   return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// zipf_table(...) builds the cumulative distribution of count items with exponent skew
+static double *zipf_table(int count, double skew)
+{
+   double *cdf = malloc(count * sizeof(double));
+   double sum = 0.0;
+
+   if (cdf == NULL)
+      return NULL;
+
+   for (int i = 0; i < count; i++)
+   {
+      sum += skew == 0.0 ? 1.0 : 1.0 / pow(i + 1, skew);
+      cdf[i] = sum;
+   }
+   for (int i = 0; i < count; i++)
+      cdf[i] /= sum;
+
+   return cdf;
+}
+
+// pick(...) draws an item from a cumulative distribution with a binary search
+static int pick(const double *cdf, int count, uint64_t *state)
+{
+   double u = next_unit(state);
+   int low = 0, high = count - 1;
+
+   while (low < high)
+   {
+      int mid = (low + high) / 2;
+      if (cdf[mid] <= u)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   return low;
+}
+
+// put_number(...) writes a decimal number without printf(...) and returns the end
+static char *put_number(char *out, uint64_t value)
+{
+   char digits[20];
+   int n = 0;
+
+   do
+   {
+      digits[n++] = '0' + value % 10;
+      value /= 10;
+   } while (value > 0);
+
+   while (n > 0)
+      *out++ = digits[--n];
+   return out;
+}
+
+// put_string(...) copies a NUL-terminated string and returns the end
+static char *put_string(char *out, const char *str)
+{
+   size_t len = strlen(str);
+   memcpy(out, str, len);
+   return out + len;
+}
+
+// put_two(...) writes a number below 100 as two digits
+static char *put_two(char *out, int value)
+{
+   out[0] = '0' + value / 10;
+   out[1] = '0' + value % 10;
+   return out + 2;
+}
+
+// make_names(...) fills count names, the well-known ones first and then prefix<n>
+static char **make_names(int count, const char **known, int known_count, const char *prefix)
+{
+   char **names = malloc(count * sizeof(char *));
+
+   if (names == NULL)
+      return NULL;
+
+   for (int i = 0; i < count; i++)
+   {
+      char name[32];
+      if (i < known_count)
+         snprintf(name, sizeof(name), "%s", known[i]);
+      else
+         snprintf(name, sizeof(name), "%s%d", prefix, i + 1);
+      names[i] = strdup(name);
+      if (names[i] == NULL)
+         return NULL;
+   }
+
+   return names;
+}
+
+// print_usage(...) shows the options
+static void print_usage(const char *program)
+{
+   fprintf(stderr, "Usage: %s [-n records] [-v viruses] [-c countries] [-z skew] [-d duplicate_rate] "
+                   "[-y vaccinated_rate] [-k citizens] [-x seed] [-s] [-o file]\n", program);
+}
+
+// driver function
+int main(int argc, char *argv[])
+{
+   uint64_t records = 100000, citizens = 0;
+   int virus_count = 9, country_count = 9, sorted = 0, opt;
+   double skew = 0.0, duplicate_rate = 0.0, vaccinated_rate = 0.7;
+   uint64_t state = 88172645463325252ULL;
+   const char *output = NULL;
+
+   while ((opt = getopt(argc, argv, "n:v:c:z:d:y:k:x:so:")) != -1)
+   {
+      switch (opt)
+      {
+      case 'n':
+         records = strtoull(optarg, NULL, 10);
+         break;
+      case 'v':
+         virus_count = atoi(optarg);
+         break;
+      case 'c':
+         country_count = atoi(optarg);
+         break;
+      case 'z':
+         skew = strtod(optarg, NULL);
+         break;
+      case 'd':
+         duplicate_rate = strtod(optarg, NULL);
+         break;
+      case 'y':
+         vaccinated_rate = strtod(optarg, NULL);
+         break;
+      case 'k':
+         citizens = strtoull(optarg, NULL, 10);
+         break;
+      case 'x':
+         state ^= strtoull(optarg, NULL, 10) * 0x9e3779b97f4a7c15ULL;
+         if (state == 0)
+            state = 88172645463325252ULL;
+         break;
+      case 's':
+         sorted = 1;
+         break;
+      case 'o':
+         output = optarg;
+         break;
+      default:
+         print_usage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (optind != argc || virus_count < 1 || country_count < 1 || skew < 0.0 ||
+       duplicate_rate < 0.0 || duplicate_rate > 1.0 || vaccinated_rate < 0.0 || vaccinated_rate > 1.0)
+   {
+      print_usage(argv[0]);
+      return 1;
+   }
+
+   FILE *out = output ? fopen(output, "w") : stdout;
+   char **viruses = make_names(virus_count, known_viruses, 9, "Virus");
+   char **countries = make_names(country_count, known_countries, 9, "Country");
+   double *virus_cdf = zipf_table(virus_count, skew);
+   double *country_cdf = zipf_table(country_count, skew);
+   Recent *recent = calloc(RECENT_RECORDS, sizeof(Recent));
+   char *buffer = malloc(OUTPUT_BUFFER + MAX_LINE);
+
+   if (out == NULL || viruses == NULL || countries == NULL || virus_cdf == NULL || country_cdf == NULL ||
+       recent == NULL || buffer == NULL)
+   {
+      fprintf(stderr, "Error while setting up the generator\n");
+      return 1;
+   }
+
+   char *p = buffer;
+   uint64_t last_id = 0;
+   uint64_t fresh = 0; // records drawn new, the ring holds the last RECENT_RECORDS of them
+
+   for (uint64_t i = 0; i < records; i++)
+   {
+      uint64_t citizen_id;
+      int virus;
+
+      // repeating a recent record's ID and virus, or drawing a new pair
+      if (fresh > 0 && duplicate_rate > 0.0 && next_unit(&state) < duplicate_rate)
+      {
+         Recent *again = &recent[next_random(&state) % (fresh < RECENT_RECORDS ? fresh : RECENT_RECORDS)];
+         citizen_id = again->citizen_id;
+         virus = again->virus;
+      }
+      else
+      {
+         // IDs of up to 12 digits, always even
+         if (citizens > 0)
+            citizen_id = 2 * (next_random(&state) % citizens);
+         else
+            citizen_id = sorted ? (last_id += 2 * (1 + next_random(&state) % 8))
+                                : 2 * (next_random(&state) % 500000000000ULL);
+         virus = pick(virus_cdf, virus_count, &state);
+         recent[fresh % RECENT_RECORDS].citizen_id = citizen_id;
+         recent[fresh % RECENT_RECORDS].virus = virus;
+         fresh++;
+      }
+
+      // with -k the personal fields come from a generator seeded by the ID, so they never change
+      uint64_t person = (citizen_id * 0x9e3779b97f4a7c15ULL) | 1;
+      uint64_t *fields = citizens > 0 ? &person : &state;
+
+      p = put_number(p, citizen_id);
+      *p++ = ' ';
+      p = put_string(p, first_names[next_random(fields) % (sizeof(first_names) / sizeof(char *))]);
+      *p++ = ' ';
+      p = put_string(p, last_names[next_random(fields) % (sizeof(last_names) / sizeof(char *))]);
+      *p++ = ' ';
+      p = put_string(p, countries[pick(country_cdf, country_count, fields)]);
+      *p++ = ' ';
+      p = put_number(p, 1 + next_random(fields) % 100);
+      *p++ = ' ';
+      p = put_string(p, viruses[virus]);
+
+      if (next_unit(&state) < vaccinated_rate)
+      {
+         // a date between 2005-01-01 and 2024-12-28, the 28th at most so every month has it
+         uint64_t r = next_random(&state);
+         p = put_string(p, " YES ");
+         p = put_number(p, 2005 + r % 20);
+         *p++ = '-';
+         p = put_two(p, 1 + (r >> 8) % 12);
+         *p++ = '-';
+         p = put_two(p, 1 + (r >> 16) % 28);
+      }
+      else
+      {
+         p = put_string(p, " NO");
+      }
+      *p++ = '\n';
+
+      if (p - buffer >= OUTPUT_BUFFER)
+      {
+         fwrite(buffer, 1, p - buffer, out);
+         p = buffer;
+      }
+   }
+
+   fwrite(buffer, 1, p - buffer, out);
+
+   if (fflush(out) != 0 || (output && fclose(out) != 0))
+   {
+      fprintf(stderr, "Error while writing %s\n", output ? output : "standard output");
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,169 @@
+/*
+   This is the list_bench.c file that measures the record indexes on the same
+   keys: the skip list with packed integer keys, the skip list comparing every ID
+   as a string, and the B+-tree, each timed on inserts, point lookups in a
+   random order and one full scan in ID order.
+
+   usage: listBench [records] [seed]
+   cache misses are read from the hardware counters through perf_event_open(...)
+   and reported as "n/a" where the kernel does not allow it
+*/
+
+// including relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../src/index.h"
+#include "../src/intern.h"
+
+#define KEY_LEN 24 // room for a 20-digit citizen ID and its terminator
+
+// now_seconds(...) reads a monotonic clock in seconds
+static double now_seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// next_random(...) is a small xorshift generator so runs are reproducible
+static uint64_t next_random(uint64_t *state)
+{
+   uint64_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+// open_cache_misses(...) opens a counter of cache misses for this thread, -1 if unavailable
+static int open_cache_misses(void)
+{
+   struct perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = PERF_TYPE_HARDWARE;
+   attr.config = PERF_COUNT_HW_CACHE_MISSES;
+   attr.disabled = 1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+
+   return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// count_node(...) is the scan visitor, it only touches the record
+static int count_node(const Node *node, void *ctx)
+{
+   *(uint64_t *)ctx += node->day;
+   return 0;
+}
+
+// run(...) fills an index with every key, searches them all in a shuffled order and scans it
+static void run(const char *mode, IndexKind kind, int packed, char (*keys)[KEY_LEN], uint64_t *order,
+                uint64_t n, uint64_t seed)
+{
+   Index *index = index_create(kind, seed);
+   if (kind == INDEX_BPTREE)
+      index->tree->packed_keys = packed;
+   else
+      index->list->packed_keys = packed;
+   volatile uint64_t sink = 0; // keeps the compiler from dropping the searches
+
+   double start = now_seconds();
+   for (uint64_t i = 0; i < n; i++)
+   {
+      Record record;
+      memset(&record, 0, sizeof(record));
+      record.citizen_id.str = keys[i];
+      record.citizen_id.len = strlen(keys[i]);
+      record.first_name = record.last_name = record.country = record.virus_name = record.citizen_id;
+      record.vaccinated.str = "YES";
+      record.vaccinated.len = 3;
+      index_insert(index, &record);
+   }
+   double insert_time = now_seconds() - start;
+
+   int counter = open_cache_misses();
+   if (counter >= 0)
+   {
+      ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+   }
+
+   start = now_seconds();
+   for (uint64_t i = 0; i < n; i++)
+   {
+      sink += index_search(index, keys[order[i]]) != NULL;
+   }
+   double search_time = now_seconds() - start;
+
+   char misses[32] = "n/a";
+   uint64_t count;
+   if (counter >= 0)
+   {
+      ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counter, &count, sizeof(count)) == sizeof(count))
+         snprintf(misses, sizeof(misses), "%.2f", (double)count / n);
+      close(counter);
+   }
+
+   uint64_t days = 0;
+   start = now_seconds();
+   index_scan(index, NULL, NULL, count_node, &days);
+   double scan_time = now_seconds() - start;
+
+   IndexStats stats;
+   index_stats(index, &stats);
+
+   printf("%-7s  found=%-10llu  insert=%6.2f M/s  search=%7.1f ns  scan=%5.2f ns/record  path=%5.1f keys  "
+          "levels=%d  memory=%5.1f B/record  cache misses/search=%s\n",
+          mode, (unsigned long long)sink, n / insert_time / 1e6, search_time / n * 1e9, scan_time / n * 1e9,
+          (double)stats.search_steps / stats.searches, stats.height, (double)index_memory(index) / n, misses);
+
+   index_delete(index);
+}
+
+// driver function
+int main(int argc, char *argv[])
+{
+   uint64_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+   uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1; // both modes build the same list shape
+   uint64_t state = 88172645463325252ULL;
+
+   char (*keys)[KEY_LEN] = malloc(n * KEY_LEN);
+   uint64_t *order = malloc(n * sizeof(uint64_t));
+   if (keys == NULL || order == NULL)
+   {
+      printf("Error while allocating keys\n");
+      return 1;
+   }
+
+   // numeric IDs of up to 13 digits, searched in a random order so every search goes cold
+   for (uint64_t i = 0; i < n; i++)
+   {
+      snprintf(keys[i], KEY_LEN, "%llu", (unsigned long long)(next_random(&state) % 10000000000000ULL));
+      order[i] = i;
+   }
+   for (uint64_t i = n - 1; i > 0; i--)
+   {
+      uint64_t j = next_random(&state) % (i + 1);
+      uint64_t swap = order[i];
+      order[i] = order[j];
+      order[j] = swap;
+   }
+
+   printf("%llu records, seed %llu\n", (unsigned long long)n, (unsigned long long)seed);
+   run("packed", INDEX_SKIP_LIST, 1, keys, order, n, seed);
+   run("string", INDEX_SKIP_LIST, 0, keys, order, n, seed);
+   run("bptree", INDEX_BPTREE, 1, keys, order, n, seed);
+
+   free(keys);
+   free(order);
+   intern_clear();
+   return 0;
+}
@@ -0,0 +1,444 @@
+/*
+   This is the load_bench.c file that measures the whole query path on a real input
+   file for every record index: loading the file into one bloom filter and one
+   index per virus, answering check queries that hit, that miss and that the bloom
+   filter lets through by mistake, scanning every record in ID order, the memory
+   all of it takes, and the latency of single operations under a mixed workload
+   (checks with a delete or re-insert every MIXED_READS_PER_WRITE of them), and
+   one filter query (over 65 in one country) answered by walking the index and by
+   the filter kernel on a column store copied from it.
+
+   usage: loadBench <input_file> [queries] [fp_rate] [layout]
+
+   The results go to standard output as CSV, one row per index with a header row,
+   so runs of different builds can be compared with a script. The misses are the
+   sampled hit IDs with their last digit raised by one; files from generateRecords
+   only have even IDs, so every miss is a real miss there.
+*/
+
+// including relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/bloom_filter.h"
+#include "../src/index.h"
+#include "../src/intern.h"
+#include "../src/citizen_table.h"
+#include "../src/column_store.h"
+#include "../src/loader.h"
+#include "../src/date.h"
+#include "../src/metrics.h"
+
+#define KEY_LEN 24      // room for a 20-digit citizen ID and its terminator
+#define MAX_VIRUSES 4096 // viruses a file may have
+#define MIXED_READS_PER_WRITE 9 // checks between two writes of the mixed workload
+
+// defining what the benchmark keeps per virus
+typedef struct
+{
+   char *name;
+   size_t len;
+   uint64_t vaccinated; // YES records, counted by the first pass to size the filter
+   BloomFilter *bloom;
+   Index *index;
+} BenchVirus;
+
+// defining one sampled check query
+typedef struct
+{
+   int virus;
+   char citizen_id[KEY_LEN];
+} Query;
+
+// defining the state both passes over the file share
+typedef struct
+{
+   BenchVirus viruses[MAX_VIRUSES];
+   int virus_count;
+   int last;             // the virus of the previous record, tried first
+   Query *queries;       // a uniform sample of the vaccinated records
+   uint64_t query_count;
+   uint64_t query_size;
+   uint64_t seen;        // vaccinated records offered to the sample
+   uint64_t state;       // xorshift state of the sampling
+} Bench;
+
+// now_seconds(...) reads a monotonic clock in seconds
+static double now_seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// next_random(...) is a small xorshift generator so runs are reproducible
+static uint64_t next_random(uint64_t *state)
+{
+   uint64_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+// find_virus(...) returns the position of a record's virus, adding it when create is set
+static int find_virus(Bench *bench, const Field *name, int create)
+{
+   BenchVirus *last = &bench->viruses[bench->last];
+   if (bench->virus_count > 0 && last->len == name->len && memcmp(last->name, name->str, name->len) == 0)
+      return bench->last;
+
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      if (bench->viruses[i].len == name->len && memcmp(bench->viruses[i].name, name->str, name->len) == 0)
+         return bench->last = i;
+   }
+
+   if (!create || bench->virus_count == MAX_VIRUSES)
+      return -1;
+
+   BenchVirus *virus = &bench->viruses[bench->virus_count];
+   memset(virus, 0, sizeof(BenchVirus));
+   virus->name = strndup(name->str, name->len);
+   virus->len = name->len;
+   return bench->last = bench->virus_count++;
+}
+
+// count_record(...) is the first pass: it finds every virus, counts its vaccinated
+// records and keeps a reservoir sample of them as hit queries
+static int count_record(const Record *record, void *ctx)
+{
+   Bench *bench = ctx;
+   int virus = find_virus(bench, &record->virus_name, 1);
+
+   if (virus < 0 || !field_equals(&record->vaccinated, "YES") || record->citizen_id.len >= KEY_LEN)
+      return LOAD_OK;
+
+   bench->viruses[virus].vaccinated++;
+
+   uint64_t slot = bench->seen++;
+   if (slot >= bench->query_size)
+   {
+      slot = next_random(&bench->state) % bench->seen;
+      if (slot >= bench->query_size)
+         return LOAD_OK;
+   }
+   else
+   {
+      bench->query_count++;
+   }
+
+   bench->queries[slot].virus = virus;
+   memcpy(bench->queries[slot].citizen_id, record->citizen_id.str, record->citizen_id.len);
+   bench->queries[slot].citizen_id[record->citizen_id.len] = '\0';
+   return LOAD_OK;
+}
+
+// store_record(...) is the timed pass: what the program does with every record
+static int store_record(const Record *record, void *ctx)
+{
+   Bench *bench = ctx;
+   int virus = find_virus(bench, &record->virus_name, 0);
+
+   if (virus >= 0 && field_equals(&record->vaccinated, "YES"))
+   {
+      Record stored = *record;
+      stored.citizen = citizen_table_add(record, 0);
+      if (stored.citizen == NULL)
+         return LOAD_STOPPED;
+
+      bloom_insert(bench->viruses[virus].bloom, record->citizen_id.str, record->citizen_id.len);
+      index_insert(bench->viruses[virus].index, &stored);
+   }
+
+   return LOAD_OK;
+}
+
+// check(...) answers one check query like the program does, 1 if the citizen was found
+// and 2 if the bloom filter said maybe but the index did not have the ID
+static int check(BenchVirus *virus, const char *citizen_id)
+{
+   if (!bloom_check(virus->bloom, citizen_id, strlen(citizen_id)))
+      return 0;
+
+   return index_search(virus->index, citizen_id) != NULL ? 1 : 2;
+}
+
+// count_node(...) is the scan visitor, it only touches the record
+static int count_node(const Node *node, void *ctx)
+{
+   *(uint64_t *)ctx += node->citizen->age;
+   return 0;
+}
+
+// defining the query both filter scans answer: over FILTER_MIN_AGE in one country
+#define FILTER_MIN_AGE 65
+typedef struct
+{
+   const char *country; // interned
+   uint64_t matches;
+} FilterQuery;
+
+// filter_node(...) is the scan visitor of the filter over the index, it follows the record's citizen
+static int filter_node(const Node *node, void *ctx)
+{
+   FilterQuery *query = ctx;
+   query->matches += node->citizen->age >= FILTER_MIN_AGE && node->citizen->country == query->country;
+   return 0;
+}
+
+// field_of(...) makes a field of a NUL-terminated string
+static Field field_of(const char *str)
+{
+   Field field = {str, strlen(str)};
+   return field;
+}
+
+// mixed(...) runs one operation per sampled query: checks of hits and misses in turn, and
+// every MIXED_READS_PER_WRITE + 1st operation either deletes a sampled record or inserts
+// the previously deleted one again, so the structures keep their size; every single
+// operation is timed into reads or writes
+static void mixed(Bench *bench, Query *misses, Histogram *reads, Histogram *writes)
+{
+   Node *removed = NULL;
+   int removed_virus = 0;
+   char date[DATE_TEXT_LEN];
+
+   for (uint64_t i = 0; i < bench->query_count; i++)
+   {
+      uint64_t start = metrics_now();
+
+      if (i % (MIXED_READS_PER_WRITE + 1) != MIXED_READS_PER_WRITE)
+      {
+         Query *query = i % 2 ? &misses[i] : &bench->queries[i];
+         check(&bench->viruses[query->virus], query->citizen_id);
+         histogram_record(reads, metrics_now() - start, 1);
+         continue;
+      }
+
+      if (removed == NULL)
+      {
+         BenchVirus *virus = &bench->viruses[bench->queries[i].virus];
+         removed = index_remove(virus->index, bench->queries[i].citizen_id);
+         if (removed != NULL)
+            bloom_remove(virus->bloom, removed->citizen_id, strlen(removed->citizen_id));
+         removed_virus = bench->queries[i].virus;
+      }
+      else
+      {
+         // the removed node stays readable, so the record is rebuilt from it
+         BenchVirus *virus = &bench->viruses[removed_virus];
+         Citizen *citizen = removed->citizen;
+         Record record = {field_of(removed->citizen_id), field_of(citizen->first_name),
+                          field_of(citizen->last_name), field_of(citizen->country), citizen->age,
+                          field_of(removed->virus_name), field_of(removed->vaccinated), {NULL, 0}, citizen};
+         date_format(removed->day, date);
+         if (removed->day != DATE_NONE)
+            record.date = field_of(date);
+
+         bloom_insert(virus->bloom, record.citizen_id.str, record.citizen_id.len);
+         index_insert(virus->index, &record);
+         removed = NULL;
+      }
+
+      histogram_record(writes, metrics_now() - start, 1);
+   }
+}
+
+// run(...) loads the file into one kind of index and times the queries and the scan
+static int run(Bench *bench, const char *filename, IndexKind kind, double fp_rate, BloomLayout layout,
+               Query *misses)
+{
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      bench->viruses[i].bloom = bloom_create(bench->viruses[i].vaccinated, fp_rate, layout);
+      bench->viruses[i].index = index_create(kind, 1);
+      if (bench->viruses[i].bloom == NULL || bench->viruses[i].index == NULL)
+      {
+         fprintf(stderr, "Error while allocating the structures\n");
+         return -1;
+      }
+   }
+
+   LoadStats load;
+   if (load_mapped(filename, store_record, bench, NULL, &load) == LOAD_ERROR)
+   {
+      fprintf(stderr, "Error while loading %s\n", filename);
+      return -1;
+   }
+
+   uint64_t found = 0, false_positives = 0, missed_hits = 0, n = bench->query_count;
+   double start = now_seconds();
+   for (uint64_t i = 0; i < n; i++)
+   {
+      found += check(&bench->viruses[bench->queries[i].virus], bench->queries[i].citizen_id) == 1;
+   }
+   double hit_time = now_seconds() - start;
+
+   start = now_seconds();
+   for (uint64_t i = 0; i < n; i++)
+   {
+      int answer = check(&bench->viruses[misses[i].virus], misses[i].citizen_id);
+      false_positives += answer == 2;
+      missed_hits += answer == 1;
+   }
+   double miss_time = now_seconds() - start;
+
+   uint64_t stored = 0, ages = 0;
+   size_t bytes = intern_memory() + citizen_table_memory();
+   start = now_seconds();
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      index_scan(bench->viruses[i].index, NULL, NULL, count_node, &ages);
+   }
+   double scan_time = now_seconds() - start;
+
+   // the same filter over the index and over columns copied from it, for the country of a sampled record
+   FilterQuery query = {NULL, 0};
+   ColumnStore *columns[MAX_VIRUSES];
+   ColumnFilter filter;
+   uint64_t column_matches = 0;
+   size_t column_bytes = 0;
+
+   if (n > 0)
+   {
+      Node *sample = index_search(bench->viruses[bench->queries[0].virus].index, bench->queries[0].citizen_id);
+      query.country = sample ? sample->citizen->country : NULL;
+   }
+   column_filter_init(&filter);
+   filter.min_age = FILTER_MIN_AGE;
+   filter.by_country = 1;
+   filter.country = query.country ? intern_id(query.country) : COLUMN_NO_COUNTRY;
+
+   start = now_seconds();
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      index_scan(bench->viruses[i].index, NULL, NULL, filter_node, &query);
+   }
+   double index_filter_time = now_seconds() - start;
+
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      columns[i] = column_store_build(bench->viruses[i].index);
+      column_bytes += column_store_memory(columns[i]);
+   }
+   start = now_seconds();
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      if (columns[i] != NULL)
+         column_matches += column_store_filter(columns[i], &filter, NULL, NULL);
+   }
+   double column_filter_time = now_seconds() - start;
+
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      column_store_delete(columns[i]);
+   }
+   if (column_matches != query.matches)
+   {
+      fprintf(stderr, "%s: the column filter matched %llu records, the index scan %llu\n", index_kind_name(kind),
+              (unsigned long long)column_matches, (unsigned long long)query.matches);
+   }
+
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      stored += index_count(bench->viruses[i].index);
+      bytes += index_memory(bench->viruses[i].index) + sizeof(BloomFilter) +
+               bloom_bytes(bench->viruses[i].bloom->size, bench->viruses[i].bloom->layout);
+   }
+
+   Histogram reads, writes;
+   memset(&reads, 0, sizeof(reads));
+   memset(&writes, 0, sizeof(writes));
+   mixed(bench, misses, &reads, &writes);
+
+   if (found != n || missed_hits > 0)
+   {
+      fprintf(stderr, "%s: %llu of %llu hits found, %llu misses found (IDs that are not misses in this file)\n",
+              index_kind_name(kind), (unsigned long long)found, (unsigned long long)n,
+              (unsigned long long)missed_hits);
+   }
+
+   printf("%s,%s,%llu,%llu,%.3f,%.0f,%.1f,%.1f,%.5f,%.2f,%.1f,%llu,%llu,%llu,%llu,%.3f,%.3f,%s,%.1f\n",
+          index_kind_name(kind),
+          bloom_layout_name(layout), (unsigned long long)load.records, (unsigned long long)stored, load.seconds,
+          load.seconds > 0 ? load.records / load.seconds : 0.0, n ? hit_time / n * 1e9 : 0.0,
+          n ? miss_time / n * 1e9 : 0.0, n ? (double)false_positives / n : 0.0,
+          stored ? scan_time / stored * 1e9 : 0.0, stored ? (double)bytes / stored : 0.0,
+          (unsigned long long)histogram_percentile(&reads, 50), (unsigned long long)histogram_percentile(&reads, 99),
+          (unsigned long long)histogram_percentile(&writes, 50), (unsigned long long)histogram_percentile(&writes, 99),
+          stored ? index_filter_time / stored * 1e9 : 0.0, stored ? column_filter_time / stored * 1e9 : 0.0,
+          column_filter_kernel(), stored ? (double)column_bytes / stored : 0.0);
+   fflush(stdout);
+
+   for (int i = 0; i < bench->virus_count; i++)
+   {
+      bloom_delete(bench->viruses[i].bloom);
+      index_delete(bench->viruses[i].index);
+   }
+   citizen_table_clear();
+
+   return 0;
+}
+
+// driver function
+int main(int argc, char *argv[])
+{
+   BloomLayout layout = BLOOM_STANDARD;
+
+   if (argc < 2 || argc > 5 || (argc > 4 && bloom_parse_layout(argv[4], &layout) != 0))
+   {
+      fprintf(stderr, "Usage: %s <input_file> [queries] [fp_rate] [standard|blocked|counting]\n", argv[0]);
+      return 1;
+   }
+
+   Bench *bench = calloc(1, sizeof(Bench));
+   if (bench == NULL)
+   {
+      fprintf(stderr, "Error while allocating the benchmark\n");
+      return 1;
+   }
+
+   bench->query_size = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+   double fp_rate = argc > 3 ? strtod(argv[3], NULL) : BLOOM_DEFAULT_FP_RATE;
+   bench->queries = malloc((bench->query_size ? bench->query_size : 1) * sizeof(Query));
+   Query *misses = malloc((bench->query_size ? bench->query_size : 1) * sizeof(Query));
+   bench->state = 88172645463325252ULL;
+
+   LoadStats first;
+   if (bench->queries == NULL || misses == NULL || load_mapped(argv[1], count_record, bench, NULL, &first) == LOAD_ERROR)
+   {
+      fprintf(stderr, "Error while reading %s\n", argv[1]);
+      return 1;
+   }
+
+   // a miss is a hit with its last digit raised by one
+   for (uint64_t i = 0; i < bench->query_count; i++)
+   {
+      misses[i] = bench->queries[i];
+      size_t len = strlen(misses[i].citizen_id);
+      if (len > 0)
+         misses[i].citizen_id[len - 1]++;
+   }
+
+   fprintf(stderr, "%s: %llu records, %d viruses, %llu queries of each kind\n", argv[1],
+           (unsigned long long)first.records, bench->virus_count, (unsigned long long)bench->query_count);
+   printf("index,bloom_layout,records,stored,load_s,load_records_per_s,hit_ns,miss_ns,false_positive_rate,"
+          "scan_ns_per_record,bytes_per_record,mixed_read_p50_ns,mixed_read_p99_ns,mixed_write_p50_ns,"
+          "mixed_write_p99_ns,filter_index_ns_per_record,filter_columns_ns_per_record,filter_kernel,"
+          "column_bytes_per_record\n");
+
+   int status = 0;
+   if (run(bench, argv[1], INDEX_SKIP_LIST, fp_rate, layout, misses) != 0 ||
+       run(bench, argv[1], INDEX_BPTREE, fp_rate, layout, misses) != 0)
+      status = 1;
+
+   for (int i = 0; i < bench->virus_count; i++)
+      free(bench->viruses[i].name);
+   free(bench->queries);
+   free(misses);
+   free(bench);
+   intern_clear();
+   return status;
+}
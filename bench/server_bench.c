@@ -0,0 +1,274 @@
+/*
+   This is the server_bench.c file that drives a running server (vaccinationManager -S)
+   with many concurrent clients and reports the throughput and latency of its check
+   requests, so the scaling of the worker pool with cores can be measured.
+
+   usage: serverBench <address> <input_file> [requests_per_client] [clients ...]
+
+   Every client is a thread with its own connection that sends one check request,
+   waits for the whole answer and sends the next (a closed loop), timing each
+   request from the write to the empty line ending its answer. Half of the requests
+   ask for a record of the input file and half for the same ID with its last digit
+   raised by one, a miss for files from generateRecords. The run is repeated for
+   every client count given (1 2 4 8 16 by default); the results go to standard
+   output as CSV, one row per run. The server may still be loading its file: the
+   clients keep trying to connect for SERVER_BENCH_WAIT seconds.
+*/
+
+// including relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../src/server.h"
+#include "../src/metrics.h"
+
+#define MAX_REQUESTS 65536   // distinct requests sampled from the input file
+#define MAX_REQUEST_LEN 128  // longest request line
+#define SERVER_BENCH_WAIT 600 // seconds to wait for the server to come up
+
+// defining one client thread
+typedef struct
+{
+   int fd;             // the client's connection, opened before the clock starts
+   char (*requests)[MAX_REQUEST_LEN];
+   size_t request_count;
+   uint64_t count;     // requests to send
+   uint64_t seed;
+   uint64_t done;      // requests answered
+   int failed;
+   Histogram latency;
+} Client;
+
+// now_seconds(...) reads a monotonic clock in seconds
+static double now_seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// next_random(...) is a small xorshift generator so runs are reproducible
+static uint64_t next_random(uint64_t *state)
+{
+   uint64_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+// read_requests(...) turns the first lines of the input file into check requests, a hit and a miss each
+static size_t read_requests(const char *filename, char (*requests)[MAX_REQUEST_LEN])
+{
+   FILE *file = fopen(filename, "r");
+   char line[512], id[48], first[64], last[64], country[64], virus[48];
+   int age;
+   size_t count = 0;
+
+   if (file == NULL)
+      return 0;
+
+   while (count + 1 < MAX_REQUESTS && fgets(line, sizeof(line), file) != NULL)
+   {
+      if (sscanf(line, "%47s %63s %63s %63s %d %47s", id, first, last, country, &age, virus) != 6)
+         continue;
+
+      snprintf(requests[count++], MAX_REQUEST_LEN, "check %s %s\n", id, virus);
+      id[strlen(id) - 1]++;
+      snprintf(requests[count++], MAX_REQUEST_LEN, "check %s %s\n", id, virus);
+   }
+
+   fclose(file);
+   return count;
+}
+
+// open_connection(...) connects to the server, retrying while it is still starting
+static int open_connection(const char *address)
+{
+   char error[128];
+   double give_up = now_seconds() + SERVER_BENCH_WAIT;
+   struct timespec pause = {0, 100000000};
+
+   while (1)
+   {
+      int fd = server_connect(address, error, sizeof(error));
+      if (fd >= 0)
+         return fd;
+      if (now_seconds() > give_up)
+      {
+         fprintf(stderr, "Cannot connect to %s: %s\n", address, error);
+         return -1;
+      }
+      nanosleep(&pause, NULL);
+   }
+}
+
+// run_client(...) sends a client's requests one at a time and times every answer
+static void *run_client(void *arg)
+{
+   Client *client = arg;
+   char buffer[SERVER_WRITE_SIZE];
+   int fd = client->fd;
+
+   for (uint64_t i = 0; i < client->count; i++)
+   {
+      const char *request = client->requests[next_random(&client->seed) % client->request_count];
+      size_t len = strlen(request);
+      uint64_t start = metrics_now();
+
+      if (send(fd, request, len, MSG_NOSIGNAL) != (ssize_t)len)
+      {
+         client->failed = 1;
+         break;
+      }
+
+      // an answer ends with an empty line, i.e. two newlines in a row
+      int newline = 0, ended = 0;
+      while (!ended)
+      {
+         ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+         if (got <= 0)
+         {
+            if (got < 0 && errno == EINTR)
+               continue;
+            client->failed = 1;
+            break;
+         }
+
+         for (ssize_t b = 0; b < got && !ended; b++)
+         {
+            ended = newline && buffer[b] == '\n';
+            newline = buffer[b] == '\n';
+         }
+      }
+
+      if (client->failed)
+         break;
+
+      histogram_record(&client->latency, metrics_now() - start, 1);
+      client->done++;
+   }
+
+   return NULL;
+}
+
+// run(...) runs client_count clients at once and prints one CSV row
+static int run(const char *address, char (*requests)[MAX_REQUEST_LEN], size_t request_count, int client_count,
+               uint64_t per_client)
+{
+   if (client_count < 1)
+   {
+      fprintf(stderr, "Invalid client count %d\n", client_count);
+      return -1;
+   }
+
+   Client *clients = calloc(client_count, sizeof(Client));
+   pthread_t *threads = calloc(client_count, sizeof(pthread_t));
+   int started = 0, failed = 0;
+
+   if (clients == NULL || threads == NULL)
+   {
+      fprintf(stderr, "Error while allocating the clients\n");
+      free(clients);
+      free(threads);
+      return -1;
+   }
+
+   // connecting everyone first, so the run times requests and not connection setup
+   for (int i = 0; i < client_count; i++)
+   {
+      clients[i].fd = open_connection(address);
+      if (clients[i].fd < 0)
+      {
+         for (int j = 0; j < i; j++)
+            close(clients[j].fd);
+         free(clients);
+         free(threads);
+         return -1;
+      }
+   }
+
+   double start = now_seconds();
+   for (int i = 0; i < client_count; i++)
+   {
+      clients[i].requests = requests;
+      clients[i].request_count = request_count;
+      clients[i].count = per_client;
+      clients[i].seed = 88172645463325252ULL ^ ((uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL);
+      if (pthread_create(&threads[i], NULL, run_client, &clients[i]) != 0)
+         break;
+      started++;
+   }
+
+   Histogram latency;
+   uint64_t done = 0;
+   memset(&latency, 0, sizeof(latency));
+
+   for (int i = 0; i < started; i++)
+   {
+      pthread_join(threads[i], NULL);
+      histogram_merge(&latency, &clients[i].latency);
+      done += clients[i].done;
+      failed |= clients[i].failed;
+   }
+   double seconds = now_seconds() - start;
+
+   for (int i = 0; i < client_count; i++)
+      close(clients[i].fd);
+
+   if (started < client_count || failed)
+      fprintf(stderr, "%d clients: %d started, some connections failed\n", client_count, started);
+
+   printf("%d,%llu,%.3f,%.0f,%llu,%llu\n", client_count, (unsigned long long)done, seconds,
+          seconds > 0 ? done / seconds : 0.0, (unsigned long long)histogram_percentile(&latency, 50),
+          (unsigned long long)histogram_percentile(&latency, 99));
+   fflush(stdout);
+
+   free(clients);
+   free(threads);
+   return started < client_count || failed ? -1 : 0;
+}
+
+// driver function
+int main(int argc, char *argv[])
+{
+   if (argc < 3)
+   {
+      fprintf(stderr, "Usage: %s <address> <input_file> [requests_per_client] [clients ...]\n", argv[0]);
+      return 1;
+   }
+
+   uint64_t per_client = argc > 3 ? strtoull(argv[3], NULL, 10) : 10000;
+   char (*requests)[MAX_REQUEST_LEN] = malloc(MAX_REQUESTS * MAX_REQUEST_LEN);
+   size_t request_count = requests ? read_requests(argv[2], requests) : 0;
+
+   if (request_count == 0)
+   {
+      fprintf(stderr, "Error while reading requests from %s\n", argv[2]);
+      free(requests);
+      return 1;
+   }
+
+   static const int default_clients[] = {1, 2, 4, 8, 16};
+   int status = 0;
+
+   printf("clients,requests,seconds,requests_per_s,p50_ns,p99_ns\n");
+   if (argc > 4)
+   {
+      for (int i = 4; i < argc && status == 0; i++)
+         status = run(argv[1], requests, request_count, atoi(argv[i]), per_client);
+   }
+   else
+   {
+      for (size_t i = 0; i < sizeof(default_clients) / sizeof(int) && status == 0; i++)
+         status = run(argv[1], requests, request_count, default_clients[i], per_client);
+   }
+
+   free(requests);
+   return status ? 1 : 0;
+}
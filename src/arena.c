@@ -0,0 +1,105 @@
+/*
+This is the arena.c file that implements a bump allocator. Memory is reserved in
+large chunks and handed out by moving a pointer forward, so that thousands of
+small allocations cost one malloc(...) and are all released by a single call
+to arena_free(...).
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "arena.h"
+
+// implementing arena_init(...) to set up an arena that owns no memory yet
+void arena_init(Arena *arena)
+{
+   arena->current = NULL;
+   arena->next_size = ARENA_FIRST_CHUNK;
+   arena->bytes_used = 0;
+   arena->bytes_reserved = 0;
+}
+
+// implementing arena_alloc(...) to hand out size bytes aligned to align (a power of two)
+void *arena_alloc(Arena *arena, size_t size, size_t align)
+{
+   ArenaChunk *chunk = arena->current;
+
+   // checking if the current chunk still has room once the offset is aligned
+   if (chunk != NULL)
+   {
+      // aligning the address, not the offset, since data[] itself is only 8-byte aligned
+      size_t offset = (((size_t)chunk->data + chunk->used + align - 1) & ~(align - 1)) - (size_t)chunk->data;
+      if (offset + size <= chunk->size)
+      {
+         chunk->used = offset + size;
+         arena->bytes_used += size;
+         return chunk->data + offset;
+      }
+   }
+
+   // otherwise reserving a new chunk, big enough for this allocation
+   size_t chunk_size = arena->next_size;
+   if (chunk_size < size + align)
+      chunk_size = size + align;
+
+   chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+
+   // checking if memory was allocated successfully
+   if (chunk == NULL)
+   {
+      printf("Error while allocating memory");
+      return NULL;
+   }
+
+   chunk->prev = arena->current;
+   chunk->size = chunk_size;
+   chunk->used = 0;
+   arena->current = chunk;
+   arena->bytes_reserved += sizeof(ArenaChunk) + chunk_size;
+
+   // doubling the chunk size so the number of chunks stays logarithmic
+   if (arena->next_size < ARENA_MAX_CHUNK)
+      arena->next_size *= 2;
+
+   size_t offset = ((size_t)chunk->data + align - 1) & ~(align - 1);
+   offset -= (size_t)chunk->data;
+   chunk->used = offset + size;
+   arena->bytes_used += size;
+   return chunk->data + offset;
+}
+
+// implementing arena_strndup(...) to copy a string of known length into the arena
+char *arena_strndup(Arena *arena, const char *str, size_t len)
+{
+   char *copy = arena_alloc(arena, len + 1, 1);
+
+   if (copy != NULL)
+   {
+      memcpy(copy, str, len);
+      copy[len] = '\0';
+   }
+
+   return copy;
+}
+
+// implementing arena_strdup(...) to copy a NUL-terminated string into the arena
+char *arena_strdup(Arena *arena, const char *str)
+{
+   return arena_strndup(arena, str, strlen(str));
+}
+
+// implementing arena_free(...) to release every chunk the arena reserved
+void arena_free(Arena *arena)
+{
+   ArenaChunk *chunk = arena->current;
+
+   while (chunk != NULL)
+   {
+      ArenaChunk *prev = chunk->prev;
+      free(chunk);
+      chunk = prev;
+   }
+
+   arena_init(arena); // leaving the arena empty but reusable
+}
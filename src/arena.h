@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_FIRST_CHUNK (64 * 1024)        // size of the first chunk an arena reserves
+#define ARENA_MAX_CHUNK (16 * 1024 * 1024)   // chunks stop doubling once they reach this size
+
+// defining one chunk of memory handed out by the arena
+typedef struct ArenaChunk
+{
+   struct ArenaChunk *prev; // the previously filled chunk (chunks form a stack)
+   size_t size;             // bytes available in data[]
+   size_t used;             // bytes already handed out from data[]
+   char data[];
+} ArenaChunk;
+
+// defining the arena (bump allocator) structure
+typedef struct
+{
+   ArenaChunk *current;   // the chunk allocations are currently served from
+   size_t next_size;      // size of the next chunk to reserve
+   size_t bytes_used;     // bytes handed out to callers
+   size_t bytes_reserved; // bytes reserved from malloc(...) for chunks
+} Arena;
+
+/*
+function prototypes
+*/
+void arena_init(Arena *arena);                                      // function to initialize an empty arena
+void *arena_alloc(Arena *arena, size_t size, size_t align);         // function to allocate size bytes with the given alignment
+char *arena_strndup(Arena *arena, const char *str, size_t len);     // function to copy len characters of str into the arena
+char *arena_strdup(Arena *arena, const char *str);                  // function to copy a whole string into the arena
+void arena_free(Arena *arena);                                      // function to release every chunk at once
+
+#endif
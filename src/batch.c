@@ -0,0 +1,378 @@
+/*
+This is the batch.c file that answers a whole file of "check <citizen_id> <virus>"
+lines at once (a file name of "-" reads standard input).
+
+Instead of answering one line at a time, the queries are grouped by virus. Each
+group goes through bloom_check_batch(...), which prefetches the probes of many
+keys before testing any of them, and the keys that pass go through
+index_search_batch(...); a skip list interleaves many descents there so their
+cache misses overlap. The answers are then written in the original order through a
+large buffered writer.
+*/
+
+// importing relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "batch.h"
+#include "citizen_table.h"
+#include "date.h"
+#include "writer.h"
+
+#define BATCH_GROUP 1024 // keys handed to the batched bloom/skip-list kernels per call
+
+// defining what we know about one query line
+typedef struct
+{
+   Field citizen_id; // the ID to look up
+   int target;       // the virus index, or one of the BATCH_* codes below
+   int status;       // the answer, one of the ANSWER_* codes below
+   Node *node;       // the record found, if any
+} Query;
+
+#define BATCH_NO_VIRUS -1 // the line named a virus we do not know
+#define BATCH_UNKNOWN -2  // the line was not a check command
+#define BATCH_BLANK -3    // an empty line, it gets no answer
+
+#define ANSWER_NOT_VACCINATED 0
+#define ANSWER_FOUND 1
+#define ANSWER_FALSE_POSITIVE 2
+
+// now_seconds(...) reads a monotonic clock in seconds
+static double now_seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// read_all(...) reads a whole file (or standard input for "-") into one buffer
+static char *read_all(const char *filename, size_t *size)
+{
+   int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+   size_t capacity = 1 << 20;
+   size_t length = 0;
+   char *data;
+
+   if (fd < 0 || (data = malloc(capacity)) == NULL)
+   {
+      return NULL;
+   }
+
+   while (1)
+   {
+      // doubling the buffer whenever it is full
+      if (length == capacity)
+      {
+         char *bigger = realloc(data, capacity * 2);
+         if (bigger == NULL)
+         {
+            free(data);
+            data = NULL;
+            break;
+         }
+         data = bigger;
+         capacity *= 2;
+      }
+
+      ssize_t got = read(fd, data + length, capacity - length);
+      if (got <= 0)
+         break;
+      length += got;
+   }
+
+   if (fd != STDIN_FILENO)
+      close(fd);
+
+   *size = length;
+   return data;
+}
+
+// next_word(...) stores the next space-separated word of [p, end) and returns the position after it
+static const char *next_word(const char *p, const char *end, Field *word)
+{
+   while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+      p++;
+
+   word->str = p;
+
+   while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+      p++;
+
+   word->len = p - word->str;
+   return p;
+}
+
+// implementing batch_write_node(...) to write a record in the same format as the interactive check command
+void batch_write_node(Writer *out, const Node *node)
+{
+   writer_puts(out, node->citizen_id);
+   writer_putc(out, ' ');
+   writer_puts(out, node->citizen->first_name);
+   writer_putc(out, ' ');
+   writer_puts(out, node->citizen->last_name);
+   writer_putc(out, ' ');
+   writer_puts(out, node->citizen->country);
+   writer_putc(out, ' ');
+   writer_put_int(out, node->citizen->age);
+   writer_putc(out, ' ');
+   writer_puts(out, node->virus_name);
+   writer_putc(out, ' ');
+   writer_puts(out, node->vaccinated);
+   writer_putc(out, ' ');
+   if (node->day != DATE_NONE)
+   {
+      char date[DATE_TEXT_LEN];
+      date_format(node->day, date);
+      writer_puts(out, date);
+   }
+   writer_putc(out, '\n');
+}
+
+// answer_group(...) answers the queries listed in members[] that all target one virus
+static void answer_group(Query *queries, const size_t *members, size_t count, BatchTarget *target)
+{
+   Field keys[BATCH_GROUP];
+   bool maybe[BATCH_GROUP];
+   size_t passed[BATCH_GROUP];
+   Node *found[BATCH_GROUP];
+
+   for (size_t base = 0; base < count; base += BATCH_GROUP)
+   {
+      size_t group = count - base < BATCH_GROUP ? count - base : BATCH_GROUP;
+      uint64_t start = metrics_now();
+
+      for (size_t i = 0; i < group; i++)
+      {
+         keys[i] = queries[members[base + i]].citizen_id;
+      }
+
+      bloom_check_batch(target->bloom, keys, group, maybe);
+
+      // only the keys the filter let through need a skip-list search
+      size_t survivors = 0;
+      for (size_t i = 0; i < group; i++)
+      {
+         if (maybe[i])
+         {
+            passed[survivors] = members[base + i];
+            keys[survivors++] = keys[i];
+         }
+         else
+         {
+            queries[members[base + i]].status = ANSWER_NOT_VACCINATED;
+         }
+      }
+
+      index_search_batch(target->index, keys, survivors, found);
+
+      size_t hits = 0;
+      for (size_t i = 0; i < survivors; i++)
+      {
+         Query *query = &queries[passed[i]];
+         query->node = found[i];
+         query->status = found[i] ? ANSWER_FOUND : ANSWER_FALSE_POSITIVE;
+         hits += found[i] != NULL;
+      }
+
+      // the queries of a group are answered together, so each is charged the group's average
+      VirusMetrics *metrics = target->metrics;
+      METRIC_ADD(metrics->checks, group);
+      METRIC_ADD(metrics->bloom_negatives, group - survivors);
+      METRIC_ADD(metrics->false_positives, survivors - hits);
+      METRIC_ADD(metrics->found, hits);
+      histogram_record(&metrics->check_latency, (metrics_now() - start) / group, group);
+   }
+}
+
+// implementing run_batch(...) to answer every check line of filename and write the answers to out_fd
+int run_batch(const char *filename, TargetLookup lookup, int out_fd, BatchStats *stats)
+{
+   memset(stats, 0, sizeof(BatchStats));
+
+   size_t size;
+   char *data = read_all(filename, &size);
+
+   // if file was not read successfully
+   if (data == NULL)
+   {
+      return -1;
+   }
+
+   double start = now_seconds();
+
+   // counting lines so every array can be allocated once
+   size_t line_count = 0;
+   for (const char *p = data; p < data + size; p++)
+   {
+      line_count += *p == '\n';
+   }
+   line_count++; // the last line may lack a newline
+
+   Query *queries = malloc(line_count * sizeof(Query));
+   BatchTarget *targets = NULL;
+   size_t *group_sizes = NULL;
+   size_t target_count = 0;
+
+   if (queries == NULL)
+   {
+      free(data);
+      return -1;
+   }
+
+   // parsing every line and resolving its virus
+   size_t query_count = 0;
+   const char *p = data;
+   const char *end = data + size;
+
+   while (p < end)
+   {
+      const char *newline = memchr(p, '\n', end - p);
+      const char *line_end = newline ? newline : end;
+      Query *query = &queries[query_count++];
+      Field command, virus, extra;
+
+      const char *q = next_word(p, line_end, &command);
+      q = next_word(q, line_end, &query->citizen_id);
+      q = next_word(q, line_end, &virus);
+      next_word(q, line_end, &extra);
+
+      query->node = NULL;
+      query->status = ANSWER_NOT_VACCINATED;
+
+      if (command.len == 0)
+      {
+         query->target = BATCH_BLANK;
+      }
+      else if (!field_equals(&command, "check") || virus.len == 0 || extra.len != 0)
+      {
+         query->target = BATCH_UNKNOWN;
+      }
+      else
+      {
+         BatchTarget target;
+         query->target = lookup(virus.str, virus.len, &target);
+
+         // growing the per-virus arrays to cover this index
+         if (query->target >= (int)target_count)
+         {
+            size_t new_count = query->target + 1;
+            BatchTarget *more_targets = realloc(targets, new_count * sizeof(BatchTarget));
+            size_t *more_sizes = realloc(group_sizes, new_count * sizeof(size_t));
+            if (more_targets)
+               targets = more_targets;
+            if (more_sizes)
+               group_sizes = more_sizes;
+            if (!more_targets || !more_sizes)
+            {
+               query->target = BATCH_UNKNOWN;
+            }
+            else
+            {
+               memset(group_sizes + target_count, 0, (new_count - target_count) * sizeof(size_t));
+               target_count = new_count;
+            }
+         }
+
+         if (query->target >= 0)
+         {
+            targets[query->target] = target;
+            group_sizes[query->target]++;
+         }
+      }
+
+      p = newline ? newline + 1 : end;
+   }
+
+   // grouping query indexes by virus with a counting sort
+   size_t *offsets = calloc(target_count + 1, sizeof(size_t));
+   size_t *members = malloc((query_count ? query_count : 1) * sizeof(size_t));
+
+   if (offsets == NULL || members == NULL)
+   {
+      free(offsets);
+      free(members);
+      free(targets);
+      free(group_sizes);
+      free(queries);
+      free(data);
+      return -1;
+   }
+
+   for (size_t t = 0; t < target_count; t++)
+   {
+      offsets[t + 1] = offsets[t] + group_sizes[t];
+   }
+   for (size_t i = 0; i < query_count; i++)
+   {
+      if (queries[i].target >= 0)
+         members[offsets[queries[i].target]++] = i;
+   }
+
+   // answering every virus's group, offsets[t] now points at the end of group t
+   for (size_t t = 0; t < target_count; t++)
+   {
+      size_t first = offsets[t] - group_sizes[t];
+      if (group_sizes[t] > 0)
+         answer_group(queries, members + first, group_sizes[t], &targets[t]);
+   }
+
+   // writing the answers in the order the queries came in
+   Writer out;
+   int result = writer_init(&out, out_fd, WRITER_DEFAULT_SIZE);
+
+   for (size_t i = 0; i < query_count && result == 0; i++)
+   {
+      Query *query = &queries[i];
+
+      switch (query->target)
+      {
+      case BATCH_BLANK:
+         continue;
+      case BATCH_UNKNOWN:
+         stats->unknown++;
+         writer_puts(&out, "Unknown command\n");
+         continue;
+      case BATCH_NO_VIRUS:
+         stats->unknown++;
+         writer_puts(&out, "Virus not found\n");
+         continue;
+      }
+
+      stats->queries++;
+      if (query->status == ANSWER_FOUND)
+      {
+         stats->found++;
+         batch_write_node(&out, query->node);
+      }
+      else if (query->status == ANSWER_FALSE_POSITIVE)
+      {
+         stats->false_positives++;
+         writer_puts(&out, "False positive from Bloom Filter\n");
+      }
+      else
+      {
+         stats->negatives++;
+         writer_puts(&out, "NOT VACCINATED\n");
+      }
+   }
+
+   if (result == 0)
+   {
+      writer_close(&out);
+      result = out.failed ? -1 : 0;
+   }
+
+   stats->seconds = now_seconds() - start;
+
+   free(offsets);
+   free(members);
+   free(targets);
+   free(group_sizes);
+   free(queries);
+   free(data);
+   return result;
+}
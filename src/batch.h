@@ -0,0 +1,40 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include "bloom_filter.h"
+#include "index.h"
+#include "metrics.h"
+#include "writer.h"
+
+// defining the pair of structures a batch query is answered from
+typedef struct
+{
+   BloomFilter *bloom;
+   Index *index;
+   VirusMetrics *metrics; // where the outcomes and latencies of the virus's checks are counted
+} BatchTarget;
+
+// defining the callback that resolves a virus name to its index and structures
+// it returns -1 when the virus does not exist
+typedef int (*TargetLookup)(const char *name, size_t len, BatchTarget *target);
+
+// defining the counters a batch run reports
+typedef struct
+{
+   uint64_t queries;         // check lines answered
+   uint64_t found;           // citizens found vaccinated
+   uint64_t negatives;       // answered by the bloom filter alone
+   uint64_t false_positives; // bloom filter said maybe, skip list said no
+   uint64_t unknown;         // lines that were not a valid check command or named no known virus
+   double seconds;           // time spent answering and writing
+} BatchStats;
+
+/*
+function prototypes
+*/
+int run_batch(const char *filename, TargetLookup lookup,
+              int out_fd, BatchStats *stats);       // function to answer a file of check commands, 0 on success
+void batch_write_node(Writer *out, const Node *node); // function to write a record like the check command prints it
+
+#endif
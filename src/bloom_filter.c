@@ -1,18 +1,68 @@
 /*
 This is the bloom_filter.c file that implements the Bloom Filter structure for our
 vaccination records management system.
+
+The filter is sized from the number of records we expect to insert and the
+false-positive rate we are willing to accept:
+
+   m = -n * ln(p) / (ln 2)^2      (number of bits)
+   k = (m / n) * ln 2             (number of probes)
+
+Instead of running k separate string hashes, every record is hashed once into a
+64-bit value which is split into k probe positions by double hashing
+(g_i = h1 + i * h2), as described by Kirsch and Mitzenmacher.
+
+The blocked layout trades a slightly higher false-positive rate for a single
+cache miss per lookup: the hash first picks one 512-bit block and all k bits of
+the record are set inside that block. A check builds the 512-bit mask of the
+record and tests it against the block with AVX2 or SSE2 when the CPU has them.
+
+The counting layout probes like the standard one, but every position is a 4-bit
+counter instead of a bit: an insert adds one to its k counters and a removal takes
+one away, so a record that is deleted or updated leaves the filter without
+rebuilding it. It takes four times the memory of the standard layout for the same
+false-positive rate. A counter that reaches BLOOM_COUNTER_MAX stays there for good,
+since it can no longer tell how many records share it; with the sizes above that
+needs about 15 records on one position, which practically never happens. The other
+layouts cannot remove anything, so a deleted record stays a false positive there.
 */
 
 // importing relevant libraries
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <pthread.h>
 #include "bloom_filter.h"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// the golden-ratio constant used to spread bits around while hashing
+#define GOLDEN_64 0x9e3779b97f4a7c15ULL
+
+// mix64(...) is the finalizer from MurmurHash3, it scrambles all 64 bits of x
+static inline uint64_t mix64(uint64_t x)
+{
+   x ^= x >> 33;
+   x *= 0xff51afd7ed558ccdULL;
+   x ^= x >> 33;
+   x *= 0xc4ceb9fe1a85ec53ULL;
+   x ^= x >> 33;
+   return x;
+}
+
+// reduce(...) maps a 64-bit hash onto [0, size) with a multiply instead of a slow modulo
+static inline uint64_t reduce(uint64_t hash, uint64_t size)
+{
+   return (uint64_t)(((unsigned __int128)hash * size) >> 64);
+}
+
 // implementing bloom_create(...) to create a new bloom filter structure
-// unsigned is used to ensure there are no negative values and that
-// the full range of positive values is available to us
-BloomFilter *bloom_create(unsigned int size)
+// expected is the number of records we plan to insert and fp_rate is the target
+// probability of the filter answering "maybe" for a record that was never inserted
+BloomFilter *bloom_create(uint64_t expected, double fp_rate, BloomLayout layout)
 {
    BloomFilter *filter = malloc(sizeof(BloomFilter));
 
@@ -23,101 +73,465 @@ BloomFilter *bloom_create(unsigned int size)
       return NULL;
    }
 
+   // guarding against nonsense parameters so the formulas below stay finite
+   if (expected == 0)
+      expected = 1;
+   if (fp_rate <= 0.0 || fp_rate >= 1.0)
+      fp_rate = BLOOM_DEFAULT_FP_RATE;
+
+   // computing the optimal number of bits
+   double ln2 = log(2.0);
+   double bits = ceil(-(double)expected * log(fp_rate) / (ln2 * ln2));
+   uint64_t size = (uint64_t)bits;
+
+   // rounding up to a whole 512-bit block so both layouts can share the allocation
+   size = (size + BLOOM_BLOCK_BITS - 1) & ~(uint64_t)(BLOOM_BLOCK_BITS - 1);
+
+   // computing the optimal number of probes for that many bits
+   int k = (int)lround((double)size / (double)expected * ln2);
+   if (k < 1)
+      k = 1;
+   if (k > BLOOM_MAX_HASHES)
+      k = BLOOM_MAX_HASHES;
+
    filter->size = size;
+   filter->num_hashes = k;
+   filter->layout = layout;
+   filter->owns_bits = true;
 
-   // using calloc() instead of malloc() to ensure all bits are set to 0 initially
-   // (size + 7) rounds up and ensures we always have enough bytes to store the bits
-   filter->bits = calloc((size + 7) / 8, sizeof(unsigned char));
+   // aligning the array to a cache line so that every block is exactly one line
+   filter->bits = aligned_alloc(64, bloom_bytes(size, layout));
+
+   // checking if memory was allocated successfully
+   if (filter->bits == NULL)
+   {
+      printf("Error while creating bloom filter");
+      free(filter);
+      return NULL;
+   }
+
+   // zeroing every bit since aligned_alloc(...) does not
+   memset(filter->bits, 0, bloom_bytes(size, layout));
+
+   return filter;
+}
+
+// implementing bloom_wrap(...) to build a filter around bits that were saved earlier
+// the bits are not copied and not freed by bloom_delete(...), size must be a multiple of
+// BLOOM_BLOCK_BITS and bits must be 64-byte aligned
+BloomFilter *bloom_wrap(unsigned char *bits, uint64_t size, int num_hashes, BloomLayout layout)
+{
+   BloomFilter *filter = malloc(sizeof(BloomFilter));
+
+   // checking if memory was allocated successfully
+   if (filter == NULL)
+   {
+      printf("Error while creating bloom filter");
+      return NULL;
+   }
 
+   filter->bits = bits;
+   filter->size = size;
+   filter->num_hashes = num_hashes;
+   filter->layout = layout;
+   filter->owns_bits = false;
    return filter;
 }
 
 // implementing bloom_delete(...) to delete the filter and free any allocated memory
 void bloom_delete(BloomFilter *filter)
 {
-   free(filter->bits);
+   if (filter->owns_bits)
+      free(filter->bits);
    free(filter);
 }
 
-// implementing bloom_insert(...) to add a new record to the bit array
-void bloom_insert(BloomFilter *filter, const char *record)
+// block_mask(...) builds the 512-bit mask of a record for the blocked layout
+// every probe consumes 9 bits of the hash (enough to address one of 512 bits)
+static inline void block_mask(uint64_t hash, int k, uint64_t mask[8])
 {
-   // running the hash functions on the new record to get bit positions
-   unsigned int h1 = hash_1(record, filter->size);
-   unsigned int h2 = hash_2(record, filter->size);
-   unsigned int h3 = hash_3(record, filter->size);
+   memset(mask, 0, 8 * sizeof(uint64_t));
+
+   for (int i = 0; i < k; i++)
+   {
+      // 7 probes fit into 64 bits, after that we scramble a fresh set of bits
+      if (i % 7 == 0 && i > 0)
+         hash = mix64(hash + GOLDEN_64);
+
+      unsigned int bit = hash & (BLOOM_BLOCK_BITS - 1);
+      mask[bit / 64] |= (uint64_t)1 << (bit % 64);
+      hash >>= 9;
+   }
+}
+
+// the three implementations of "are all mask bits set in this block"
+static bool block_test_scalar(const uint64_t *block, const uint64_t *mask)
+{
+   uint64_t missing = 0;
+   for (int i = 0; i < 8; i++)
+   {
+      missing |= mask[i] & ~block[i];
+   }
+   return missing == 0;
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of every x86-64 CPU, so this kernel needs no runtime check
+static bool block_test_sse2(const uint64_t *block, const uint64_t *mask)
+{
+   __m128i missing = _mm_setzero_si128();
+   for (int i = 0; i < 8; i += 2)
+   {
+      __m128i b = _mm_load_si128((const __m128i *)(block + i));
+      __m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+      missing = _mm_or_si128(missing, _mm_andnot_si128(b, m));
+   }
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xFFFF;
+}
+
+// the AVX2 kernel is compiled for AVX2 only here and picked at runtime
+__attribute__((target("avx2"))) static bool block_test_avx2(const uint64_t *block, const uint64_t *mask)
+{
+   __m256i b0 = _mm256_load_si256((const __m256i *)block);
+   __m256i b1 = _mm256_load_si256((const __m256i *)(block + 4));
+   __m256i m0 = _mm256_loadu_si256((const __m256i *)mask);
+   __m256i m1 = _mm256_loadu_si256((const __m256i *)(mask + 4));
+
+   // testc returns 1 when every bit set in the mask is also set in the block
+   return _mm256_testc_si256(b0, m0) & _mm256_testc_si256(b1, m1);
+}
+#endif
+
+// block_test points at the fastest kernel the running CPU supports, it is set once through
+// block_test_once, so queries on several threads never race to pick it
+static bool (*block_test)(const uint64_t *, const uint64_t *) = NULL;
+static pthread_once_t block_test_once = PTHREAD_ONCE_INIT;
+
+// pick_block_test(...) runs once and chooses the probe kernel
+// setting the BLOOM_SCALAR environment variable forces the portable kernel (for benchmarking)
+static void pick_block_test(void)
+{
+   if (getenv("BLOOM_SCALAR") != NULL)
+   {
+      block_test = block_test_scalar;
+      return;
+   }
+#if defined(__x86_64__)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      block_test = block_test_avx2;
+   else
+      block_test = block_test_sse2;
+#else
+   block_test = block_test_scalar;
+#endif
+}
+
+// implementing bloom_probe_kernel(...) so callers can report which kernel is in use
+const char *bloom_probe_kernel(void)
+{
+   pthread_once(&block_test_once, pick_block_test);
+#if defined(__x86_64__)
+   if (block_test == block_test_avx2)
+      return "avx2";
+   if (block_test == block_test_sse2)
+      return "sse2";
+#endif
+   return "scalar";
+}
+
+// add_counter(...) adds delta (1 or -1) to the 4-bit counter at position, leaving a
+// counter at BLOOM_COUNTER_MAX (or a removal from 0) alone; the atomic variant retries
+// on the byte, which it shares with the neighbouring counter
+static inline void add_counter(BloomFilter *filter, uint64_t position, int delta, bool atomic)
+{
+   unsigned char *byte = &filter->bits[position / 2];
+   int shift = (position % 2) * 4;
+   unsigned char old = atomic ? __atomic_load_n(byte, __ATOMIC_RELAXED) : *byte;
+
+   while (1)
+   {
+      int counter = (old >> shift) & 0xF;
+      if (counter == BLOOM_COUNTER_MAX || counter + delta < 0)
+         return;
+
+      unsigned char updated = (unsigned char)(old + delta * (1 << shift));
+      if (!atomic)
+      {
+         *byte = updated;
+         return;
+      }
+      if (__atomic_compare_exchange_n(byte, &old, updated, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+         return;
+   }
+}
+
+// probe_set(...) tells whether the bit (or counter) at a position of the standard or
+// counting layout is set
+static inline bool probe_set(const BloomFilter *filter, uint64_t position, bool atomic)
+{
+   if (filter->layout == BLOOM_COUNTING)
+   {
+      unsigned char byte = atomic ? __atomic_load_n(&filter->bits[position / 2], __ATOMIC_RELAXED)
+                                  : filter->bits[position / 2];
+      return (byte >> ((position % 2) * 4)) & 0xF;
+   }
+
+   unsigned char byte = atomic ? __atomic_load_n(&filter->bits[position / 8], __ATOMIC_RELAXED)
+                               : filter->bits[position / 8];
+   return byte & (1 << (position % 8));
+}
+
+// set_bits(...) sets every probe bit of a record, with atomic read-modify-writes when
+// other threads may be setting bits of the same filter at the same time
+static inline void set_bits(BloomFilter *filter, const char *record, size_t len, bool atomic)
+{
+   // hashing the record once and deriving the two halves of the double hash
+   // (h2 is only forced to be odd as the stride of the standard layout, inside a
+   // block all of its bits are used as probe positions)
+   uint64_t h1 = bloom_hash(record, len);
+   uint64_t h2 = mix64(h1);
+
+   // in the blocked layout h1 picks the block and h2 the bits inside it
+   if (filter->layout == BLOOM_BLOCKED)
+   {
+      uint64_t mask[8];
+      uint64_t *block = (uint64_t *)filter->bits + reduce(h1, filter->size / BLOOM_BLOCK_BITS) * 8;
+      block_mask(h2, filter->num_hashes, mask);
+      for (int i = 0; i < 8; i++)
+      {
+         if (!atomic)
+            block[i] |= mask[i];
+         else if (mask[i])
+            __atomic_fetch_or(&block[i], mask[i], __ATOMIC_RELAXED);
+      }
+      return;
+   }
+
+   h2 |= 1; // forcing h2 to be odd so probes never collapse onto h1
 
    /*
-   the code below sets the bits in the respective hash positions to 1
+   the loop below sets the bit at every probe position to 1
    (h / 8) tells us which byte our hash position belongs to
    (h % 8) tells us which bit to set within that byte
    */
+   for (int i = 0; i < filter->num_hashes; i++)
+   {
+      uint64_t h = reduce(h1, filter->size);
+      if (filter->layout == BLOOM_COUNTING)
+         add_counter(filter, h, 1, atomic);
+      else if (atomic)
+         __atomic_fetch_or(&filter->bits[h / 8], (unsigned char)(1 << (h % 8)), __ATOMIC_RELAXED);
+      else
+         filter->bits[h / 8] |= (1 << (h % 8));
+      h1 += h2;
+   }
+}
 
-   // setting the first hash position to 1
-   filter->bits[h1 / 8] |= (1 << (h1 % 8));
-
-   // setting second hash position to 1
-   filter->bits[h2 / 8] |= (1 << (h2 % 8));
+// implementing bloom_insert(...) to add a new record to the bit array
+// record does not need to be NUL-terminated, len gives its length
+void bloom_insert(BloomFilter *filter, const char *record, size_t len)
+{
+   set_bits(filter, record, len, false);
+}
 
-   // setting third hash position to 1
-   filter->bits[h3 / 8] |= (1 << (h3 % 8));
+// implementing bloom_insert_atomic(...) for filters that are written by several threads
+// or read while being written (a check never sees a torn byte or word)
+void bloom_insert_atomic(BloomFilter *filter, const char *record, size_t len)
+{
+   set_bits(filter, record, len, true);
 }
 
-// implementing bloom_check(...) to check if record exists
-bool bloom_check(BloomFilter *filter, const char *record)
+// implementing bloom_remove(...) to take back a record that was inserted earlier
+// only the counting layout can do it, the others return false and keep the record's bits
+// (removing a record that was never inserted would break the filter for others); the
+// counters are updated atomically, so it may run beside bloom_insert_atomic(...)
+bool bloom_remove(BloomFilter *filter, const char *record, size_t len)
 {
-   // running the hash functions on the new record to get bit positions
-   unsigned int h1 = hash_1(record, filter->size);
-   unsigned int h2 = hash_2(record, filter->size);
-   unsigned int h3 = hash_3(record, filter->size);
+   if (filter->layout != BLOOM_COUNTING)
+   {
+      return false;
+   }
 
-   // performing bitwise & operation to check if the bit at the respective hash position is set
-   // then performing && to check if all the hash bits are set
-   return ((filter->bits[h1 / 8] & (1 << (h1 % 8))) &&
-           (filter->bits[h2 / 8] & (1 << (h2 % 8))) &&
-           (filter->bits[h3 / 8] & (1 << (h3 % 8))));
+   uint64_t h1 = bloom_hash(record, len);
+   uint64_t h2 = mix64(h1) | 1;
+
+   for (int i = 0; i < filter->num_hashes; i++)
+   {
+      add_counter(filter, reduce(h1, filter->size), -1, true);
+      h1 += h2;
+   }
+
+   return true;
 }
 
-// implementing the first hash function
-unsigned int hash_1(const char *str, unsigned int size)
+// check_bits(...) tests every probe bit of a record, with atomic loads when another
+// thread may be setting bits of the same filter at the same time
+static inline bool check_bits(BloomFilter *filter, const char *record, size_t len, bool atomic)
 {
-   unsigned int hash = 5381; // initial seed value
-   int c;                    // int to store ascii value of each character of the record
+   uint64_t h1 = bloom_hash(record, len);
+   uint64_t h2 = mix64(h1);
+
+   // in the blocked layout one cache line holds the answer
+   if (filter->layout == BLOOM_BLOCKED)
+   {
+      uint64_t mask[8];
+      const uint64_t *block = (const uint64_t *)filter->bits + reduce(h1, filter->size / BLOOM_BLOCK_BITS) * 8;
+      block_mask(h2, filter->num_hashes, mask);
+      pthread_once(&block_test_once, pick_block_test);
+
+      // copying the block word by word first, so the kernel never reads a word being written
+      if (atomic)
+      {
+         _Alignas(64) uint64_t words[8];
+         for (int i = 0; i < 8; i++)
+         {
+            words[i] = __atomic_load_n(&block[i], __ATOMIC_RELAXED);
+         }
+         return block_test(words, mask);
+      }
+
+      return block_test(block, mask);
+   }
+
+   h2 |= 1;
 
-   // continues until end of file is encountered
-   // c stores ascii value of current character
-   while ((c = *str++))
+   // stopping at the first probe whose bit is not set
+   for (int i = 0; i < filter->num_hashes; i++)
    {
-      hash = ((hash << 5) + hash) + c; // same as (hash * 33 + c), faster with bit operations
+      if (!probe_set(filter, reduce(h1, filter->size), atomic))
+         return false;
+      h1 += h2;
    }
 
-   // finally, we perform the (% size) operation to ensure the hash is within bounds
-   return hash % size;
+   return true;
 }
 
-// implementing the second hash function
-unsigned int hash_2(const char *str, unsigned int size)
+// implementing bloom_check(...) to check if record exists
+bool bloom_check(BloomFilter *filter, const char *record, size_t len)
+{
+   return check_bits(filter, record, len, false);
+}
+
+// implementing bloom_check_atomic(...) to check a filter that bloom_insert_atomic(...)
+// may be writing to at the same time
+bool bloom_check_atomic(BloomFilter *filter, const char *record, size_t len)
 {
-   unsigned int hash = 0; // initial seed value
-   int c;                 // int to store ascii value of current character
+   return check_bits(filter, record, len, true);
+}
+
+// implementing bloom_check_batch(...) to check count keys at once
+// the probe addresses of a whole group are computed and prefetched first, so the
+// cache misses of the group overlap instead of being paid one after the other
+// (batches run once loading is over, so the filter is not being written meanwhile)
+void bloom_check_batch(BloomFilter *filter, const Field *keys, size_t count, bool *results)
+{
+   uint64_t h1[BLOOM_BATCH];
+   uint64_t h2[BLOOM_BATCH];
+
+   pthread_once(&block_test_once, pick_block_test);
 
-   while ((c = *str++))
+   for (size_t base = 0; base < count; base += BLOOM_BATCH)
    {
-      hash = c + (hash << 6) + (hash << 16) - hash; // same as (c + hash * 64 + hash * 65536 - hash)
+      size_t group = count - base < BLOOM_BATCH ? count - base : BLOOM_BATCH;
+
+      // pass 1: hashing every key of the group and prefetching the memory it touches
+      for (size_t i = 0; i < group; i++)
+      {
+         h1[i] = bloom_hash(keys[base + i].str, keys[base + i].len);
+         h2[i] = mix64(h1[i]);
+
+         if (filter->layout == BLOOM_BLOCKED)
+         {
+            __builtin_prefetch((uint64_t *)filter->bits + reduce(h1[i], filter->size / BLOOM_BLOCK_BITS) * 8);
+         }
+         else
+         {
+            h2[i] |= 1;
+            uint64_t h = h1[i];
+            int per_byte = filter->layout == BLOOM_COUNTING ? 2 : 8;
+            for (int k = 0; k < filter->num_hashes; k++)
+            {
+               __builtin_prefetch(&filter->bits[reduce(h, filter->size) / per_byte]);
+               h += h2[i];
+            }
+         }
+      }
+
+      // pass 2: the same checks as bloom_check(...), now mostly hitting the cache
+      for (size_t i = 0; i < group; i++)
+      {
+         bool found = true;
+
+         if (filter->layout == BLOOM_BLOCKED)
+         {
+            uint64_t mask[8];
+            const uint64_t *block = (const uint64_t *)filter->bits + reduce(h1[i], filter->size / BLOOM_BLOCK_BITS) * 8;
+            block_mask(h2[i], filter->num_hashes, mask);
+            found = block_test(block, mask);
+         }
+         else
+         {
+            uint64_t h = h1[i];
+            for (int k = 0; k < filter->num_hashes && found; k++)
+            {
+               found = probe_set(filter, reduce(h, filter->size), false);
+               h += h2[i];
+            }
+         }
+
+         results[base + i] = found;
+      }
    }
-   return hash % size; // ensuring hash value is within bounds
 }
 
-// implementing the third hash function
-unsigned int hash_3(const char *str, unsigned int size)
+// implementing bloom_hash(...), a fast 64-bit string hash that reads 8 bytes at a time
+uint64_t bloom_hash(const char *str, size_t len)
 {
-   unsigned int hash = 0; // initial seed value
-   int c;                 // int to store ascii value of current character
+   uint64_t hash = GOLDEN_64 ^ (len * 0xff51afd7ed558ccdULL);
+   uint64_t word;
 
-   while ((c = *str++))
+   // consuming the string one 64-bit word at a time
+   while (len >= 8)
    {
-      hash = (hash * 31) + c; // multiplying with a prime number
+      memcpy(&word, str, 8); // memcpy(...) avoids unaligned loads being undefined behaviour
+      hash = (hash ^ mix64(word)) * GOLDEN_64;
+      str += 8;
+      len -= 8;
    }
 
-   return hash % size; // ensuring hash value is within bounds
-}
\ No newline at end of file
+   // folding in the last 0-7 bytes
+   word = 0;
+   memcpy(&word, str, len);
+   hash = (hash ^ mix64(word ^ GOLDEN_64)) * GOLDEN_64;
+
+   return mix64(hash);
+}
+
+// implementing bloom_bytes(...) to size the array of a filter with size bits (or counters)
+uint64_t bloom_bytes(uint64_t size, BloomLayout layout)
+{
+   return layout == BLOOM_COUNTING ? size / 2 : size / 8;
+}
+
+// implementing bloom_layout_name(...) to print a layout
+const char *bloom_layout_name(BloomLayout layout)
+{
+   if (layout == BLOOM_COUNTING)
+      return "counting";
+   return layout == BLOOM_BLOCKED ? "blocked" : "standard";
+}
+
+// implementing bloom_parse_layout(...) to read a layout name given by the user
+int bloom_parse_layout(const char *name, BloomLayout *layout)
+{
+   if (strcmp(name, "standard") == 0)
+      *layout = BLOOM_STANDARD;
+   else if (strcmp(name, "blocked") == 0)
+      *layout = BLOOM_BLOCKED;
+   else if (strcmp(name, "counting") == 0)
+      *layout = BLOOM_COUNTING;
+   else
+      return -1;
+   return 0;
+}
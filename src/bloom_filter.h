@@ -2,23 +2,55 @@
 #define BLOOM_FILTER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "record.h"
+
+#define BLOOM_DEFAULT_FP_RATE 0.01 // target false-positive rate used when none is given
+#define BLOOM_MAX_HASHES 16        // upper bound on the number of probes per record
+#define BLOOM_BLOCK_BITS 512       // bits per block (one 64-byte cache line) in the blocked layout
+#define BLOOM_BATCH 32             // keys whose probes are prefetched together by bloom_check_batch(...)
+#define BLOOM_COUNTER_MAX 15       // a counting filter's counter sticks here and is never decremented again
+
+// defining the ways the bits of a filter can be laid out
+typedef enum
+{
+   BLOOM_STANDARD, // k probes spread over the whole bit array
+   BLOOM_BLOCKED,  // all k probes of a record inside one cache-line-sized block
+   BLOOM_COUNTING  // k probes like BLOOM_STANDARD on 4-bit counters, so records can be removed
+} BloomLayout;
 
 // defining bloom filter structure
 typedef struct
 {
-   unsigned char *bits; // the bit array
-   unsigned int size;   // the size of the array
+   unsigned char *bits; // the bit array, two counters per byte when counting (64-byte aligned)
+   uint64_t size;       // the number of bits (or counters) in the array
+   int num_hashes;      // the number of probes (k) derived from size and expected count
+   BloomLayout layout;  // how the probes of a record are placed in the bit array
+   bool owns_bits;      // false when bits belong to someone else (a snapshot mapping)
 } BloomFilter;
 
 /*
 function prototypes
 */
-BloomFilter *bloom_create(unsigned int size);               // function to create a new bloom filter
-void bloom_delete(BloomFilter *filter);                     // function to delete an existing bloom filter
-void bloom_insert(BloomFilter *filter, const char *record); // function to insert record into filter
-bool bloom_check(BloomFilter *filter, const char *record);  // function to check if record exists in filter
-unsigned int hash_1(const char *str, unsigned int size);    // first hash function
-unsigned int hash_2(const char *str, unsigned int size);    // second hash function
-unsigned int hash_3(const char *str, unsigned int size);    // third hash function
+BloomFilter *bloom_create(uint64_t expected, double fp_rate,
+                          BloomLayout layout);                // function to create a bloom filter sized for expected records
+BloomFilter *bloom_wrap(unsigned char *bits, uint64_t size, int num_hashes,
+                        BloomLayout layout);                  // function to use an existing bit array as a filter
+void bloom_delete(BloomFilter *filter);                       // function to delete an existing bloom filter
+void bloom_insert(BloomFilter *filter, const char *record, size_t len); // function to insert record into filter
+void bloom_insert_atomic(BloomFilter *filter, const char *record,
+                         size_t len);                           // function to insert while other threads use the filter
+bool bloom_remove(BloomFilter *filter, const char *record, size_t len); // function to remove an inserted record, false if the layout cannot
+bool bloom_check(BloomFilter *filter, const char *record, size_t len);  // function to check if record exists in filter
+bool bloom_check_atomic(BloomFilter *filter, const char *record,
+                        size_t len);                            // function to check while other threads insert into the filter
+void bloom_check_batch(BloomFilter *filter, const Field *keys,
+                       size_t count, bool *results);            // function to check many keys with their probes prefetched
+uint64_t bloom_hash(const char *str, size_t len);             // 64-bit hash that is split into k probes
+uint64_t bloom_bytes(uint64_t size, BloomLayout layout);      // function to get the bytes of a filter's array
+const char *bloom_layout_name(BloomLayout layout);            // function to get the printable name of a layout
+int bloom_parse_layout(const char *name, BloomLayout *layout); // function to parse "standard"/"blocked"/"counting", 0 on success
+const char *bloom_probe_kernel(void);                         // function to get the name of the blocked probe kernel in use
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,505 @@
+/*
+This is the bptree.c file that implements a B+-tree index of vaccination records,
+the alternative to the skip list selected with -i bptree.
+
+Nodes are wide (BPTREE_ORDER keys) and cache-line aligned, and every node keeps its
+packed keys in one contiguous array, so a lookup reads a handful of cache lines per
+level instead of one node per comparison. Records sit in the leaves, which are
+chained in ID order, so a full or range scan walks arrays instead of pointers.
+
+Keys are the packed IDs the skip list uses (list_pack_key(...)); an ID without a
+packed key is compared through the record it belongs to, which is why inner nodes
+keep the record each separator was taken from next to the separator's key.
+
+A node that overflows is split in half, except when the new record goes after the
+last record of the tree: then the full node is left as it is and the new one starts
+a fresh node, so input sorted by ID (and snapshots) builds completely full leaves.
+
+Every node and record comes from the tree's arena. Searches and scans take the read
+side of a rwlock; bptree_insert_concurrent(...) takes the write side, so a
+background load can fill a tree that queries read. bptree_insert(...) does not lock
+and is for a tree no other thread uses yet. A scan holds the lock only while it
+copies a batch of record pointers out of the leaves (records never move or get
+freed before the tree does), and calls the visitor after releasing it, so a slow
+visitor never holds up the writer and a visitor may change the tree itself.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bptree.h"
+#include "metrics.h"
+
+// compare_entry(...) orders a stored key (and the record it came from) against a search key
+static inline int compare_entry(uint64_t entry_key, const Node *entry, uint64_t key,
+                                const char *citizen_id, size_t len)
+{
+   if (entry_key != LIST_NO_KEY && key != LIST_NO_KEY)
+      return (entry_key > key) - (entry_key < key);
+
+   return compare_key(entry->citizen_id, citizen_id, len);
+}
+
+// leaf_position(...) finds the first record of a leaf that is not smaller than the key
+static int leaf_position(const BPLeaf *leaf, uint64_t key, const char *citizen_id, size_t len,
+                         uint64_t *steps)
+{
+   int low = 0, high = leaf->count;
+
+   while (low < high)
+   {
+      int mid = (low + high) / 2;
+      (*steps)++;
+      if (compare_entry(leaf->keys[mid], leaf->records[mid], key, citizen_id, len) < 0)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   return low;
+}
+
+// child_position(...) finds the child of an inner node whose range holds the key
+static int child_position(const BPInner *inner, uint64_t key, const char *citizen_id, size_t len,
+                          uint64_t *steps)
+{
+   int low = 0, high = inner->count;
+
+   while (low < high)
+   {
+      int mid = (low + high) / 2;
+      (*steps)++;
+      if (compare_entry(inner->keys[mid], inner->separators[mid], key, citizen_id, len) <= 0)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   return low;
+}
+
+// find_leaf(...) descends to the leaf whose range holds the key, remembering the inner
+// nodes and child slots it went through when path is given
+static BPLeaf *find_leaf(BPTree *tree, uint64_t key, const char *citizen_id, size_t len,
+                         BPInner **path, int *slots, uint64_t *steps)
+{
+   void *node = tree->root;
+
+   for (int level = tree->height - 1; level > 0; level--)
+   {
+      BPInner *inner = node;
+      int slot = child_position(inner, key, citizen_id, len, steps);
+
+      if (path != NULL)
+      {
+         path[level] = inner;
+         slots[level] = slot;
+      }
+      node = inner->children[slot];
+   }
+
+   return node;
+}
+
+// alloc_leaf(...) carves an empty leaf out of the arena
+static BPLeaf *alloc_leaf(BPTree *tree)
+{
+   BPLeaf *leaf = arena_alloc(&tree->arena, sizeof(BPLeaf), 64);
+
+   if (leaf != NULL)
+   {
+      leaf->count = 0;
+      leaf->next = NULL;
+   }
+
+   return leaf;
+}
+
+// implementing bptree_create(...) to create an empty tree, a single empty leaf
+BPTree *bptree_create(void)
+{
+   BPTree *tree = malloc(sizeof(BPTree));
+
+   // checking if memory was allocated successfully
+   if (tree == NULL)
+   {
+      printf("Error while creating B+-tree");
+      return NULL;
+   }
+
+   arena_init(&tree->arena);
+   pthread_rwlock_init(&tree->lock, NULL);
+   tree->height = 1;
+   tree->count = 0;
+   tree->searches = 0;
+   tree->search_steps = 0;
+   tree->search_levels = 0;
+   tree->packed_keys = getenv("LIST_STRING_KEYS") == NULL;
+   tree->root = tree->first = alloc_leaf(tree);
+
+   if (tree->root == NULL)
+   {
+      bptree_delete(tree);
+      return NULL;
+   }
+
+   return tree;
+}
+
+// implementing bptree_delete(...) to release the tree, its nodes and its records at once
+void bptree_delete(BPTree *tree)
+{
+   arena_free(&tree->arena);
+   pthread_rwlock_destroy(&tree->lock);
+   free(tree);
+}
+
+// insert_separator(...) hangs right next to the child at slots[level] of path[level], with
+// the separator (key, record) between them, splitting inner nodes up to the root as needed
+// at_end is set when right holds the largest IDs of the tree
+static int insert_separator(BPTree *tree, int level, BPInner **path, int *slots, void *left,
+                            uint64_t key, Node *separator, void *right, int at_end)
+{
+   // a split root gets a new root above it
+   if (level == tree->height)
+   {
+      BPInner *root = arena_alloc(&tree->arena, sizeof(BPInner), 64);
+      if (root == NULL || tree->height == BPTREE_MAX_HEIGHT)
+         return -1;
+
+      root->count = 1;
+      root->keys[0] = key;
+      root->separators[0] = separator;
+      root->children[0] = left;
+      root->children[1] = right;
+      tree->root = root;
+      tree->height++;
+      return 0;
+   }
+
+   BPInner *inner = path[level];
+   int slot = slots[level];
+
+   // the common case: room for one more separator
+   if (inner->count < BPTREE_ORDER)
+   {
+      int move = inner->count - slot;
+      memmove(&inner->keys[slot + 1], &inner->keys[slot], move * sizeof(uint64_t));
+      memmove(&inner->separators[slot + 1], &inner->separators[slot], move * sizeof(Node *));
+      memmove(&inner->children[slot + 2], &inner->children[slot + 1], move * sizeof(void *));
+      inner->keys[slot] = key;
+      inner->separators[slot] = separator;
+      inner->children[slot + 1] = right;
+      inner->count++;
+      return 0;
+   }
+
+   // otherwise lining up all ORDER + 1 separators and splitting them around the middle one
+   uint64_t keys[BPTREE_ORDER + 1];
+   Node *separators[BPTREE_ORDER + 1];
+   void *children[BPTREE_ORDER + 2];
+
+   for (int i = 0, j = 0; i <= BPTREE_ORDER; i++)
+   {
+      if (i == slot)
+      {
+         keys[i] = key;
+         separators[i] = separator;
+         continue;
+      }
+      keys[i] = inner->keys[j];
+      separators[i] = inner->separators[j];
+      j++;
+   }
+   for (int i = 0, j = 0; i <= BPTREE_ORDER + 1; i++)
+   {
+      children[i] = i == slot + 1 ? right : inner->children[j++];
+   }
+
+   BPInner *sibling = arena_alloc(&tree->arena, sizeof(BPInner), 64);
+   if (sibling == NULL)
+      return -1;
+
+   // sorted input keeps the full node and moves only the new child over
+   at_end = at_end && slot == BPTREE_ORDER;
+   int mid = at_end ? BPTREE_ORDER : (BPTREE_ORDER + 1) / 2;
+
+   inner->count = mid;
+   memcpy(inner->keys, keys, mid * sizeof(uint64_t));
+   memcpy(inner->separators, separators, mid * sizeof(Node *));
+   memcpy(inner->children, children, (mid + 1) * sizeof(void *));
+
+   sibling->count = BPTREE_ORDER - mid;
+   memcpy(sibling->keys, &keys[mid + 1], sibling->count * sizeof(uint64_t));
+   memcpy(sibling->separators, &separators[mid + 1], sibling->count * sizeof(Node *));
+   memcpy(sibling->children, &children[mid + 1], (sibling->count + 1) * sizeof(void *));
+
+   return insert_separator(tree, level + 1, path, slots, inner, keys[mid], separators[mid], sibling, at_end);
+}
+
+// tree_insert(...) places a record that has no equal in the tree yet; the record is built
+// from record, or copied from node for bptree_append(...) (which must go last)
+static Node *tree_insert(BPTree *tree, const Record *record, const Node *node)
+{
+   const char *citizen_id = record ? record->citizen_id.str : node->citizen_id;
+   size_t id_len = record ? record->citizen_id.len : strlen(node->citizen_id);
+   uint64_t key = tree->packed_keys ? list_pack_key(citizen_id, id_len) : LIST_NO_KEY;
+   BPInner *path[BPTREE_MAX_HEIGHT];
+   int slots[BPTREE_MAX_HEIGHT];
+   uint64_t steps = 0;
+
+   BPLeaf *leaf = find_leaf(tree, key, citizen_id, id_len, path, slots, &steps);
+   int pos = leaf_position(leaf, key, citizen_id, id_len, &steps);
+   int at_end = pos == leaf->count && leaf->next == NULL;
+
+   // refusing a duplicate ID, and an appended record that would break the order
+   if (pos < leaf->count && compare_entry(leaf->keys[pos], leaf->records[pos], key, citizen_id, id_len) == 0)
+      return NULL;
+   if (node != NULL && !at_end)
+      return NULL;
+
+   Node *new_node;
+   if (record != NULL)
+   {
+      new_node = node_create(&tree->arena, 0, record, tree->packed_keys);
+   }
+   else
+   {
+      // an appended record's strings are used as given, like list_append(...)
+      new_node = arena_alloc(&tree->arena, sizeof(Node), _Alignof(Node));
+      if (new_node != NULL)
+      {
+         *new_node = *node;
+         new_node->next = NULL;
+         new_node->key = key;
+      }
+   }
+
+   if (new_node == NULL)
+   {
+      return NULL;
+   }
+
+   // a full leaf is split first, sorted input leaves it full and starts a new one
+   BPLeaf *target = leaf;
+   if (leaf->count == BPTREE_ORDER)
+   {
+      BPLeaf *right = alloc_leaf(tree);
+      if (right == NULL)
+         return NULL;
+
+      int keep = at_end ? BPTREE_ORDER : BPTREE_ORDER / 2;
+      right->count = BPTREE_ORDER - keep;
+      memcpy(right->keys, &leaf->keys[keep], right->count * sizeof(uint64_t));
+      memcpy(right->records, &leaf->records[keep], right->count * sizeof(Node *));
+      leaf->count = keep;
+
+      if (pos >= keep)
+      {
+         target = right;
+         pos -= keep;
+      }
+
+      // the new record is placed before the split is hung into the tree, since it may
+      // be the first record of the right leaf and so become the separator
+      memmove(&target->keys[pos + 1], &target->keys[pos], (target->count - pos) * sizeof(uint64_t));
+      memmove(&target->records[pos + 1], &target->records[pos], (target->count - pos) * sizeof(Node *));
+      target->keys[pos] = key;
+      target->records[pos] = new_node;
+      target->count++;
+
+      right->next = leaf->next;
+      leaf->next = right;
+
+      if (insert_separator(tree, 1, path, slots, leaf, right->keys[0], right->records[0], right, at_end) != 0)
+         return NULL;
+   }
+   else
+   {
+      memmove(&leaf->keys[pos + 1], &leaf->keys[pos], (leaf->count - pos) * sizeof(uint64_t));
+      memmove(&leaf->records[pos + 1], &leaf->records[pos], (leaf->count - pos) * sizeof(Node *));
+      leaf->keys[pos] = key;
+      leaf->records[pos] = new_node;
+      leaf->count++;
+   }
+
+   __atomic_fetch_add(&tree->count, 1, __ATOMIC_RELAXED);
+   return new_node;
+}
+
+// implementing bptree_insert(...) to add a record (copied into the tree's arena)
+Node *bptree_insert(BPTree *tree, const Record *record)
+{
+   return tree_insert(tree, record, NULL);
+}
+
+// implementing bptree_insert_concurrent(...) to add a record while other threads search the tree
+Node *bptree_insert_concurrent(BPTree *tree, const Record *record)
+{
+   pthread_rwlock_wrlock(&tree->lock);
+   Node *node = tree_insert(tree, record, NULL);
+   pthread_rwlock_unlock(&tree->lock);
+
+   return node;
+}
+
+// implementing bptree_append(...) to add a record whose ID is larger than every ID in the tree
+// the record's strings are stored as given (not copied), so they must outlive the tree
+Node *bptree_append(BPTree *tree, const Node *record)
+{
+   return tree_insert(tree, NULL, record);
+}
+
+// implementing bptree_remove(...) to take the record of citizen_id out of its leaf, returns it or NULL
+// leaves are not merged when they shrink: the separators above still bound the keys under
+// them, an empty leaf is skipped by scans and refilled by later inserts, and the removed
+// record stays in the arena since a separator may still compare against it
+Node *bptree_remove(BPTree *tree, const char *citizen_id)
+{
+   size_t len = strlen(citizen_id);
+   uint64_t key = tree->packed_keys ? list_pack_key(citizen_id, len) : LIST_NO_KEY;
+   uint64_t steps = 0;
+   Node *node = NULL;
+
+   pthread_rwlock_wrlock(&tree->lock);
+
+   BPLeaf *leaf = find_leaf(tree, key, citizen_id, len, NULL, NULL, &steps);
+   int pos = leaf_position(leaf, key, citizen_id, len, &steps);
+
+   if (pos < leaf->count && compare_entry(leaf->keys[pos], leaf->records[pos], key, citizen_id, len) == 0)
+   {
+      node = leaf->records[pos];
+      memmove(&leaf->keys[pos], &leaf->keys[pos + 1], (leaf->count - pos - 1) * sizeof(uint64_t));
+      memmove(&leaf->records[pos], &leaf->records[pos + 1], (leaf->count - pos - 1) * sizeof(Node *));
+      leaf->count--;
+      __atomic_fetch_sub(&tree->count, 1, __ATOMIC_RELAXED);
+   }
+
+   pthread_rwlock_unlock(&tree->lock);
+   return node;
+}
+
+// search(...) finds one ID, the caller holds the read lock
+static Node *search(BPTree *tree, const char *citizen_id, size_t len, uint64_t *steps)
+{
+   uint64_t key = tree->packed_keys ? list_pack_key(citizen_id, len) : LIST_NO_KEY;
+   BPLeaf *leaf = find_leaf(tree, key, citizen_id, len, NULL, NULL, steps);
+   int pos = leaf_position(leaf, key, citizen_id, len, steps);
+
+   if (pos < leaf->count && compare_entry(leaf->keys[pos], leaf->records[pos], key, citizen_id, len) == 0)
+   {
+      return leaf->records[pos];
+   }
+
+   return NULL;
+}
+
+// implementing bptree_search(...) to find the record of a citizen ID
+Node *bptree_search(BPTree *tree, const char *citizen_id)
+{
+   uint64_t steps = 0;
+
+   pthread_rwlock_rdlock(&tree->lock);
+   Node *node = search(tree, citizen_id, strlen(citizen_id), &steps);
+   int height = tree->height;
+   pthread_rwlock_unlock(&tree->lock);
+
+   METRIC_ADD(tree->searches, 1);
+   METRIC_ADD(tree->search_steps, steps);
+   METRIC_ADD(tree->search_levels, height);
+   return node;
+}
+
+// implementing bptree_search_batch(...) to answer many searches under one read lock
+void bptree_search_batch(BPTree *tree, const Field *keys, size_t count, Node **results)
+{
+   uint64_t steps = 0;
+
+   pthread_rwlock_rdlock(&tree->lock);
+   for (size_t i = 0; i < count; i++)
+   {
+      results[i] = search(tree, keys[i].str, keys[i].len, &steps);
+   }
+   int height = tree->height;
+   pthread_rwlock_unlock(&tree->lock);
+
+   METRIC_ADD(tree->searches, count);
+   METRIC_ADD(tree->search_steps, steps);
+   METRIC_ADD(tree->search_levels, (uint64_t)height * count);
+}
+
+// copy_batch(...) copies up to BPTREE_SCAN_BATCH records with start <= ID <= to into batch, starting
+// after the ID of after when it is set (it may have been removed since); the caller holds the read lock
+// returns how many were copied, fewer than a batch once the bound or the last leaf is reached
+static int copy_batch(BPTree *tree, const char *start, const Node *after, const char *to, uint64_t to_key,
+                      size_t to_len, const Node **batch)
+{
+   BPLeaf *leaf = tree->first;
+   int pos = 0, count = 0;
+   uint64_t steps = 0;
+
+   if (start != NULL)
+   {
+      size_t len = strlen(start);
+      uint64_t key = tree->packed_keys ? list_pack_key(start, len) : LIST_NO_KEY;
+      leaf = find_leaf(tree, key, start, len, NULL, NULL, &steps);
+      pos = leaf_position(leaf, key, start, len, &steps);
+
+      // the record the last batch ended with was visited already
+      if (after != NULL && pos < leaf->count && compare_entry(leaf->keys[pos], leaf->records[pos], key, start, len) == 0)
+         pos++;
+   }
+
+   // walking the leaf chain until the upper bound or a full batch
+   for (; leaf != NULL; leaf = leaf->next, pos = 0)
+   {
+      for (; pos < leaf->count; pos++)
+      {
+         if (count == BPTREE_SCAN_BATCH ||
+             (to != NULL && compare_entry(leaf->keys[pos], leaf->records[pos], to_key, to, to_len) > 0))
+            return count;
+
+         batch[count++] = leaf->records[pos];
+      }
+   }
+
+   return count;
+}
+
+// implementing bptree_scan(...) to hand every record with from <= ID <= to to visit(...)
+// in ID order, a NULL bound is open, returns the number of records visited
+// the records are copied out a batch at a time and visited without the lock, so the scan
+// sees every record that stays in the tree while it runs, and the others at most once
+size_t bptree_scan(BPTree *tree, const char *from, const char *to, BPVisitor visit, void *ctx)
+{
+   size_t to_len = to ? strlen(to) : 0;
+   uint64_t to_key = to && tree->packed_keys ? list_pack_key(to, to_len) : LIST_NO_KEY;
+   const Node *batch[BPTREE_SCAN_BATCH];
+   const Node *last = NULL;
+   size_t visited = 0;
+
+   while (1)
+   {
+      pthread_rwlock_rdlock(&tree->lock);
+      int count = copy_batch(tree, last ? last->citizen_id : from, last, to, to_key, to_len, batch);
+      pthread_rwlock_unlock(&tree->lock);
+
+      for (int i = 0; i < count; i++)
+      {
+         visited++;
+         if (visit(batch[i], ctx) != 0)
+            return visited;
+      }
+
+      if (count < BPTREE_SCAN_BATCH)
+         return visited;
+      last = batch[count - 1];
+   }
+}
+
+// implementing bptree_memory(...) to report how many bytes the tree has reserved
+size_t bptree_memory(BPTree *tree)
+{
+   return sizeof(BPTree) + tree->arena.bytes_reserved;
+}
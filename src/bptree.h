@@ -0,0 +1,67 @@
+#ifndef BPTREE_H
+#define BPTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "arena.h"
+#include "record.h"
+#include "skip_list.h"
+
+#define BPTREE_ORDER 32     // keys per node, so a node's key array is four cache lines
+#define BPTREE_MAX_HEIGHT 16 // enough levels for 32^15 records
+#define BPTREE_SCAN_BATCH 256 // records a scan copies out under the read lock before visiting them
+
+// defining a leaf, its records sit in one array in citizen ID order
+typedef struct BPLeaf
+{
+   uint64_t keys[BPTREE_ORDER]; // packed keys of the records (LIST_NO_KEY when not numeric)
+   Node *records[BPTREE_ORDER]; // the records, allocated from the tree's arena
+   int count;                   // records in use
+   struct BPLeaf *next;         // the leaf holding the next larger IDs
+} BPLeaf;
+
+// defining an inner node, keys[i] is the smallest key under children[i + 1]
+typedef struct
+{
+   uint64_t keys[BPTREE_ORDER];       // packed keys of the separators
+   Node *separators[BPTREE_ORDER];    // the records the separators were taken from (for string comparison)
+   void *children[BPTREE_ORDER + 1];  // inner nodes, or leaves on the level above the leaves
+   int count;                         // separators in use, children in use is count + 1
+} BPInner;
+
+// defining the structure for our B+-tree
+typedef struct
+{
+   void *root;          // a leaf while height is 1
+   int height;          // levels, counting the leaves
+   BPLeaf *first;       // the leaf with the smallest IDs, where a full scan starts
+   size_t count;        // number of records stored
+   int packed_keys;     // 0 compares every ID as a string, like SkipList
+   uint64_t searches;     // searches run on the tree
+   uint64_t search_steps; // keys those searches compared against
+   uint64_t search_levels; // levels those searches went down
+   Arena arena;         // owns every node and record
+   pthread_rwlock_t lock; // readers share it, bptree_insert_concurrent(...) takes it alone
+} BPTree;
+
+// defining the callback a scan hands every record to, non-zero stops the scan
+typedef int (*BPVisitor)(const Node *node, void *ctx);
+
+/*
+function prototypes
+*/
+BPTree *bptree_create(void);                                         // function to create an empty tree
+void bptree_delete(BPTree *tree);                                    // function to delete a tree and every record in it
+Node *bptree_insert(BPTree *tree, const Record *record);             // function to insert a record, NULL for a duplicate ID
+Node *bptree_insert_concurrent(BPTree *tree, const Record *record);  // function to insert while other threads search
+Node *bptree_append(BPTree *tree, const Node *record);               // function to add a record with the largest ID
+Node *bptree_remove(BPTree *tree, const char *citizen_id);           // function to take a record out, returns it
+Node *bptree_search(BPTree *tree, const char *citizen_id);           // function to find a record by ID
+void bptree_search_batch(BPTree *tree, const Field *keys,
+                         size_t count, Node **results);              // function to search many keys under one lock
+size_t bptree_scan(BPTree *tree, const char *from, const char *to,
+                   BPVisitor visit, void *ctx);                      // function to visit IDs in [from, to] in order
+size_t bptree_memory(BPTree *tree);                                  // function to get the bytes reserved by the tree
+
+#endif
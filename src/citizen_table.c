@@ -0,0 +1,509 @@
+/*
+This is the citizen_table.c file that keeps every citizen once, hashed by citizen
+ID, so the records a citizen has for several viruses share one copy of the ID,
+names, country and age instead of each carrying its own.
+
+Every citizen also carries a bitmap of the viruses that store a record of it, set
+and cleared as records come and go, so "what is this citizen vaccinated against?"
+is one hash lookup instead of a bloom filter probe and an index search per virus.
+
+The table is split into CITIZEN_SHARDS parts by the top bits of the ID's hash, each
+an open-addressing table with its own mutex, so the inserter threads of a parallel
+load rarely wait on each other. The citizens themselves live in their shard's arena
+and never move, so records can point at them. The bits of the first
+CITIZEN_INLINE_VIRUSES viruses are changed with atomic operations and read without
+a lock; the bits of later viruses are kept in an array taken under the shard lock.
+
+A record that turns out not to be stored (a repeated citizen ID) must not leave
+a citizen behind, so the loader takes a hold on the citizen while it tries the
+insert: a citizen that no virus stores and nobody holds any more is unlinked from
+its shard. Its bytes stay in the arena, since a reader may still be walking it.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "citizen_table.h"
+#include "arena.h"
+#include "intern.h"
+#include "bloom_filter.h"
+
+// defining one part of the table
+typedef struct
+{
+   pthread_mutex_t lock;
+   Citizen **slots;   // the first variant of every ID, NULL for an empty slot
+   size_t slot_count; // number of slots (a power of two), 0 before the first citizen
+   size_t count;      // IDs stored
+   size_t variants;   // citizens stored, variants included
+   size_t extra_bytes; // bytes of every extra[] bitmap
+   Arena arena;       // the citizens and their strings
+} CitizenShard;
+
+static CitizenShard shards[CITIZEN_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+// init_shards(...) sets up every shard the first time the table is used
+static void init_shards(void)
+{
+   for (int s = 0; s < CITIZEN_SHARDS; s++)
+   {
+      pthread_mutex_init(&shards[s].lock, NULL);
+      arena_init(&shards[s].arena);
+   }
+}
+
+// shard_of(...) picks the shard of a hash by its top bits, the slots use the bottom ones
+static inline int shard_of(uint64_t hash)
+{
+   return hash >> (64 - __builtin_ctz(CITIZEN_SHARDS));
+}
+
+// find_slot(...) returns the slot holding the ID, or the empty slot where it belongs
+static size_t find_slot(CitizenShard *shard, uint64_t hash, const char *citizen_id, size_t len)
+{
+   size_t mask = shard->slot_count - 1;
+   size_t i = hash & mask;
+   Citizen *entry;
+
+   // linear probing until we hit the ID or an empty slot
+   while ((entry = shard->slots[i]) != NULL &&
+          !(strncmp(entry->citizen_id, citizen_id, len) == 0 && entry->citizen_id[len] == '\0'))
+   {
+      i = (i + 1) & mask;
+   }
+
+   return i;
+}
+
+// grow(...) rehashes a shard into a table twice the size (called with the shard lock held)
+static int grow(CitizenShard *shard)
+{
+   size_t new_count = shard->slot_count ? shard->slot_count * 2 : CITIZEN_INITIAL_SLOTS;
+   Citizen **bigger = calloc(new_count, sizeof(Citizen *));
+
+   // checking if memory was allocated successfully
+   if (bigger == NULL)
+   {
+      printf("Error while allocating memory");
+      return -1;
+   }
+
+   Citizen **old = shard->slots;
+   size_t old_count = shard->slot_count;
+   shard->slots = bigger;
+   shard->slot_count = new_count;
+
+   for (size_t i = 0; i < old_count; i++)
+   {
+      if (old[i] != NULL)
+      {
+         const char *id = old[i]->citizen_id;
+         size_t len = strlen(id);
+         bigger[find_slot(shard, bloom_hash(id, len), id, len)] = old[i];
+      }
+   }
+
+   free(old);
+   return 0;
+}
+
+// same_person(...) tells if a citizen has exactly the personal fields of a record
+static int same_person(const Citizen *citizen, const Record *record, const char *country)
+{
+   return citizen->country == country && citizen->age == record->age &&
+          field_equals(&record->first_name, citizen->first_name) &&
+          field_equals(&record->last_name, citizen->last_name);
+}
+
+// make_citizen(...) allocates a citizen from a record in a shard's arena, copying its
+// strings behind it unless they are borrowed (called with the shard lock held)
+static Citizen *make_citizen(CitizenShard *shard, int index, const Record *record, const char *country,
+                             const char *citizen_id, int borrow)
+{
+   size_t string_bytes = 0;
+
+   if (!borrow)
+   {
+      string_bytes = record->first_name.len + record->last_name.len + 2;
+      if (citizen_id == NULL)
+         string_bytes += record->citizen_id.len + 1;
+   }
+
+   Citizen *citizen = arena_alloc(&shard->arena, sizeof(Citizen) + string_bytes, _Alignof(Citizen));
+
+   if (citizen == NULL)
+   {
+      return NULL;
+   }
+
+   memset(citizen, 0, sizeof(Citizen));
+   citizen->country = country;
+   citizen->age = record->age;
+   citizen->shard = index;
+
+   if (borrow)
+   {
+      // the fields are whole NUL-terminated strings (a snapshot's pool)
+      citizen->citizen_id = citizen_id ? citizen_id : record->citizen_id.str;
+      citizen->first_name = record->first_name.str;
+      citizen->last_name = record->last_name.str;
+      return citizen;
+   }
+
+   char *strings = (char *)(citizen + 1);
+
+   // COPY_FIELD appends a NUL-terminated copy of a field to the citizen's strings
+#define COPY_FIELD(dest, field)                        \
+   do                                                  \
+   {                                                   \
+      dest = strings;                                  \
+      memcpy(strings, (field).str, (field).len);       \
+      strings[(field).len] = '\0';                     \
+      strings += (field).len + 1;                      \
+   } while (0)
+
+   // a variant shares the ID string of the citizen it was found under
+   if (citizen_id != NULL)
+      citizen->citizen_id = citizen_id;
+   else
+      COPY_FIELD(citizen->citizen_id, record->citizen_id);
+   COPY_FIELD(citizen->first_name, record->first_name);
+   COPY_FIELD(citizen->last_name, record->last_name);
+#undef COPY_FIELD
+
+   return citizen;
+}
+
+// add_citizen(...) is citizen_table_add(...), also taking a hold on the citizen when hold is set
+static Citizen *add_citizen(const Record *record, int borrow, int hold)
+{
+   const char *country = intern(record->country.str, record->country.len);
+   uint64_t hash = bloom_hash(record->citizen_id.str, record->citizen_id.len);
+   int index = shard_of(hash);
+   CitizenShard *shard = &shards[index];
+
+   if (country == NULL)
+   {
+      return NULL;
+   }
+
+   pthread_once(&shards_once, init_shards);
+   pthread_mutex_lock(&shard->lock);
+
+   // keeping the table at most half full so probe sequences stay short
+   if ((shard->count + 1) * 2 > shard->slot_count && grow(shard) != 0)
+   {
+      pthread_mutex_unlock(&shard->lock);
+      return NULL;
+   }
+
+   size_t slot = find_slot(shard, hash, record->citizen_id.str, record->citizen_id.len);
+   Citizen *first = shard->slots[slot];
+   Citizen *last = NULL;
+
+   // the citizen is usually there already, with the same fields
+   for (Citizen *citizen = first; citizen != NULL; citizen = citizen->variant)
+   {
+      if (same_person(citizen, record, country))
+      {
+         if (hold)
+            __atomic_fetch_add(&citizen->holds, 1, __ATOMIC_RELAXED);
+         pthread_mutex_unlock(&shard->lock);
+         return citizen;
+      }
+      last = citizen;
+   }
+
+   Citizen *citizen = make_citizen(shard, index, record, country, first ? first->citizen_id : NULL, borrow);
+
+   if (citizen != NULL)
+   {
+      citizen->holds = hold;
+
+      // a variant is published behind the last one, so readers walking the chain see it whole
+      if (last != NULL)
+      {
+         __atomic_store_n(&last->variant, citizen, __ATOMIC_RELEASE);
+      }
+      else
+      {
+         shard->slots[slot] = citizen;
+         shard->count++;
+      }
+      shard->variants++;
+   }
+
+   pthread_mutex_unlock(&shard->lock);
+   return citizen;
+}
+
+// implementing citizen_table_add(...) to return the citizen whose ID and personal fields are
+// the record's, adding it (or a new variant of its ID) the first time; with borrow set the
+// record's fields are NUL-terminated strings that outlive the table, and are not copied
+Citizen *citizen_table_add(const Record *record, int borrow)
+{
+   return add_citizen(record, borrow, 0);
+}
+
+// implementing citizen_table_hold(...) to add a record's citizen like citizen_table_add(...), for
+// a record that may not be stored: the hold keeps the citizen linked until citizen_table_settle(...)
+Citizen *citizen_table_hold(const Record *record)
+{
+   return add_citizen(record, 0, 1);
+}
+
+// is_stored(...) tells if any virus stores a record of the citizen (called with the shard lock held)
+static int is_stored(const Citizen *citizen)
+{
+   if (__atomic_load_n(&citizen->viruses, __ATOMIC_ACQUIRE) != 0)
+      return 1;
+
+   for (int w = 0; w < citizen->extra_words; w++)
+   {
+      if (citizen->extra[w] != 0)
+         return 1;
+   }
+
+   return 0;
+}
+
+// unlink_slot(...) empties a slot of the open-addressing table, moving back the entries
+// after it that would no longer be reached (called with the shard lock held)
+static void unlink_slot(CitizenShard *shard, size_t slot)
+{
+   size_t mask = shard->slot_count - 1;
+   size_t hole = slot;
+
+   shard->slots[hole] = NULL;
+   for (size_t i = (hole + 1) & mask; shard->slots[i] != NULL; i = (i + 1) & mask)
+   {
+      const char *id = shard->slots[i]->citizen_id;
+      size_t home = bloom_hash(id, strlen(id)) & mask;
+
+      // an entry whose home lies cyclically in (hole, i] is still reached, the others move into the hole
+      if (hole <= i ? (home > hole && home <= i) : (home > hole || home <= i))
+         continue;
+
+      shard->slots[hole] = shard->slots[i];
+      shard->slots[i] = NULL;
+      hole = i;
+   }
+}
+
+// implementing citizen_table_settle(...) to end the hold citizen_table_hold(...) took, once the
+// record was stored (stored set, after citizen_table_mark(...)) or given up: a citizen no virus
+// stores and no other adder holds is unlinked, so a repeated record leaves nothing behind
+void citizen_table_settle(Citizen *citizen, int stored)
+{
+   // a stored citizen stays, so only the count goes down (the mark is published by the release)
+   if (stored)
+   {
+      __atomic_fetch_sub(&citizen->holds, 1, __ATOMIC_RELEASE);
+      return;
+   }
+
+   CitizenShard *shard = &shards[citizen->shard];
+   pthread_mutex_lock(&shard->lock);
+
+   if (__atomic_sub_fetch(&citizen->holds, 1, __ATOMIC_ACQ_REL) == 0 && !is_stored(citizen))
+   {
+      // citizen_table_clear(...) only reaches linked citizens, so the extra bits go now
+      shard->extra_bytes -= citizen->extra_words * sizeof(uint64_t);
+      __atomic_store_n(&citizen->extra_words, 0, __ATOMIC_RELAXED);
+      free(citizen->extra);
+      citizen->extra = NULL;
+
+      const char *id = citizen->citizen_id;
+      size_t len = strlen(id);
+      size_t slot = find_slot(shard, bloom_hash(id, len), id, len);
+      Citizen *first = shard->slots[slot];
+
+      // the chain loses the citizen; a reader already on it still finds its successor
+      if (first == citizen && citizen->variant != NULL)
+      {
+         shard->slots[slot] = citizen->variant;
+         shard->variants--;
+      }
+      else if (first == citizen)
+      {
+         unlink_slot(shard, slot);
+         shard->count--;
+         shard->variants--;
+      }
+      else
+      {
+         for (Citizen *prev = first; prev != NULL; prev = prev->variant)
+         {
+            if (prev->variant == citizen)
+            {
+               __atomic_store_n(&prev->variant, citizen->variant, __ATOMIC_RELEASE);
+               shard->variants--;
+               break;
+            }
+         }
+      }
+   }
+
+   pthread_mutex_unlock(&shard->lock);
+}
+
+// implementing citizen_table_find(...) to return the first variant of an ID, NULL if it was never added
+// the other variants follow through citizen->variant
+Citizen *citizen_table_find(const char *citizen_id, size_t len)
+{
+   uint64_t hash = bloom_hash(citizen_id, len);
+   CitizenShard *shard = &shards[shard_of(hash)];
+   Citizen *citizen = NULL;
+
+   pthread_once(&shards_once, init_shards);
+   pthread_mutex_lock(&shard->lock);
+   if (shard->slot_count > 0)
+      citizen = shard->slots[find_slot(shard, hash, citizen_id, len)];
+   pthread_mutex_unlock(&shard->lock);
+
+   return citizen;
+}
+
+// implementing citizen_table_mark(...) to record that virus (a Virus.index) now stores a record
+// of the citizen (stored set) or no longer does (stored clear)
+int citizen_table_mark(Citizen *citizen, int virus, int stored)
+{
+   if (virus < CITIZEN_INLINE_VIRUSES)
+   {
+      uint64_t bit = 1ULL << virus;
+      if (stored)
+         __atomic_fetch_or(&citizen->viruses, bit, __ATOMIC_RELAXED);
+      else
+         __atomic_fetch_and(&citizen->viruses, ~bit, __ATOMIC_RELAXED);
+      return 0;
+   }
+
+   CitizenShard *shard = &shards[citizen->shard];
+   int word = (virus - CITIZEN_INLINE_VIRUSES) / 64;
+   int result = 0;
+
+   pthread_mutex_lock(&shard->lock);
+
+   // growing the extra bits to cover the virus, a clear of a bit never set needs none
+   if (word >= citizen->extra_words && stored)
+   {
+      uint64_t *bigger = realloc(citizen->extra, (word + 1) * sizeof(uint64_t));
+      if (bigger == NULL)
+      {
+         result = -1;
+      }
+      else
+      {
+         memset(bigger + citizen->extra_words, 0, (word + 1 - citizen->extra_words) * sizeof(uint64_t));
+         shard->extra_bytes += (word + 1 - citizen->extra_words) * sizeof(uint64_t);
+         citizen->extra = bigger;
+         __atomic_store_n(&citizen->extra_words, word + 1, __ATOMIC_RELAXED);
+      }
+   }
+
+   if (result == 0 && word < citizen->extra_words)
+   {
+      uint64_t bit = 1ULL << ((virus - CITIZEN_INLINE_VIRUSES) % 64);
+      if (stored)
+         citizen->extra[word] |= bit;
+      else
+         citizen->extra[word] &= ~bit;
+   }
+
+   pthread_mutex_unlock(&shard->lock);
+   return result;
+}
+
+// implementing citizen_table_viruses(...) to fill viruses with up to max indexes of the viruses
+// storing a record of the citizen, in increasing order; returns how many there are in all
+int citizen_table_viruses(const Citizen *citizen, int *viruses, int max)
+{
+   uint64_t bits = __atomic_load_n(&citizen->viruses, __ATOMIC_RELAXED);
+   int found = 0;
+
+   while (bits != 0)
+   {
+      if (found < max)
+         viruses[found] = __builtin_ctzll(bits);
+      found++;
+      bits &= bits - 1;
+   }
+
+   if (__atomic_load_n(&citizen->extra_words, __ATOMIC_RELAXED) == 0)
+   {
+      return found;
+   }
+
+   CitizenShard *shard = &shards[citizen->shard];
+   pthread_mutex_lock(&shard->lock);
+   for (int w = 0; w < citizen->extra_words; w++)
+   {
+      for (bits = citizen->extra[w]; bits != 0; bits &= bits - 1)
+      {
+         if (found < max)
+            viruses[found] = CITIZEN_INLINE_VIRUSES + w * 64 + __builtin_ctzll(bits);
+         found++;
+      }
+   }
+   pthread_mutex_unlock(&shard->lock);
+
+   return found;
+}
+
+// implementing citizen_table_count(...) to count the citizens, every variant counting once
+size_t citizen_table_count(void)
+{
+   size_t count = 0;
+
+   pthread_once(&shards_once, init_shards);
+   for (int s = 0; s < CITIZEN_SHARDS; s++)
+   {
+      pthread_mutex_lock(&shards[s].lock);
+      count += shards[s].variants;
+      pthread_mutex_unlock(&shards[s].lock);
+   }
+
+   return count;
+}
+
+// implementing citizen_table_memory(...) to report what the table costs
+size_t citizen_table_memory(void)
+{
+   size_t bytes = 0;
+
+   pthread_once(&shards_once, init_shards);
+   for (int s = 0; s < CITIZEN_SHARDS; s++)
+   {
+      pthread_mutex_lock(&shards[s].lock);
+      bytes += shards[s].slot_count * sizeof(Citizen *) + shards[s].arena.bytes_reserved + shards[s].extra_bytes;
+      pthread_mutex_unlock(&shards[s].lock);
+   }
+
+   return bytes;
+}
+
+// implementing citizen_table_clear(...) to release every citizen at once
+// nothing may use the table while this runs, and no record may point at a citizen afterwards
+void citizen_table_clear(void)
+{
+   pthread_once(&shards_once, init_shards);
+   for (int s = 0; s < CITIZEN_SHARDS; s++)
+   {
+      CitizenShard *shard = &shards[s];
+
+      for (size_t i = 0; i < shard->slot_count; i++)
+      {
+         for (Citizen *citizen = shard->slots[i]; citizen != NULL; citizen = citizen->variant)
+            free(citizen->extra);
+      }
+
+      free(shard->slots);
+      arena_free(&shard->arena);
+      arena_init(&shard->arena);
+      shard->slots = NULL;
+      shard->slot_count = shard->count = shard->variants = shard->extra_bytes = 0;
+   }
+}
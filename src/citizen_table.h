@@ -0,0 +1,44 @@
+#ifndef CITIZEN_TABLE_H
+#define CITIZEN_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "record.h"
+
+#define CITIZEN_SHARDS 16          // independently locked parts of the table (a power of two)
+#define CITIZEN_INITIAL_SLOTS 64   // slots of a shard's first hash table (a power of two)
+#define CITIZEN_INLINE_VIRUSES 64  // viruses whose bits live in the citizen itself
+
+// defining a citizen, the personal fields every virus's records of the citizen share
+// a file may give one ID different personal fields on different lines; each distinct set
+// becomes a variant of the citizen, so every record keeps the fields its own line had
+typedef struct Citizen
+{
+   const char *citizen_id;
+   const char *first_name;
+   const char *last_name;
+   const char *country;      // interned
+   int age;
+   uint8_t shard;            // the part of the table holding the citizen
+   uint8_t holds;            // adders between citizen_table_hold(...) and citizen_table_settle(...)
+   uint16_t extra_words;     // words in extra[]
+   uint64_t viruses;         // bit v is set while virus v (Virus.index) stores a record of this variant
+   uint64_t *extra;          // the bits of viruses CITIZEN_INLINE_VIRUSES and up, NULL until needed
+   struct Citizen *variant;  // the next variant with the same ID, NULL for the last
+} Citizen;
+
+/*
+function prototypes
+*/
+Citizen *citizen_table_add(const Record *record, int borrow);        // function to find or add the citizen a record describes
+Citizen *citizen_table_hold(const Record *record);                   // function to find or add a citizen for a record that may not be stored
+void citizen_table_settle(Citizen *citizen, int stored);             // function to end a hold, unlinking a citizen nothing stores
+Citizen *citizen_table_find(const char *citizen_id, size_t len);      // function to find the first variant of an ID
+int citizen_table_mark(Citizen *citizen, int virus, int stored);      // function to set or clear the bit of a virus, 0 on success
+int citizen_table_viruses(const Citizen *citizen, int *viruses,
+                          int max);                                   // function to list the viruses storing a record of a variant
+size_t citizen_table_count(void);                                     // function to get the number of citizens (variants included)
+size_t citizen_table_memory(void);                                    // function to get the bytes held by the table
+void citizen_table_clear(void);                                       // function to release every citizen at once
+
+#endif
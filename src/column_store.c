@@ -0,0 +1,362 @@
+/*
+This is the column_store.c file that keeps a second, read-only copy of a virus's
+records as a struct of arrays (age, country, day and a pointer back to the
+record), so queries like "vaccinated, over 65, in Japan, in March" test packed
+columns instead of following two pointers per record.
+
+The copy is built by one scan of the index and is not updated by later changes;
+its owner stamps it and builds a new one once the records changed (see
+columns_for(...) in main.c). A filter runs in blocks of COLUMN_BLOCK rows: a
+kernel compares a block of every column it needs against the predicates and
+sets one bit per passing row, and only the set bits are looked at afterwards.
+Like the bloom filter, the kernel is picked once at runtime: AVX2 when the CPU
+has it, SSE2 (part of every x86-64 CPU) otherwise, or the portable loop.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "column_store.h"
+#include "citizen_table.h"
+#include "intern.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define COLUMN_CHUNK 64 // blocks a kernel call fills masks for (4096 rows, 512 bytes of masks)
+
+// defining a kernel: the match masks of blocks [first, first + blocks)
+typedef void (*FilterKernel)(const ColumnStore *store, const ColumnFilter *filter, size_t first, size_t blocks,
+                             uint64_t *masks);
+
+// grow_columns(...) moves every column into arrays with room for size rows, 64-byte aligned
+// so the kernels can use aligned loads
+static int grow_columns(ColumnStore *store, size_t size)
+{
+   uint8_t *age = aligned_alloc(64, size * sizeof(uint8_t));
+   uint32_t *country = aligned_alloc(64, size * sizeof(uint32_t));
+   int32_t *day = aligned_alloc(64, size * sizeof(int32_t));
+   const Node **nodes = malloc(size * sizeof(Node *));
+
+   if (age == NULL || country == NULL || day == NULL || nodes == NULL)
+   {
+      free(age);
+      free(country);
+      free(day);
+      free(nodes);
+      return -1;
+   }
+
+   if (store->count > 0)
+   {
+      memcpy(age, store->age, store->count * sizeof(uint8_t));
+      memcpy(country, store->country, store->count * sizeof(uint32_t));
+      memcpy(day, store->day, store->count * sizeof(int32_t));
+      memcpy(nodes, store->nodes, store->count * sizeof(Node *));
+   }
+
+   free(store->age);
+   free(store->country);
+   free(store->day);
+   free(store->nodes);
+   store->age = age;
+   store->country = country;
+   store->day = day;
+   store->nodes = nodes;
+   store->size = size;
+   return 0;
+}
+
+// add_row(...) is the scan visitor of column_store_build(...), it appends one record
+static int add_row(const Node *node, void *ctx)
+{
+   ColumnStore *store = ctx;
+
+   // the records of a -b load keep arriving while the index is copied
+   if (store->count == store->size && grow_columns(store, store->size * 2) != 0)
+      return 1;
+
+   int age = node->citizen->age;
+   store->age[store->count] = age < 0 ? 0 : age > COLUMN_AGE_MAX ? COLUMN_AGE_MAX : age;
+   store->country[store->count] = intern_id(node->citizen->country);
+   store->day[store->count] = node->day;
+   store->nodes[store->count] = node;
+   store->count++;
+   return 0;
+}
+
+// implementing column_store_build(...) to copy every record of an index into a new column store
+ColumnStore *column_store_build(Index *records)
+{
+   ColumnStore *store = calloc(1, sizeof(ColumnStore));
+   size_t expected = index_count(records);
+
+   if (store == NULL)
+      return NULL;
+
+   if (grow_columns(store, (expected / COLUMN_BLOCK + 1) * COLUMN_BLOCK) != 0 ||
+       index_scan(records, NULL, NULL, add_row, store) != store->count)
+   {
+      column_store_delete(store);
+      return NULL;
+   }
+
+   // the rows past count are never matched, but the kernels read them
+   memset(store->age + store->count, 0, (store->size - store->count) * sizeof(uint8_t));
+   memset(store->country + store->count, 0, (store->size - store->count) * sizeof(uint32_t));
+   memset(store->day + store->count, 0, (store->size - store->count) * sizeof(int32_t));
+   return store;
+}
+
+// implementing column_store_delete(...) to release the columns
+void column_store_delete(ColumnStore *store)
+{
+   if (store == NULL)
+      return;
+
+   free(store->age);
+   free(store->country);
+   free(store->day);
+   free(store->nodes);
+   free(store);
+}
+
+// implementing column_filter_init(...) to make a filter without predicates
+void column_filter_init(ColumnFilter *filter)
+{
+   memset(filter, 0, sizeof(ColumnFilter));
+   filter->min_age = 0;
+   filter->max_age = COLUMN_AGE_MAX;
+   filter->from_day = INT32_MIN;
+   filter->to_day = INT32_MAX;
+}
+
+// filter_scalar(...) is the portable kernel, one row at a time without branches
+static void filter_scalar(const ColumnStore *store, const ColumnFilter *filter, size_t first, size_t blocks,
+                          uint64_t *masks)
+{
+   uint8_t age_span = filter->max_age - filter->min_age;
+
+   for (size_t b = 0; b < blocks; b++)
+   {
+      size_t row = (first + b) * COLUMN_BLOCK;
+      uint64_t mask = 0;
+
+      for (int i = 0; i < COLUMN_BLOCK; i++)
+      {
+         // one unsigned compare tests both ends of the age range
+         int pass = (uint8_t)(store->age[row + i] - filter->min_age) <= age_span;
+         pass &= !filter->by_country | (store->country[row + i] == filter->country);
+         pass &= (store->day[row + i] >= filter->from_day) & (store->day[row + i] <= filter->to_day);
+         mask |= (uint64_t)pass << i;
+      }
+
+      masks[b] = mask;
+   }
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of every x86-64 CPU, so this kernel needs no runtime check
+static void filter_sse2(const ColumnStore *store, const ColumnFilter *filter, size_t first, size_t blocks,
+                        uint64_t *masks)
+{
+   int by_age = filter->min_age > 0 || filter->max_age < COLUMN_AGE_MAX;
+   int by_day = filter->from_day > INT32_MIN || filter->to_day < INT32_MAX;
+   __m128i min_age = _mm_set1_epi8((char)filter->min_age), max_age = _mm_set1_epi8((char)filter->max_age);
+   __m128i country = _mm_set1_epi32((int)filter->country);
+   __m128i from = _mm_set1_epi32(filter->from_day), to = _mm_set1_epi32(filter->to_day);
+
+   for (size_t b = 0; b < blocks; b++)
+   {
+      size_t row = (first + b) * COLUMN_BLOCK;
+      uint64_t mask = ~0ULL;
+
+      if (by_age)
+      {
+         uint64_t ages = 0;
+         for (int i = 0; i < COLUMN_BLOCK; i += 16)
+         {
+            // an age is in range when clamping it to the range leaves it unchanged
+            __m128i a = _mm_load_si128((const __m128i *)(store->age + row + i));
+            __m128i in = _mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(a, min_age), max_age), a);
+            ages |= (uint64_t)(uint16_t)_mm_movemask_epi8(in) << i;
+         }
+         mask &= ages;
+      }
+
+      if (filter->by_country)
+      {
+         uint64_t countries = 0;
+         for (int i = 0; i < COLUMN_BLOCK; i += 4)
+         {
+            __m128i c = _mm_load_si128((const __m128i *)(store->country + row + i));
+            countries |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(c, country))) << i;
+         }
+         mask &= countries;
+      }
+
+      if (by_day)
+      {
+         uint64_t outside = 0;
+         for (int i = 0; i < COLUMN_BLOCK; i += 4)
+         {
+            __m128i d = _mm_load_si128((const __m128i *)(store->day + row + i));
+            __m128i out = _mm_or_si128(_mm_cmplt_epi32(d, from), _mm_cmpgt_epi32(d, to));
+            outside |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(out)) << i;
+         }
+         mask &= ~outside;
+      }
+
+      masks[b] = mask;
+   }
+}
+
+// the AVX2 kernel is compiled for AVX2 only here and picked at runtime
+__attribute__((target("avx2"))) static void filter_avx2(const ColumnStore *store, const ColumnFilter *filter,
+                                                        size_t first, size_t blocks, uint64_t *masks)
+{
+   int by_age = filter->min_age > 0 || filter->max_age < COLUMN_AGE_MAX;
+   int by_day = filter->from_day > INT32_MIN || filter->to_day < INT32_MAX;
+   __m256i min_age = _mm256_set1_epi8((char)filter->min_age), max_age = _mm256_set1_epi8((char)filter->max_age);
+   __m256i country = _mm256_set1_epi32((int)filter->country);
+   __m256i from = _mm256_set1_epi32(filter->from_day), to = _mm256_set1_epi32(filter->to_day);
+
+   for (size_t b = 0; b < blocks; b++)
+   {
+      size_t row = (first + b) * COLUMN_BLOCK;
+      uint64_t mask = ~0ULL;
+
+      if (by_age)
+      {
+         uint64_t ages = 0;
+         for (int i = 0; i < COLUMN_BLOCK; i += 32)
+         {
+            __m256i a = _mm256_load_si256((const __m256i *)(store->age + row + i));
+            __m256i in = _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_max_epu8(a, min_age), max_age), a);
+            ages |= (uint64_t)(uint32_t)_mm256_movemask_epi8(in) << i;
+         }
+         mask &= ages;
+      }
+
+      if (filter->by_country)
+      {
+         uint64_t countries = 0;
+         for (int i = 0; i < COLUMN_BLOCK; i += 8)
+         {
+            __m256i c = _mm256_load_si256((const __m256i *)(store->country + row + i));
+            countries |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(c, country))) << i;
+         }
+         mask &= countries;
+      }
+
+      if (by_day)
+      {
+         uint64_t outside = 0;
+         for (int i = 0; i < COLUMN_BLOCK; i += 8)
+         {
+            __m256i d = _mm256_load_si256((const __m256i *)(store->day + row + i));
+            __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(from, d), _mm256_cmpgt_epi32(d, to));
+            outside |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(out)) << i;
+         }
+         mask &= ~outside;
+      }
+
+      masks[b] = mask;
+   }
+}
+#endif
+
+// filter_blocks points at the fastest kernel the running CPU supports, it is set once
+// through kernel_once, so filters on several threads never race to pick it
+static FilterKernel filter_blocks = NULL;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+// pick_kernel(...) runs once and chooses the filter kernel
+// setting the COLUMN_SCALAR environment variable forces the portable kernel (for benchmarking)
+static void pick_kernel(void)
+{
+   if (getenv("COLUMN_SCALAR") != NULL)
+   {
+      filter_blocks = filter_scalar;
+      return;
+   }
+#if defined(__x86_64__)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      filter_blocks = filter_avx2;
+   else
+      filter_blocks = filter_sse2;
+#else
+   filter_blocks = filter_scalar;
+#endif
+}
+
+// implementing column_filter_kernel(...) so callers can report which kernel is in use
+const char *column_filter_kernel(void)
+{
+   pthread_once(&kernel_once, pick_kernel);
+#if defined(__x86_64__)
+   if (filter_blocks == filter_avx2)
+      return "avx2";
+   if (filter_blocks == filter_sse2)
+      return "sse2";
+#endif
+   return "scalar";
+}
+
+// implementing column_store_filter(...) to hand every row passing the filter to visit, in
+// citizen ID order; returns the rows visited, or every match when visit is NULL
+size_t column_store_filter(const ColumnStore *store, const ColumnFilter *filter, IndexVisitor visit, void *ctx)
+{
+   uint64_t masks[COLUMN_CHUNK];
+   size_t blocks = (store->count + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+   size_t matches = 0;
+
+   pthread_once(&kernel_once, pick_kernel);
+
+   for (size_t first = 0; first < blocks; first += COLUMN_CHUNK)
+   {
+      size_t n = blocks - first < COLUMN_CHUNK ? blocks - first : COLUMN_CHUNK;
+      filter_blocks(store, filter, first, n, masks);
+
+      // dropping the padding rows of the last block
+      if (first + n == blocks && store->count % COLUMN_BLOCK != 0)
+         masks[n - 1] &= (1ULL << (store->count % COLUMN_BLOCK)) - 1;
+
+      for (size_t b = 0; b < n; b++)
+      {
+         uint64_t mask = masks[b];
+
+         if (visit == NULL)
+         {
+            matches += __builtin_popcountll(mask);
+            continue;
+         }
+
+         // visiting the set bits lowest first, which is citizen ID order
+         while (mask != 0)
+         {
+            size_t row = (first + b) * COLUMN_BLOCK + __builtin_ctzll(mask);
+            mask &= mask - 1;
+            matches++;
+            if (visit(store->nodes[row], ctx) != 0)
+               return matches;
+         }
+      }
+   }
+
+   return matches;
+}
+
+// implementing column_store_memory(...) to report what the columns cost
+size_t column_store_memory(const ColumnStore *store)
+{
+   if (store == NULL)
+      return 0;
+
+   return sizeof(ColumnStore) +
+          store->size * (sizeof(uint8_t) + sizeof(uint32_t) + sizeof(int32_t) + sizeof(Node *));
+}
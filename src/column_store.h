@@ -0,0 +1,47 @@
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "index.h"
+
+#define COLUMN_BLOCK 64       // rows a filter kernel tests at once, one bit each of a 64-bit mask
+#define COLUMN_AGE_MAX 255    // ages are kept as one byte, older ones are stored as this
+#define COLUMN_NO_COUNTRY UINT32_MAX // a country id no record has, for a country never interned
+
+// defining a read-only copy of one virus's records as a struct of arrays, in citizen ID order
+// every array has room for a whole number of blocks, the rows past count are never matched
+typedef struct
+{
+   size_t count;        // rows
+   size_t size;         // room in every array, a multiple of COLUMN_BLOCK
+   uint8_t *age;        // the citizen's age, clamped to [0, COLUMN_AGE_MAX]
+   uint32_t *country;   // the intern id of the citizen's country
+   int32_t *day;        // the vaccination day, DATE_NONE without a date
+   const Node **nodes;  // the record of every row, to print the matches
+   uint64_t stamp;      // set by the owner to tell whether the copy is still current
+} ColumnStore;
+
+// defining the predicates of a filter, a row must pass all of them
+typedef struct
+{
+   uint8_t min_age;      // ages in [min_age, max_age]
+   uint8_t max_age;
+   int by_country;       // only rows of country when set
+   uint32_t country;
+   int32_t from_day;     // days in [from_day, to_day]; a row without a date only
+   int32_t to_day;       // passes the default [INT32_MIN, INT32_MAX]
+} ColumnFilter;
+
+/*
+function prototypes
+*/
+ColumnStore *column_store_build(Index *records);                      // function to copy the records of an index into columns
+void column_store_delete(ColumnStore *store);                         // function to delete a column store (not the records)
+void column_filter_init(ColumnFilter *filter);                        // function to make a filter every row passes
+size_t column_store_filter(const ColumnStore *store, const ColumnFilter *filter,
+                           IndexVisitor visit, void *ctx);            // function to visit the matching rows in order (NULL only counts them)
+size_t column_store_memory(const ColumnStore *store);                 // function to get the bytes held by the columns
+const char *column_filter_kernel(void);                               // function to get the name of the filter kernel in use
+
+#endif
@@ -0,0 +1,95 @@
+/*
+This is the date.c file that converts vaccination dates between their text form
+("YYYY-MM-DD") and a day number, the count of days since 1970-01-01. Records keep
+the day number, which takes 4 bytes instead of an 11-byte string and orders dates
+with one integer comparison.
+
+The conversions are the usual civil-calendar formulas, which count in 400-year
+eras of 146097 days so that leap years need no table.
+*/
+
+// importing relevant libraries
+#include "date.h"
+
+// read_number(...) reads exactly digits decimal digits, -1 if any of them is not a digit
+static int read_number(const char *str, int digits)
+{
+   int value = 0;
+
+   for (int i = 0; i < digits; i++)
+   {
+      unsigned digit = (unsigned char)str[i] - '0';
+      if (digit > 9)
+         return -1;
+      value = value * 10 + digit;
+   }
+
+   return value;
+}
+
+// implementing date_parse(...) to read a date, rejecting anything that is not a real day
+int32_t date_parse(const char *str, size_t len)
+{
+   if (len != 10 || str[4] != '-' || str[7] != '-')
+   {
+      return DATE_NONE;
+   }
+
+   int year = read_number(str, 4);
+   int month = read_number(str + 5, 2);
+   int day = read_number(str + 8, 2);
+   static const int month_days[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+   if (year < 1 || month < 1 || month > 12 || day < 1 || day > month_days[month - 1])
+   {
+      return DATE_NONE;
+   }
+
+   int leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+   if (month == 2 && day == 29 && !leap)
+   {
+      return DATE_NONE;
+   }
+
+   // counting the year from March, so the leap day is the last day of the year
+   int y = year - (month <= 2);
+   int era = y / 400;
+   int year_of_era = y - era * 400;
+   int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+   int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+   return era * 146097 + day_of_era - 719468; // 719468 days from 0000-03-01 to 1970-01-01
+}
+
+// implementing date_format(...) to write a day number back in the input's format
+void date_format(int32_t day, char *out)
+{
+   if (day == DATE_NONE)
+   {
+      out[0] = '\0';
+      return;
+   }
+
+   int z = day + 719468;
+   int era = (z >= 0 ? z : z - 146096) / 146097;
+   int day_of_era = z - era * 146097;
+   int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+   int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+   int mp = (5 * day_of_year + 2) / 153;
+   int d = day_of_year - (153 * mp + 2) / 5 + 1;
+   int m = mp < 10 ? mp + 3 : mp - 9;
+   int y = year_of_era + era * 400 + (m <= 2);
+
+   // writing the digits directly, every day number date_parse(...) gives has a 4-digit year
+   out[0] = '0' + y / 1000 % 10;
+   out[1] = '0' + y / 100 % 10;
+   out[2] = '0' + y / 10 % 10;
+   out[3] = '0' + y % 10;
+   out[4] = '-';
+   out[5] = '0' + m / 10;
+   out[6] = '0' + m % 10;
+   out[7] = '-';
+   out[8] = '0' + d / 10;
+   out[9] = '0' + d % 10;
+   out[10] = '\0';
+}
@@ -0,0 +1,16 @@
+#ifndef DATE_H
+#define DATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DATE_NONE INT32_MIN // day number of a record without a (valid) date
+#define DATE_TEXT_LEN 11    // bytes date_format(...) writes, "YYYY-MM-DD" and the NUL
+
+/*
+function prototypes
+*/
+int32_t date_parse(const char *str, size_t len); // function to turn "YYYY-MM-DD" into a day number, DATE_NONE if invalid
+void date_format(int32_t day, char *out);        // function to write a day number as "YYYY-MM-DD" (empty for DATE_NONE)
+
+#endif
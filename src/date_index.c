@@ -0,0 +1,277 @@
+/*
+This is the date_index.c file that implements the secondary index of a virus's
+records by vaccination date, which answers "vaccinated between A and B" without
+walking every record.
+
+The index is a sorted array of (day, record) entries plus a pending array that
+new records are appended to. Adding a record is one append. The first query after
+some adds sorts the pending entries and merges them into the sorted array (from
+the back, in place), and then finds the start of the window with a binary search,
+so a query costs O(log n + k) once the index is up to date. A load followed by
+queries therefore pays one sort, not one ordered insert per record.
+
+Entries with the same day are ordered by citizen ID, so a window lists records in
+the same order whether they were loaded from text or restored from a snapshot.
+
+Records added and removed one at a time by the insert, update and delete commands
+must not make every query pay for a merge of the whole array. So a query only
+merges once more than DATE_INDEX_PENDING_LIMIT entries are pending (or nothing is
+sorted yet); below that it sorts the few pending entries and walks them beside the
+sorted array. A removal marks its entry instead of moving the array, and the
+marked entries are compacted away once they are half of it or at the next merge.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include "date_index.h"
+
+// compare_entries(...) orders entries by day, then by citizen ID (a qsort(...) comparator)
+static int compare_entries(const void *a, const void *b)
+{
+   const DateEntry *x = a, *y = b;
+
+   if (x->day != y->day)
+      return (x->day > y->day) - (x->day < y->day);
+
+   return compare_nodes(x->node, y->node);
+}
+
+// implementing date_index_create(...) to create an empty date index
+DateIndex *date_index_create(void)
+{
+   DateIndex *index = calloc(1, sizeof(DateIndex));
+
+   // checking if memory was allocated successfully
+   if (index == NULL)
+   {
+      printf("Error while creating date index");
+      return NULL;
+   }
+
+   pthread_mutex_init(&index->lock, NULL);
+   return index;
+}
+
+// implementing date_index_delete(...) to release the index, the records belong to the virus's index
+void date_index_delete(DateIndex *index)
+{
+   free(index->sorted);
+   free(index->pending);
+   pthread_mutex_destroy(&index->lock);
+   free(index);
+}
+
+// implementing date_index_add(...) to add a dated record when no other thread uses the index
+int date_index_add(DateIndex *index, const Node *node)
+{
+   if (index->pending_count == index->pending_size)
+   {
+      size_t size = index->pending_size ? index->pending_size * 2 : 64;
+      DateEntry *pending = realloc(index->pending, size * sizeof(DateEntry));
+      if (pending == NULL)
+         return -1;
+
+      index->pending = pending;
+      index->pending_size = size;
+   }
+
+   index->pending[index->pending_count].day = node->day;
+   index->pending[index->pending_count].removed = 0;
+   index->pending[index->pending_count].node = node;
+   index->pending_count++;
+   index->pending_sorted = 0;
+   return 0;
+}
+
+// implementing date_index_add_concurrent(...) to add a record while queries may run
+int date_index_add_concurrent(DateIndex *index, const Node *node)
+{
+   pthread_mutex_lock(&index->lock);
+   int result = date_index_add(index, node);
+   pthread_mutex_unlock(&index->lock);
+
+   return result;
+}
+
+// find_entry(...) returns the position of the first entry of entries[] not before key
+static size_t find_entry(const DateEntry *entries, size_t count, const DateEntry *key)
+{
+   size_t low = 0, high = count;
+
+   while (low < high)
+   {
+      size_t mid = (low + high) / 2;
+      if (compare_entries(&entries[mid], key) < 0)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   return low;
+}
+
+// find_day(...) returns the position of the first entry of entries[] not before day
+static size_t find_day(const DateEntry *entries, size_t count, int32_t day)
+{
+   size_t low = 0, high = count;
+
+   while (low < high)
+   {
+      size_t mid = (low + high) / 2;
+      if (entries[mid].day < day)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   return low;
+}
+
+// compact(...) drops the entries marked removed from the sorted array, the caller holds the lock
+static void compact(DateIndex *index)
+{
+   size_t kept = 0;
+
+   for (size_t i = 0; i < index->count; i++)
+   {
+      if (!index->sorted[i].removed)
+         index->sorted[kept++] = index->sorted[i];
+   }
+
+   index->count = kept;
+   index->removed = 0;
+}
+
+// sort_pending(...) puts the pending entries in order, the caller holds the lock
+static void sort_pending(DateIndex *index)
+{
+   if (!index->pending_sorted)
+   {
+      qsort(index->pending, index->pending_count, sizeof(DateEntry), compare_entries);
+      index->pending_sorted = 1;
+   }
+}
+
+// merge_pending(...) sorts the pending entries into the sorted array, the caller holds the lock
+// on failure the pending entries stay pending and the query answers from what is sorted
+static void merge_pending(DateIndex *index)
+{
+   if (index->removed > 0)
+   {
+      compact(index);
+   }
+
+   size_t total = index->count + index->pending_count;
+   DateEntry *sorted = realloc(index->sorted, total * sizeof(DateEntry));
+
+   if (sorted == NULL)
+   {
+      return;
+   }
+
+   sort_pending(index);
+
+   // merging from the back, so no entry is overwritten before it has moved
+   size_t i = index->count, j = index->pending_count, k = total;
+   while (j > 0)
+   {
+      if (i > 0 && compare_entries(&sorted[i - 1], &index->pending[j - 1]) > 0)
+         sorted[--k] = sorted[--i];
+      else
+         sorted[--k] = index->pending[--j];
+   }
+
+   index->sorted = sorted;
+   index->count = total;
+   index->pending_count = 0;
+}
+
+// implementing date_index_remove(...) to take a record out of the index, -1 if it is not there
+int date_index_remove(DateIndex *index, const Node *node)
+{
+   DateEntry key = {node->day, 0, node};
+   int result = -1;
+
+   pthread_mutex_lock(&index->lock);
+
+   // a record of the same ID may have been removed and added again, so the node itself is matched
+   for (size_t i = find_entry(index->sorted, index->count, &key);
+        i < index->count && compare_entries(&index->sorted[i], &key) == 0; i++)
+   {
+      if (index->sorted[i].node == node && !index->sorted[i].removed)
+      {
+         index->sorted[i].removed = 1;
+         index->removed++;
+         result = 0;
+         break;
+      }
+   }
+
+   // pending entries are few, the last one takes the removed one's place
+   for (size_t i = 0; result != 0 && i < index->pending_count; i++)
+   {
+      if (index->pending[i].node == node)
+      {
+         index->pending[i] = index->pending[--index->pending_count];
+         index->pending_sorted = 0;
+         result = 0;
+      }
+   }
+
+   if (index->removed > index->count / 2)
+   {
+      compact(index);
+   }
+
+   pthread_mutex_unlock(&index->lock);
+   return result;
+}
+
+// implementing date_index_window(...) to hand every record dated from <= day <= to to
+// visit(...) in date order, returns the number of records visited
+size_t date_index_window(DateIndex *index, int32_t from, int32_t to, DateVisitor visit, void *ctx)
+{
+   size_t visited = 0;
+
+   pthread_mutex_lock(&index->lock);
+
+   if (index->pending_count > DATE_INDEX_PENDING_LIMIT || (index->pending_count > 0 && index->count == 0))
+   {
+      merge_pending(index);
+   }
+   sort_pending(index);
+
+   // walking both arrays from the first entry not before from, taking the smaller entry each time
+   size_t i = find_day(index->sorted, index->count, from);
+   size_t j = find_day(index->pending, index->pending_count, from);
+   while (1)
+   {
+      const DateEntry *entry;
+      if (j < index->pending_count &&
+          (i == index->count || compare_entries(&index->pending[j], &index->sorted[i]) < 0))
+         entry = &index->pending[j++];
+      else if (i < index->count)
+         entry = &index->sorted[i++];
+      else
+         break;
+
+      if (entry->day > to)
+         break;
+      if (entry->removed)
+         continue;
+
+      visited++;
+      if (visit(entry->node, ctx) != 0)
+         break;
+   }
+
+   pthread_mutex_unlock(&index->lock);
+   return visited;
+}
+
+// implementing date_index_memory(...) to report how many bytes the index holds
+size_t date_index_memory(DateIndex *index)
+{
+   return sizeof(DateIndex) + (index->count + index->pending_size) * sizeof(DateEntry);
+}
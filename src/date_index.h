@@ -0,0 +1,48 @@
+#ifndef DATE_INDEX_H
+#define DATE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "skip_list.h"
+
+#define DATE_INDEX_PENDING_LIMIT 4096 // pending entries a query walks beside sorted[] instead of merging them
+
+// defining one entry of the date index, the day is kept next to the record pointer
+// so a binary search never has to follow the pointer
+typedef struct
+{
+   int32_t day;
+   int32_t removed; // set by date_index_remove(...), the entry is skipped until it is compacted away
+   const Node *node;
+} DateEntry;
+
+// defining a secondary index of one virus's records by vaccination date
+typedef struct
+{
+   DateEntry *sorted;  // entries ordered by day, then citizen ID
+   size_t count;       // entries in sorted[]
+   size_t removed;     // entries of sorted[] marked removed
+   DateEntry *pending; // entries added since the last merge, in arrival order until a query sorts them
+   size_t pending_count;
+   size_t pending_size; // room in pending[]
+   int pending_sorted;  // pending[] is in order, cleared by every add
+   pthread_mutex_t lock; // taken by date_index_add_concurrent(...) and every query
+} DateIndex;
+
+// defining the callback a window query hands every record to, non-zero stops the query
+typedef int (*DateVisitor)(const Node *node, void *ctx);
+
+/*
+function prototypes
+*/
+DateIndex *date_index_create(void);                                   // function to create an empty date index
+void date_index_delete(DateIndex *index);                             // function to delete a date index (not the records)
+int date_index_add(DateIndex *index, const Node *node);               // function to add a record, 0 on success
+int date_index_add_concurrent(DateIndex *index, const Node *node);    // function to add a record while other threads query
+int date_index_remove(DateIndex *index, const Node *node);            // function to remove a record, 0 if it was there
+size_t date_index_window(DateIndex *index, int32_t from, int32_t to,
+                         DateVisitor visit, void *ctx);               // function to visit records dated in [from, to] in order
+size_t date_index_memory(DateIndex *index);                           // function to get the bytes held by the index
+
+#endif
@@ -0,0 +1,179 @@
+/*
+This is the export.c file that dumps every record of a virus to a file, as CSV for
+other tools or in a compact binary form (see export.h), for bulk copies that
+would be slow to scrape from the text output of list.
+
+The records are visited in citizen ID order by one index scan and formatted by
+hand into a large buffered writer, so a dump of millions of records costs a few
+write(...) calls. A binary export learns its record count only at the end, so
+its header is written again once everything else is out.
+*/
+
+// importing relevant libraries
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "export.h"
+#include "citizen_table.h"
+#include "date.h"
+
+// defining the state of one export
+typedef struct
+{
+   Writer out;
+   ExportFormat format;
+   uint64_t records;
+} Export;
+
+// write_csv_field(...) writes one CSV field, quoted only if it holds a comma or a quote
+static void write_csv_field(Writer *out, const char *field)
+{
+   if (strpbrk(field, ",\"") == NULL)
+   {
+      writer_puts(out, field);
+      return;
+   }
+
+   writer_putc(out, '"');
+   for (const char *p = field; *p; p++)
+   {
+      if (*p == '"')
+         writer_putc(out, '"');
+      writer_putc(out, *p);
+   }
+   writer_putc(out, '"');
+}
+
+// write_csv(...) writes one record as a CSV row
+static void write_csv(Writer *out, const Node *node)
+{
+   char date[DATE_TEXT_LEN];
+
+   write_csv_field(out, node->citizen_id);
+   writer_putc(out, ',');
+   write_csv_field(out, node->citizen->first_name);
+   writer_putc(out, ',');
+   write_csv_field(out, node->citizen->last_name);
+   writer_putc(out, ',');
+   write_csv_field(out, node->citizen->country);
+   writer_putc(out, ',');
+   writer_put_int(out, node->citizen->age);
+   writer_putc(out, ',');
+   write_csv_field(out, node->virus_name);
+   writer_putc(out, ',');
+   writer_puts(out, node->vaccinated);
+   writer_putc(out, ',');
+   date_format(node->day, date);
+   writer_puts(out, date);
+   writer_putc(out, '\n');
+}
+
+// write_binary(...) writes one record as an ExportRecord and its strings
+static void write_binary(Writer *out, const Node *node)
+{
+   const char *strings[5] = {node->citizen_id, node->citizen->first_name, node->citizen->last_name,
+                             node->citizen->country, node->virus_name};
+   size_t lengths[5];
+   ExportRecord record;
+
+   for (int i = 0; i < 5; i++)
+   {
+      lengths[i] = strlen(strings[i]);
+      if (lengths[i] > UINT16_MAX)
+         lengths[i] = UINT16_MAX;
+   }
+
+   memset(&record, 0, sizeof(record));
+   record.day = node->day;
+   record.age = node->citizen->age;
+   record.id_len = lengths[0];
+   record.first_len = lengths[1];
+   record.last_len = lengths[2];
+   record.country_len = lengths[3];
+   record.virus_len = lengths[4];
+   record.vaccinated = strcmp(node->vaccinated, "YES") == 0;
+
+   writer_put(out, (const char *)&record, sizeof(record));
+   for (int i = 0; i < 5; i++)
+      writer_put(out, strings[i], lengths[i]);
+}
+
+// export_node(...) is the scan visitor, a failed write stops the scan
+static int export_node(const Node *node, void *ctx)
+{
+   Export *export = ctx;
+
+   if (export->format == EXPORT_BINARY)
+      write_binary(&export->out, node);
+   else
+      write_csv(&export->out, node);
+
+   export->records++;
+   return export->out.failed;
+}
+
+// implementing export_parse_format(...) to read a format name given by the user
+int export_parse_format(const char *name, ExportFormat *format)
+{
+   if (strcmp(name, "csv") == 0)
+      *format = EXPORT_CSV;
+   else if (strcmp(name, "binary") == 0)
+      *format = EXPORT_BINARY;
+   else
+      return -1;
+   return 0;
+}
+
+// implementing export_format_name(...) to print a format
+const char *export_format_name(ExportFormat format)
+{
+   return format == EXPORT_BINARY ? "binary" : "csv";
+}
+
+// implementing export_records(...) to write every record of index to path, replacing the file
+int export_records(Index *index, const char *path, ExportFormat format, uint64_t *records)
+{
+   Export export;
+   ExportHeader header;
+   int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+   if (fd < 0)
+   {
+      return -1;
+   }
+
+   if (writer_init(&export.out, fd, WRITER_DEFAULT_SIZE) != 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   export.format = format;
+   export.records = 0;
+
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, EXPORT_MAGIC, sizeof(header.magic));
+   header.version = EXPORT_VERSION;
+
+   if (format == EXPORT_BINARY)
+      writer_put(&export.out, (const char *)&header, sizeof(header));
+   else
+      writer_puts(&export.out, "citizen_id,first_name,last_name,country,age,virus,vaccinated,date\n");
+
+   index_scan(index, NULL, NULL, export_node, &export);
+   writer_close(&export.out);
+
+   // the record count is known now, so the header is written again with it
+   int result = export.out.failed ? -1 : 0;
+   header.records = export.records;
+   if (result == 0 && format == EXPORT_BINARY &&
+       pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+      result = -1;
+
+   if (close(fd) != 0)
+      result = -1;
+
+   *records = export.records;
+   return result;
+}
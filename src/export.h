@@ -0,0 +1,61 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "index.h"
+#include "writer.h"
+
+#define EXPORT_MAGIC "VACEXP1" // the first 8 bytes of a binary export (with the NUL)
+#define EXPORT_VERSION 1       // bumped whenever the layout below changes
+
+/*
+Binary layout, integers in the byte order of the machine that wrote the file:
+
+   ExportHeader
+   for every record in citizen ID order: ExportRecord, then the ID, first name,
+   last name, country and virus name back to back (lengths in the record, no NULs)
+
+The CSV export has a header row and one row per record, with the columns of the
+text output (the date is empty for a record without one).
+*/
+
+// defining the formats a virus can be exported in
+typedef enum
+{
+   EXPORT_CSV = 0,
+   EXPORT_BINARY = 1
+} ExportFormat;
+
+// defining the fixed-size header of a binary export
+typedef struct
+{
+   char magic[8];     // EXPORT_MAGIC
+   uint32_t version;  // EXPORT_VERSION
+   uint32_t reserved; // zero
+   uint64_t records;  // records that follow
+} ExportHeader;
+
+// defining the fixed part of one record of a binary export
+typedef struct
+{
+   int32_t day;          // days since 1970-01-01, DATE_NONE without a date
+   int32_t age;
+   uint16_t id_len;
+   uint16_t first_len;
+   uint16_t last_len;
+   uint16_t country_len;
+   uint16_t virus_len;
+   uint8_t vaccinated;   // 1 for YES
+   uint8_t reserved;     // zero
+} ExportRecord;
+
+/*
+function prototypes
+*/
+int export_parse_format(const char *name, ExportFormat *format);     // function to read csv|binary, 0 on success
+const char *export_format_name(ExportFormat format);                  // function to get the name of a format
+int export_records(Index *index, const char *path, ExportFormat format,
+                   uint64_t *records);                                // function to write every record of an index to a file, 0 on success
+
+#endif
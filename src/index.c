@@ -0,0 +1,175 @@
+/*
+This is the index.c file that puts the skip list and the B+-tree behind one
+interface, so the rest of the program does not care which one holds a virus's
+records. Every function only dispatches on the backend.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "index.h"
+
+// implementing index_create(...) to create an empty index of the given backend
+Index *index_create(IndexKind kind, uint64_t seed)
+{
+   Index *index = malloc(sizeof(Index));
+
+   // checking if memory was allocated successfully
+   if (index == NULL)
+   {
+      printf("Error while creating index");
+      return NULL;
+   }
+
+   index->kind = kind;
+   void *backend;
+   if (kind == INDEX_BPTREE)
+      backend = index->tree = bptree_create();
+   else
+      backend = index->list = list_create(seed);
+
+   if (backend == NULL)
+   {
+      free(index);
+      return NULL;
+   }
+
+   return index;
+}
+
+// implementing index_delete(...) to delete an index and its records
+void index_delete(Index *index)
+{
+   if (index->kind == INDEX_BPTREE)
+      bptree_delete(index->tree);
+   else
+      list_delete(index->list);
+   free(index);
+}
+
+// implementing index_insert(...) to add a record when no other thread uses the index
+Node *index_insert(Index *index, const Record *record)
+{
+   return index->kind == INDEX_BPTREE ? bptree_insert(index->tree, record) : list_insert(index->list, record);
+}
+
+// implementing index_insert_concurrent(...) to add a record while others insert or search
+Node *index_insert_concurrent(Index *index, const Record *record)
+{
+   return index->kind == INDEX_BPTREE ? bptree_insert_concurrent(index->tree, record)
+                                      : list_insert_concurrent(index->list, record);
+}
+
+// implementing index_append(...) to add a record whose ID is larger than every stored ID
+Node *index_append(Index *index, const Node *record)
+{
+   return index->kind == INDEX_BPTREE ? bptree_append(index->tree, record) : list_append(index->list, record);
+}
+
+// implementing index_remove(...) to take the record of a citizen ID out, returns it or NULL
+// the record's memory stays with the index, so the returned node can still be read
+Node *index_remove(Index *index, const char *citizen_id)
+{
+   return index->kind == INDEX_BPTREE ? bptree_remove(index->tree, citizen_id) : list_remove(index->list, citizen_id);
+}
+
+// implementing index_search(...) to find the record of a citizen ID
+Node *index_search(Index *index, const char *citizen_id)
+{
+   return index->kind == INDEX_BPTREE ? bptree_search(index->tree, citizen_id) : list_search(index->list, citizen_id);
+}
+
+// implementing index_search_batch(...) to answer many searches at once
+void index_search_batch(Index *index, const Field *keys, size_t count, Node **results)
+{
+   if (index->kind == INDEX_BPTREE)
+      bptree_search_batch(index->tree, keys, count, results);
+   else
+      list_search_batch(index->list, keys, count, results);
+}
+
+// implementing index_scan(...) to hand every record with from <= ID <= to to visit(...)
+// in ID order, returns the number of records visited
+size_t index_scan(Index *index, const char *from, const char *to, IndexVisitor visit, void *ctx)
+{
+   if (index->kind == INDEX_BPTREE)
+   {
+      return bptree_scan(index->tree, from, to, visit, ctx);
+   }
+
+   // the skip list is walked on its base level, which is safe during concurrent inserts
+   SkipList *list = index->list;
+   size_t to_len = to ? strlen(to) : 0;
+   uint64_t to_key = to && list->packed_keys ? list_pack_key(to, to_len) : LIST_NO_KEY;
+   size_t visited = 0;
+
+   for (Node *node = from ? list_seek(list, from) : list_first(list); node != NULL; node = list_next(node))
+   {
+      if (to != NULL && compare_node(node, to_key, to, to_len) > 0)
+         break;
+
+      visited++;
+      if (visit(node, ctx) != 0)
+         break;
+   }
+
+   return visited;
+}
+
+// implementing index_count(...) to get the number of records stored
+size_t index_count(Index *index)
+{
+   return index->kind == INDEX_BPTREE ? __atomic_load_n(&index->tree->count, __ATOMIC_RELAXED)
+                                      : __atomic_load_n(&index->list->count, __ATOMIC_RELAXED);
+}
+
+// implementing index_memory(...) to report how many bytes the index has reserved
+size_t index_memory(Index *index)
+{
+   return sizeof(Index) + (index->kind == INDEX_BPTREE ? bptree_memory(index->tree) : list_memory(index->list));
+}
+
+// implementing index_stats(...) to read the shape and search counters of an index
+void index_stats(Index *index, IndexStats *stats)
+{
+   stats->records = index_count(index);
+
+   if (index->kind == INDEX_BPTREE)
+   {
+      BPTree *tree = index->tree;
+      pthread_rwlock_rdlock(&tree->lock);
+      stats->height = stats->max_height = tree->height;
+      pthread_rwlock_unlock(&tree->lock);
+      stats->searches = __atomic_load_n(&tree->searches, __ATOMIC_RELAXED);
+      stats->search_steps = __atomic_load_n(&tree->search_steps, __ATOMIC_RELAXED);
+      stats->search_levels = __atomic_load_n(&tree->search_levels, __ATOMIC_RELAXED);
+   }
+   else
+   {
+      SkipList *list = index->list;
+      stats->height = __atomic_load_n(&list->level, __ATOMIC_RELAXED) + 1;
+      stats->max_height = __atomic_load_n(&list->max_level, __ATOMIC_RELAXED) + 1;
+      stats->searches = __atomic_load_n(&list->searches, __ATOMIC_RELAXED);
+      stats->search_steps = __atomic_load_n(&list->search_steps, __ATOMIC_RELAXED);
+      stats->search_levels = __atomic_load_n(&list->search_levels, __ATOMIC_RELAXED);
+   }
+}
+
+// implementing index_kind_name(...) to print a backend
+const char *index_kind_name(IndexKind kind)
+{
+   return kind == INDEX_BPTREE ? "bptree" : "skiplist";
+}
+
+// implementing index_parse_kind(...) to read a backend name given by the user
+int index_parse_kind(const char *name, IndexKind *kind)
+{
+   if (strcmp(name, "skiplist") == 0)
+      *kind = INDEX_SKIP_LIST;
+   else if (strcmp(name, "bptree") == 0)
+      *kind = INDEX_BPTREE;
+   else
+      return -1;
+   return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "record.h"
+#include "skip_list.h"
+#include "bptree.h"
+
+// defining the ordered structures a virus's records can be kept in
+typedef enum
+{
+   INDEX_SKIP_LIST, // SkipList, lock-free searches during concurrent inserts
+   INDEX_BPTREE     // BPTree, wide cache-line-aligned nodes and contiguous leaves
+} IndexKind;
+
+// defining an index, one of the backends behind a common set of functions
+typedef struct
+{
+   IndexKind kind;
+   union
+   {
+      SkipList *list; // INDEX_SKIP_LIST
+      BPTree *tree;   // INDEX_BPTREE
+   };
+} Index;
+
+// defining the shape and search cost of an index, for the stats command
+typedef struct
+{
+   size_t records;
+   int height;            // skip-list levels in use, or tree levels
+   int max_height;        // the level cap of a skip list, the height of a tree
+   uint64_t searches;     // searches run so far
+   uint64_t search_steps; // keys those searches compared against
+   uint64_t search_levels; // levels those searches went down
+} IndexStats;
+
+// defining the callback a scan hands every record to, non-zero stops the scan
+typedef int (*IndexVisitor)(const Node *node, void *ctx);
+
+/*
+function prototypes
+*/
+Index *index_create(IndexKind kind, uint64_t seed);                   // function to create an empty index (seed is for skip lists)
+void index_delete(Index *index);                                      // function to delete an index and its records
+Node *index_insert(Index *index, const Record *record);               // function to insert a record, NULL for a duplicate ID
+Node *index_insert_concurrent(Index *index, const Record *record);    // function to insert while other threads use the index
+Node *index_append(Index *index, const Node *record);                 // function to add a record with the largest ID
+Node *index_remove(Index *index, const char *citizen_id);             // function to take a record out, returns it
+Node *index_search(Index *index, const char *citizen_id);             // function to find a record by ID
+void index_search_batch(Index *index, const Field *keys,
+                        size_t count, Node **results);                // function to search many keys at once
+size_t index_scan(Index *index, const char *from, const char *to,
+                  IndexVisitor visit, void *ctx);                     // function to visit IDs in [from, to] in order (NULL is open)
+size_t index_count(Index *index);                                     // function to get the number of records
+size_t index_memory(Index *index);                                    // function to get the bytes reserved by the index
+void index_stats(Index *index, IndexStats *stats);                    // function to get the shape and search cost
+const char *index_kind_name(IndexKind kind);                          // function to get the printable name of a backend
+int index_parse_kind(const char *name, IndexKind *kind);              // function to parse "skiplist"/"bptree", 0 on success
+
+#endif
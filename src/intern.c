@@ -0,0 +1,211 @@
+/*
+This is the intern.c file that implements a shared dictionary for the
+low-cardinality fields of our records (country, virus name, vaccination status).
+Every distinct string is stored once and all records point at that copy, so
+millions of records from a handful of countries cost a handful of strings.
+
+Several loader threads intern strings at the same time. Looking up a string that
+is already stored takes no lock: the table is only ever replaced (never changed
+in place) when it grows, and the old tables are kept until intern_clear(), so a
+reader holding an old table can still probe it safely. Adding a new string takes
+a mutex, but that only happens once per distinct string.
+
+Every string also gets a small id, its position in order of first appearance, kept
+in the 4 bytes right before its characters. Counters kept per country can then sit
+in a plain array indexed by that id instead of in a second hash table.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "intern.h"
+#include "arena.h"
+
+#define INTERN_INITIAL_SLOTS 64 // the table starts with this many slots (a power of two)
+
+// defining one generation of the open-addressing table
+typedef struct InternTable
+{
+   struct InternTable *older; // the table this one replaced, freed by intern_clear()
+   size_t slot_count;         // number of slots (a power of two)
+   const char *slots[];       // the interned strings, NULL for an empty slot
+} InternTable;
+
+static InternTable *table = NULL; // the current table, read without the lock
+static size_t string_count = 0;   // number of strings stored
+static Arena strings;             // arena holding the characters of every string
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER; // serializes additions
+
+// hash_string(...) is the 64-bit FNV-1a hash, plenty for short strings
+static uint64_t hash_string(const char *str, size_t len)
+{
+   uint64_t hash = 0xcbf29ce484222325ULL;
+
+   for (size_t i = 0; i < len; i++)
+   {
+      hash ^= (unsigned char)str[i];
+      hash *= 0x100000001b3ULL;
+   }
+
+   return hash;
+}
+
+// find_slot(...) returns the slot holding str, or the empty slot where it belongs
+// the entry seen in that slot (NULL if it was empty) is stored in *entry_out
+static size_t find_slot(InternTable *current, const char *str, size_t len, const char **entry_out)
+{
+   size_t mask = current->slot_count - 1;
+   size_t i = hash_string(str, len) & mask;
+   const char *entry;
+
+   // linear probing until we hit the string or an empty slot
+   while ((entry = __atomic_load_n(&current->slots[i], __ATOMIC_ACQUIRE)) != NULL &&
+          !(strncmp(entry, str, len) == 0 && entry[len] == '\0'))
+   {
+      i = (i + 1) & mask;
+   }
+
+   *entry_out = entry;
+   return i;
+}
+
+// grow(...) builds a table twice the size and publishes it (called with the lock held)
+static int grow(void)
+{
+   size_t new_count = table ? table->slot_count * 2 : INTERN_INITIAL_SLOTS;
+   InternTable *bigger = calloc(1, sizeof(InternTable) + new_count * sizeof(char *));
+
+   // checking if memory was allocated successfully
+   if (bigger == NULL)
+   {
+      printf("Error while allocating memory");
+      return -1;
+   }
+
+   bigger->slot_count = new_count;
+   bigger->older = table;
+   const char *entry;
+
+   if (table != NULL)
+   {
+      for (size_t i = 0; i < table->slot_count; i++)
+      {
+         if (table->slots[i] != NULL)
+            bigger->slots[find_slot(bigger, table->slots[i], strlen(table->slots[i]), &entry)] = table->slots[i];
+      }
+   }
+   else
+   {
+      // the arena is set up the first time the table is created
+      arena_init(&strings);
+   }
+
+   __atomic_store_n(&table, bigger, __ATOMIC_RELEASE);
+   return 0;
+}
+
+// implementing intern(...) to return the shared copy of the first len characters of str
+const char *intern(const char *str, size_t len)
+{
+   // the lock-free path: the string is usually already there
+   InternTable *current = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+   const char *result;
+   if (current != NULL)
+   {
+      find_slot(current, str, len, &result);
+      if (result != NULL)
+         return result;
+   }
+
+   pthread_mutex_lock(&intern_lock);
+
+   // keeping the table at most half full so probe sequences stay short
+   if ((table == NULL || (string_count + 1) * 2 > table->slot_count) && grow() != 0)
+   {
+      pthread_mutex_unlock(&intern_lock);
+      return NULL;
+   }
+
+   // probing again, another thread may have added the string in the meantime
+   size_t i = find_slot(table, str, len, &result);
+
+   // first time we see this string, so we store it
+   if (result == NULL)
+   {
+      char *copy = arena_alloc(&strings, sizeof(uint32_t) + len + 1, sizeof(uint32_t));
+      if (copy == NULL)
+      {
+         pthread_mutex_unlock(&intern_lock);
+         return NULL;
+      }
+
+      uint32_t id = string_count;
+      memcpy(copy, &id, sizeof(id));
+      memcpy(copy + sizeof(id), str, len);
+      copy[sizeof(id) + len] = '\0';
+      result = copy + sizeof(id);
+      __atomic_store_n(&table->slots[i], result, __ATOMIC_RELEASE);
+      string_count++;
+   }
+
+   pthread_mutex_unlock(&intern_lock);
+   return result;
+}
+
+// implementing intern_find(...) to look a string up without adding it, NULL if it was never interned
+const char *intern_find(const char *str, size_t len)
+{
+   InternTable *current = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+   const char *result = NULL;
+
+   if (current != NULL)
+      find_slot(current, str, len, &result);
+
+   return result;
+}
+
+// implementing intern_id(...) to read the id stored in front of an interned string
+uint32_t intern_id(const char *interned)
+{
+   uint32_t id;
+   memcpy(&id, interned - sizeof(id), sizeof(id));
+   return id;
+}
+
+// implementing intern_memory(...) to report what the dictionary costs
+size_t intern_memory(void)
+{
+   size_t bytes = 0;
+
+   pthread_mutex_lock(&intern_lock);
+   for (InternTable *t = table; t != NULL; t = t->older)
+   {
+      bytes += sizeof(InternTable) + t->slot_count * sizeof(char *);
+   }
+   if (table != NULL)
+      bytes += strings.bytes_reserved;
+   pthread_mutex_unlock(&intern_lock);
+
+   return bytes;
+}
+
+// implementing intern_clear(...) to release every table and every string at once
+// no other thread may be interning while this runs
+void intern_clear(void)
+{
+   if (table == NULL)
+      return;
+
+   while (table != NULL)
+   {
+      InternTable *older = table->older;
+      free(table);
+      table = older;
+   }
+
+   arena_free(&strings);
+   string_count = 0;
+}
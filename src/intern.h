@@ -0,0 +1,16 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+function prototypes
+*/
+const char *intern(const char *str, size_t len);      // function to get the one shared copy of a string
+const char *intern_find(const char *str, size_t len); // function to get the shared copy only if it exists
+uint32_t intern_id(const char *interned);             // function to get the dense id of an interned string
+size_t intern_memory(void);                           // function to get the bytes held by the dictionary
+void intern_clear(void);                              // function to release every interned string
+
+#endif
@@ -0,0 +1,1247 @@
+/*
+This is the loader.c file that reads vaccination records from an input file and
+hands every parsed record to a callback.
+
+Two loaders are provided:
+   - load_stream(...) reads the file line by line with getline(...), so lines of
+     any length are handled, and works for any readable file
+   - load_mapped(...) maps the whole file into memory with mmap(...), finds line
+     ends with memchr(...) (which glibc vectorizes) and hands the handler field
+     slices that point straight into the mapping, without copying a byte
+
+load_parallel(...) maps the file too, but splits it into chunks at line
+boundaries and works in two phases:
+   1. parse threads tokenize the chunks and append every parsed record (its field
+      slices into the mapping) to a per-chunk queue of the index (virus) the record
+      is routed to; a chunk only creates new viruses once every chunk before it is
+      known to be valid, other records of an unknown virus wait until the end of
+      the phase, so a virus that only appears after an invalid line is never created
+   2. inserter threads each take whole indexes and insert their queued records,
+      chunk by chunk, so no index is ever touched by two threads and records reach
+      it in file order (the first copy of a duplicate ID still wins); this phase can
+      therefore use at most as many threads as there are viruses
+
+load_pipelined(...) overlaps reading with parsing: a reader thread fills a ring of
+LOAD_RING_BUFFERS large buffers, each cut after its last newline (the partial line
+starts the next buffer), while the calling thread parses the full ones with the
+same per-line step as the other loaders, so parsing makes no system calls. It also
+reads compressed input, which it tells apart by its first bytes: gzip is inflated
+with zlib on the reader thread, and zstd (libzstd is not a dependency of this
+build) is decompressed by a zstd -dc child process writing into a pipe.
+Either way decompression runs beside the parser rather than before it.
+
+All loaders share parse_record(...), a hand-written tokenizer that never reads past the
+end of the line it is given, so long or malformed fields cannot overflow anything.
+
+Every loader stops at the first line it cannot parse or whose date is not a real
+YYYY-MM-DD day (parse_load_record(...)), since a record keeps its date as a day
+number and would lose it otherwise. Given a reject log (-x), each line is also
+checked for a YES/NO status while it is parsed (validate_record(...)), and a line
+failing any check is written to the log and skipped. The parallel loader keeps the skipped lines of a chunk and writes
+them once the line number the chunk starts at is known.
+*/
+
+// importing relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <spawn.h>
+#include <errno.h>
+#include <pthread.h>
+#include "loader.h"
+#include "date.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+extern char **environ; // handed to the zstd child process
+
+#define CHUNKS_PER_THREAD 4 // more chunks than threads keeps fast threads busy
+
+// now_seconds(...) reads a monotonic clock in seconds
+static double now_seconds(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// is_space(...) matches the characters sscanf's %s treats as separators
+static inline int is_space(char c)
+{
+   return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// next_field(...) stores the next whitespace-separated field of [p, end) and
+// returns the position right after it (field->len is 0 when the line is used up)
+static inline const char *next_field(const char *p, const char *end, Field *field)
+{
+   while (p < end && is_space(*p))
+   {
+      p++;
+   }
+
+   field->str = p;
+
+   while (p < end && !is_space(*p))
+   {
+      p++;
+   }
+
+   field->len = p - field->str;
+   return p;
+}
+
+// parse_age(...) converts a field of decimal digits (with an optional sign) to an int
+static int parse_age(const Field *field, int *age)
+{
+   size_t i = 0;
+   int negative = 0;
+   int value = 0;
+
+   if (field->len > 0 && (field->str[0] == '-' || field->str[0] == '+'))
+   {
+      negative = field->str[0] == '-';
+      i = 1;
+   }
+
+   // rejecting empty numbers and anything too long to be an age
+   if (i == field->len || field->len - i > 9)
+   {
+      return -1;
+   }
+
+   for (; i < field->len; i++)
+   {
+      if (field->str[i] < '0' || field->str[i] > '9')
+         return -1;
+      value = value * 10 + (field->str[i] - '0');
+   }
+
+   *age = negative ? -value : value;
+   return 0;
+}
+
+// implementing parse_record(...) to split the line [line, end) into a record
+// a record needs at least 7 fields, the 8th (date) is optional and extra fields are ignored
+int parse_record(const char *line, const char *end, Record *record)
+{
+   Field age;
+
+   line = next_field(line, end, &record->citizen_id);
+   line = next_field(line, end, &record->first_name);
+   line = next_field(line, end, &record->last_name);
+   line = next_field(line, end, &record->country);
+   line = next_field(line, end, &age);
+   line = next_field(line, end, &record->virus_name);
+   line = next_field(line, end, &record->vaccinated);
+   line = next_field(line, end, &record->date);
+   record->citizen = NULL;
+   record->text.str = record->citizen_id.str;
+   record->text.len = line - record->citizen_id.str;
+   record->line = 0;
+
+   // the 7th field is only empty when the line had fewer than 7 fields
+   if (record->vaccinated.len == 0 || parse_age(&age, &record->age) != 0)
+   {
+      return -1;
+   }
+
+   return 0;
+}
+
+// date_valid(...) checks that a record has no date or one that parses
+static int date_valid(const Record *record)
+{
+   return record->date.len == 0 || date_parse(record->date.str, record->date.len) != DATE_NONE;
+}
+
+// parse_load_record(...) parses a line for a load without a reject log, where a date that does
+// not parse makes the line invalid like a missing field would
+static int parse_load_record(const char *line, const char *end, Record *record)
+{
+   if (parse_record(line, end, record) != 0 || !date_valid(record))
+   {
+      return -1;
+   }
+
+   return 0;
+}
+
+// implementing validate_record(...) to parse a line like parse_record(...) and also check what
+// the loaders otherwise take as it comes: a status other than YES or NO, or a date that does
+// not parse; *kind tells why a line is invalid
+int validate_record(const char *line, const char *end, Record *record, RejectKind *kind)
+{
+   if (parse_record(line, end, record) != 0)
+   {
+      *kind = record->vaccinated.len == 0 ? REJECT_FIELDS : REJECT_AGE;
+      return -1;
+   }
+
+   if (!field_equals(&record->vaccinated, "YES") && !field_equals(&record->vaccinated, "NO"))
+   {
+      *kind = REJECT_STATUS;
+      return -1;
+   }
+
+   if (!date_valid(record))
+   {
+      *kind = REJECT_DATE;
+      return -1;
+   }
+
+   return 0;
+}
+
+// is_blank(...) checks whether a line only holds whitespace
+static int is_blank(const char *p, const char *end)
+{
+   while (p < end && is_space(*p))
+   {
+      p++;
+   }
+   return p == end;
+}
+
+// handle_line(...) is the per-line step shared by the single-threaded loaders
+// returns LOAD_OK to keep going, LOAD_INVALID for an invalid record, or the handler's result
+// (with a reject log, an invalid record is logged and the load goes on)
+static int handle_line(const char *line, const char *end, RecordHandler handler,
+                       void *ctx, RejectLog *rejects, LoadStats *stats)
+{
+   Record record;
+   RejectKind kind;
+
+   stats->lines++;
+
+   // blank lines carry no record, so they are skipped
+   if (is_blank(line, end))
+   {
+      return LOAD_OK;
+   }
+
+   if (rejects != NULL)
+   {
+      if (validate_record(line, end, &record, &kind) != 0)
+      {
+         reject_add(rejects, kind, stats->lines, line, end - line);
+         return LOAD_OK;
+      }
+   }
+   else if (parse_load_record(line, end, &record) != 0)
+   {
+      stats->bad_line = stats->lines;
+      return LOAD_INVALID;
+   }
+
+   record.line = stats->lines;
+   stats->records++;
+   return handler(&record, ctx);
+}
+
+// implementing load_stream(...) to read the file one line at a time
+// returns LOAD_OK when the whole file was loaded, LOAD_ERROR when it could not be opened,
+// LOAD_INVALID when it stopped at an invalid record, or LOAD_STOPPED from the handler
+int load_stream(const char *filename, RecordHandler handler, void *ctx, RejectLog *rejects, LoadStats *stats)
+{
+   memset(stats, 0, sizeof(LoadStats));
+
+   FILE *file = fopen(filename, "r");
+
+   // if file was not opened successfully
+   if (!file)
+   {
+      return LOAD_ERROR;
+   }
+
+   double start = now_seconds();
+   char *line = NULL; // getline(...) grows this buffer as long lines come in
+   size_t capacity = 0;
+   ssize_t length;
+   int result = LOAD_OK;
+
+   while (result == LOAD_OK && (length = getline(&line, &capacity, file)) != -1)
+   {
+      stats->bytes += length;
+
+      // dropping the newline so it does not end up in the last field
+      if (length > 0 && line[length - 1] == '\n')
+         length--;
+
+      result = handle_line(line, line + length, handler, ctx, rejects, stats);
+   }
+
+   free(line);
+   fclose(file); // close file
+   stats->seconds = now_seconds() - start;
+   return result;
+}
+
+// map_file(...) opens and maps a whole file read-only, *size is set to its length
+// returns NULL (with *size 0) for an empty file and MAP_FAILED on errors
+static const char *map_file(const char *filename, size_t *size)
+{
+   int fd = open(filename, O_RDONLY);
+   struct stat info;
+   const char *data = NULL;
+
+   *size = 0;
+
+   if (fd < 0)
+   {
+      return MAP_FAILED;
+   }
+
+   if (fstat(fd, &info) != 0)
+   {
+      close(fd);
+      return MAP_FAILED;
+   }
+
+   if (info.st_size > 0)
+   {
+      data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      *size = info.st_size;
+   }
+
+   close(fd); // the mapping stays valid after the descriptor is closed
+   return data;
+}
+
+// implementing load_mapped(...) to load the file straight out of a memory mapping
+// returns the same codes as load_stream(...)
+int load_mapped(const char *filename, RecordHandler handler, void *ctx, RejectLog *rejects, LoadStats *stats)
+{
+   memset(stats, 0, sizeof(LoadStats));
+
+   size_t size;
+   double start = now_seconds();
+   const char *data = map_file(filename, &size);
+   int result = LOAD_OK;
+
+   // if file was not opened successfully
+   if (data == MAP_FAILED)
+   {
+      return LOAD_ERROR;
+   }
+
+   // an empty file is not mapped but is trivially loaded
+   if (data != NULL)
+   {
+      // telling the kernel we read front to back so it reads ahead aggressively
+      madvise((void *)data, size, MADV_SEQUENTIAL);
+
+      const char *p = data;
+      const char *end = data + size;
+
+      while (result == LOAD_OK && p < end)
+      {
+         const char *newline = memchr(p, '\n', end - p);
+         const char *line_end = newline ? newline : end; // the last line may lack a newline
+
+         result = handle_line(p, line_end, handler, ctx, rejects, stats);
+         p = newline ? newline + 1 : end;
+      }
+
+      stats->bytes = p - data;
+      munmap((void *)data, size);
+   }
+
+   stats->seconds = now_seconds() - start;
+   return result;
+}
+
+// defining where the reader thread of load_pipelined(...) gets its bytes from
+typedef struct
+{
+   InputEncoding encoding;
+   int fd;        // the file, or the read end of the pipe from zstd
+   pid_t child;   // the zstd process, 0 for none
+#ifdef HAVE_ZLIB
+   gzFile gz;     // the file through zlib, for gzip input
+#endif
+} Source;
+
+// defining one buffer of the ring
+typedef struct
+{
+   char *data;
+   size_t len;  // bytes up to and including the last whole line
+   size_t size; // room in data
+   int full;    // set by the reader, cleared by the parser once it is done with the buffer
+} RingBuffer;
+
+// defining the state the reader thread and the parser share
+typedef struct
+{
+   Source source;
+   RingBuffer buffers[LOAD_RING_BUFFERS];
+   pthread_mutex_t lock;
+   pthread_cond_t filled;   // signalled when a buffer becomes full or the reader is done
+   pthread_cond_t emptied;  // signalled when a buffer is handed back or the parser stops
+   int done;                // set by the reader after its last buffer
+   int failed;              // set by the reader when reading or decompressing failed
+   int stop;                // set by the parser when the load ends early
+} Ring;
+
+// implementing load_encoding(...) to look at the magic bytes at the start of a file
+InputEncoding load_encoding(const char *filename)
+{
+   unsigned char magic[4] = {0};
+   int fd = open(filename, O_RDONLY);
+
+   if (fd < 0)
+      return INPUT_PLAIN;
+
+   ssize_t got = read(fd, magic, sizeof(magic));
+   close(fd);
+
+   if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+      return INPUT_GZIP;
+   if (got == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+      return INPUT_ZSTD;
+   return INPUT_PLAIN;
+}
+
+// implementing load_encoding_name(...) to print an encoding
+const char *load_encoding_name(InputEncoding encoding)
+{
+   return encoding == INPUT_GZIP ? "gzip" : encoding == INPUT_ZSTD ? "zstd" : "plain";
+}
+
+// open_source(...) opens a file for the reader thread, starting zstd for zstd input
+// *size is set to the bytes of the file itself
+static int open_source(Source *source, const char *filename, uint64_t *size)
+{
+   struct stat info;
+
+   memset(source, 0, sizeof(Source));
+   source->encoding = load_encoding(filename);
+   source->fd = open(filename, O_RDONLY);
+
+   if (source->fd < 0)
+      return -1;
+
+   *size = fstat(source->fd, &info) == 0 ? info.st_size : 0;
+
+   if (source->encoding == INPUT_PLAIN)
+   {
+      // telling the kernel we read front to back so it reads ahead aggressively
+      posix_fadvise(source->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      return 0;
+   }
+
+   if (source->encoding == INPUT_GZIP)
+   {
+#ifdef HAVE_ZLIB
+      posix_fadvise(source->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      source->gz = gzdopen(source->fd, "rb");
+      if (source->gz == NULL)
+      {
+         close(source->fd);
+         return -1;
+      }
+      gzbuffer(source->gz, 1 << 20);
+      return 0;
+#else
+      printf("This build reads no gzip input (rebuild with GZIP=1)\n");
+      close(source->fd);
+      return -1;
+#endif
+   }
+
+   // zstd: the child reads the file itself and writes the records into a pipe
+   int pipe_fds[2];
+   posix_spawn_file_actions_t actions;
+   posix_spawnattr_t attributes;
+   sigset_t no_signals;
+   char *argv[] = {"zstd", "-dcq", "--", (char *)filename, NULL};
+
+   close(source->fd);
+   source->fd = -1;
+   if (pipe(pipe_fds) != 0)
+      return -1;
+
+   posix_spawn_file_actions_init(&actions);
+   posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+   posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
+   posix_spawn_file_actions_addclose(&actions, pipe_fds[1]);
+
+   // the server mode blocks SIGINT and SIGTERM in every thread, the child gets them back
+   sigemptyset(&no_signals);
+   posix_spawnattr_init(&attributes);
+   posix_spawnattr_setsigmask(&attributes, &no_signals);
+   posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+   int spawned = posix_spawnp(&source->child, "zstd", &actions, &attributes, argv, environ);
+   posix_spawn_file_actions_destroy(&actions);
+   posix_spawnattr_destroy(&attributes);
+   close(pipe_fds[1]);
+
+   if (spawned != 0)
+   {
+      printf("Error while starting zstd to read %s\n", filename);
+      close(pipe_fds[0]);
+      source->child = 0;
+      return -1;
+   }
+
+   source->fd = pipe_fds[0];
+   return 0;
+}
+
+// read_source(...) reads up to size decompressed bytes, 0 at the end, -1 on errors
+static ssize_t read_source(Source *source, char *buffer, size_t size)
+{
+#ifdef HAVE_ZLIB
+   if (source->gz != NULL)
+   {
+      int got = gzread(source->gz, buffer, size > INT32_MAX ? INT32_MAX : size);
+      return got < 0 ? -1 : got;
+   }
+#endif
+
+   while (1)
+   {
+      ssize_t got = read(source->fd, buffer, size);
+      if (got >= 0 || errno != EINTR)
+         return got;
+   }
+}
+
+// close_source(...) closes the input; returns -1 if zstd failed or was cut off by stopped
+static int close_source(Source *source, int stopped)
+{
+   int result = 0;
+
+#ifdef HAVE_ZLIB
+   if (source->gz != NULL)
+   {
+      gzclose(source->gz); // closes the descriptor too
+      return 0;
+   }
+#endif
+
+   if (source->fd >= 0)
+      close(source->fd);
+
+   if (source->child > 0)
+   {
+      int status;
+      if (stopped)
+         kill(source->child, SIGTERM);
+      if (waitpid(source->child, &status, 0) < 0 || (!stopped && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)))
+         result = -1;
+   }
+
+   return result;
+}
+
+// last_newline(...) finds the last newline of a buffer, NULL for none
+static const char *last_newline(const char *data, size_t len)
+{
+   while (len > 0)
+      if (data[--len] == '\n')
+         return data + len;
+   return NULL;
+}
+
+// read_ahead(...) is the reader thread: it fills every free buffer in turn and cuts it after
+// its last newline, carrying the partial line over to the start of the next buffer
+static void *read_ahead(void *arg)
+{
+   Ring *ring = arg;
+   RingBuffer *previous = NULL;
+   size_t carry = 0; // bytes of previous past its len, the start of the next line
+
+   for (int i = 0;; i = (i + 1) % LOAD_RING_BUFFERS)
+   {
+      RingBuffer *buffer = &ring->buffers[i];
+
+      pthread_mutex_lock(&ring->lock);
+      while (buffer->full && !ring->stop)
+         pthread_cond_wait(&ring->emptied, &ring->lock);
+      int stop = ring->stop;
+      pthread_mutex_unlock(&ring->lock);
+
+      if (stop)
+         break;
+
+      // the parser only reads previous up to its len, so its tail is still ours to copy
+      if (carry > buffer->size)
+      {
+         char *data = realloc(buffer->data, carry * 2);
+         if (data == NULL)
+         {
+            ring->failed = 1;
+            break;
+         }
+         buffer->data = data;
+         buffer->size = carry * 2;
+      }
+      if (carry > 0)
+         memcpy(buffer->data, previous->data + previous->len, carry);
+
+      size_t len = carry;
+      int end = 0;
+      while (1)
+      {
+         while (len < buffer->size)
+         {
+            ssize_t got = read_source(&ring->source, buffer->data + len, buffer->size - len);
+            if (got <= 0)
+            {
+               ring->failed = got < 0;
+               end = 1;
+               break;
+            }
+            len += got;
+         }
+
+         // a buffer without a newline holds part of one long line, so it grows
+         if (end || last_newline(buffer->data, len) != NULL)
+            break;
+         char *data = realloc(buffer->data, buffer->size * 2);
+         if (data == NULL)
+         {
+            ring->failed = 1;
+            end = 1;
+            break;
+         }
+         buffer->data = data;
+         buffer->size *= 2;
+      }
+
+      // at the end the last line needs no newline; otherwise the buffer ends after its last one
+      const char *newline = end ? NULL : last_newline(buffer->data, len);
+      buffer->len = newline ? (size_t)(newline + 1 - buffer->data) : len;
+      carry = len - buffer->len;
+      previous = buffer;
+
+      pthread_mutex_lock(&ring->lock);
+      buffer->full = 1;
+      ring->done = end;
+      pthread_cond_signal(&ring->filled);
+      pthread_mutex_unlock(&ring->lock);
+
+      if (end)
+         break;
+   }
+
+   pthread_mutex_lock(&ring->lock);
+   ring->done = 1;
+   pthread_cond_signal(&ring->filled);
+   pthread_mutex_unlock(&ring->lock);
+   return NULL;
+}
+
+// implementing load_pipelined(...) to parse the file while a reader thread reads ahead
+// returns the same codes as load_stream(...), and LOAD_ERROR when the input breaks off
+int load_pipelined(const char *filename, RecordHandler handler, void *ctx, RejectLog *rejects, LoadStats *stats)
+{
+   memset(stats, 0, sizeof(LoadStats));
+
+   Ring ring;
+   pthread_t reader;
+   double start = now_seconds();
+   int result = LOAD_OK;
+
+   memset(&ring, 0, sizeof(ring));
+   if (open_source(&ring.source, filename, &stats->input_bytes) != 0)
+   {
+      return LOAD_ERROR;
+   }
+
+   for (int i = 0; i < LOAD_RING_BUFFERS; i++)
+   {
+      ring.buffers[i].data = malloc(LOAD_RING_SIZE);
+      ring.buffers[i].size = LOAD_RING_SIZE;
+      if (ring.buffers[i].data == NULL)
+         result = LOAD_ERROR;
+   }
+   pthread_mutex_init(&ring.lock, NULL);
+   pthread_cond_init(&ring.filled, NULL);
+   pthread_cond_init(&ring.emptied, NULL);
+
+   if (result == LOAD_OK && pthread_create(&reader, NULL, read_ahead, &ring) != 0)
+   {
+      result = LOAD_ERROR;
+   }
+
+   if (result == LOAD_OK)
+   {
+      for (int i = 0;; i = (i + 1) % LOAD_RING_BUFFERS)
+      {
+         RingBuffer *buffer = &ring.buffers[i];
+         double wait = now_seconds();
+
+         pthread_mutex_lock(&ring.lock);
+         while (!buffer->full && !ring.done)
+            pthread_cond_wait(&ring.filled, &ring.lock);
+         int full = buffer->full;
+         pthread_mutex_unlock(&ring.lock);
+         stats->wait_seconds += now_seconds() - wait;
+
+         // the reader fills the buffers in order, so an empty one after it is done is the end
+         if (!full)
+            break;
+
+         const char *p = buffer->data;
+         const char *end = buffer->data + buffer->len;
+
+         while (result == LOAD_OK && p < end)
+         {
+            const char *newline = memchr(p, '\n', end - p);
+            const char *line_end = newline ? newline : end; // the last line may lack a newline
+
+            result = handle_line(p, line_end, handler, ctx, rejects, stats);
+            p = newline ? newline + 1 : end;
+         }
+         stats->bytes += p - buffer->data;
+
+         pthread_mutex_lock(&ring.lock);
+         buffer->full = 0;
+         ring.stop = result != LOAD_OK;
+         pthread_cond_signal(&ring.emptied);
+         pthread_mutex_unlock(&ring.lock);
+
+         if (result != LOAD_OK)
+            break;
+      }
+
+      pthread_join(reader, NULL);
+   }
+
+   // a broken gzip stream or a failing zstd ends the load like a file that cannot be read
+   if (close_source(&ring.source, ring.stop) != 0 || ring.failed)
+   {
+      if (result == LOAD_OK)
+         result = LOAD_ERROR;
+   }
+
+   for (int i = 0; i < LOAD_RING_BUFFERS; i++)
+      free(ring.buffers[i].data);
+   pthread_mutex_destroy(&ring.lock);
+   pthread_cond_destroy(&ring.filled);
+   pthread_cond_destroy(&ring.emptied);
+
+   stats->seconds = now_seconds() - start;
+   return result;
+}
+
+// defining a growable queue of parsed records
+// the fields are slices of the mapping, so a queued record costs no copy of the line
+typedef struct
+{
+   Record *items;
+   size_t count;
+   size_t capacity;
+   uint64_t reserved; // records that count towards reserve(...)
+} RecordQueue;
+
+// defining a line a tolerant parse phase skipped, logged once its chunk's first line is known
+typedef struct
+{
+   uint64_t line; // chunk-local line number
+   RejectKind kind;
+   Field text;
+} SkippedLine;
+
+// defining what one chunk of the file produces in the parse phase
+typedef struct
+{
+   const char *start; // first byte of the chunk (always the start of a line)
+   const char *end;   // one past the last byte (always right after a newline, or the end of file)
+   uint64_t lines;    // lines in the chunk
+   uint64_t first_line; // lines of the chunks before this one, set after the parse phase
+   uint64_t records;  // valid records in the chunk
+   uint64_t bad_line; // chunk-local line number of the first invalid record, 0 if none
+   SkippedLine *skipped; // the invalid lines of a tolerant load, in line order
+   size_t skipped_count;
+   size_t skipped_size;  // room in skipped[]
+   int parsed;        // set once the whole chunk has been parsed
+   RecordQueue *queues; // one queue per owner index
+   int queue_count;
+   RecordQueue pending; // records whose owner did not exist yet, routed after phase 1
+   Field *pending_names; // owners of the pending records, their later records wait too
+   int pending_name_count;
+} Chunk;
+
+// defining the state shared by all threads of one parallel load
+typedef struct
+{
+   const char *data;                // the mapped file
+   Chunk *chunks;
+   int chunk_count;
+   int next_chunk;                  // next chunk to parse, taken atomically
+   int valid_prefix;                // leading chunks parsed without an invalid record
+   pthread_mutex_t prefix_lock;     // taken to move valid_prefix forward
+   int *order;                      // owner indexes, largest first, for the insert phase
+   int order_count;
+   int next_index;                  // next position in order[] to insert, taken atomically
+   int stopped;                     // set when an insert callback asked to stop
+   const ParallelHandler *handler;
+   RejectLog *rejects;              // set for a load that skips invalid lines
+} ParallelLoad;
+
+// push_record(...) appends a record to a queue
+static int push_record(RecordQueue *queue, const Record *record)
+{
+   if (queue->count == queue->capacity)
+   {
+      size_t capacity = queue->capacity ? queue->capacity * 2 : 1024;
+      Record *items = realloc(queue->items, capacity * sizeof(Record));
+      if (items == NULL)
+         return -1;
+      queue->items = items;
+      queue->capacity = capacity;
+   }
+
+   queue->items[queue->count++] = *record;
+   return 0;
+}
+
+// push_routed(...) appends a record to the queue of the index route(...) returned
+static int push_routed(Chunk *chunk, int route, const Record *record)
+{
+   int index = route & ~ROUTE_UNRESERVED;
+
+   // growing the array of queues when a new index shows up
+   if (index >= chunk->queue_count)
+   {
+      int new_count = chunk->queue_count ? chunk->queue_count : 16;
+      while (new_count <= index)
+         new_count *= 2;
+
+      RecordQueue *queues = realloc(chunk->queues, new_count * sizeof(RecordQueue));
+      if (queues == NULL)
+         return -1;
+      memset(queues + chunk->queue_count, 0, (new_count - chunk->queue_count) * sizeof(RecordQueue));
+      chunk->queues = queues;
+      chunk->queue_count = new_count;
+   }
+
+   if (!(route & ROUTE_UNRESERVED))
+      chunk->queues[index].reserved++;
+   return push_record(&chunk->queues[index], record);
+}
+
+// add_skipped(...) keeps an invalid line of a tolerant load for the reject log
+static int add_skipped(Chunk *chunk, RejectKind kind, const char *line, const char *end)
+{
+   if (chunk->skipped_count == chunk->skipped_size)
+   {
+      size_t size = chunk->skipped_size ? chunk->skipped_size * 2 : 64;
+      SkippedLine *skipped = realloc(chunk->skipped, size * sizeof(SkippedLine));
+      if (skipped == NULL)
+         return -1;
+      chunk->skipped = skipped;
+      chunk->skipped_size = size;
+   }
+
+   SkippedLine *skipped = &chunk->skipped[chunk->skipped_count++];
+   skipped->line = chunk->lines;
+   skipped->kind = kind;
+   skipped->text.str = line;
+   skipped->text.len = end - line;
+   return 0;
+}
+
+// is_pending(...) tells whether earlier records of this owner name are waiting in the chunk
+static int is_pending(const Chunk *chunk, const Field *name)
+{
+   for (int i = 0; i < chunk->pending_name_count; i++)
+   {
+      if (chunk->pending_names[i].len == name->len &&
+          memcmp(chunk->pending_names[i].str, name->str, name->len) == 0)
+         return 1;
+   }
+
+   return 0;
+}
+
+// add_pending(...) keeps a record for routing after phase 1, and its owner name so that
+// the owner's later records in this chunk wait behind it (they stay in file order)
+static int add_pending(Chunk *chunk, const Record *record)
+{
+   if (!is_pending(chunk, &record->virus_name))
+   {
+      Field *names = realloc(chunk->pending_names, (chunk->pending_name_count + 1) * sizeof(Field));
+      if (names == NULL)
+         return -1;
+      names[chunk->pending_name_count++] = record->virus_name;
+      chunk->pending_names = names;
+   }
+
+   return push_record(&chunk->pending, record);
+}
+
+// finish_chunk(...) marks a chunk parsed and moves the valid prefix past every
+// leading chunk that is now known to be valid
+static void finish_chunk(ParallelLoad *load, Chunk *chunk)
+{
+   pthread_mutex_lock(&load->prefix_lock);
+   chunk->parsed = 1;
+
+   int prefix = load->valid_prefix;
+   while (prefix < load->chunk_count && load->chunks[prefix].parsed && !load->chunks[prefix].bad_line)
+   {
+      prefix++;
+   }
+   __atomic_store_n(&load->valid_prefix, prefix, __ATOMIC_RELEASE);
+   pthread_mutex_unlock(&load->prefix_lock);
+}
+
+// parse_chunk(...) is phase 1 for one chunk: tokenize, route and queue every record
+// new owners are only created while every chunk before this one is known to be valid,
+// otherwise the record waits, so nothing after an invalid line ever creates an owner
+static void parse_chunk(ParallelLoad *load, Chunk *chunk)
+{
+   const char *p = chunk->start;
+   int position = chunk - load->chunks;
+   Record record;
+   RejectKind kind;
+
+   while (p < chunk->end)
+   {
+      const char *newline = memchr(p, '\n', chunk->end - p);
+      const char *line_end = newline ? newline : chunk->end;
+
+      chunk->lines++;
+
+      if (!is_blank(p, line_end))
+      {
+         // a tolerant load keeps the invalid line for the log and goes on
+         if (load->rejects != NULL && validate_record(p, line_end, &record, &kind) != 0)
+         {
+            if (add_skipped(chunk, kind, p, line_end) != 0)
+            {
+               printf("Error while allocating memory");
+               chunk->bad_line = chunk->lines;
+               break;
+            }
+            p = newline ? newline + 1 : chunk->end;
+            continue;
+         }
+
+         // otherwise stopping at the first invalid record, everything after it is dropped
+         if (load->rejects == NULL && parse_load_record(p, line_end, &record) != 0)
+         {
+            chunk->bad_line = chunk->lines;
+            break;
+         }
+
+         record.line = chunk->lines; // made a file line number in the insert phase
+         chunk->records++;
+         int create = __atomic_load_n(&load->valid_prefix, __ATOMIC_ACQUIRE) >= position;
+         int index = ROUTE_UNKNOWN;
+         if (chunk->pending_name_count == 0 || !is_pending(chunk, &record.virus_name))
+            index = load->handler->route(&record, create, load->handler->ctx);
+
+         int failed = 0;
+         if (index == ROUTE_UNKNOWN)
+            failed = add_pending(chunk, &record);
+         else if (index >= 0)
+            failed = push_routed(chunk, index, &record);
+
+         if (failed)
+         {
+            printf("Error while allocating memory");
+            chunk->bad_line = chunk->lines;
+            break;
+         }
+      }
+
+      p = newline ? newline + 1 : chunk->end;
+   }
+
+   finish_chunk(load, chunk);
+}
+
+// parse_worker(...) keeps taking chunks until none are left
+static void *parse_worker(void *arg)
+{
+   ParallelLoad *load = arg;
+   int i;
+
+   while ((i = __atomic_fetch_add(&load->next_chunk, 1, __ATOMIC_RELAXED)) < load->chunk_count)
+   {
+      parse_chunk(load, &load->chunks[i]);
+   }
+
+   return NULL;
+}
+
+// insert_worker(...) keeps taking whole indexes and inserts their records in file order
+static void *insert_worker(void *arg)
+{
+   ParallelLoad *load = arg;
+   int position;
+
+   while ((position = __atomic_fetch_add(&load->next_index, 1, __ATOMIC_RELAXED)) < load->order_count)
+   {
+      int index = load->order[position];
+
+      for (int c = 0; c < load->chunk_count; c++)
+      {
+         Chunk *chunk = &load->chunks[c];
+         if (index >= chunk->queue_count)
+            continue;
+
+         // the records were parsed in phase 1, their slices still point into the mapping
+         RecordQueue *queue = &chunk->queues[index];
+         for (size_t i = 0; i < queue->count; i++)
+         {
+            queue->items[i].line += chunk->first_line;
+            if (load->handler->insert(index, &queue->items[i], load->handler->ctx) == LOAD_STOPPED)
+            {
+               __atomic_store_n(&load->stopped, 1, __ATOMIC_RELAXED);
+               return NULL;
+            }
+         }
+      }
+   }
+
+   return NULL;
+}
+
+// run_workers(...) runs worker on up to threads threads and waits for all of them
+// if no thread can be started, the calling thread does the work itself
+static void run_workers(void *(*worker)(void *), ParallelLoad *load, pthread_t *workers, int threads)
+{
+   int started = 0;
+
+   while (started < threads && pthread_create(&workers[started], NULL, worker, load) == 0)
+   {
+      started++;
+   }
+
+   if (started == 0)
+   {
+      worker(load);
+   }
+
+   for (int t = 0; t < started; t++)
+   {
+      pthread_join(workers[t], NULL);
+   }
+}
+
+// split_chunks(...) cuts [data, data + size) into up to count chunks that end on newlines
+static int split_chunks(const char *data, size_t size, Chunk *chunks, int count)
+{
+   const char *p = data;
+   const char *end = data + size;
+   int made = 0;
+
+   for (int i = 0; i < count && p < end; i++)
+   {
+      const char *cut = data + size / count * (i + 1);
+
+      // moving the cut forward to just after the next newline
+      if (i == count - 1 || cut >= end)
+      {
+         cut = end;
+      }
+      else
+      {
+         if (cut < p)
+            cut = p;
+         const char *newline = memchr(cut, '\n', end - cut);
+         cut = newline ? newline + 1 : end;
+      }
+
+      memset(&chunks[made], 0, sizeof(Chunk));
+      chunks[made].start = p;
+      chunks[made].end = cut;
+      made++;
+      p = cut;
+   }
+
+   return made;
+}
+
+// implementing load_parallel(...) to load a file with threads parse threads and as many inserters
+// returns the same codes as load_stream(...)
+int load_parallel(const char *filename, int threads, const ParallelHandler *handler, RejectLog *rejects,
+                  LoadStats *stats)
+{
+   memset(stats, 0, sizeof(LoadStats));
+
+   size_t size;
+   const char *data = map_file(filename, &size);
+
+   // if file was not opened successfully
+   if (data == MAP_FAILED)
+   {
+      return LOAD_ERROR;
+   }
+
+   if (threads < 1)
+      threads = 1;
+   if (threads > LOAD_MAX_THREADS)
+      threads = LOAD_MAX_THREADS;
+
+   double start = now_seconds();
+   ParallelLoad load;
+   pthread_t workers[LOAD_MAX_THREADS];
+   int result = LOAD_OK;
+
+   memset(&load, 0, sizeof(load));
+   load.data = data;
+   load.handler = handler;
+   load.rejects = rejects;
+   load.chunks = calloc((size_t)threads * CHUNKS_PER_THREAD, sizeof(Chunk));
+   pthread_mutex_init(&load.prefix_lock, NULL);
+
+   if (load.chunks == NULL)
+   {
+      pthread_mutex_destroy(&load.prefix_lock);
+      if (data != NULL)
+         munmap((void *)data, size);
+      return LOAD_ERROR;
+   }
+
+   if (data != NULL)
+   {
+      load.chunk_count = split_chunks(data, size, load.chunks, threads * CHUNKS_PER_THREAD);
+   }
+
+   // phase 1: parsing and routing every chunk
+   run_workers(parse_worker, &load, workers, threads);
+
+   // everything after the first invalid record is dropped, like the sequential loaders do
+   // (a chunk stops parsing at its invalid record, so its line count ends there)
+   int parsed_chunks = load.chunk_count;
+   int chunks_used = load.chunk_count;
+   for (int c = 0; c < load.chunk_count; c++)
+   {
+      load.chunks[c].first_line = stats->lines;
+      stats->lines += load.chunks[c].lines;
+      stats->records += load.chunks[c].records;
+      stats->bytes = load.chunks[c].end - data;
+
+      if (load.chunks[c].bad_line)
+      {
+         stats->bad_line = stats->lines;
+         chunks_used = c + 1;
+         result = LOAD_INVALID;
+         break;
+      }
+   }
+
+   // logging the lines a tolerant load skipped, in line order, now that every chunk's first line is known
+   for (int c = 0; c < chunks_used && rejects != NULL; c++)
+   {
+      for (size_t i = 0; i < load.chunks[c].skipped_count; i++)
+      {
+         SkippedLine *skipped = &load.chunks[c].skipped[i];
+         reject_add(rejects, skipped->kind, load.chunks[c].first_line + skipped->line, skipped->text.str,
+                    skipped->text.len);
+      }
+   }
+
+   // routing the records that waited for a new owner, in file order, now that the
+   // valid part of the file is known (creating owners is allowed for all of it)
+   for (int c = 0; c < chunks_used && result != LOAD_ERROR; c++)
+   {
+      RecordQueue *pending = &load.chunks[c].pending;
+      for (size_t i = 0; i < pending->count; i++)
+      {
+         int index = handler->route(&pending->items[i], 1, handler->ctx);
+         if (index >= 0 && push_routed(&load.chunks[c], index, &pending->items[i]) != 0)
+         {
+            printf("Error while allocating memory");
+            result = LOAD_ERROR;
+            break;
+         }
+      }
+   }
+
+   // counting the records queued for every index
+   int index_count = 0;
+   for (int c = 0; c < chunks_used; c++)
+   {
+      if (load.chunks[c].queue_count > index_count)
+         index_count = load.chunks[c].queue_count;
+   }
+
+   uint64_t *totals = calloc(index_count + 1, sizeof(uint64_t));
+   uint64_t *reserved = calloc(index_count + 1, sizeof(uint64_t));
+   load.order = malloc((index_count + 1) * sizeof(int));
+
+   if (result == LOAD_ERROR)
+   {
+      // the pending records could not be queued, nothing is inserted
+   }
+   else if (totals != NULL && reserved != NULL && load.order != NULL)
+   {
+      for (int c = 0; c < chunks_used; c++)
+      {
+         for (int i = 0; i < load.chunks[c].queue_count; i++)
+         {
+            totals[i] += load.chunks[c].queues[i].count;
+            reserved[i] += load.chunks[c].queues[i].reserved;
+         }
+      }
+
+      for (int i = 0; i < index_count; i++)
+      {
+         if (totals[i] == 0)
+            continue;
+         handler->reserve(i, reserved[i], handler->ctx);
+
+         // keeping order[] sorted by size so the biggest indexes start first
+         int j = load.order_count++;
+         while (j > 0 && totals[load.order[j - 1]] < totals[i])
+         {
+            load.order[j] = load.order[j - 1];
+            j--;
+         }
+         load.order[j] = i;
+      }
+
+      // phase 2: inserting, one thread per index at a time
+      load.chunk_count = chunks_used;
+      run_workers(insert_worker, &load, workers, threads);
+
+      if (load.stopped && result == LOAD_OK)
+         result = LOAD_STOPPED;
+   }
+   else
+   {
+      printf("Error while allocating memory");
+      result = LOAD_ERROR;
+   }
+
+   // releasing the queues of every chunk
+   for (int c = 0; c < parsed_chunks; c++)
+   {
+      for (int i = 0; i < load.chunks[c].queue_count; i++)
+         free(load.chunks[c].queues[i].items);
+      free(load.chunks[c].queues);
+      free(load.chunks[c].pending.items);
+      free(load.chunks[c].pending_names);
+      free(load.chunks[c].skipped);
+   }
+
+   free(totals);
+   free(reserved);
+   free(load.order);
+   free(load.chunks);
+   pthread_mutex_destroy(&load.prefix_lock);
+   if (data != NULL)
+      munmap((void *)data, size);
+
+   stats->seconds = now_seconds() - start;
+   return result;
+}
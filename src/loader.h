@@ -0,0 +1,74 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdint.h>
+#include "record.h"
+#include "reject.h"
+
+// defining what a load returns (handlers return LOAD_OK or LOAD_STOPPED)
+#define LOAD_ERROR -1  // the file could not be opened or mapped
+#define LOAD_OK 0      // every record was loaded
+#define LOAD_INVALID 1 // the load stopped at a record with fewer than 7 fields (or a bad age)
+#define LOAD_STOPPED 2 // a handler asked the load to stop early
+
+#define LOAD_MAX_THREADS 64  // load_parallel(...) uses at most this many threads
+#define LOAD_RING_BUFFERS 4  // buffers load_pipelined(...) reads ahead into
+#define LOAD_RING_SIZE (4 << 20) // bytes per buffer, grown for a line that does not fit
+#define ROUTE_SKIP -1        // route(...): the record is not inserted anywhere
+#define ROUTE_UNKNOWN -2     // route(...) without create: the record's owner does not exist yet
+#define ROUTE_UNRESERVED 0x40000000 // or'ed into an owner index: insert(...) gets the record, reserve(...) does not count it
+
+// defining the callback every parsed record is handed to, LOAD_STOPPED stops the load
+typedef int (*RecordHandler)(const Record *record, void *ctx);
+
+// defining the callbacks of the parallel loader
+// records are routed to an owner index (a virus) by the parse threads, and all
+// records of one index are inserted by a single thread, in file order
+// route(...) may only create a new owner when create is set, which the loader does
+// only once every line before the record is known to be valid
+typedef struct
+{
+   int (*route)(const Record *record, int create, void *ctx);     // parse threads: owner index, ROUTE_SKIP or ROUTE_UNKNOWN (must be thread-safe)
+   void (*reserve)(int index, uint64_t count, void *ctx);         // once per index before inserting, with its reserved record count
+   int (*insert)(int index, const Record *record, void *ctx);     // inserter threads: store one record, LOAD_STOPPED to stop
+   void *ctx;                                                     // passed to every callback
+} ParallelHandler;
+
+// defining the encodings load_pipelined(...) can read, told apart by the first bytes of the file
+typedef enum
+{
+   INPUT_PLAIN,
+   INPUT_GZIP, // decompressed with zlib on the reader thread
+   INPUT_ZSTD  // decompressed by a zstd -dc child process, read through a pipe
+} InputEncoding;
+
+// defining the counters a load reports when it is done
+typedef struct
+{
+   uint64_t lines;    // lines read, including blank ones
+   uint64_t records;  // records handed to the handler
+   uint64_t bytes;    // bytes of input consumed
+   uint64_t bad_line; // line number of the first invalid record, 0 if none
+   uint64_t input_bytes; // bytes of the file itself, fewer than bytes for compressed input (load_pipelined(...))
+   double wait_seconds;  // time the parser waited for the reader thread (load_pipelined(...))
+   double seconds;    // wall-clock time spent loading
+} LoadStats;
+
+/*
+function prototypes
+*/
+int parse_record(const char *line, const char *end, Record *record);  // function to split one line into fields, 0 on success
+int validate_record(const char *line, const char *end, Record *record,
+                    RejectKind *kind);                                 // function to parse a line and check its status and date, 0 if valid
+int load_stream(const char *filename, RecordHandler handler, void *ctx,
+                RejectLog *rejects, LoadStats *stats);                 // function to load a file line by line with stdio
+int load_mapped(const char *filename, RecordHandler handler, void *ctx,
+                RejectLog *rejects, LoadStats *stats);                 // function to load a file through mmap(...) without copying
+int load_parallel(const char *filename, int threads, const ParallelHandler *handler,
+                  RejectLog *rejects, LoadStats *stats);              // function to parse and insert on several threads
+int load_pipelined(const char *filename, RecordHandler handler, void *ctx,
+                   RejectLog *rejects, LoadStats *stats);              // function to parse while a reader thread reads (and decompresses) ahead
+InputEncoding load_encoding(const char *filename);                    // function to tell plain from gzip or zstd input
+const char *load_encoding_name(InputEncoding encoding);               // function to get the printable name of an encoding
+
+#endif
@@ -7,229 +7,2165 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
 #include "bloom_filter.h"
-#include "skip_list.h"
+#include "index.h"
+#include "intern.h"
+#include "loader.h"
+#include "batch.h"
+#include "snapshot.h"
+#include "virus_table.h"
+#include "date.h"
+#include "wal.h"
+#include "citizen_table.h"
+#include "server.h"
+#include "export.h"
 
-#define MAX_VIRUSES 50   // max number of viruses that this program can handle
-#define BLOOM_SIZE 10000 // setting the size of the bloom filter
+#define MAX_LAYOUT_OVERRIDES 50 // max number of -l <virus>=<layout> options
+#define NEW_VIRUS_RECORDS 10000  // records the bloom filter of a virus first seen by insert or update is sized for
+#define LIST_CHUNK 256          // records a list takes from its index per scan before writing them out
 
-// defining the structure for a virus
+// the viruses live in the hash table of virus_table.c
+// creating a virus takes this lock, finding one does not: a virus is fully set up
+// before virus_table_add(...) publishes it
+pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t expected_records = 0;              // expected records per virus (-e), 0 means pre-scan the input file
+double bloom_fp_rate = BLOOM_DEFAULT_FP_RATE; // target false-positive rate for every bloom filter (-p)
+BloomLayout bloom_layout = BLOOM_STANDARD;    // bloom filter layout for viruses without an override (-l)
+int use_mmap = 0;                             // load through mmap(...) instead of stdio (-m)
+int load_threads = 1;                         // parse/insert threads, more than one uses load_parallel(...) (-j)
+int async_read = 0;                           // read on a thread of its own while parsing, through load_pipelined(...) (-a)
+InputEncoding input_encoding = INPUT_PLAIN;   // gzip or zstd input is always read through load_pipelined(...)
+int background_load = 0;                      // answer queries while a background thread loads (-b)
+char *batch_file = NULL;                      // file of check commands to answer instead of prompting (-q)
+char *snapshot_file = NULL;                   // snapshot to restore instead of parsing the input file (-r)
+Snapshot *snapshot = NULL;                    // the restored snapshot, its mapping backs the restored viruses
+uint64_t list_seed = 0;                       // seed of the skip lists' level generators (-s), 0 picks one per run
+IndexKind index_kind = INDEX_SKIP_LIST;       // ordered index every virus keeps its records in (-i)
+int dump_interval = 0;                        // seconds between metric dumps to stderr (-t), 0 for none
+char *wal_file = NULL;                        // write-ahead log of insert, update and delete commands (-w)
+Wal *wal = NULL;                              // the open log, NULL without -w
+char *server_address = NULL;                  // socket path or host:port to answer check/list requests on (-S)
+int server_workers = 0;                       // worker threads of the server (-n), 0 for one per online CPU
+sigset_t stop_signals;                        // SIGINT and SIGTERM, which end the server mode
+char *reject_file = NULL;                     // side file of the lines a tolerant load skips (-x), NULL stops at the first bad line
+RejectLog *rejects = NULL;                    // the open reject log while the file loads
+
+int loading = 0;      // set while the background load is still running
+int stop_loading = 0; // set on exit to ask the background load to stop early
+int stop_dumping = 0; // set on exit to stop the metrics dump thread
+
+char *layout_viruses[MAX_LAYOUT_OVERRIDES];       // viruses given their own layout with -l <virus>=<layout>
+BloomLayout layout_overrides[MAX_LAYOUT_OVERRIDES]; // the layout chosen for each of those viruses
+int layout_override_count = 0;
+
+/*
+   function declarations
+*/
+Virus *create_virus(const char *name, size_t len, uint64_t expected); // function to create a new virus
+Virus *find_virus(const char *name, size_t len);                      // function to find an existing virus
+Virus *find_or_create_virus(const char *name, size_t len);            // function to find a virus, creating it if needed
+uint64_t list_seed_for(const char *name, size_t len);                 // function to pick the seed of a virus's skip list
+int prescan_records(const char *filename);                // function to size every virus from a first pass over the file
+int parse_layout_option(char *arg);                       // function to read a -l option, 0 on success
+BloomLayout layout_for(const char *virus_name);           // function to pick the bloom layout of a virus
+int process_record(const Record *record, void *ctx);                           // function to process a new vaccination record
+int load_file(const char *filename, RecordHandler handler, void *ctx,
+              RejectLog *log, LoadStats *stats);                              // function to run the loader selected with -m
+void load_records(const char *filename);                                      // function to load vaccination records from a file
+void print_rejects();                                                         // function to show what a -x load skipped
+Node *lookup_citizen(Virus *virus, const char *citizen_id, bool *maybe);      // function to find a vaccinated citizen through the bloom filter
+void check_vaccination_status(char *citizen_id, const char *virus_name);      // function to check vaccination status
+int parse_list_options(char *words[], int count, const char **after,
+                       uint64_t *limit);                                      // function to read the [after <id>] [limit N] of a list command, 0 on success
+void list_vaccinated(const char *virus_name, const char *after, uint64_t limit,
+                     Writer *out);                                            // function to list a page of the vaccination records of a virus
+int write_page_record(const Node *node, void *page);                          // function to write one record of a list page, an IndexVisitor
+void export_virus(const char *virus_name, const char *path, const char *format); // function to dump every record of a virus to a file
+void list_id_range(const char *virus_name, const char *from, const char *to); // function to list the records of an ID range
+void list_date_window(const char *virus_name, const char *from, const char *to,
+                      const char *country);                                   // function to list the records vaccinated in a date window
+ColumnStore *columns_for(Virus *virus, int *rebuilt);                         // function to get a current column store of a virus
+int parse_filter(char *words, ColumnFilter *filter, int *count_only);         // function to read the predicates of a filter command, 0 on success
+void filter_records(const char *virus_name, char *predicates);                // function to list the records passing age/country/date predicates
+int add_to_dates(const Node *node, void *virus);                              // function to add a restored record to its virus's date index and day counts
+int mark_citizen(const Node *node, void *virus);                              // function to set a restored record's virus bit in its citizen
+int print_record(const Node *node, void *ctx);                                // function to print one record, an IndexVisitor
+void print_stats();                                                           // function to show the shape and search cost of every index
+void print_population(const char *virus_name, const char *country);           // function to show the YES/NO counts of a virus
+void print_coverage(const char *virus_name, const char *date);                // function to show how many were vaccinated by a date
+void print_citizen_status(const char *citizen_id);                            // function to show every virus a citizen is vaccinated against
+void insert_citizen(const char *fields);                                      // function to add a record typed at the prompt
+void update_citizen(const char *fields);                                      // function to replace a citizen's record for a virus
+void delete_citizen(const char *citizen_id, const char *virus_name);          // function to remove a citizen's record for a virus
+int replay_change(WalOp op, const char *text, size_t len, void *ctx);         // function to apply one logged change, a WalVisitor
+void replay_log();                                                            // function to apply the changes logged with -w on top of the base
+void compact_log(const char *path);                                           // function to fold the log into a new snapshot
+void report_memory();                                                         // function to print the bytes spent per record
+void dump_metrics(FILE *out);                                                 // function to write every counter as key=value lines
+void *metrics_dumper(void *arg);                                              // function run by the -t dump thread
+void *background_loader(void *filename);                                      // function run by the background load thread
+int loading_note(Virus *virus, char *note, size_t size);                      // function to describe a load still in progress, 0 if there is none
+void print_loading_note(Virus *virus);                                        // function to flag answers given mid-load
+int batch_lookup(const char *name, size_t len, BatchTarget *target);          // function to resolve a virus for run_batch(...)
+int run_batch_mode(const char *filename);                                     // function to answer a query file and report the rate
+int restore_snapshot(const char *path);                                       // function to rebuild every virus from a snapshot
+int save_snapshot(const char *path);                                          // function to write every virus to a snapshot, 0 on success
+void serve_request(const char *line, size_t len, Writer *out, void *ctx);     // function to answer one client request, a ServerHandler
+int run_server_mode();                                                        // function to answer clients until SIGINT or SIGTERM
+void run();                                                                   // function to enable user interaction
+void print_usage(const char *program);                                        // function to print the command-line options
+
+// driver function
+int main(int argc, char *argv[])
+{
+   int opt;
+
+   // reading the optional flags that tune the bloom filters
+   while ((opt = getopt(argc, argv, "e:p:l:mj:abq:r:s:i:t:w:S:n:x:")) != -1)
+   {
+      switch (opt)
+      {
+      case 'e':
+         expected_records = strtoull(optarg, NULL, 10);
+         break;
+      case 'p':
+         bloom_fp_rate = strtod(optarg, NULL);
+         if (!(bloom_fp_rate > 0.0 && bloom_fp_rate < 1.0))
+         {
+            printf("Invalid false-positive rate %s (expected a number between 0 and 1)\n", optarg);
+            print_usage(argv[0]);
+            return 1;
+         }
+         break;
+      case 'l':
+         if (parse_layout_option(optarg) != 0)
+         {
+            printf("Invalid layout %s (expected [virus=]standard|blocked|counting)\n", optarg);
+            return 1;
+         }
+         break;
+      case 'm':
+         use_mmap = 1;
+         break;
+      case 'j':
+         load_threads = atoi(optarg);
+         break;
+      case 'a':
+         async_read = 1;
+         break;
+      case 'b':
+         background_load = 1;
+         break;
+      case 'q':
+         batch_file = optarg;
+         break;
+      case 'r':
+         snapshot_file = optarg;
+         break;
+      case 's':
+         list_seed = strtoull(optarg, NULL, 10);
+         break;
+      case 'i':
+         if (index_parse_kind(optarg, &index_kind) != 0)
+         {
+            printf("Invalid index %s (expected skiplist|bptree)\n", optarg);
+            return 1;
+         }
+         break;
+      case 't':
+         dump_interval = atoi(optarg);
+         break;
+      case 'w':
+         wal_file = optarg;
+         break;
+      case 'S':
+         server_address = optarg;
+         break;
+      case 'n':
+         server_workers = atoi(optarg);
+         break;
+      case 'x':
+         reject_file = optarg;
+         break;
+      default:
+         print_usage(argv[0]);
+         return 1;
+      }
+   }
+
+   // check if user provided input file as an argument (a snapshot can stand in for it)
+   if (optind != argc - 1 && !(snapshot_file && optind == argc))
+   {
+      print_usage(argv[0]);
+      return 1;
+   }
+
+   // compressed input is inflated as one stream, which the parallel loader cannot split
+   if (optind < argc)
+      input_encoding = load_encoding(argv[optind]);
+   if (input_encoding != INPUT_PLAIN && load_threads > 1)
+   {
+      printf("%s is %s compressed, loading it on one parse thread (-j is ignored)\n", argv[optind],
+             load_encoding_name(input_encoding));
+      load_threads = 1;
+   }
+
+   // with -S the signals that stop the server are left to sigwait(...), so every thread
+   // started from here on inherits them blocked
+   sigemptyset(&stop_signals);
+   sigaddset(&stop_signals, SIGINT);
+   sigaddset(&stop_signals, SIGTERM);
+   if (server_address)
+      pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+   // with -w the log is opened up front, so a log of another base stops the program before loading
+   if (wal_file)
+   {
+      char error[WAL_BASE_LEN + 64];
+      const char *base = snapshot_file ? snapshot_file : argv[optind];
+
+      wal = wal_open(wal_file, base, error, sizeof(error));
+      if (wal == NULL)
+      {
+         printf("Cannot open log %s: %s\n", wal_file, error);
+         return 1;
+      }
+   }
+
+   int status = 0;
+
+   // with -t a thread writes every counter to stderr every few seconds
+   pthread_t dumper;
+   int dumping = dump_interval > 0 && pthread_create(&dumper, NULL, metrics_dumper, NULL) == 0;
+
+   // with -r the viruses are rebuilt from a snapshot and the input file is not parsed
+   if (snapshot_file)
+   {
+      if (restore_snapshot(snapshot_file) != 0)
+      {
+         if (wal)
+            wal_close(wal);
+         return 1;
+      }
+      replay_log();
+
+      if (batch_file)
+         status = run_batch_mode(batch_file);
+      else if (server_address)
+         status = run_server_mode();
+      else
+         run();
+   }
+   // with -q the queries come from a file, so they wait for the whole load
+   else if (batch_file)
+   {
+      background_load = 0;
+      background_loader(argv[optind]);
+      status = run_batch_mode(batch_file);
+   }
+   // with -b the file is loaded by a second thread while queries are answered
+   else if (background_load)
+   {
+      pthread_t loader;
+      loading = 1;
+      pthread_create(&loader, NULL, background_loader, argv[optind]);
+
+      // start user interaction (or serving clients) right away
+      if (server_address)
+         status = run_server_mode();
+      else
+         run();
+
+      // asking the loader to stop early if the user quit before it finished
+      __atomic_store_n(&stop_loading, 1, __ATOMIC_RELAXED);
+      pthread_join(loader, NULL);
+   }
+   else
+   {
+      background_loader(argv[optind]);
+
+      // start user interaction
+      if (server_address)
+         status = run_server_mode();
+      else
+         run();
+   }
+
+   if (dumping)
+   {
+      __atomic_store_n(&stop_dumping, 1, __ATOMIC_RELAXED);
+      pthread_join(dumper, NULL);
+   }
+
+   // committing the changes the last group commit has not covered yet
+   if (wal)
+      wal_close(wal);
+
+   // cleaning up allocated memory
+   for (int i = 0; i < virus_table_count(); i++)
+   {
+      Virus *virus = virus_table_get(i);
+      free(virus->name);
+      bloom_delete(virus->bloom);
+      if (virus->retired_bloom)
+         bloom_delete(virus->retired_bloom);
+      index_delete(virus->records);
+      date_index_delete(virus->dates);
+      population_delete(virus->population);
+      unvaccinated_delete(virus->unvaccinated);
+      column_store_delete(virus->columns);
+      free(virus);
+   }
+   virus_table_clear();
+   citizen_table_clear(); // the records pointed at the citizens
+   if (snapshot)
+      snapshot_close(snapshot); // the restored filters, records and citizens pointed into it
+   intern_clear(); // the shared strings outlive every list, so they go last
+
+   return status;
+}
+
+// implementing print_usage(...) to show how the program is run
+void print_usage(const char *program)
+{
+   printf("Usage: %s [-e expected_per_virus] [-p fp_rate] [-l [virus=]layout] [-m] [-j threads] [-a] [-b] "
+          "[-q query_file] [-r snapshot] [-s seed] [-i index] [-t seconds] [-w log_file] [-S address] [-n workers] "
+          "[-x reject_file] <input_file>\n", program);
+}
+
+// implementing create_virus(...) to create a new virus
+// expected is the number of vaccinated records the virus's bloom filter is sized for
+// the caller holds registry_lock (or is the only thread creating viruses)
+Virus *create_virus(const char *name, size_t len, uint64_t expected)
+{
+   Virus *virus = calloc(1, sizeof(Virus));             // create new Virus
+
+   // checking if memory was allocated successfully
+   if (virus == NULL)
+   {
+      return NULL;
+   }
+
+   virus->name = strndup(name, len);                    // set virus's name
+   virus->len = len;
+   virus->bloom = bloom_create(expected, bloom_fp_rate,
+                               layout_for(virus->name)); // create a new bloom filter for the virus
+   virus->records = index_create(index_kind, list_seed_for(name, len)); // create a new index for the virus's records
+   virus->dates = date_index_create();                  // create the virus's index by vaccination date
+   virus->population = population_create();             // create the virus's YES/NO counters
+   virus->unvaccinated = unvaccinated_create();         // create the virus's set of NO records
+
+   // publishing the virus only once it is complete, for lock-free readers
+   if (virus->name == NULL || virus->bloom == NULL || virus->records == NULL || virus->dates == NULL ||
+       virus->population == NULL || virus->unvaccinated == NULL || virus_table_add(virus) < 0)
+   {
+      free(virus->name);
+      if (virus->bloom)
+         bloom_delete(virus->bloom);
+      if (virus->records)
+         index_delete(virus->records);
+      if (virus->dates)
+         date_index_delete(virus->dates);
+      if (virus->population)
+         population_delete(virus->population);
+      if (virus->unvaccinated)
+         unvaccinated_delete(virus->unvaccinated);
+      free(virus);
+      return NULL;
+   }
+
+   return virus;
+}
+
+// implementing list_seed_for(...) to give every virus its own level sequence under -s
+// the seed depends on the name, not on creation order, so parallel loads are reproducible too
+uint64_t list_seed_for(const char *name, size_t len)
+{
+   return list_seed ? list_seed ^ bloom_hash(name, len) : 0;
+}
+
+// implementing parse_layout_option(...) to read "-l blocked" (every virus)
+// or "-l Measles=blocked" (only that virus)
+int parse_layout_option(char *arg)
+{
+   char *equals = strchr(arg, '=');
+
+   // no virus given, so the layout becomes the default
+   if (equals == NULL)
+   {
+      return bloom_parse_layout(arg, &bloom_layout);
+   }
+
+   if (layout_override_count >= MAX_LAYOUT_OVERRIDES)
+   {
+      return -1;
+   }
+
+   *equals = '\0'; // splitting the argument into virus name and layout name
+   if (bloom_parse_layout(equals + 1, &layout_overrides[layout_override_count]) != 0)
+   {
+      return -1;
+   }
+   layout_viruses[layout_override_count++] = arg;
+   return 0;
+}
+
+// implementing layout_for(...) to look up the layout a virus should use
+BloomLayout layout_for(const char *virus_name)
+{
+   for (int i = 0; i < layout_override_count; i++)
+   {
+      if (strcmp(layout_viruses[i], virus_name) == 0)
+         return layout_overrides[i];
+   }
+
+   return bloom_layout;
+}
+
+// implementing find_virus(...) to find an existing virus
+// name does not need to be NUL-terminated, len gives its length
+Virus *find_virus(const char *name, size_t len)
+{
+   return virus_table_find(name, len);
+}
+
+// implementing find_or_create_virus(...) to get the virus of a record from any thread
+// input files tend to have runs of the same virus, so every loader thread first
+// compares against the virus its previous record used
+Virus *find_or_create_virus(const char *name, size_t len)
+{
+   static __thread Virus *last_virus = NULL;
+   Virus *virus = last_virus;
+
+   if (virus != NULL && virus->len == len && memcmp(virus->name, name, len) == 0)
+   {
+      return virus;
+   }
+
+   virus = find_virus(name, len);
+
+   if (virus != NULL)
+   {
+      last_virus = virus;
+      return virus;
+   }
+
+   // looking again under the lock, another thread may have just created it
+   pthread_mutex_lock(&registry_lock);
+   virus = find_virus(name, len);
+   if (virus == NULL)
+   {
+      virus = create_virus(name, len, expected_records);
+   }
+   pthread_mutex_unlock(&registry_lock);
+
+   last_virus = virus;
+   return virus;
+}
+
+// log_repeat(...) writes a record of the file that repeats a stored citizen ID to the reject
+// log: with the same names, country, age and date as the stored record it is a duplicate,
+// otherwise a conflict (the first record of the file is the one kept either way); a NO record
+// keeps only its country and age, so a repeated NO is compared on those
+static void log_repeat(Virus *virus, const Record *record)
+{
+   RejectKind kind = REJECT_CONFLICT;
+
+   if (field_equals(&record->vaccinated, "NO"))
+   {
+      Unvaccinated stored;
+      if (unvaccinated_find(virus->unvaccinated, record->citizen_id.str, record->citizen_id.len, &stored) == 0 &&
+          field_equals(&record->country, stored.country) && record->age == stored.age)
+         kind = REJECT_DUPLICATE;
+
+      reject_add(rejects, kind, record->line, record->text.str, record->text.len);
+      return;
+   }
+
+   char *citizen_id = strndup(record->citizen_id.str, record->citizen_id.len);
+   Node *stored = citizen_id ? index_search(virus->records, citizen_id) : NULL;
+
+   if (stored != NULL && field_equals(&record->first_name, stored->citizen->first_name) &&
+       field_equals(&record->last_name, stored->citizen->last_name) &&
+       field_equals(&record->country, stored->citizen->country) && record->age == stored->citizen->age &&
+       date_parse(record->date.str, record->date.len) == stored->day)
+      kind = REJECT_DUPLICATE;
+
+   reject_add(rejects, kind, record->line, record->text.str, record->text.len);
+   free(citizen_id);
+}
+
+// add_record(...) files a record under its virus: a vaccinated record goes into the
+// bloom filter and the indexes, an unvaccinated one into the NO set, and each is counted
+// once per citizen ID (like a YES, a repeated NO is not counted again)
+// while queries run concurrently, the thread-safe variants are used
+// returns the stored node, NULL for an unvaccinated record or a repeated citizen ID
+static Node *add_record(Virus *virus, const Record *record)
+{
+   Node *node = NULL;
+
+   if (!field_equals(&record->vaccinated, "YES"))
+   {
+      // an unvaccinated record is only counted, so only its ID, country and age are kept
+      const char *country = field_equals(&record->vaccinated, "NO") ? intern(record->country.str, record->country.len) : NULL;
+      int added = country ? unvaccinated_add(virus->unvaccinated, record->citizen_id.str, record->citizen_id.len,
+                                             country, record->age, 0)
+                          : -1;
+      if (added > 0)
+         population_add(virus->population, country, record->age, 0, DATE_NONE);
+      else if (added == 0 && rejects != NULL && record->line > 0)
+         log_repeat(virus, record);
+      return NULL;
+   }
+
+   // the personal fields are kept once per citizen, and the record points at them
+   Record stored = *record;
+   stored.citizen = citizen_table_hold(record);
+   if (stored.citizen == NULL)
+   {
+      printf("Error while adding citizen %.*s\n", (int)record->citizen_id.len, record->citizen_id.str);
+      return NULL;
+   }
+
+   if (background_load)
+   {
+      bloom_insert_atomic(virus->bloom, record->citizen_id.str, record->citizen_id.len);
+      node = index_insert_concurrent(virus->records, &stored);
+      if (node != NULL && node->day != DATE_NONE)
+         date_index_add_concurrent(virus->dates, node);
+   }
+   else
+   {
+      bloom_insert(virus->bloom, record->citizen_id.str, record->citizen_id.len);
+      node = index_insert(virus->records, &stored);
+      if (node != NULL && node->day != DATE_NONE)
+         date_index_add(virus->dates, node);
+   }
+
+   // a repeated citizen ID is not stored again, so it is not counted again either, a counting
+   // filter takes back the count it was just given, and the citizen added for it is unlinked
+   // again unless some virus stores it
+   if (node != NULL)
+   {
+      citizen_table_mark(node->citizen, virus->index, 1);
+      citizen_table_settle(stored.citizen, 1);
+      population_add(virus->population, node->citizen->country, node->citizen->age, 1, node->day);
+   }
+   else
+   {
+      citizen_table_settle(stored.citizen, 0);
+      bloom_remove(virus->bloom, record->citizen_id.str, record->citizen_id.len);
+      if (rejects != NULL && record->line > 0)
+         log_repeat(virus, record);
+   }
+
+   return node;
+}
+
+// store_record(...) is add_record(...) timed as one step of the load
+static void store_record(Virus *virus, const Record *record)
+{
+   uint64_t start = metrics_now();
+   add_record(virus, record);
+   histogram_record(&virus->metrics.load_latency, metrics_now() - start, 1);
+}
+
+// remove_record(...) takes a node that index_remove(...) returned out of the rest of its virus:
+// the date index, the YES counts, the citizen's bitmap and, for a counting layout, the bloom filter
+static void remove_record(Virus *virus, const Node *node)
+{
+   bloom_remove(virus->bloom, node->citizen_id, strlen(node->citizen_id));
+   if (node->day != DATE_NONE)
+      date_index_remove(virus->dates, node);
+   population_remove(virus->population, node->citizen->country, node->citizen->age, 1, node->day);
+   citizen_table_mark(node->citizen, virus->index, 0);
+   virus->removals++;
+}
+
+// remove_citizen(...) takes a citizen's records for a virus out before a change: the stored YES
+// record through remove_record(...), and a NO record from the NO set and the tally it was
+// counted in; returns how many records were removed
+static int remove_citizen(Virus *virus, const char *citizen_id)
+{
+   Node *old = index_remove(virus->records, citizen_id);
+   Unvaccinated no;
+   int removed = 0;
+
+   if (old != NULL)
+   {
+      remove_record(virus, old);
+      removed++;
+   }
+
+   if (unvaccinated_remove(virus->unvaccinated, citizen_id, strlen(citizen_id), &no) == 0)
+   {
+      population_remove(virus->population, no.country, no.age, 0, DATE_NONE);
+      removed++;
+   }
+
+   return removed;
+}
+
+// implementing process_record(...) to process a vaccination record from start to finish
+// it matches RecordHandler so the loaders can hand records straight to it
+int process_record(const Record *record, void *ctx)
+{
+   // the user quit while we were still loading in the background
+   if (__atomic_load_n(&stop_loading, __ATOMIC_RELAXED))
+   {
+      return LOAD_STOPPED;
+   }
+
+   // create virus if it does not already exist
+   Virus *virus = find_or_create_virus(record->virus_name.str, record->virus_name.len);
+
+   // if virus is not created for some reason...
+   if (!virus)
+   {
+      printf("Error encountered with virus %.*s", (int)record->virus_name.len, record->virus_name.str);
+      return 0;
+   }
+
+   // storing the record if the citizen is vaccinated, and counting it either way
+   store_record(virus, record);
+
+   return LOAD_OK;
+}
+
+// route_record(...) runs on the parse threads of load_parallel(...)
+// every record creates its virus (when allowed to), vaccinated and unvaccinated records
+// are queued for the virus's inserter, but only vaccinated ones size its bloom filter
+static int route_record(const Record *record, int create, void *ctx)
+{
+   Virus *virus = create ? find_or_create_virus(record->virus_name.str, record->virus_name.len)
+                         : find_virus(record->virus_name.str, record->virus_name.len);
+
+   if (virus == NULL && !create)
+   {
+      return ROUTE_UNKNOWN;
+   }
+
+   if (virus != NULL && field_equals(&record->vaccinated, "YES"))
+   {
+      return virus->index;
+   }
+
+   if (virus != NULL && field_equals(&record->vaccinated, "NO"))
+   {
+      return virus->index | ROUTE_UNRESERVED;
+   }
+
+   return ROUTE_SKIP;
+}
+
+// reserve_virus(...) sizes a virus's bloom filter from the exact count the parse phase found
+static void reserve_virus(int index, uint64_t count, void *ctx)
+{
+   Virus *virus = virus_table_get(index);
+
+   // an explicit -e wins over the counted size
+   if (expected_records == 0)
+   {
+      BloomFilter *sized = bloom_create(count, bloom_fp_rate, layout_for(virus->name));
+
+      // keeping the current (undersized) filter if the new one could not be allocated
+      if (sized == NULL)
+      {
+         printf("Error while sizing the bloom filter of %s\n", virus->name);
+         return;
+      }
+
+      // a query may be reading the old (empty) filter right now, so it is kept until exit
+      virus->retired_bloom = virus->bloom;
+      __atomic_store_n(&virus->bloom, sized, __ATOMIC_RELEASE);
+   }
+}
+
+// insert_record(...) runs on the inserter thread that owns the virus
+static int insert_record(int index, const Record *record, void *ctx)
+{
+   if (__atomic_load_n(&stop_loading, __ATOMIC_RELAXED))
+   {
+      return LOAD_STOPPED;
+   }
+
+   store_record(virus_table_get(index), record);
+   return LOAD_OK;
+}
+
+// count_record(...) is the pre-scan's RecordHandler, it creates every virus and
+// only tallies its vaccinated records
+static int count_record(const Record *record, void *ctx)
+{
+   // the user quit while we were still counting in the background
+   if (__atomic_load_n(&stop_loading, __ATOMIC_RELAXED))
+   {
+      return LOAD_STOPPED;
+   }
+
+   Virus *virus = find_or_create_virus(record->virus_name.str, record->virus_name.len);
+
+   if (virus != NULL && field_equals(&record->vaccinated, "YES"))
+   {
+      virus->counted++;
+   }
+
+   return 0;
+}
+
+// implementing prescan_records(...) to count the vaccinated records of every virus
+// so that each bloom filter is sized right before loading starts
+// returns LOAD_STOPPED if the user quit before the pass was over
+int prescan_records(const char *filename)
+{
+   LoadStats stats;
+
+   // errors are ignored here, load_records(...) reports them on the real pass
+   // (with -x that pass logs the invalid lines, this one only needs to get past them)
+   RejectLog *skipped = reject_file ? reject_open(NULL) : NULL;
+   int result = load_file(filename, count_record, NULL, skipped, &stats);
+   reject_close(skipped);
+
+   if (result == LOAD_STOPPED)
+   {
+      return LOAD_STOPPED;
+   }
+
+   // replacing the minimal filter every virus was created with by one of its own size
+   for (int i = 0; i < virus_table_count(); i++)
+   {
+      reserve_virus(i, virus_table_get(i)->counted, NULL);
+   }
+
+   return LOAD_OK;
+}
+
+// implementing load_file(...) to run whichever loader was picked on the command line
+int load_file(const char *filename, RecordHandler handler, void *ctx, RejectLog *log, LoadStats *stats)
+{
+   if (async_read || input_encoding != INPUT_PLAIN)
+   {
+      return load_pipelined(filename, handler, ctx, log, stats);
+   }
+
+   if (use_mmap)
+   {
+      return load_mapped(filename, handler, ctx, log, stats);
+   }
+
+   return load_stream(filename, handler, ctx, log, stats);
+}
+
+// implementing load_records(...) to read records from file
+void load_records(const char *filename)
+{
+   LoadStats stats;
+   int result;
+
+   // with -x invalid lines are logged and skipped instead of ending the load
+   if (reject_file != NULL && (rejects = reject_open(reject_file)) == NULL)
+   {
+      printf("Error opening reject file %s\n", reject_file);
+      return;
+   }
+
+   // several threads: records are routed by virus so each list has a single writer
+   if (load_threads > 1)
+   {
+      ParallelHandler handler = {route_record, reserve_virus, insert_record, NULL};
+      result = load_parallel(filename, load_threads, &handler, rejects, &stats);
+   }
+   else
+   {
+      result = load_file(filename, process_record, NULL, rejects, &stats);
+   }
+
+   // if file was not opened successfully
+   if (result < 0)
+   {
+      printf("Error opening file");
+   }
+   else if (result == LOAD_STOPPED)
+   {
+      printf("Load stopped after %llu records\n", (unsigned long long)stats.records);
+   }
+   // without -x the load stops at the first record that does not have at least 7 fields
+   else if (result == LOAD_INVALID)
+   {
+      printf("Record format is invalid (line %llu)\n", (unsigned long long)stats.bad_line);
+   }
+   else
+   {
+      printf("Loaded %llu records (%.1f MB) in %.3f s: %.0f records/s, %.1f MB/s\n",
+             (unsigned long long)stats.records, stats.bytes / 1e6, stats.seconds,
+             stats.seconds > 0 ? stats.records / stats.seconds : 0.0,
+             stats.seconds > 0 ? stats.bytes / 1e6 / stats.seconds : 0.0);
+
+      // the pipelined loader also tells how long parsing sat idle waiting for the reader thread
+      if (stats.input_bytes > 0)
+         printf("Read %.1f MB (%s) on a reader thread, the parser waited %.3f s for input\n",
+                stats.input_bytes / 1e6, load_encoding_name(input_encoding), stats.wait_seconds);
+   }
+
+   if (rejects != NULL)
+   {
+      print_rejects();
+      if (reject_close(rejects) != 0)
+         printf("Error while writing reject file %s\n", reject_file);
+      rejects = NULL;
+   }
+}
+
+// implementing print_rejects(...) to count the lines a tolerant load skipped, by kind
+void print_rejects()
+{
+   uint64_t invalid = 0;
+
+   for (RejectKind kind = REJECT_FIELDS; kind <= REJECT_DATE; kind++)
+      invalid += reject_count(rejects, kind);
+
+   printf("Skipped %llu invalid lines (%llu too few fields, %llu bad age, %llu bad status, %llu bad date), "
+          "%llu duplicates and %llu conflicts, listed in %s\n",
+          (unsigned long long)invalid, (unsigned long long)reject_count(rejects, REJECT_FIELDS),
+          (unsigned long long)reject_count(rejects, REJECT_AGE), (unsigned long long)reject_count(rejects, REJECT_STATUS),
+          (unsigned long long)reject_count(rejects, REJECT_DATE), (unsigned long long)reject_count(rejects, REJECT_DUPLICATE),
+          (unsigned long long)reject_count(rejects, REJECT_CONFLICT), reject_file);
+}
+
+// implementing background_loader(...) to size, load and report, it runs on its own
+// thread with -b and is called directly otherwise
+void *background_loader(void *filename)
+{
+   // without an explicit expected count, size every bloom filter from a first pass
+   // (the parallel loader counts the records of every virus on its own)
+   // (the user may quit during the pre-scan, then there is nothing left to load)
+   if (expected_records == 0 && load_threads <= 1 && prescan_records(filename) == LOAD_STOPPED)
+   {
+      printf("Load stopped before it started\n");
+   }
+   else
+   {
+      // if input file provided, load all records from input file
+      load_records(filename);
+      report_memory();
+
+      // the logged changes go on top of a complete load, before changes are let through
+      if (!__atomic_load_n(&stop_loading, __ATOMIC_RELAXED))
+         replay_log();
+   }
+
+   __atomic_store_n(&loading, 0, __ATOMIC_RELEASE);
+   return NULL;
+}
+
+// implementing print_loading_note(...) to tell the user an answer may change
+// because the background load has not reached the end of the file yet
+void print_loading_note(Virus *virus)
+{
+   char note[96];
+
+   if (loading_note(virus, note, sizeof(note)))
+      printf("%s", note);
+}
+
+// implementing loading_note(...) to write the note flagging answers given while the background
+// load is still running, returns 0 (and writes nothing) once it is done
+int loading_note(Virus *virus, char *note, size_t size)
+{
+   if (!__atomic_load_n(&loading, __ATOMIC_ACQUIRE))
+   {
+      return 0;
+   }
+
+   size_t indexed = virus ? index_count(virus->records) : 0;
+   snprintf(note, size, "(load in progress: %zu records indexed for this virus so far)\n", indexed);
+   return 1;
+}
+
+// implementing batch_lookup(...) to hand run_batch(...) the structures of a virus
+int batch_lookup(const char *name, size_t len, BatchTarget *target)
+{
+   Virus *virus = find_virus(name, len);
+
+   if (virus == NULL)
+   {
+      return -1;
+   }
+
+   target->bloom = virus->bloom;
+   target->index = virus->records;
+   target->metrics = &virus->metrics;
+   return virus->index;
+}
+
+// implementing run_batch_mode(...) to answer every query of a file (or stdin for "-")
+// answers go to standard output, the summary goes to standard error
+int run_batch_mode(const char *filename)
+{
+   BatchStats stats;
+
+   // flushing stdio first so the load summary comes before the answers
+   fflush(stdout);
+
+   if (run_batch(filename, batch_lookup, STDOUT_FILENO, &stats) != 0)
+   {
+      fprintf(stderr, "Error while answering queries from %s\n", filename);
+      return 1;
+   }
+
+   fprintf(stderr, "Answered %llu queries in %.3f s (%.0f queries/s): %llu vaccinated, "
+                   "%llu bloom negatives, %llu false positives, %llu unknown\n",
+           (unsigned long long)stats.queries, stats.seconds,
+           stats.seconds > 0 ? stats.queries / stats.seconds : 0.0,
+           (unsigned long long)stats.found, (unsigned long long)stats.negatives,
+           (unsigned long long)stats.false_positives, (unsigned long long)stats.unknown);
+   return 0;
+}
+
+// implementing restore_snapshot(...) to rebuild every virus from a snapshot written by save
+// a stale or damaged snapshot is reported and nothing is loaded
+int restore_snapshot(const char *path)
+{
+   SnapshotEntry *entries;
+   int count;
+   char error[128];
+   struct timespec start, end;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   snapshot = snapshot_load(path, &entries, &count, index_kind, list_seed, error, sizeof(error));
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   if (snapshot == NULL)
+   {
+      printf("Cannot restore %s: %s\n", path, error);
+      return -1;
+   }
+
+   size_t records = 0;
+   for (int i = 0; i < count; i++)
+   {
+      Virus *virus = calloc(1, sizeof(Virus));
+
+      if (virus != NULL)
+      {
+         virus->name = strdup(entries[i].name);
+         virus->len = strlen(entries[i].name);
+         virus->bloom = entries[i].bloom;
+         virus->records = entries[i].index;
+         virus->population = entries[i].population;
+         virus->unvaccinated = entries[i].unvaccinated;
+         virus->dates = date_index_create();
+         if (virus->dates != NULL)
+            index_scan(virus->records, NULL, NULL, add_to_dates, virus);
+      }
+
+      if (virus == NULL || virus->name == NULL || virus->dates == NULL || virus_table_add(virus) < 0)
+      {
+         printf("Error encountered with virus %s\n", entries[i].name);
+         if (virus)
+         {
+            free(virus->name);
+            if (virus->dates)
+               date_index_delete(virus->dates);
+         }
+         free(virus);
+         bloom_delete(entries[i].bloom);
+         index_delete(entries[i].index);
+         population_delete(entries[i].population);
+         unvaccinated_delete(entries[i].unvaccinated);
+         continue;
+      }
+
+      // the bits need the index the virus was just given
+      index_scan(virus->records, NULL, NULL, mark_citizen, virus);
+      records += index_count(virus->records);
+   }
+   free(entries);
+
+   double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   printf("Restored %zu records of %d viruses from %s in %.3f s\n", records, virus_table_count(), path, seconds);
+   report_memory();
+   return 0;
+}
+
+// implementing add_to_dates(...) to put a restored record into its virus's date index
+// and day counts (the snapshot keeps the YES/NO tallies, but not the days)
+int add_to_dates(const Node *node, void *virus)
+{
+   if (node->day != DATE_NONE)
+   {
+      date_index_add(((Virus *)virus)->dates, node);
+      population_add_day(((Virus *)virus)->population, node->day);
+   }
+   return 0;
+}
+
+// implementing mark_citizen(...) to record in a restored record's citizen that its virus stores it
+int mark_citizen(const Node *node, void *virus)
+{
+   return citizen_table_mark(node->citizen, ((Virus *)virus)->index, 1);
+}
+
+// implementing save_snapshot(...) to write every virus to path for a later -r
+int save_snapshot(const char *path)
+{
+   // the lists must not change while they are written out
+   if (__atomic_load_n(&loading, __ATOMIC_ACQUIRE))
+   {
+      printf("Cannot save while the load is in progress\n");
+      return -1;
+   }
+
+   int count = virus_table_count();
+   SnapshotEntry *entries = malloc((count > 0 ? count : 1) * sizeof(SnapshotEntry));
+
+   if (entries == NULL)
+   {
+      printf("Error while saving snapshot to %s\n", path);
+      return -1;
+   }
+
+   for (int i = 0; i < count; i++)
+   {
+      Virus *virus = virus_table_get(i);
+      entries[i].name = virus->name;
+      entries[i].bloom = virus->bloom;
+      entries[i].index = virus->records;
+      entries[i].population = virus->population;
+      entries[i].unvaccinated = virus->unvaccinated;
+   }
+
+   int result = snapshot_save(path, entries, count);
+   free(entries);
+
+   if (result != 0)
+   {
+      printf("Error while saving snapshot to %s\n", path);
+      return -1;
+   }
+
+   printf("Saved %d viruses to %s\n", count, path);
+   return 0;
+}
+
+// implementing report_memory(...) to show how compactly the records are stored
+void report_memory()
+{
+   size_t records = 0;
+   size_t bytes = intern_memory() + virus_table_memory() + citizen_table_memory(); // the shared tables are paid for once
+
+   for (int i = 0; i < virus_table_count(); i++)
+   {
+      records += index_count(virus_table_get(i)->records);
+      bytes += index_memory(virus_table_get(i)->records) + date_index_memory(virus_table_get(i)->dates) +
+               population_memory(virus_table_get(i)->population) + column_store_memory(virus_table_get(i)->columns) +
+               unvaccinated_memory(virus_table_get(i)->unvaccinated);
+   }
+
+   printf("Loaded %zu records of %zu citizens in %zu bytes (%.1f bytes/record)\n",
+          records, citizen_table_count(), bytes, records ? (double)bytes / records : 0.0);
+}
+
+// implementing lookup_citizen(...) to search a virus's index for a citizen the bloom filter may hold,
+// counting the outcome; maybe tells a false positive from a filter negative when NULL comes back
+Node *lookup_citizen(Virus *virus, const char *citizen_id, bool *maybe)
+{
+   uint64_t start = metrics_now();
+   BloomFilter *bloom = __atomic_load_n(&virus->bloom, __ATOMIC_ACQUIRE);
+
+   // if the citizen ID is found in the bloom filter of the virus
+   // (a background load may be setting bits of it right now)
+   *maybe = background_load ? bloom_check_atomic(bloom, citizen_id, strlen(citizen_id))
+                            : bloom_check(bloom, citizen_id, strlen(citizen_id));
+   Node *node = *maybe ? index_search(virus->records, citizen_id) : NULL;
+
+   // counting the outcome before anything is printed, so the latency is the lookup's alone
+   histogram_record(&virus->metrics.check_latency, metrics_now() - start, 1);
+   METRIC_ADD(virus->metrics.checks, 1);
+   METRIC_ADD(virus->metrics.bloom_negatives, !*maybe);
+   METRIC_ADD(virus->metrics.false_positives, *maybe && node == NULL);
+   METRIC_ADD(virus->metrics.found, node != NULL);
+
+   return node;
+}
+
+// implementing check_vaccination_status(...) to check if a citizen is vaccinated for the given virus
+void check_vaccination_status(char *citizen_id, const char *virus_name)
+{
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
+
+   // if the given virus does not exist...
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      print_loading_note(NULL);
+      return;
+   }
+
+   bool maybe;
+   Node *node = lookup_citizen(virus, citizen_id, &maybe);
+
+   if (node)
+   {
+      print_record(node, NULL);
+   }
+   else if (maybe)
+   {
+      printf("False positive from Bloom Filter\n");
+   }
+   else
+   {
+      printf("NOT VACCINATED\n");
+   }
+   print_loading_note(virus);
+}
+
+// defining one page of a list command: the records after a citizen ID, at most limit of them
+typedef struct
+{
+   Writer *out;
+   const char *after; // the ID the previous page ended with, NULL for the first page
+   uint64_t limit;    // records per page, 0 for all of them
+   uint64_t written;
+   const char *last;  // the ID of the last record written
+   int more;          // set once a record past the limit is seen
+} ListPage;
+
+// defining the records a list collects from one scan of its index before writing them out
 typedef struct
 {
-   char *name;
-   BloomFilter *bloom;
-   SkipList *skip_list;
-} Virus;
+   const Node *nodes[LIST_CHUNK];
+   int count;
+   const char *skip; // the ID the previous chunk ended with, where this scan starts again
+} ListChunk;
+
+// collect_node(...) adds a record to a chunk, stopping the scan once the chunk is full
+static int collect_node(const Node *node, void *chunk)
+{
+   ListChunk *list = chunk;
+
+   if (list->skip != NULL && strcmp(node->citizen_id, list->skip) == 0)
+      return 0;
+
+   list->nodes[list->count++] = node;
+   return list->count == LIST_CHUNK;
+}
+
+// implementing parse_list_options(...) to read the words after "list <virus>":
+// "after <citizen_id>" and "limit N", each at most once and in any order
+int parse_list_options(char *words[], int count, const char **after, uint64_t *limit)
+{
+   *after = NULL;
+   *limit = 0;
+
+   for (int i = 0; i < count; i += 2)
+   {
+      char *end;
+
+      if (i + 1 == count)
+         return -1; // an option without its value
+
+      if (strcmp(words[i], "after") == 0 && *after == NULL)
+      {
+         *after = words[i + 1];
+      }
+      else if (strcmp(words[i], "limit") == 0 && *limit == 0)
+      {
+         *limit = strtoull(words[i + 1], &end, 10);
+         if (*end != '\0' || *limit == 0)
+            return -1;
+      }
+      else
+      {
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+// implementing list_vaccinated(...) to write the records of the citizens vaccinated for the
+// given virus to out, in citizen ID order; with after the walk starts with one descent to the
+// first ID past it, and with a limit it stops there and ends with the command of the next page
+void list_vaccinated(const char *virus_name, const char *after, uint64_t limit, Writer *out)
+{
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
+   char note[96];
+
+   // if the given virus does not exist...
+   if (virus == NULL)
+   {
+      writer_puts(out, "Virus not found\n");
+   }
+   else
+   {
+      ListPage page = {out, after, limit, 0, NULL, 0};
+      ListChunk chunk = {.skip = NULL};
+      const char *from = after;
+      int stop = 0;
+
+      // out may be a slow client's socket, so records are collected a chunk at a time
+      // and only written once the scan that found them is over
+      do
+      {
+         chunk.count = 0;
+         index_scan(virus->records, from, NULL, collect_node, &chunk);
+
+         for (int i = 0; i < chunk.count && !stop; i++)
+            stop = write_page_record(chunk.nodes[i], &page);
+
+         if (chunk.count > 0)
+            from = chunk.skip = chunk.nodes[chunk.count - 1]->citizen_id;
+      } while (!stop && chunk.count == LIST_CHUNK);
+
+      if (page.more)
+      {
+         writer_puts(out, "(more: list ");
+         writer_puts(out, virus->name);
+         writer_puts(out, " after ");
+         writer_puts(out, page.last);
+         writer_puts(out, " limit ");
+         writer_put_int(out, limit);
+         writer_puts(out, ")\n");
+      }
+   }
+
+   if (loading_note(virus, note, sizeof(note)))
+      writer_puts(out, note);
+}
+
+// implementing write_page_record(...) to write one record of a page, stopping one record
+// past the limit (so a last page is known to be the last) or once the output fails
+int write_page_record(const Node *node, void *page)
+{
+   ListPage *list = page;
+
+   // the scan starts at the first ID not below after, which the previous page already had
+   if (list->after != NULL && list->written == 0 && strcmp(node->citizen_id, list->after) == 0)
+      return 0;
+
+   if (list->limit > 0 && list->written == list->limit)
+   {
+      list->more = 1;
+      return 1;
+   }
+
+   batch_write_node(list->out, node);
+   list->written++;
+   list->last = node->citizen_id;
+   return list->out->failed;
+}
+
+// implementing export_virus(...) to write every record of a virus to a file as CSV or binary
+void export_virus(const char *virus_name, const char *path, const char *format_name)
+{
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
+   ExportFormat format = EXPORT_CSV;
+   uint64_t records;
+   struct timespec start, end;
+
+   if (format_name != NULL && export_parse_format(format_name, &format) != 0)
+   {
+      printf("Invalid format %s (expected csv|binary)\n", format_name);
+      return;
+   }
+
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      print_loading_note(NULL);
+      return;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   int result = export_records(virus->records, path, format, &records);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   if (result != 0)
+   {
+      printf("Error while exporting %s to %s\n", virus->name, path);
+      return;
+   }
+
+   double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   printf("Exported %llu records of %s to %s (%s) in %.3f s\n", (unsigned long long)records, virus->name, path,
+          export_format_name(format), seconds);
+   print_loading_note(virus);
+}
+
+// implementing print_record(...) to print one record on its own line
+int print_record(const Node *node, void *ctx)
+{
+   char date[DATE_TEXT_LEN];
+   date_format(node->day, date);
+
+   printf("%s %s %s %s %d %s %s %s\n",
+          node->citizen_id, node->citizen->first_name, node->citizen->last_name,
+          node->citizen->country, node->citizen->age, node->virus_name,
+          node->vaccinated, date);
+   return 0;
+}
+
+// implementing list_id_range(...) to display the records with from <= citizen ID <= to
+// the scan starts with one search and then follows the index's ID order
+void list_id_range(const char *virus_name, const char *from, const char *to)
+{
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
+
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      print_loading_note(NULL);
+      return;
+   }
+
+   index_scan(virus->records, from, to, print_record, NULL);
+   print_loading_note(virus);
+}
+
+// print_in_country(...) prints a record if it is from the country given as ctx (NULL for any)
+static int print_in_country(const Node *node, void *ctx)
+{
+   if (ctx == NULL || strcmp(node->citizen->country, ctx) == 0)
+      print_record(node, NULL);
+   return 0;
+}
+
+// implementing list_date_window(...) to display the records vaccinated from <= date <= to,
+// optionally only those of one country, in date order
+void list_date_window(const char *virus_name, const char *from, const char *to, const char *country)
+{
+   int32_t first = date_parse(from, strlen(from));
+   int32_t last = date_parse(to, strlen(to));
+
+   if (first == DATE_NONE || last == DATE_NONE)
+   {
+      printf("Invalid date (expected YYYY-MM-DD)\n");
+      return;
+   }
+
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
+
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      print_loading_note(NULL);
+      return;
+   }
+
+   date_index_window(virus->dates, first, last, print_in_country, (void *)country);
+   print_loading_note(virus);
+}
+
+// implementing columns_for(...) to give the column store of a virus, building it again
+// when a record was added or removed since it was built; NULL when memory ran out
+// only the prompt calls it, so the store needs no lock
+ColumnStore *columns_for(Virus *virus, int *rebuilt)
+{
+   ColumnStore *columns = virus->columns;
+
+   *rebuilt = 0;
+   if (columns != NULL && columns->count == index_count(virus->records) && columns->stamp == virus->removals)
+      return columns;
+
+   *rebuilt = 1;
+   column_store_delete(columns);
+   virus->columns = columns = column_store_build(virus->records);
+   if (columns != NULL)
+      columns->stamp = virus->removals;
+   return columns;
+}
+
+// implementing parse_filter(...) to read the words after "filter <virus>": "age A-B" (or "A-"
+// for A and over), "country C", "from D", "to D" and "count", each at most once
+int parse_filter(char *words, ColumnFilter *filter, int *count_only)
+{
+   char *save, *end;
+   int seen_age = 0, seen_from = 0, seen_to = 0;
+
+   column_filter_init(filter);
+   *count_only = 0;
+
+   for (char *word = strtok_r(words, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save))
+   {
+      if (strcmp(word, "count") == 0 && !*count_only)
+      {
+         *count_only = 1;
+         continue;
+      }
+
+      char *value = strtok_r(NULL, " \t\r\n", &save);
+      if (value == NULL)
+         return -1; // an option without its value
+
+      if (strcmp(word, "age") == 0 && !seen_age)
+      {
+         long min = strtol(value, &end, 10), max = COLUMN_AGE_MAX;
+         if (end == value || *end != '-')
+            return -1;
+         if (end[1] != '\0')
+         {
+            value = end + 1;
+            max = strtol(value, &end, 10);
+            if (*end != '\0')
+               return -1;
+         }
+         if (min < 0 || max > COLUMN_AGE_MAX || min > max)
+            return -1;
+         filter->min_age = min;
+         filter->max_age = max;
+         seen_age = 1;
+      }
+      else if (strcmp(word, "country") == 0 && !filter->by_country)
+      {
+         // a country no record has is no intern string either, and matches nothing
+         const char *country = intern_find(value, strlen(value));
+         filter->by_country = 1;
+         filter->country = country ? intern_id(country) : COLUMN_NO_COUNTRY;
+      }
+      else if ((strcmp(word, "from") == 0 && !seen_from) || (strcmp(word, "to") == 0 && !seen_to))
+      {
+         int32_t day = date_parse(value, strlen(value));
+         if (day == DATE_NONE)
+            return -1;
+         if (word[0] == 'f')
+            filter->from_day = day, seen_from = 1;
+         else
+            filter->to_day = day, seen_to = 1;
+      }
+      else
+      {
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+// implementing filter_records(...) to list (or with "count" only count) the records of a virus
+// passing the predicates typed after its name, in citizen ID order, by a scan of its columns
+void filter_records(const char *virus_name, char *predicates)
+{
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
+   ColumnFilter filter;
+   int count_only, rebuilt;
+   struct timespec start, built, end;
+
+   if (parse_filter(predicates, &filter, &count_only) != 0)
+   {
+      printf("Usage: filter <virus> [age <min>-[max]] [country <name>] [from <date>] [to <date>] [count]\n");
+      return;
+   }
+
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      print_loading_note(NULL);
+      return;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   ColumnStore *columns = columns_for(virus, &rebuilt);
+   clock_gettime(CLOCK_MONOTONIC, &built);
+
+   if (columns == NULL)
+   {
+      printf("Error while building the columns of %s\n", virus->name);
+      return;
+   }
+
+   size_t matches;
+   if (count_only)
+   {
+      matches = column_store_filter(columns, &filter, NULL, NULL);
+   }
+   else
+   {
+      // the records bypass stdio, so what printf holds goes out first
+      Writer out;
+      ListPage page = {&out, NULL, 0, 0, NULL, 0};
+
+      fflush(stdout);
+      if (writer_init(&out, STDOUT_FILENO, WRITER_DEFAULT_SIZE) != 0)
+      {
+         printf("Error while allocating the output buffer\n");
+         return;
+      }
+      matches = column_store_filter(columns, &filter, write_page_record, &page);
+      writer_close(&out);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   double seconds = (end.tv_sec - built.tv_sec) + (end.tv_nsec - built.tv_nsec) / 1e9;
+   printf("%zu of %zu records matched in %.3f ms (%.0f M rows/s, %s)", matches, columns->count, seconds * 1e3,
+          seconds > 0 ? columns->count / seconds / 1e6 : 0.0, column_filter_kernel());
+   if (rebuilt)
+      printf(", columns built in %.3f ms", ((built.tv_sec - start.tv_sec) + (built.tv_nsec - start.tv_nsec) / 1e9) * 1e3);
+   printf("\n");
+   print_loading_note(virus);
+}
+
+// percent(...) gives part as a percentage of whole, 0 for an empty whole
+static double percent(uint64_t part, uint64_t whole)
+{
+   return whole ? 100.0 * part / whole : 0.0;
+}
+
+// implementing print_stats(...) to show how long the searches of every index are, how its
+// checks were answered and how long loading and checking took
+// a skip list with a good shape compares about 2 log2(records) keys per search,
+// a B+-tree about log2(records) (a binary search per node)
+void print_stats()
+{
+   for (int i = 0; i < virus_table_count(); i++)
+   {
+      Virus *virus = virus_table_get(i);
+      VirusMetrics *metrics = &virus->metrics;
+      IndexStats stats;
+      index_stats(virus->records, &stats);
+
+      printf("%s: %zu records in a %s, %d of %d levels, %llu searches, %.1f keys compared and "
+             "%.1f levels per search\n",
+             virus->name, stats.records, index_kind_name(index_kind), stats.height,
+             stats.max_height, (unsigned long long)stats.searches,
+             stats.searches ? (double)stats.search_steps / stats.searches : 0.0,
+             stats.searches ? (double)stats.search_levels / stats.searches : 0.0);
+
+      if (!METRICS_ENABLED)
+         continue;
+
+      uint64_t negatives = __atomic_load_n(&metrics->bloom_negatives, __ATOMIC_RELAXED);
+      uint64_t false_positives = __atomic_load_n(&metrics->false_positives, __ATOMIC_RELAXED);
+      printf("   %llu checks: %llu found, %llu stopped by the bloom filter (%d probes each), "
+             "%llu false positives (%.2f%% of absent IDs)\n",
+             (unsigned long long)__atomic_load_n(&metrics->checks, __ATOMIC_RELAXED),
+             (unsigned long long)__atomic_load_n(&metrics->found, __ATOMIC_RELAXED),
+             (unsigned long long)negatives, virus->bloom->num_hashes, (unsigned long long)false_positives,
+             percent(false_positives, negatives + false_positives));
+      printf("   check latency p50 <= %llu ns, p99 <= %llu ns; load latency p50 <= %llu ns, p99 <= %llu ns\n",
+             (unsigned long long)histogram_percentile(&metrics->check_latency, 50),
+             (unsigned long long)histogram_percentile(&metrics->check_latency, 99),
+             (unsigned long long)histogram_percentile(&metrics->load_latency, 50),
+             (unsigned long long)histogram_percentile(&metrics->load_latency, 99));
+
+      if (__atomic_load_n(&metrics->change_latency.count, __ATOMIC_RELAXED) > 0)
+         printf("   %llu changes (insert, update, delete): latency p50 <= %llu ns, p99 <= %llu ns\n",
+                (unsigned long long)__atomic_load_n(&metrics->change_latency.count, __ATOMIC_RELAXED),
+                (unsigned long long)histogram_percentile(&metrics->change_latency, 50),
+                (unsigned long long)histogram_percentile(&metrics->change_latency, 99));
+   }
+
+   if (wal != NULL)
+   {
+      pthread_mutex_lock(&wal->lock);
+      printf("Log %s: %llu changes appended, %llu on disk after %llu fsyncs (%.1f changes per fsync)\n",
+             wal_file, (unsigned long long)wal->appended, (unsigned long long)wal->durable,
+             (unsigned long long)wal->syncs, wal->syncs ? (double)wal->durable / wal->syncs : 0.0);
+      pthread_mutex_unlock(&wal->lock);
+   }
+
+   if (!METRICS_ENABLED)
+      printf("(check counters and latencies are compiled out, rebuild without METRICS=0)\n");
+   print_loading_note(NULL);
+}
+
+// implementing dump_metrics(...) to write one key=value line per virus plus one for every
+// virus together, so a log of periodic dumps can be graphed with a script
+void dump_metrics(FILE *out)
+{
+   Histogram check_total, load_total, change_total;
+   memset(&check_total, 0, sizeof(check_total));
+   memset(&load_total, 0, sizeof(load_total));
+   memset(&change_total, 0, sizeof(change_total));
+   long now = (long)time(NULL);
+
+   for (int i = 0; i < virus_table_count(); i++)
+   {
+      Virus *virus = virus_table_get(i);
+      VirusMetrics *metrics = &virus->metrics;
+      IndexStats stats;
+      index_stats(virus->records, &stats);
+
+      fprintf(out, "metrics time=%ld virus=%s records=%zu searches=%llu search_steps=%llu search_levels=%llu "
+                   "checks=%llu found=%llu bloom_negatives=%llu false_positives=%llu",
+              now, virus->name, stats.records, (unsigned long long)stats.searches,
+              (unsigned long long)stats.search_steps, (unsigned long long)stats.search_levels,
+              (unsigned long long)__atomic_load_n(&metrics->checks, __ATOMIC_RELAXED),
+              (unsigned long long)__atomic_load_n(&metrics->found, __ATOMIC_RELAXED),
+              (unsigned long long)__atomic_load_n(&metrics->bloom_negatives, __ATOMIC_RELAXED),
+              (unsigned long long)__atomic_load_n(&metrics->false_positives, __ATOMIC_RELAXED));
+      histogram_print(out, "check", &metrics->check_latency);
+      histogram_print(out, "load", &metrics->load_latency);
+      histogram_print(out, "change", &metrics->change_latency);
+      fprintf(out, "\n");
+
+      histogram_merge(&check_total, &metrics->check_latency);
+      histogram_merge(&load_total, &metrics->load_latency);
+      histogram_merge(&change_total, &metrics->change_latency);
+   }
+
+   fprintf(out, "metrics time=%ld virus=*", now);
+   histogram_print(out, "check", &check_total);
+   histogram_print(out, "load", &load_total);
+   histogram_print(out, "change", &change_total);
+   fprintf(out, "\n");
+
+   if (wal != NULL)
+   {
+      pthread_mutex_lock(&wal->lock);
+      fprintf(out, "metrics time=%ld wal=%s appended=%llu durable=%llu syncs=%llu bytes=%llu\n", now, wal_file,
+              (unsigned long long)wal->appended, (unsigned long long)wal->durable,
+              (unsigned long long)wal->syncs, (unsigned long long)wal->bytes);
+      pthread_mutex_unlock(&wal->lock);
+   }
+   fflush(out);
+}
+
+// implementing metrics_dumper(...) to call dump_metrics(...) every dump_interval seconds until exit
+void *metrics_dumper(void *arg)
+{
+   struct timespec tick = {0, 100000000}; // checking for exit every 100 ms
+   int ticks = 0;
+
+   while (!__atomic_load_n(&stop_dumping, __ATOMIC_RELAXED))
+   {
+      nanosleep(&tick, NULL);
+      if (++ticks == dump_interval * 10)
+      {
+         dump_metrics(stderr);
+         ticks = 0;
+      }
+   }
+
+   return NULL;
+}
+
+// implementing print_population(...) to show how many records of a virus said YES and NO,
+// overall and per age band, for one country or for all of them
+// the counters are kept while loading, so this reads a few numbers whatever the record count
+void print_population(const char *virus_name, const char *country)
+{
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
 
-Virus viruses[MAX_VIRUSES]; // initializing global array viruses[] to contain all viruses
-int virus_count = 0;        // initializing global var virus count to zero
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      print_loading_note(NULL);
+      return;
+   }
 
-/*
-   function declarations
-*/
-Virus *create_virus(const char *name); // function to create a new virus
-Virus *find_virus(const char *name);   // function to find an existing virus
-void process_record(char *citizen_id, char *first_name, char *last_name, char *country,
-                    int age, char *virus_name, char *vaccinated, char *date); // function to process a new vaccination record
-void load_records(const char *filename);                                      // function to load vaccination records from a file
-void check_vaccination_status(char *citizen_id, const char *virus_name);      // function to check vaccination status
-void list_vaccinated(const char *virus_name);                                 // function to list all vaccination records for a given virus
-void run();                                                                   // function to enable user interaction
+   PopulationCounts counts;
+   if (population_get(virus->population, country, &counts) != 0)
+   {
+      printf("No records of %s in %s\n", virus_name, country);
+      print_loading_note(virus);
+      return;
+   }
 
-// driver function
-int main(int argc, char *argv[])
+   uint64_t yes = 0, no = 0;
+   for (int band = 0; band < POPULATION_AGE_BANDS; band++)
+   {
+      yes += counts.yes[band];
+      no += counts.no[band];
+   }
+
+   printf("%s%s%s: %llu of %llu citizens vaccinated (%.1f%%)\n", virus_name, country ? " in " : "",
+          country ? country : "", (unsigned long long)yes, (unsigned long long)(yes + no), percent(yes, yes + no));
+
+   for (int band = 0; band < POPULATION_AGE_BANDS; band++)
+   {
+      uint64_t total = counts.yes[band] + counts.no[band];
+      if (total == 0)
+         continue;
+
+      int from = band * POPULATION_BAND_YEARS;
+      if (band == POPULATION_AGE_BANDS - 1)
+         printf("   ages %d+: ", from);
+      else
+         printf("   ages %d-%d: ", from, from + POPULATION_BAND_YEARS - 1);
+      printf("%llu of %llu (%.1f%%)\n", (unsigned long long)counts.yes[band], (unsigned long long)total,
+             percent(counts.yes[band], total));
+   }
+   print_loading_note(virus);
+}
+
+// implementing print_coverage(...) to show how many citizens were vaccinated on or before a date
+// the vaccinations are counted per day while loading, so this is one binary search
+void print_coverage(const char *virus_name, const char *date)
 {
-   // check if user provided input file as an argument
-   if (argc != 2)
+   int32_t day = date_parse(date, strlen(date));
+
+   if (day == DATE_NONE)
    {
-      printf("Usage: %s <input_file>\n", argv[0]);
-      return 1;
+      printf("Invalid date (expected YYYY-MM-DD)\n");
+      return;
    }
 
-   // if input file provided, load all records from input file
-   load_records(argv[1]);
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
 
-   // start user interaction
-   run();
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      print_loading_note(NULL);
+      return;
+   }
 
-   // cleaning up allocated memory
-   for (int i = 0; i < virus_count; i++)
+   PopulationCounts counts;
+   uint64_t citizens = 0;
+   population_get(virus->population, NULL, &counts);
+   for (int band = 0; band < POPULATION_AGE_BANDS; band++)
    {
-      free(viruses[i].name);
-      bloom_delete(viruses[i].bloom);
-      list_delete(viruses[i].skip_list);
+      citizens += counts.yes[band] + counts.no[band];
    }
 
-   return 0;
+   uint64_t vaccinated = population_vaccinated_by(virus->population, day);
+   printf("%s: %llu of %llu citizens vaccinated by %s (%.1f%%)\n", virus_name, (unsigned long long)vaccinated,
+          (unsigned long long)citizens, date, percent(vaccinated, citizens));
+   print_loading_note(virus);
 }
 
-// implementing create_virus(...) to create a new virus
-Virus *create_virus(const char *name)
+// implementing print_citizen_status(...) to list the viruses a citizen is vaccinated against,
+// read from the citizen's bitmap in the citizen table instead of probing every virus;
+// an ID whose lines disagree on the personal fields gets one line per version of them
+// that some virus stores
+void print_citizen_status(const char *citizen_id)
 {
-   // if we can't add more viruses...
-   if (virus_count >= MAX_VIRUSES)
+   Citizen *citizen = citizen_table_find(citizen_id, strlen(citizen_id));
+   int printed = 0;
+
+   for (; citizen != NULL; citizen = __atomic_load_n(&citizen->variant, __ATOMIC_ACQUIRE))
    {
-      return NULL;
+      int known = virus_table_count();
+      int viruses[known > 0 ? known : 1];
+      int count = citizen_table_viruses(citizen, viruses, known);
+
+      // a virus published after known was read is left out, as if the record came a moment later
+      if (count > known)
+         count = known;
+      while (count > 0 && viruses[count - 1] >= known)
+         count--;
+      if (count == 0)
+         continue;
+
+      printf("%s %s %s %s %d:", citizen->citizen_id, citizen->first_name, citizen->last_name, citizen->country,
+             citizen->age);
+      for (int i = 0; i < count; i++)
+         printf(" %s", virus_table_get(viruses[i])->name);
+      printf("\n");
+      printed++;
    }
 
-   // if we can...
-   Virus *virus = &viruses[virus_count++];  // create new Virus
-   virus->name = strdup(name);              // set virus's name
-   virus->bloom = bloom_create(BLOOM_SIZE); // create a new bloom filter for the virus
-   virus->skip_list = list_create(5);       // create a new skip list for the virus
+   if (printed == 0)
+      printf("%s is not vaccinated against any virus\n", citizen_id);
+   print_loading_note(NULL);
+}
 
-   return virus;
+// changes_blocked(...) refuses a change while the background load is still filling the viruses,
+// which would race with the load's single writer per virus
+static int changes_blocked(void)
+{
+   if (__atomic_load_n(&loading, __ATOMIC_ACQUIRE))
+   {
+      printf("Cannot change records while the load is in progress\n");
+      return 1;
+   }
+
+   return 0;
 }
 
-// implementing find_virus(...) to find an existing virus
-Virus *find_virus(const char *name)
+// defining the outcomes of a change, apply_change(...) reports one and the commands print it
+typedef enum
+{
+   CHANGE_INSERTED, // a YES record was stored
+   CHANGE_COUNTED,  // a NO record was counted
+   CHANGE_EXISTS,   // insert of a citizen who already has a record for the virus
+   CHANGE_UPDATED,  // update replaced a stored record
+   CHANGE_ADDED,    // update of a citizen who had no stored record
+   CHANGE_DELETED,  // delete removed a record
+   CHANGE_MISSING,  // delete of a citizen who has no record for the virus
+   CHANGE_FAILED    // the record or its virus could not be set up
+} ChangeResult;
+
+// parse_change(...) parses the record fields typed after insert or update (len bytes) and
+// copies the citizen ID into citizen_id (size bytes), returns NULL when the record is valid
+// and the reason it is not otherwise
+static const char *parse_change(const char *fields, size_t len, Record *record, char *citizen_id, size_t size)
 {
-   for (int i = 0; i < virus_count; i++)
+   RejectKind kind;
+
+   if (validate_record(fields, fields + len, record, &kind) != 0)
    {
-      if (strcmp(viruses[i].name, name) == 0)
-         return &viruses[i];
+      return kind == REJECT_DATE ? "Invalid date (expected YYYY-MM-DD)"
+                                 : "Invalid record (expected <citizen_id> <first> <last> <country> <age> <virus> YES|NO [date])";
    }
 
+   if (record->citizen_id.len >= size)
+   {
+      return "Citizen ID too long";
+   }
+
+   memcpy(citizen_id, record->citizen_id.str, record->citizen_id.len);
+   citizen_id[record->citizen_id.len] = '\0';
    return NULL;
 }
 
-// implementing process_record(...) to process a vaccination record from start to finish
-void process_record(char *citizen_id, char *first_name, char *last_name,
-                    char *country, int age, char *virus_name, char *vaccinated,
-                    char *date)
+// virus_for_change(...) finds the virus of a typed record, creating it with a filter sized for
+// NEW_VIRUS_RECORDS when -e did not give a size (the pre-scan only sized the file's viruses)
+static Virus *virus_for_change(const Record *record)
 {
-   Virus *virus = find_virus(virus_name);
+   Virus *virus = find_virus(record->virus_name.str, record->virus_name.len);
 
-   // create virus if it does not already exist
    if (virus == NULL)
    {
-      virus = create_virus(virus_name);
+      pthread_mutex_lock(&registry_lock);
+      virus = find_virus(record->virus_name.str, record->virus_name.len);
+      if (virus == NULL)
+         virus = create_virus(record->virus_name.str, record->virus_name.len,
+                              expected_records ? expected_records : NEW_VIRUS_RECORDS);
+      pthread_mutex_unlock(&registry_lock);
    }
 
-   // if virus is not created for some reason...
-   if (!virus)
+   return virus;
+}
+
+// apply_change(...) applies a parsed insert or update to the record's virus, timing it;
+// an insert of a citizen who already has a YES or NO record for the virus is refused, an
+// update takes the citizen's old records out (a YES from every structure, a NO from the NO
+// set and the tallies it was counted in) and adds the new record like an insert
+static ChangeResult apply_change(WalOp op, const Record *record, const char *citizen_id)
+{
+   Virus *virus = virus_for_change(record);
+
+   if (virus == NULL)
+   {
+      return CHANGE_FAILED;
+   }
+
+   uint64_t start = metrics_now();
+   ChangeResult result;
+
+   if (op == WAL_INSERT)
+   {
+      if (index_search(virus->records, citizen_id) != NULL ||
+          unvaccinated_find(virus->unvaccinated, citizen_id, strlen(citizen_id), NULL) == 0)
+         return CHANGE_EXISTS;
+
+      result = add_record(virus, record) != NULL ? CHANGE_INSERTED : CHANGE_COUNTED;
+   }
+   else
+   {
+      int removed = remove_citizen(virus, citizen_id);
+      add_record(virus, record);
+      result = removed ? CHANGE_UPDATED : CHANGE_ADDED;
+   }
+
+   histogram_record(&virus->metrics.change_latency, metrics_now() - start, 1);
+   return result;
+}
+
+// apply_delete(...) removes a citizen's YES or NO record for a virus, timing it
+static ChangeResult apply_delete(Virus *virus, const char *citizen_id)
+{
+   uint64_t start = metrics_now();
+   int removed = remove_citizen(virus, citizen_id);
+   histogram_record(&virus->metrics.change_latency, metrics_now() - start, 1);
+
+   return removed ? CHANGE_DELETED : CHANGE_MISSING;
+}
+
+// log_change(...) appends an applied change to the log (-w), the next group commit makes it durable
+static void log_change(WalOp op, const char *text, size_t len)
+{
+   if (wal != NULL && wal_append(wal, op, text, len) == 0)
+   {
+      printf("Warning: the change could not be written to %s and will not survive a restart\n", wal_file);
+   }
+}
+
+// change_citizen(...) runs an insert or update typed at the prompt and prints its outcome
+static void change_citizen(WalOp op, const char *fields)
+{
+   Record record;
+   char citizen_id[64];
+
+   if (changes_blocked())
+   {
+      return;
+   }
+
+   // the fields end where the typed line does, without its newline
+   size_t len = strcspn(fields, "\r\n");
+   const char *error = parse_change(fields, len, &record, citizen_id, sizeof(citizen_id));
+   if (error != NULL)
    {
-      printf("Error encountered with virus %s", virus_name);
+      printf("%s\n", error);
       return;
    }
 
-   // if citizen is vaccinated, add citizen to the virus's bloom filter and skip list
-   if (strcmp(vaccinated, "YES") == 0)
+   ChangeResult result = apply_change(op, &record, citizen_id);
+   if (result != CHANGE_EXISTS && result != CHANGE_FAILED)
    {
-      bloom_insert(virus->bloom, citizen_id);
-      list_insert(virus->skip_list, citizen_id, first_name, last_name,
-                  country, age, virus_name, vaccinated, date);
+      log_change(op, fields, len);
+   }
+
+   switch (result)
+   {
+   case CHANGE_INSERTED:
+      printf("Record inserted\n");
+      break;
+   case CHANGE_COUNTED:
+      printf("Record counted (unvaccinated records are only counted, not stored)\n");
+      break;
+   case CHANGE_EXISTS:
+      printf("Citizen %s already has a record for %.*s (use update)\n", citizen_id, (int)record.virus_name.len,
+             record.virus_name.str);
+      break;
+   case CHANGE_UPDATED:
+      printf("Record updated\n");
+      break;
+   case CHANGE_ADDED:
+      printf("Record added\n");
+      break;
+   default:
+      printf("Error encountered with virus %.*s\n", (int)record.virus_name.len, record.virus_name.str);
+      break;
    }
 }
 
-// implementing load_records(...) to read records from file
-void load_records(const char *filename)
+// implementing insert_citizen(...) to add a record typed at the prompt, in the format of the input file
+// a citizen who already has a record for the virus is refused, update replaces it
+void insert_citizen(const char *fields)
 {
-   FILE *file = fopen(filename, "r");
+   change_citizen(WAL_INSERT, fields);
+}
 
-   // if file was not opened successfully
-   if (!file)
+// implementing update_citizen(...) to replace a citizen's record for a virus with the typed one
+void update_citizen(const char *fields)
+{
+   change_citizen(WAL_UPDATE, fields);
+}
+
+// implementing delete_citizen(...) to remove a citizen's vaccination record for a virus
+void delete_citizen(const char *citizen_id, const char *virus_name)
+{
+   if (changes_blocked())
    {
-      printf("Error opening file");
       return;
    }
 
-   char line[256]; // setting a 256 character limit for a line
+   Virus *virus = find_virus(virus_name, strlen(virus_name));
+
+   if (virus == NULL)
+   {
+      printf("Virus not found\n");
+      return;
+   }
 
-   while (fgets(line, sizeof(line), file))
+   if (apply_delete(virus, citizen_id) == CHANGE_DELETED)
+   {
+      char text[128];
+      int len = snprintf(text, sizeof(text), "%s %s", citizen_id, virus_name);
+      log_change(WAL_DELETE, text, len);
+      printf("Record deleted\n");
+   }
+   else
    {
-      // initializing strings and int to read data into
-      char citizen_id[50], first_name[50], last_name[50], country[50];
-      char virus_name[50], vaccinated[10], date[20] = "";
-      int age;
+      printf("No record of %s for %s\n", citizen_id, virus_name);
+   }
+}
 
-      // sscanf(...) parses one line (record) according to given string
-      // into the data variables and returns number of successfully assigned variables
-      int fields = sscanf(line, "%s %s %s %s %d %s %s %s",
-                          citizen_id, first_name, last_name, country,
-                          &age, virus_name, vaccinated, date);
+// implementing replay_change(...) to apply one change read back from the log, quietly
+// every logged change was applied once, so it applies again on top of the same base;
+// ctx counts the ones that no longer do (which would mean the base was edited in place)
+int replay_change(WalOp op, const char *text, size_t len, void *ctx)
+{
+   char citizen_id[64], virus_name[64];
+   ChangeResult result = CHANGE_FAILED;
 
-      // check if the format of the record is valid (at least 7 fields)
-      if (fields >= 7)
-      {
-         process_record(citizen_id, first_name, last_name, country,
-                        age, virus_name, vaccinated,
-                        (fields == 8) ? date : NULL);
-      }
-      else
+   if (op == WAL_DELETE)
+   {
+      char line[128];
+      Virus *virus;
+
+      if (len < sizeof(line))
       {
-         printf("Record format is invalid");
-         return;
+         memcpy(line, text, len);
+         line[len] = '\0';
+         if (sscanf(line, "%63s %63s", citizen_id, virus_name) == 2 &&
+             (virus = find_virus(virus_name, strlen(virus_name))) != NULL)
+            result = apply_delete(virus, citizen_id);
       }
    }
+   else
+   {
+      Record record;
+      if (parse_change(text, len, &record, citizen_id, sizeof(citizen_id)) == NULL)
+         result = apply_change(op, &record, citizen_id);
+   }
+
+   if (result == CHANGE_EXISTS || result == CHANGE_MISSING || result == CHANGE_FAILED)
+   {
+      (*(uint64_t *)ctx)++;
+   }
 
-   fclose(file); // close file
+   return 0;
 }
 
-// implementing check_vaccination_status(...) to check if a citizen is vaccinated for the given virus
-void check_vaccination_status(char *citizen_id, const char *virus_name)
+// implementing replay_log(...) to apply the changes logged with -w on top of the freshly loaded base
+void replay_log()
 {
-   // loop through all viruses
-   for (int i = 0; i < virus_count; i++)
+   uint64_t entries, skipped = 0;
+   struct timespec start, end;
+
+   if (wal == NULL)
    {
-      // if given virus name matches any of the existing viruses...
-      if (strcmp(viruses[i].name, virus_name) == 0)
-      {
-         // if the citizen ID is found in the bloom filter of the virus
-         if (bloom_check(viruses[i].bloom, citizen_id))
-         {
-            Node *node = list_search(viruses[i].skip_list, citizen_id);
-            if (node)
-            {
-               printf("%s %s %s %s %d %s %s %s\n",
-                      node->citizen_id, node->first_name, node->last_name,
-                      node->country, node->age, node->virus_name,
-                      node->vaccinated, node->date ? node->date : "");
-            }
-            else
-            {
-               printf("False positive from Bloom Filter\n");
-            }
-         }
-         else
-         {
-            printf("NOT VACCINATED\n");
-         }
-         return;
-      }
+      return;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   int result = wal_replay(wal, replay_change, &skipped, &entries);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   if (result != 0)
+   {
+      printf("Error while replaying log %s after %llu changes\n", wal_file, (unsigned long long)entries);
+      return;
    }
-   printf("Virus not found\n"); // if virus was not found
+
+   double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   printf("Replayed %llu changes from %s in %.3f s\n", (unsigned long long)entries, wal_file, seconds);
+   if (skipped > 0)
+      printf("(%llu of them no longer applied, was the base file changed?)\n", (unsigned long long)skipped);
 }
 
-// implementing list_vaccinated(...) to display records of all citizens that are
-// vaccinated for the given virus
-void list_vaccinated(const char *virus_name)
+// implementing compact_log(...) to save every virus to a snapshot and restart the log on it,
+// so a restart with -r path -w log_file loads the snapshot and replays only the newer changes
+void compact_log(const char *path)
 {
-   // loop through all the viruses
-   for (int i = 0; i < virus_count; i++)
+   if (wal == NULL)
    {
-      // if given virus exists
-      if (strcmp(viruses[i].name, virus_name) == 0)
-      {
-         // start at head node of the skip list and move to the first node at level 0
-         Node *node = viruses[i].skip_list->head->next[0];
+      printf("No log to compact (start with -w <log_file>)\n");
+      return;
+   }
 
-         // continue as long as there is a node
-         while (node)
-         {
-            // print the records
-            printf("%s %s %s %s %d %s %s %s\n",
-                   node->citizen_id, node->first_name, node->last_name,
-                   node->country, node->age, node->virus_name,
-                   node->vaccinated, node->date ? node->date : "");
-
-            // move to the next node
-            node = node->next[0];
-         }
-         return;
-      }
+   // changes are only made by this thread, so none can slip in between the two steps
+   if (save_snapshot(path) != 0)
+   {
+      return;
+   }
+
+   if (wal_reset(wal, path) != 0)
+   {
+      printf("Error while restarting log %s on %s, it still applies to the old base\n", wal_file, path);
+      return;
+   }
+
+   printf("Compacted the log into %s, restart with -r %s -w %s\n", path, path, wal_file);
+}
+
+// implementing serve_request(...) to answer a check or list request of a server client
+// with the lines the prompt would print; the server workers call it concurrently, and
+// it only reads the viruses, like the queries answered during a background load
+void serve_request(const char *line, size_t len, Writer *out, void *ctx)
+{
+   char text[SERVER_MAX_LINE + 1], command[20], arg1[50], arg2[50], arg3[50], arg4[50], arg5[50];
+   char *options[] = {arg2, arg3, arg4, arg5};
+   const char *after;
+   uint64_t limit;
+   char note[96];
+
+   memcpy(text, line, len);
+   text[len] = '\0';
+
+   int args = sscanf(text, "%19s %49s %49s %49s %49s %49s", command, arg1, arg2, arg3, arg4, arg5) - 1;
+   Virus *virus = NULL;
+
+   // a line of other whitespace (or one starting with a NUL) has no command to compare
+   if (args < 0)
+   {
+      writer_puts(out, "Unknown command\n");
+      return;
+   }
+
+   if (strcmp(command, "check") == 0 && args == 2)
+   {
+      bool maybe;
+
+      virus = find_virus(arg2, strlen(arg2));
+      Node *node = virus ? lookup_citizen(virus, arg1, &maybe) : NULL;
+
+      if (virus == NULL)
+         writer_puts(out, "Virus not found\n");
+      else if (node)
+         batch_write_node(out, node);
+      else if (maybe)
+         writer_puts(out, "False positive from Bloom Filter\n");
+      else
+         writer_puts(out, "NOT VACCINATED\n");
+   }
+   else if (strcmp(command, "list") == 0 && args >= 1 && parse_list_options(options, args - 1, &after, &limit) == 0)
+   {
+      list_vaccinated(arg1, after, limit, out); // writes its own loading note
+      return;
+   }
+   else if (strcmp(command, "check") == 0)
+   {
+      writer_puts(out, "Usage: check <citizen_id> <virus>\n");
+      return;
+   }
+   else if (strcmp(command, "list") == 0)
+   {
+      writer_puts(out, "Usage: list <virus> [after <citizen_id>] [limit N]\n");
+      return;
+   }
+   else
+   {
+      writer_puts(out, "Unknown command\n");
+      return;
+   }
+
+   if (loading_note(virus, note, sizeof(note)))
+      writer_puts(out, note);
+}
+
+// implementing run_server_mode(...) to answer check and list requests from clients on
+// server_address until the program gets SIGINT or SIGTERM
+int run_server_mode()
+{
+   char error[128];
+   int workers = server_workers > 0 ? server_workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+   int signal_number;
+
+   if (workers < 1)
+      workers = 1;
+
+   Server *server = server_start(server_address, workers, serve_request, NULL, error, sizeof(error));
+
+   if (server == NULL)
+   {
+      printf("Cannot serve on %s: %s\n", server_address, error);
+      return 1;
    }
-   printf("Virus not found\n"); // if virus not found
+
+   printf("Serving check and list requests on %s with %d workers (Ctrl-C stops)\n", server_address, workers);
+   fflush(stdout);
+
+   // every thread blocks the stop signals (see main), so they wait here
+   sigwait(&stop_signals, &signal_number);
+
+   uint64_t requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+   pthread_mutex_lock(&server->lock);
+   uint64_t accepted = server->accepted;
+   pthread_mutex_unlock(&server->lock);
+   server_stop(server);
+
+   printf("Served %llu requests on %llu connections\n", (unsigned long long)requests, (unsigned long long)accepted);
+   return 0;
 }
 
 void run()
@@ -237,33 +2173,170 @@ void run()
    printf("\nVaccination Records Management System\n");
    printf("\nCommands:\n");
    printf("\tcheck <citizen_id> <virus>\n");
-   printf("\tlist <virus>\n");
+   printf("\tlist <virus> [after <citizen_id>] [limit N]\n");
+   printf("\trange <virus> <from_id> <to_id>\n");
+   printf("\tbetween <virus> <from_date> <to_date> [country]\n");
+   printf("\tsave <snapshot_file>\n");
+   printf("\tstats [<virus> [country]]\n");
+   printf("\tcoverage <virus> <date>\n");
+   printf("\tstatus <citizen_id>\n");
+   printf("\tinsert <citizen_id> <first> <last> <country> <age> <virus> YES|NO [date]\n");
+   printf("\tupdate <citizen_id> <first> <last> <country> <age> <virus> YES|NO [date]\n");
+   printf("\tdelete <citizen_id> <virus>\n");
+   printf("\tcompact <snapshot_file>\n");
+   printf("\texport <virus> <file> [csv|binary]\n");
+   printf("\tfilter <virus> [age <min>-[max]] [country <name>] [from <date>] [to <date>] [count]\n");
    printf("\texit\n");
 
-   char command[20], arg1[50], arg2[50];
+   char line[256], command[20], arg1[50], arg2[50], arg3[50], arg4[50], arg5[50];
+   char *options[] = {arg2, arg3, arg4, arg5};
 
    // keep running until user exits
    while (1)
    {
       printf("\n> ");
 
-      //
-      if (scanf("%s", command) != 1)
+      // reading one command per line, so commands can take optional arguments
+      if (fgets(line, sizeof(line), stdin) == NULL)
       {
          break;
       }
 
+      int args = sscanf(line, "%19s %49s %49s %49s %49s %49s", command, arg1, arg2, arg3, arg4, arg5) - 1;
+
+      // skipping empty lines
+      if (args < 0)
+      {
+         continue;
+      }
+
       // if user typed "check" as the command...
       if (strcmp(command, "check") == 0)
       {
-         scanf("%s %s", arg1, arg2);           // read the two arguments citizen_id and virus_name
-         check_vaccination_status(arg1, arg2); // call function to check vaccination status
+         if (args != 2)
+            printf("Usage: check <citizen_id> <virus>\n");
+         else
+            check_vaccination_status(arg1, arg2); // call function to check vaccination status
       }
       // if user typed "list" as the command...
       else if (strcmp(command, "list") == 0)
       {
-         scanf("%s", arg1);     // read the argument virus_name into arg1
-         list_vaccinated(arg1); // call function to list all records of respective virus
+         const char *after;
+         uint64_t limit;
+         Writer out;
+
+         if (args < 1 || parse_list_options(options, args - 1, &after, &limit) != 0)
+         {
+            printf("Usage: list <virus> [after <citizen_id>] [limit N]\n");
+         }
+         else
+         {
+            // the records bypass stdio, so what printf holds goes out first
+            fflush(stdout);
+            if (writer_init(&out, STDOUT_FILENO, WRITER_DEFAULT_SIZE) != 0)
+            {
+               printf("Error while allocating the output buffer\n");
+               continue;
+            }
+            list_vaccinated(arg1, after, limit, &out); // call function to list a page of records of respective virus
+            writer_close(&out);
+         }
+      }
+      // if user typed "range" as the command...
+      else if (strcmp(command, "range") == 0)
+      {
+         if (args != 3)
+            printf("Usage: range <virus> <from_id> <to_id>\n");
+         else
+            list_id_range(arg1, arg2, arg3); // call function to list the records of an ID range
+      }
+      // if user typed "between" as the command...
+      else if (strcmp(command, "between") == 0)
+      {
+         if (args != 3 && args != 4)
+            printf("Usage: between <virus> <from_date> <to_date> [country]\n");
+         else
+            list_date_window(arg1, arg2, arg3, args == 4 ? arg4 : NULL); // call function to list a date window
+      }
+      // if user typed "save" as the command...
+      else if (strcmp(command, "save") == 0)
+      {
+         if (args != 1)
+            printf("Usage: save <snapshot_file>\n");
+         else
+            save_snapshot(arg1); // call function to write every virus to the snapshot
+      }
+      // if user typed "stats" as the command...
+      else if (strcmp(command, "stats") == 0)
+      {
+         if (args == 0)
+            print_stats(); // call function to show the search cost of every virus
+         else if (args <= 2)
+            print_population(arg1, args == 2 ? arg2 : NULL); // call function to show the YES/NO counts
+         else
+            printf("Usage: stats [<virus> [country]]\n");
+      }
+      // if user typed "coverage" as the command...
+      else if (strcmp(command, "coverage") == 0)
+      {
+         if (args != 2)
+            printf("Usage: coverage <virus> <date>\n");
+         else
+            print_coverage(arg1, arg2); // call function to show the vaccinations up to a date
+      }
+      // if user typed "status" as the command...
+      else if (strcmp(command, "status") == 0)
+      {
+         if (args != 1)
+            printf("Usage: status <citizen_id>\n");
+         else
+            print_citizen_status(arg1); // call function to list the viruses of the citizen
+      }
+      // if user typed "insert" or "update" as the command, the rest of the line is a record
+      else if (strcmp(command, "insert") == 0 || strcmp(command, "update") == 0)
+      {
+         const char *fields = strstr(line, command) + strlen(command);
+         if (command[0] == 'i')
+            insert_citizen(fields); // call function to add the record
+         else
+            update_citizen(fields); // call function to replace the citizen's record
+      }
+      // if user typed "delete" as the command...
+      else if (strcmp(command, "delete") == 0)
+      {
+         if (args != 2)
+            printf("Usage: delete <citizen_id> <virus>\n");
+         else
+            delete_citizen(arg1, arg2); // call function to remove the citizen's record
+      }
+      // if user typed "compact" as the command...
+      else if (strcmp(command, "compact") == 0)
+      {
+         if (args != 1)
+            printf("Usage: compact <snapshot_file>\n");
+         else
+            compact_log(arg1); // call function to fold the log into a snapshot
+      }
+      // if user typed "filter" as the command, the words after the virus are predicates
+      else if (strcmp(command, "filter") == 0)
+      {
+         char *rest = line + strspn(line, " \t");
+         rest += strcspn(rest, " \t\r\n"); // past the command
+         rest += strspn(rest, " \t");
+         rest += strcspn(rest, " \t\r\n"); // past the virus
+
+         if (args < 1)
+            printf("Usage: filter <virus> [age <min>-[max]] [country <name>] [from <date>] [to <date>] [count]\n");
+         else
+            filter_records(arg1, rest); // call function to scan the virus's columns
+      }
+      // if user typed "export" as the command...
+      else if (strcmp(command, "export") == 0)
+      {
+         if (args != 2 && args != 3)
+            printf("Usage: export <virus> <file> [csv|binary]\n");
+         else
+            export_virus(arg1, arg2, args == 3 ? arg3 : NULL); // call function to dump the records to a file
       }
       // if user types "exit" as the command...
       else if (strcmp(command, "exit") == 0)
@@ -276,4 +2349,4 @@ void run()
          printf("Unknown command\n");
       }
    }
-}
\ No newline at end of file
+}
@@ -0,0 +1,89 @@
+/*
+This is the metrics.c file that implements the latency histograms behind the stats
+command and the periodic dump (-t).
+
+A histogram has one bucket per power of two of nanoseconds, so recording a latency
+is a count-leading-zeros and an add, and 40 buckets cover everything from 1 ns to
+about 9 minutes. A percentile is reported as the upper edge of the bucket it falls
+in, so it is at most twice the real value, which is enough to see a regression.
+
+Each virus's load latencies are recorded by the one thread loading that virus, and
+check latencies by the thread answering queries, but readers may print them at any
+time, so every update is an atomic add.
+*/
+
+// importing relevant libraries
+#include "metrics.h"
+
+// bucket_of(...) gives the bucket of a latency: 0 for 0 ns, else 1 + floor(log2(ns))
+static int bucket_of(uint64_t nanoseconds)
+{
+   int bucket = nanoseconds ? 64 - __builtin_clzll(nanoseconds) : 0;
+   return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+// implementing histogram_record(...) to add count latencies of nanoseconds each
+void histogram_record(Histogram *histogram, uint64_t nanoseconds, uint64_t count)
+{
+   if (!METRICS_ENABLED || count == 0)
+      return;
+
+   __atomic_fetch_add(&histogram->buckets[bucket_of(nanoseconds)], count, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&histogram->count, count, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&histogram->total_ns, nanoseconds * count, __ATOMIC_RELAXED);
+}
+
+// implementing histogram_merge(...) to add the counts of one histogram to another
+void histogram_merge(Histogram *into, const Histogram *from)
+{
+   for (int b = 0; b < METRICS_BUCKETS; b++)
+   {
+      into->buckets[b] += __atomic_load_n(&from->buckets[b], __ATOMIC_RELAXED);
+   }
+   into->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+   into->total_ns += __atomic_load_n(&from->total_ns, __ATOMIC_RELAXED);
+}
+
+// implementing histogram_percentile(...) to find the bucket holding a percentile (0-100)
+// and return its upper edge in nanoseconds, 0 for an empty histogram
+uint64_t histogram_percentile(const Histogram *histogram, double percentile)
+{
+   uint64_t total = 0;
+   for (int b = 0; b < METRICS_BUCKETS; b++)
+   {
+      total += __atomic_load_n(&histogram->buckets[b], __ATOMIC_RELAXED);
+   }
+
+   if (total == 0)
+   {
+      return 0;
+   }
+
+   // the rank of the percentile, counted from 1
+   uint64_t rank = (uint64_t)(percentile / 100.0 * total);
+   if (rank < 1)
+      rank = 1;
+
+   uint64_t seen = 0;
+   for (int b = 0; b < METRICS_BUCKETS; b++)
+   {
+      seen += __atomic_load_n(&histogram->buckets[b], __ATOMIC_RELAXED);
+      if (seen >= rank)
+         return b ? 1ULL << b : 0;
+   }
+
+   return 1ULL << (METRICS_BUCKETS - 1);
+}
+
+// implementing histogram_print(...) to print a histogram as name=count/mean/p50/p99/max fields
+void histogram_print(FILE *out, const char *name, const Histogram *histogram)
+{
+   uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+   uint64_t total = __atomic_load_n(&histogram->total_ns, __ATOMIC_RELAXED);
+
+   fprintf(out, " %s_count=%llu %s_mean_ns=%llu %s_p50_ns=%llu %s_p99_ns=%llu %s_max_ns=%llu", name,
+           (unsigned long long)count, name, (unsigned long long)(count ? total / count : 0), name,
+           (unsigned long long)histogram_percentile(histogram, 50), name,
+           (unsigned long long)histogram_percentile(histogram, 99), name,
+           (unsigned long long)histogram_percentile(histogram, 100));
+}
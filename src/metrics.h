@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// building with -DNO_METRICS (make METRICS=0) compiles every counter update away
+#ifdef NO_METRICS
+#define METRICS_ENABLED 0
+#else
+#define METRICS_ENABLED 1
+#endif
+
+#define METRICS_BUCKETS 40 // latency buckets, bucket b holds latencies in [2^(b-1), 2^b) nanoseconds
+
+// METRIC_ADD(...) adds to a counter several threads may update
+#define METRIC_ADD(counter, amount)                                     \
+   do                                                                   \
+   {                                                                    \
+      if (METRICS_ENABLED)                                              \
+         __atomic_fetch_add(&(counter), (amount), __ATOMIC_RELAXED);    \
+   } while (0)
+
+// defining a latency histogram with power-of-two buckets
+typedef struct
+{
+   uint64_t buckets[METRICS_BUCKETS];
+   uint64_t count;    // latencies recorded
+   uint64_t total_ns; // their sum
+} Histogram;
+
+// defining the counters every virus keeps about its check queries, its load and its changes
+typedef struct
+{
+   uint64_t checks;          // check queries answered
+   uint64_t bloom_negatives; // answered by the bloom filter alone
+   uint64_t false_positives; // the bloom filter said maybe, the index had no such ID
+   uint64_t found;           // the index had the ID
+   Histogram check_latency;  // time to answer one check
+   Histogram load_latency;   // time to store one record while loading
+   Histogram change_latency; // time to apply one insert, update or delete command
+} VirusMetrics;
+
+// metrics_now(...) reads a monotonic clock in nanoseconds, 0 when metrics are compiled out
+static inline uint64_t metrics_now(void)
+{
+   if (!METRICS_ENABLED)
+      return 0;
+
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+function prototypes
+*/
+void histogram_record(Histogram *histogram, uint64_t nanoseconds, uint64_t count); // function to add count latencies of the same length
+void histogram_merge(Histogram *into, const Histogram *from);                     // function to add one histogram to another
+uint64_t histogram_percentile(const Histogram *histogram, double percentile);      // function to get an upper bound of a percentile in ns
+void histogram_print(FILE *out, const char *name, const Histogram *histogram);    // function to print a one-line summary
+
+#endif
@@ -0,0 +1,375 @@
+/*
+This is the population.c file that keeps the per-virus counters behind the stats
+command: how many records of every country and age band said YES and NO, and how
+many vaccinations happened up to every day. The counters are updated as records
+are loaded and changed, so a query reads a few numbers instead of walking the records.
+
+Each virus's records are loaded by exactly one thread at a time (the loader thread
+or the inserter thread that owns the virus), so the writer bumps a counter with a
+relaxed load and store and takes no lock. Queries may run at the same time: they
+take the lock, which the writer also takes whenever it has to grow an array, so a
+query never reads an array that is being moved. A query may see a count one
+record behind, which is also what it would see a moment earlier.
+
+Countries are found through the id intern(...) gives every string: slots[] maps an
+id to the country's entry, so counting a record is two array reads. Days are kept
+as a sorted array of the days that had vaccinations (far fewer than the records),
+and the running totals over it are rebuilt by the first query after a change, so
+"vaccinated by day D" is one binary search.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "population.h"
+#include "intern.h"
+#include "date.h"
+
+// bump(...) adds one to a counter only its writer changes, readers load it atomically
+static inline void bump(uint64_t *counter, uint64_t amount)
+{
+   __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+// implementing population_create(...) to create counters with nothing counted
+Population *population_create(void)
+{
+   Population *population = calloc(1, sizeof(Population));
+
+   // checking if memory was allocated successfully
+   if (population == NULL)
+   {
+      printf("Error while creating population counters");
+      return NULL;
+   }
+
+   pthread_mutex_init(&population->lock, NULL);
+   return population;
+}
+
+// implementing population_delete(...) to release the counters
+void population_delete(Population *population)
+{
+   free(population->countries);
+   free(population->names);
+   free(population->slots);
+   free(population->days);
+   pthread_mutex_destroy(&population->lock);
+   free(population);
+}
+
+// find_country(...) returns the entry of an interned country, -1 if it has none
+static long find_country(const Population *population, const char *country)
+{
+   uint32_t id = intern_id(country);
+   return id < population->slot_count ? population->slots[id] : -1;
+}
+
+// add_country(...) gives an interned country its entry, the writer calls it without the lock
+static long add_country(Population *population, const char *country)
+{
+   uint32_t id = intern_id(country);
+   long entry = find_country(population, country);
+
+   if (entry >= 0)
+   {
+      return entry;
+   }
+
+   pthread_mutex_lock(&population->lock);
+
+   if (id >= population->slot_count)
+   {
+      size_t count = population->slot_count ? population->slot_count : 64;
+      while (count <= id)
+         count *= 2;
+
+      int32_t *slots = realloc(population->slots, count * sizeof(int32_t));
+      if (slots == NULL)
+      {
+         pthread_mutex_unlock(&population->lock);
+         return -1;
+      }
+
+      for (size_t i = population->slot_count; i < count; i++)
+         slots[i] = -1;
+      population->slots = slots;
+      population->slot_count = count;
+   }
+
+   if (population->country_count == population->country_size)
+   {
+      size_t size = population->country_size ? population->country_size * 2 : 16;
+      PopulationCounts *countries = realloc(population->countries, size * sizeof(PopulationCounts));
+      if (countries != NULL)
+         population->countries = countries;
+      const char **names = realloc(population->names, size * sizeof(char *));
+      if (names != NULL)
+         population->names = names;
+
+      if (countries == NULL || names == NULL)
+      {
+         pthread_mutex_unlock(&population->lock);
+         return -1;
+      }
+      population->country_size = size;
+   }
+
+   entry = population->country_count++;
+   memset(&population->countries[entry], 0, sizeof(PopulationCounts));
+   population->names[entry] = country;
+   population->slots[id] = entry;
+
+   pthread_mutex_unlock(&population->lock);
+   return entry;
+}
+
+// implementing population_add(...) to count one record of an interned country
+// a vaccinated record also counts on its day, unless it has none (DATE_NONE)
+int population_add(Population *population, const char *country, int age, int vaccinated, int32_t day)
+{
+   long entry = add_country(population, country);
+
+   if (entry < 0)
+   {
+      return -1;
+   }
+
+   int band = population_band(age);
+   PopulationCounts *counts = &population->countries[entry];
+
+   if (vaccinated)
+   {
+      bump(&counts->yes[band], 1);
+      bump(&population->total.yes[band], 1);
+      return day != DATE_NONE ? population_add_day(population, day) : 0;
+   }
+
+   bump(&counts->no[band], 1);
+   bump(&population->total.no[band], 1);
+   return 0;
+}
+
+// find_day(...) returns the position of the first entry not before day
+static size_t find_day(const DayCount *days, size_t count, int32_t day)
+{
+   size_t low = 0, high = count;
+
+   while (low < high)
+   {
+      size_t mid = (low + high) / 2;
+      if (days[mid].day < day)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   return low;
+}
+
+// implementing population_remove(...) to take back one record that population_add(...) counted
+// returns -1 when the country and band have no such record, and changes nothing then
+int population_remove(Population *population, const char *country, int age, int vaccinated, int32_t day)
+{
+   long entry = find_country(population, country);
+
+   if (entry < 0)
+   {
+      return -1;
+   }
+
+   int band = population_band(age);
+   PopulationCounts *counts = &population->countries[entry];
+   uint64_t *counter = vaccinated ? &counts->yes[band] : &counts->no[band];
+
+   if (__atomic_load_n(counter, __ATOMIC_RELAXED) == 0)
+   {
+      return -1;
+   }
+
+   // adding the largest value wraps around, which is subtracting one
+   bump(counter, UINT64_MAX);
+   bump(vaccinated ? &population->total.yes[band] : &population->total.no[band], UINT64_MAX);
+
+   if (vaccinated && day != DATE_NONE)
+   {
+      size_t i = find_day(population->days, population->day_count, day);
+      if (i < population->day_count && population->days[i].day == day && population->days[i].count > 0)
+      {
+         bump(&population->days[i].count, UINT64_MAX);
+         __atomic_store_n(&population->stale, 1, __ATOMIC_RELEASE);
+      }
+   }
+
+   return 0;
+}
+
+// implementing population_add_counts(...) to add the tallies of a country at once (a restore)
+int population_add_counts(Population *population, const char *country, const PopulationCounts *counts)
+{
+   long entry = add_country(population, country);
+
+   if (entry < 0)
+   {
+      return -1;
+   }
+
+   for (int band = 0; band < POPULATION_AGE_BANDS; band++)
+   {
+      bump(&population->countries[entry].yes[band], counts->yes[band]);
+      bump(&population->countries[entry].no[band], counts->no[band]);
+      bump(&population->total.yes[band], counts->yes[band]);
+      bump(&population->total.no[band], counts->no[band]);
+   }
+
+   return 0;
+}
+
+// implementing population_add_day(...) to count one vaccination on a day
+// loads mostly repeat recent days, so the last day counted is tried before searching
+int population_add_day(Population *population, int32_t day)
+{
+   static __thread const Population *last_population = NULL;
+   static __thread size_t last_position = 0;
+   size_t i;
+
+   if (last_population == population && last_position < population->day_count &&
+       population->days[last_position].day == day)
+   {
+      i = last_position;
+   }
+   else
+   {
+      i = find_day(population->days, population->day_count, day);
+   }
+
+   // a day never seen before is inserted in order, under the lock queries take
+   if (i == population->day_count || population->days[i].day != day)
+   {
+      pthread_mutex_lock(&population->lock);
+
+      if (population->day_count == population->day_size)
+      {
+         size_t size = population->day_size ? population->day_size * 2 : 64;
+         DayCount *days = realloc(population->days, size * sizeof(DayCount));
+         if (days == NULL)
+         {
+            pthread_mutex_unlock(&population->lock);
+            return -1;
+         }
+         population->days = days;
+         population->day_size = size;
+      }
+
+      memmove(&population->days[i + 1], &population->days[i], (population->day_count - i) * sizeof(DayCount));
+      population->days[i].day = day;
+      population->days[i].count = 0;
+      population->day_count++;
+      pthread_mutex_unlock(&population->lock);
+   }
+
+   bump(&population->days[i].count, 1);
+   __atomic_store_n(&population->stale, 1, __ATOMIC_RELEASE);
+
+   last_population = population;
+   last_position = i;
+   return 0;
+}
+
+// read_counts(...) copies a set of tallies that the writer may be bumping
+static void read_counts(const PopulationCounts *from, PopulationCounts *to)
+{
+   for (int band = 0; band < POPULATION_AGE_BANDS; band++)
+   {
+      to->yes[band] = __atomic_load_n(&from->yes[band], __ATOMIC_RELAXED);
+      to->no[band] = __atomic_load_n(&from->no[band], __ATOMIC_RELAXED);
+   }
+}
+
+// implementing population_get(...) to read the tallies of one country, or of all of them for NULL
+// returns -1 when the country has no records for this virus
+int population_get(Population *population, const char *country, PopulationCounts *counts)
+{
+   // a name that was never interned was never in any record
+   const char *interned = country ? intern_find(country, strlen(country)) : NULL;
+   if (country != NULL && interned == NULL)
+   {
+      return -1;
+   }
+
+   pthread_mutex_lock(&population->lock);
+
+   long entry = interned ? find_country(population, interned) : 0;
+   if (entry >= 0)
+      read_counts(interned ? &population->countries[entry] : &population->total, counts);
+
+   pthread_mutex_unlock(&population->lock);
+   return entry >= 0 ? 0 : -1;
+}
+
+// implementing population_vaccinated_by(...) to count the vaccinations dated on or before day
+uint64_t population_vaccinated_by(Population *population, int32_t day)
+{
+   uint64_t total = 0;
+
+   pthread_mutex_lock(&population->lock);
+
+   // clearing the flag first, a count bumped during the rebuild sets it again
+   if (__atomic_exchange_n(&population->stale, 0, __ATOMIC_ACQUIRE))
+   {
+      uint64_t running = 0;
+      for (size_t i = 0; i < population->day_count; i++)
+      {
+         running += __atomic_load_n(&population->days[i].count, __ATOMIC_RELAXED);
+         population->days[i].cumulative = running;
+      }
+   }
+
+   size_t i = find_day(population->days, population->day_count, day);
+   if (i < population->day_count && population->days[i].day == day)
+      total = population->days[i].cumulative;
+   else if (i > 0)
+      total = population->days[i - 1].cumulative;
+
+   pthread_mutex_unlock(&population->lock);
+   return total;
+}
+
+// implementing population_scan(...) to hand the tallies of every country to visit(...)
+// in order of first appearance
+void population_scan(Population *population, PopulationVisitor visit, void *ctx)
+{
+   pthread_mutex_lock(&population->lock);
+
+   for (size_t i = 0; i < population->country_count; i++)
+   {
+      PopulationCounts counts;
+      read_counts(&population->countries[i], &counts);
+      if (visit(population->names[i], &counts, ctx) != 0)
+         break;
+   }
+
+   pthread_mutex_unlock(&population->lock);
+}
+
+// implementing population_countries(...) to get the number of countries with records
+size_t population_countries(Population *population)
+{
+   pthread_mutex_lock(&population->lock);
+   size_t count = population->country_count;
+   pthread_mutex_unlock(&population->lock);
+
+   return count;
+}
+
+// implementing population_memory(...) to report how many bytes the counters hold
+size_t population_memory(Population *population)
+{
+   pthread_mutex_lock(&population->lock);
+   size_t bytes = sizeof(Population) + population->country_size * (sizeof(PopulationCounts) + sizeof(char *)) +
+                  population->slot_count * sizeof(int32_t) + population->day_size * sizeof(DayCount);
+   pthread_mutex_unlock(&population->lock);
+
+   return bytes;
+}
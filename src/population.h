@@ -0,0 +1,73 @@
+#ifndef POPULATION_H
+#define POPULATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define POPULATION_AGE_BANDS 10 // ages 0-9, 10-19, ..., 80-89 and 90 or over
+#define POPULATION_BAND_YEARS 10 // width of every band but the last
+
+// defining the YES/NO tallies of one country (or of every country together)
+typedef struct
+{
+   uint64_t yes[POPULATION_AGE_BANDS];
+   uint64_t no[POPULATION_AGE_BANDS];
+} PopulationCounts;
+
+// defining the vaccinations of one day, with the running total up to and including it
+typedef struct
+{
+   int32_t day;
+   uint64_t count;
+   uint64_t cumulative; // valid while the population is not stale
+} DayCount;
+
+// defining the counters of one virus, kept up to date while its records are loaded
+typedef struct
+{
+   PopulationCounts total;       // every country together
+   PopulationCounts *countries;  // one entry per country, in order of its first record
+   const char **names;           // the interned name of every entry
+   size_t country_count;
+   size_t country_size;          // room in countries[] and names[]
+   int32_t *slots;               // entry of every intern id, -1 for a string that is no country of this virus
+   size_t slot_count;
+   DayCount *days;               // every day with a vaccination, in date order
+   size_t day_count;
+   size_t day_size;              // room in days[]
+   int stale;                    // set when a count changed since the running totals were built
+   pthread_mutex_t lock;         // taken by every query and by the writer when an array grows
+} Population;
+
+// defining the callback population_scan(...) hands every country to, non-zero stops the scan
+typedef int (*PopulationVisitor)(const char *country, const PopulationCounts *counts, void *ctx);
+
+// population_band(...) gives the age band a record is counted in
+static inline int population_band(int age)
+{
+   if (age < 0)
+      return 0;
+   return age / POPULATION_BAND_YEARS < POPULATION_AGE_BANDS ? age / POPULATION_BAND_YEARS : POPULATION_AGE_BANDS - 1;
+}
+
+/*
+function prototypes
+*/
+Population *population_create(void);                                         // function to create empty counters
+void population_delete(Population *population);                              // function to delete the counters
+int population_add(Population *population, const char *country, int age,
+                   int vaccinated, int32_t day);                             // function to count one record (interned country), 0 on success
+int population_remove(Population *population, const char *country, int age,
+                      int vaccinated, int32_t day);                          // function to take one record back, -1 if it was not counted
+int population_add_counts(Population *population, const char *country,
+                          const PopulationCounts *counts);                   // function to add a country's saved tallies
+int population_add_day(Population *population, int32_t day);                 // function to count one vaccination on a day
+int population_get(Population *population, const char *country,
+                   PopulationCounts *counts);                                // function to read a country's tallies (NULL: all), -1 if unknown
+uint64_t population_vaccinated_by(Population *population, int32_t day);      // function to count the vaccinations dated up to day
+void population_scan(Population *population, PopulationVisitor visit, void *ctx); // function to visit every country's tallies
+size_t population_countries(Population *population);                         // function to get the number of countries counted
+size_t population_memory(Population *population);                            // function to get the bytes held by the counters
+
+#endif
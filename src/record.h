@@ -0,0 +1,38 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <string.h>
+
+// defining a field as a slice of the input, it is NOT NUL-terminated
+typedef struct
+{
+   const char *str; // first character of the field
+   size_t len;      // number of characters in the field
+} Field;
+
+struct Citizen;
+
+// defining one parsed line of the input file
+typedef struct
+{
+   Field citizen_id;
+   Field first_name;
+   Field last_name;
+   Field country;
+   int age;
+   Field virus_name;
+   Field vaccinated;
+   Field date; // len is 0 when the record has no date
+   struct Citizen *citizen; // the citizen-table entry of the record, set before it is stored (see node_create(...))
+   Field text;    // the whole line, for the reject log
+   uint64_t line; // the line number in the input file, 0 for a record that was not read from one
+} Record;
+
+// field_equals(...) compares a field against a NUL-terminated string
+static inline int field_equals(const Field *field, const char *str)
+{
+   return strncmp(field->str, str, field->len) == 0 && str[field->len] == '\0';
+}
+
+#endif
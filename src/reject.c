@@ -0,0 +1,102 @@
+/*
+This is the reject.c file that keeps the log of a tolerant load (-x): every line
+the load skips, because it could not be parsed or because its citizen already has
+a record for the virus, goes to a side file with its line number and why, so a
+messy feed can be loaded in one run and its bad lines fixed afterwards.
+
+Rows go through a buffered writer under a lock, since the parallel loader's
+threads report from several threads at once; with -j the rows of different
+viruses may therefore interleave out of line order.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "reject.h"
+
+// the names rows are written with, in RejectKind order
+static const char *kind_names[REJECT_KINDS] = {"fields", "age", "status", "date", "duplicate", "conflict"};
+
+// implementing reject_open(...) to create a log, replacing the file at path
+RejectLog *reject_open(const char *path)
+{
+   RejectLog *log = calloc(1, sizeof(RejectLog));
+
+   if (log == NULL)
+      return NULL;
+
+   if (path != NULL)
+   {
+      int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0 || writer_init(&log->out, fd, WRITER_DEFAULT_SIZE) != 0)
+      {
+         if (fd >= 0)
+            close(fd);
+         free(log);
+         return NULL;
+      }
+      log->has_file = 1;
+   }
+
+   pthread_mutex_init(&log->lock, NULL);
+   return log;
+}
+
+// implementing reject_add(...) to count a skipped line and write its row
+void reject_add(RejectLog *log, RejectKind kind, uint64_t line, const char *text, size_t len)
+{
+   pthread_mutex_lock(&log->lock);
+   log->counts[kind]++;
+
+   if (log->has_file)
+   {
+      writer_put_int(&log->out, line);
+      writer_putc(&log->out, '\t');
+      writer_puts(&log->out, kind_names[kind]);
+      writer_putc(&log->out, '\t');
+      writer_put(&log->out, text, len);
+      writer_putc(&log->out, '\n');
+   }
+
+   pthread_mutex_unlock(&log->lock);
+}
+
+// implementing reject_count(...) to read the count of one kind
+uint64_t reject_count(RejectLog *log, RejectKind kind)
+{
+   pthread_mutex_lock(&log->lock);
+   uint64_t count = log->counts[kind];
+   pthread_mutex_unlock(&log->lock);
+   return count;
+}
+
+// implementing reject_close(...) to write out what is buffered and release the log
+int reject_close(RejectLog *log)
+{
+   int result = 0;
+
+   if (log == NULL)
+      return 0;
+
+   if (log->has_file)
+   {
+      int fd = log->out.fd;
+      writer_close(&log->out);
+      if (log->out.failed)
+         result = -1;
+      if (close(fd) != 0)
+         result = -1;
+   }
+
+   pthread_mutex_destroy(&log->lock);
+   free(log);
+   return result;
+}
+
+// implementing reject_kind_name(...) to print a kind
+const char *reject_kind_name(RejectKind kind)
+{
+   return kind >= 0 && kind < REJECT_KINDS ? kind_names[kind] : "unknown";
+}
@@ -0,0 +1,41 @@
+#ifndef REJECT_H
+#define REJECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "writer.h"
+
+// defining why a line of the input was not loaded
+typedef enum
+{
+   REJECT_FIELDS,    // fewer than 7 fields
+   REJECT_AGE,       // an age that is not a number
+   REJECT_STATUS,    // neither YES nor NO
+   REJECT_DATE,      // a date that is not YYYY-MM-DD
+   REJECT_DUPLICATE, // the same citizen and virus as a stored record, with the same data
+   REJECT_CONFLICT,  // the same citizen and virus as a stored record, with other data
+   REJECT_KINDS      // number of kinds
+} RejectKind;
+
+// defining the side file the lines a tolerant load skips are written to, one
+// "<line number>\t<kind>\t<line>" row each, and the count of every kind
+typedef struct
+{
+   Writer out;
+   int has_file;                   // cleared for a log that only counts
+   uint64_t counts[REJECT_KINDS];
+   pthread_mutex_t lock;           // the parallel loader's threads share the log
+} RejectLog;
+
+/*
+function prototypes
+*/
+RejectLog *reject_open(const char *path);                             // function to create a log writing to path (NULL only counts)
+void reject_add(RejectLog *log, RejectKind kind, uint64_t line,
+                const char *text, size_t len);                        // function to log one skipped line
+uint64_t reject_count(RejectLog *log, RejectKind kind);               // function to get how many lines of a kind were logged
+int reject_close(RejectLog *log);                                     // function to flush and delete a log, 0 if every row was written
+const char *reject_kind_name(RejectKind kind);                        // function to get the name a kind is written with
+
+#endif
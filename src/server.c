@@ -0,0 +1,438 @@
+/*
+This is the server.c file that answers requests from many clients at once over a
+Unix-domain or loopback TCP socket, with the same check/list line protocol as the
+prompt (see server.h).
+
+A fixed pool of worker threads waits on one epoll set holding the listening
+socket and every connection. Each socket is armed for a single event
+(EPOLLONESHOT), so whichever worker wakes up owns it until it re-arms it: the
+listener is drained with accept(...), a connection has one read's worth of
+request lines answered into its buffered writer, which is then written out in
+one go. Idle connections cost no thread, so far more clients than workers can
+stay connected.
+
+Answers are written with blocking writes, but every connection has a send
+timeout (SERVER_SEND_TIMEOUT): a client that stops reading its answers holds a
+worker for at most that long, then the write fails and the client is dropped.
+*/
+
+// importing relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "server.h"
+
+#define SERVER_READ_SIZE (16 * 1024) // bytes read from a connection per event
+
+// defining a parsed address
+typedef struct
+{
+   struct sockaddr_storage storage;
+   socklen_t size;
+   int tcp;
+} Address;
+
+// parse_address(...) turns "host:port" or a socket path into an address
+static int parse_address(const char *text, Address *address, char *error, size_t error_size)
+{
+   const char *colon = strrchr(text, ':');
+
+   memset(address, 0, sizeof(Address));
+
+   if (colon == NULL)
+   {
+      struct sockaddr_un *un = (struct sockaddr_un *)&address->storage;
+
+      if (strlen(text) == 0 || strlen(text) >= sizeof(un->sun_path))
+      {
+         snprintf(error, error_size, "socket path is empty or longer than %zu characters", sizeof(un->sun_path) - 1);
+         return -1;
+      }
+
+      un->sun_family = AF_UNIX;
+      strcpy(un->sun_path, text);
+      address->size = sizeof(struct sockaddr_un);
+      return 0;
+   }
+
+   struct sockaddr_in *in = (struct sockaddr_in *)&address->storage;
+   char host[64];
+   size_t host_len = colon - text;
+   char *end;
+   long port = strtol(colon + 1, &end, 10);
+
+   if (host_len >= sizeof(host) || *end != '\0' || colon[1] == '\0' || port < 1 || port > 65535)
+   {
+      snprintf(error, error_size, "expected host:port with a port from 1 to 65535");
+      return -1;
+   }
+
+   memcpy(host, text, host_len);
+   host[host_len] = '\0';
+
+   // an empty host or "localhost" is the loopback address
+   if (host_len == 0 || strcmp(host, "localhost") == 0)
+      strcpy(host, "127.0.0.1");
+
+   in->sin_family = AF_INET;
+   in->sin_port = htons(port);
+   if (inet_pton(AF_INET, host, &in->sin_addr) != 1)
+   {
+      snprintf(error, error_size, "%s is not an IPv4 address", host);
+      return -1;
+   }
+
+   address->size = sizeof(struct sockaddr_in);
+   address->tcp = 1;
+   return 0;
+}
+
+// no_delay(...) sends small answers right away instead of waiting to coalesce them (TCP only)
+static void no_delay(int fd)
+{
+   int on = 1;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+// send_timeout(...) makes a write to a client that stopped reading fail instead of blocking forever
+static int send_timeout(int fd)
+{
+   struct timeval timeout = {.tv_sec = SERVER_SEND_TIMEOUT, .tv_usec = 0};
+   return setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// arm(...) lets one worker receive the next event of a socket
+static int arm(Server *server, int op, int fd, void *ptr)
+{
+   struct epoll_event event;
+
+   event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+   event.data.ptr = ptr;
+   return epoll_ctl(server->epoll_fd, op, fd, &event);
+}
+
+// close_connection(...) forgets a connection and releases it
+static void close_connection(Server *server, Connection *connection)
+{
+   pthread_mutex_lock(&server->lock);
+   if (connection->prev)
+      connection->prev->next = connection->next;
+   else
+      server->connections = connection->next;
+   if (connection->next)
+      connection->next->prev = connection->prev;
+   server->open--;
+   pthread_mutex_unlock(&server->lock);
+
+   // closing the descriptor also takes it out of the epoll set
+   free(connection->out.buf);
+   close(connection->fd);
+   free(connection);
+}
+
+// accept_all(...) takes every pending connection off the listener, then re-arms it
+static void accept_all(Server *server)
+{
+   while (!__atomic_load_n(&server->stop, __ATOMIC_RELAXED))
+   {
+      // blocking, so answers are written in full, but never for longer than the send timeout
+      int fd = accept(server->listen_fd, NULL, NULL);
+
+      if (fd < 0)
+      {
+         if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+         break; // EAGAIN once the queue is empty, or out of descriptors
+      }
+
+      Connection *connection = calloc(1, sizeof(Connection));
+
+      if (connection == NULL || send_timeout(fd) != 0 || writer_init(&connection->out, fd, SERVER_WRITE_SIZE) != 0)
+      {
+         free(connection);
+         close(fd);
+         continue;
+      }
+
+      if (server->unix_path == NULL)
+         no_delay(fd);
+      connection->fd = fd;
+
+      pthread_mutex_lock(&server->lock);
+      connection->next = server->connections;
+      if (server->connections)
+         server->connections->prev = connection;
+      server->connections = connection;
+      server->accepted++;
+      server->open++;
+      pthread_mutex_unlock(&server->lock);
+
+      if (arm(server, EPOLL_CTL_ADD, fd, connection) != 0)
+         close_connection(server, connection);
+   }
+
+   arm(server, EPOLL_CTL_MOD, server->listen_fd, &server->listen_fd);
+}
+
+// answer(...) hands one complete request line to the handler and ends its answer
+static void answer(Server *server, Connection *connection, const char *line, size_t len)
+{
+   if (len > 0 && line[len - 1] == '\r')
+      len--;
+
+   // a blank line is no request, like at the prompt
+   size_t i = 0;
+   while (i < len && (line[i] == ' ' || line[i] == '\t'))
+      i++;
+   if (i == len)
+      return;
+
+   server->handle(line, len, &connection->out, server->ctx);
+   writer_putc(&connection->out, '\n');
+   __atomic_fetch_add(&server->requests, 1, __ATOMIC_RELAXED);
+}
+
+// answer_lines(...) answers every line a read completed; a line split across reads waits in in[]
+static void answer_lines(Server *server, Connection *connection, const char *data, size_t size)
+{
+   const char *end = data + size;
+
+   while (data < end)
+   {
+      const char *newline = memchr(data, '\n', end - data);
+      size_t part = (newline ? newline : end) - data;
+
+      if (!connection->overflow && connection->len + part > SERVER_MAX_LINE)
+      {
+         connection->overflow = 1;
+      }
+
+      if (!connection->overflow && (newline == NULL || connection->len > 0))
+      {
+         memcpy(connection->in + connection->len, data, part);
+         connection->len += part;
+      }
+
+      if (newline == NULL)
+      {
+         break;
+      }
+
+      // a line that fits in the read is answered in place, without a copy
+      if (connection->overflow)
+         writer_puts(&connection->out, "Request too long\n\n");
+      else if (connection->len > 0)
+         answer(server, connection, connection->in, connection->len);
+      else
+         answer(server, connection, data, part);
+
+      connection->len = 0;
+      connection->overflow = 0;
+      data = newline + 1;
+   }
+}
+
+// serve_connection(...) answers what one read of a connection brought, then re-arms it
+static void serve_connection(Server *server, Connection *connection)
+{
+   char data[SERVER_READ_SIZE];
+   ssize_t got = recv(connection->fd, data, sizeof(data), MSG_DONTWAIT);
+
+   if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+   {
+      close_connection(server, connection);
+      return;
+   }
+
+   if (got > 0)
+   {
+      answer_lines(server, connection, data, got);
+
+      // a client that stopped reading its answers is dropped once a write times out
+      // (the handler may have flushed part of a long answer already and failed the writer)
+      if (writer_flush(&connection->out) != 0)
+      {
+         close_connection(server, connection);
+         return;
+      }
+   }
+
+   // the socket is level-triggered, so bytes left unread wake a worker again right away
+   if (arm(server, EPOLL_CTL_MOD, connection->fd, connection) != 0)
+      close_connection(server, connection);
+}
+
+// worker(...) is run by every thread of the pool
+static void *worker(void *arg)
+{
+   Server *server = arg;
+   struct epoll_event event;
+
+   while (!__atomic_load_n(&server->stop, __ATOMIC_RELAXED))
+   {
+      // taking one event at a time, so a burst is spread over the whole pool
+      int ready = epoll_wait(server->epoll_fd, &event, 1, -1);
+
+      if (ready <= 0 || event.data.ptr == &server->wake_fd)
+         continue; // an interrupted wait, or the wake-up of server_stop(...)
+      if (event.data.ptr == &server->listen_fd)
+         accept_all(server);
+      else
+         serve_connection(server, event.data.ptr);
+   }
+
+   return NULL;
+}
+
+// implementing server_start(...) to listen on address and answer requests with workers threads
+// a stale Unix socket file left by an earlier run is replaced
+Server *server_start(const char *address, int workers, ServerHandler handle, void *ctx,
+                     char *error, size_t error_size)
+{
+   Address parsed;
+
+   if (parse_address(address, &parsed, error, error_size) != 0)
+   {
+      return NULL;
+   }
+
+   Server *server = calloc(1, sizeof(Server));
+   if (server == NULL || (server->workers = calloc(workers, sizeof(pthread_t))) == NULL)
+   {
+      snprintf(error, error_size, "out of memory");
+      free(server);
+      return NULL;
+   }
+
+   // a client that hangs up mid-answer must make write(...) fail, not kill the process
+   signal(SIGPIPE, SIG_IGN);
+
+   pthread_mutex_init(&server->lock, NULL);
+   server->handle = handle;
+   server->ctx = ctx;
+   server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   server->listen_fd = socket(parsed.storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   const char *path = ((struct sockaddr_un *)&parsed.storage)->sun_path;
+   struct stat st;
+   int on = 1;
+
+   if (!parsed.tcp && stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(path);
+   if (parsed.tcp && server->listen_fd >= 0)
+      setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+   if (server->epoll_fd < 0 || server->wake_fd < 0 || server->listen_fd < 0 ||
+       bind(server->listen_fd, (struct sockaddr *)&parsed.storage, parsed.size) != 0)
+   {
+      snprintf(error, error_size, "%s", strerror(errno));
+      server_stop(server);
+      return NULL;
+   }
+
+   // only a socket file this server created is removed again by server_stop(...)
+   if (!parsed.tcp)
+      server->unix_path = strdup(path);
+
+   struct epoll_event wake = {.events = EPOLLIN, .data.ptr = &server->wake_fd};
+
+   if (listen(server->listen_fd, SERVER_BACKLOG) != 0 ||
+       epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &wake) != 0 ||
+       arm(server, EPOLL_CTL_ADD, server->listen_fd, &server->listen_fd) != 0)
+   {
+      snprintf(error, error_size, "%s", strerror(errno));
+      server_stop(server);
+      return NULL;
+   }
+
+   for (int i = 0; i < workers; i++)
+   {
+      if (pthread_create(&server->workers[i], NULL, worker, server) != 0)
+      {
+         snprintf(error, error_size, "cannot start worker %d", i + 1);
+         server_stop(server);
+         return NULL;
+      }
+      server->worker_count++;
+   }
+
+   return server;
+}
+
+// implementing server_stop(...) to stop accepting, wait for every worker and close what is still open
+void server_stop(Server *server)
+{
+   __atomic_store_n(&server->stop, 1, __ATOMIC_RELAXED);
+   if (server->wake_fd >= 0)
+      eventfd_write(server->wake_fd, 1);
+
+   // shutting the connections down first frees a worker blocked writing to a client
+   pthread_mutex_lock(&server->lock);
+   for (Connection *connection = server->connections; connection != NULL; connection = connection->next)
+      shutdown(connection->fd, SHUT_RDWR);
+   pthread_mutex_unlock(&server->lock);
+
+   for (int i = 0; i < server->worker_count; i++)
+   {
+      pthread_join(server->workers[i], NULL);
+   }
+
+   while (server->connections != NULL)
+   {
+      close_connection(server, server->connections);
+   }
+
+   if (server->listen_fd >= 0)
+      close(server->listen_fd);
+   if (server->epoll_fd >= 0)
+      close(server->epoll_fd);
+   if (server->wake_fd >= 0)
+      close(server->wake_fd);
+   if (server->unix_path)
+   {
+      unlink(server->unix_path);
+      free(server->unix_path);
+   }
+
+   pthread_mutex_destroy(&server->lock);
+   free(server->workers);
+   free(server);
+}
+
+// implementing server_connect(...) to open a blocking client connection to a server's address
+int server_connect(const char *address, char *error, size_t error_size)
+{
+   Address parsed;
+
+   if (parse_address(address, &parsed, error, error_size) != 0)
+   {
+      return -1;
+   }
+
+   int fd = socket(parsed.storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   if (fd < 0 || connect(fd, (struct sockaddr *)&parsed.storage, parsed.size) != 0)
+   {
+      snprintf(error, error_size, "%s", strerror(errno));
+      if (fd >= 0)
+         close(fd);
+      return -1;
+   }
+
+   if (parsed.tcp)
+      no_delay(fd);
+   return fd;
+}
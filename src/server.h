@@ -0,0 +1,68 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "writer.h"
+
+#define SERVER_MAX_LINE 1024           // longest request line, a longer one is answered with an error
+#define SERVER_WRITE_SIZE (64 * 1024)  // bytes of answers a connection buffers before writing them out
+#define SERVER_BACKLOG 128             // connections the kernel queues before they are accepted
+#define SERVER_SEND_TIMEOUT 5          // seconds a write to a client may block before the client is dropped
+
+/*
+Protocol: a client sends one request per line and gets one answer per request,
+in order. An answer is the lines the prompt would print for the same command,
+followed by an empty line, so a client reads until it sees one. Requests may be
+pipelined; the answers to every request that arrived in one read are written
+out together.
+
+An address containing a ':' is a TCP address (host:port, the host an IPv4
+address or "localhost"), anything else is the path of a Unix-domain socket.
+*/
+
+// defining the callback that answers one request line (without its newline) into out
+typedef void (*ServerHandler)(const char *line, size_t len, Writer *out, void *ctx);
+
+// defining one client connection, handled by one worker at a time
+typedef struct Connection
+{
+   int fd;
+   char in[SERVER_MAX_LINE]; // bytes of a request line that has not ended yet
+   size_t len;
+   int overflow;             // set while skipping the rest of a line that did not fit in[]
+   Writer out;               // answers not yet written to the client
+   struct Connection *prev;  // the other open connections, for server_stop(...)
+   struct Connection *next;
+} Connection;
+
+// defining a running server: a listening socket and a fixed pool of workers sharing one epoll set
+// every socket is armed for one event at a time, so a connection is only ever served by one worker
+typedef struct
+{
+   int listen_fd;
+   int epoll_fd;
+   int wake_fd;           // an eventfd that wakes every worker when the server stops
+   char *unix_path;       // the socket file to remove on stop, NULL for TCP
+   ServerHandler handle;
+   void *ctx;
+   int worker_count;
+   pthread_t *workers;
+   int stop;              // set by server_stop(...), the workers leave at their next event
+   pthread_mutex_t lock;  // guards the list of connections
+   Connection *connections;
+   uint64_t accepted;     // connections accepted so far
+   uint64_t open;         // connections open right now
+   uint64_t requests;     // request lines answered
+} Server;
+
+/*
+function prototypes
+*/
+Server *server_start(const char *address, int workers, ServerHandler handle, void *ctx,
+                     char *error, size_t error_size);                      // function to listen on an address and start the workers
+void server_stop(Server *server);                                        // function to stop the workers and close every connection
+int server_connect(const char *address, char *error, size_t error_size); // function to open a client connection, returns the fd or -1
+
+#endif
@@ -7,11 +7,73 @@ vaccination records management system.
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
 #include "skip_list.h"
+#include "citizen_table.h"
+#include "intern.h"
+#include "date.h"
+#include "metrics.h"
+
+/*
+Every node, its forward array and its strings are carved out of the list's arena,
+and the low-cardinality fields are interned into the shared dictionary, so
+deleting a list is a handful of free(...) calls no matter how many records it has.
+
+Readers never lock. A new node is filled in completely before it is published
+with a release store (or CAS), and readers follow forward pointers with acquire
+loads, so list_search(...) is safe while another thread inserts:
+   - list_insert(...) is the fast path for a single writer per list
+   - list_insert_concurrent(...) links a node level by level with compare-and-swap,
+     retrying a level whose predecessor changed, so any number of threads may
+     insert into the same list at once (they only share a lock around the arena)
+
+Numeric citizen IDs are also stored packed into the node as a 64-bit key, one
+4-bit digit (plus one) per position and zeros after the last digit. Comparing two
+packed keys as integers gives exactly the order strcmp(...) gives the strings, so
+searches compare integers that sit in the node instead of chasing the ID string,
+and `list` still prints in the same order. IDs that do not fit (not all digits, or
+longer than LIST_KEY_DIGITS) get LIST_NO_KEY and are compared as strings; mixing
+both kinds in one list is fine since both comparisons agree on the order.
+
+list_insert(...) remembers where its previous insert happened (the "finger"). An
+ID larger than the previous one starts its search from the finger instead of the
+head, and nearly-sorted input only walks a short distance. Sorted input is
+detected with one comparison against the last node (list->tail[0]) and is linked
+straight behind the tail of every level, so loading it takes linear time.
+
+A list starts with a level cap of LIST_MIN_LEVEL and raises it to the bit length
+of its record count as it grows, so the expected search path stays about 2 log2 n
+whether a virus holds a hundred records or a hundred million. The head and the
+tail/finger arrays are sized for LIST_MAX_LEVEL up front, so raising the cap never
+moves anything. Node levels come from a per-list splitmix64 generator, so lists
+filled by different threads never share random state, and a fixed seed gives the
+same list shape on every run.
+*/
+
+// next_of(...) reads a forward pointer that another thread may be publishing
+static inline Node *next_of(Node *node, int level)
+{
+   return __atomic_load_n(&node->next[level], __ATOMIC_ACQUIRE);
+}
+
+// alloc_node(...) carves a node and its level + 1 forward pointers out of the arena
+static Node *alloc_node(SkipList *list, int level)
+{
+   Node *node = arena_alloc(&list->arena, sizeof(Node) + sizeof(Node *) * (level + 1),
+                            _Alignof(Node));
+
+   if (node != NULL)
+   {
+      node->next = (Node **)(node + 1); // the forward array sits right behind the node
+   }
+
+   return node;
+}
 
 // implementing list_create(...) to create a new skip list
-SkipList *list_create(int max_level)
+SkipList *list_create(uint64_t seed)
 {
    SkipList *list = malloc(sizeof(SkipList));
 
@@ -22,10 +84,26 @@ SkipList *list_create(int max_level)
       return NULL; // exit with failure
    }
 
-   list->max_level = max_level; // setting max_level of skip list
-   list->level = 0;             // initializing current highest level to zero
+   list->max_level = LIST_MIN_LEVEL; // small to start with, raised as records come in
+   list->level = 0;                  // initializing current highest level to zero
+   list->count = 0;                  // the list starts empty
+   list->searches = 0;
+   list->search_steps = 0;
+   list->search_levels = 0;
+
+   // without a seed, the clock and the list's address keep lists created together apart
+   if (seed == 0)
+   {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      seed = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + (uintptr_t)list;
+   }
+   list->rng = seed;
+   list->packed_keys = getenv("LIST_STRING_KEYS") == NULL;
+   arena_init(&list->arena);
+   pthread_mutex_init(&list->arena_lock, NULL);
 
-   Node *head = malloc(sizeof(Node));
+   Node *head = alloc_node(list, LIST_MAX_LEVEL);
 
    // checking if memory was allocated successfully
    if (head == NULL)
@@ -34,81 +112,168 @@ SkipList *list_create(int max_level)
       return NULL; // exit with failure
    }
 
-   head->citizen_id = NULL;                               // setting dummy head-node key to NULL
-   head->next = malloc(sizeof(Node *) * (max_level + 1)); // allocating memory for max_level + 1 Node pointers
+   head->citizen_id = NULL; // setting dummy head-node key to NULL
+   head->key = LIST_NO_KEY;
 
    // initializing all next pointers to NULL
-   for (int i = 0; i <= max_level; i++)
+   for (int i = 0; i <= LIST_MAX_LEVEL; i++)
    {
       head->next[i] = NULL;
    }
 
    list->head = head; // setting the head of the list to the dummy head we just created
-   srand(time(NULL)); // seeding random number generator
+
+   // every level of an empty list ends at the head
+   list->tail = arena_alloc(&list->arena, sizeof(Node *) * (LIST_MAX_LEVEL + 1), _Alignof(Node *));
+   if (list->tail == NULL)
+   {
+      return NULL;
+   }
+   for (int i = 0; i <= LIST_MAX_LEVEL; i++)
+   {
+      list->tail[i] = head;
+   }
+   list->tail_valid = 1;
+
+   // the head comes before every ID, so it is a valid finger for the first insert
+   list->finger = arena_alloc(&list->arena, sizeof(Node *) * (LIST_MAX_LEVEL + 1), _Alignof(Node *));
+   if (list->finger == NULL)
+   {
+      return NULL;
+   }
+   for (int i = 0; i <= LIST_MAX_LEVEL; i++)
+   {
+      list->finger[i] = head;
+   }
+   list->finger_valid = 1;
+
    return list;
 }
 
 // implementing list_delete(...) to destroy a skip_list after use
 void list_delete(SkipList *list)
 {
-   /*
-      for destroying the list, since the base level contains all nodes, we
-      iterate through every node at the base level and free all allocated memory
-   */
-   Node *current = list->head->next[0]; // setting current node to the first node (after head) of the base level
-   while (current != NULL)
-   {
-      Node *next_node = current->next[0];
+   // every node lives in the arena, so the whole list goes in one sweep
+   // (interned strings are shared between lists and released by intern_clear())
+   arena_free(&list->arena);
+   pthread_mutex_destroy(&list->arena_lock);
+   free(list);
+}
 
-      // freeing all allocated memory
-      free(current->citizen_id);
-      free(current->first_name);
-      free(current->last_name);
-      free(current->country);
-      free(current->virus_name);
-      free(current->vaccinated);
-      if (current->date)
-         free(current->date);
-      free(current->next);
-      free(current);
+// implementing random_level(...) to generate a random level
+// every trailing zero bit of a random word is one coin flip that came up heads, so
+// counting them gives the same geometric distribution as flipping coins
+int random_level(SkipList *list)
+{
+   // splitmix64: one add and a few multiply/shift steps, every output bit is usable
+   uint64_t x = (list->rng += 0x9E3779B97F4A7C15ULL);
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+   x ^= x >> 31;
+
+   int cap = __atomic_load_n(&list->max_level, __ATOMIC_RELAXED);
+   return __builtin_ctzll(x | (1ULL << cap));
+}
 
-      current = next_node; // iterating to the next node
+// grow_max_level(...) raises the level cap to the bit length of count
+// readers never look at the cap, they descend from list->level
+static void grow_max_level(SkipList *list, size_t count)
+{
+   int wanted = 64 - __builtin_clzll((unsigned long long)count | 1);
+   if (wanted > LIST_MAX_LEVEL)
+      wanted = LIST_MAX_LEVEL;
+
+   int cap = __atomic_load_n(&list->max_level, __ATOMIC_RELAXED);
+   while (wanted > cap &&
+          !__atomic_compare_exchange_n(&list->max_level, &cap, wanted, false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+   {
    }
-
-   // free all remaining memory
-   free(list->head->next);
-   free(list->head);
-   free(list);
 }
 
-// implementing random_level(...) to generate a random level
-int random_level(int max_level)
+// implementing node_create(...) to allocate a record with levels forward pointers (0 for
+// none) in one arena allocation, which also holds a copy of the ID of a record without a citizen
+Node *node_create(Arena *arena, int levels, const Record *record, int packed_keys)
 {
-   int level = 0;
+   size_t next_bytes = sizeof(Node *) * levels;
+   size_t string_bytes = record->citizen ? 0 : record->citizen_id.len + 1;
+
+   Node *node = arena_alloc(arena, sizeof(Node) + next_bytes + string_bytes, _Alignof(Node));
 
-   // incrementing level a random number of times using the rand() function
-   while (rand() % 2 && level < max_level)
+   // checking for memory allocation errors
+   if (node == NULL)
    {
-      level++;
+      return NULL;
    }
 
-   return level;
+   node->next = levels ? (Node **)(node + 1) : NULL; // the forward array sits right behind the node
+   node->key = packed_keys ? list_pack_key(record->citizen_id.str, record->citizen_id.len) : LIST_NO_KEY;
+   node->citizen = record->citizen;
+
+   // the personal fields live in the citizen table, a record without a citizen (an index
+   // used on its own, as the benchmarks do) only keeps a copy of its ID
+   if (record->citizen != NULL)
+   {
+      node->citizen_id = record->citizen->citizen_id;
+   }
+   else
+   {
+      char *copy = (char *)(node + 1) + next_bytes;
+      memcpy(copy, record->citizen_id.str, record->citizen_id.len);
+      copy[record->citizen_id.len] = '\0';
+      node->citizen_id = copy;
+   }
+
+   // interning the fields every record of a virus shares
+   node->day = date_parse(record->date.str, record->date.len);
+   node->virus_name = intern(record->virus_name.str, record->virus_name.len);
+   node->vaccinated = intern(record->vaccinated.str, record->vaccinated.len);
+
+   return node;
 }
 
 // implementing list_insert(...) to add a new record (Node)  to the skip list
-Node *list_insert(SkipList *list, char *citizen_id, char *first_name,
-                  char *last_name, char *country, int age,
-                  char *virus_name, char *vaccinated, char *date)
+// the record's fields are slices, they are copied (or interned) into the list here
+Node *list_insert(SkipList *list, const Record *record)
 {
-   Node *update[list->max_level + 1]; // initializing a Node array of size max_level + 1 to keep track of linking
+   const char *citizen_id = record->citizen_id.str;
+   size_t id_len = record->citizen_id.len;
+   uint64_t key = list->packed_keys ? list_pack_key(citizen_id, id_len) : LIST_NO_KEY;
+
+   Node *update[LIST_MAX_LEVEL + 1]; // initializing a Node array big enough for any level to keep track of linking
    Node *current = list->head;        // starting at the head node of the list
+   Node **finger = list->finger;
+
+   // sorted input: an ID after the last one goes straight behind the tail of every level
+   // (levels the list has not reached yet end at the head), so nothing is searched
+   int at_tail = list->tail_valid &&
+                 (list->tail[0] == list->head || compare_node(list->tail[0], key, citizen_id, id_len) < 0);
+
+   // otherwise the finger helps an ID that comes after the previously inserted one
+   int use_finger = !at_tail && list->finger_valid &&
+                    (finger[0] == list->head || compare_node(finger[0], key, citizen_id, id_len) < 0);
+
+   if (at_tail)
+   {
+      for (int i = 0; i <= list->max_level; i++)
+      {
+         update[i] = list->tail[i];
+      }
+   }
 
    // a for-loop to find where to insert the new node at each level
-   for (int i = list->level; i >= 0; i--)
+   for (int i = at_tail ? -1 : list->level; i >= 0; i--)
    {
+      // jumping to the finger when it is further along this level than we already are
+      if (use_finger && finger[i] != current &&
+          (current == list->head || (finger[i] != list->head && compare_nodes(finger[i], current) > 0)))
+      {
+         current = finger[i];
+      }
+
       // moving forward as long as there is a node ahead and its ID is smaller
       while (current->next[i] != NULL &&
-             strcmp(current->next[i]->citizen_id, citizen_id) < 0)
+             compare_node(current->next[i], key, citizen_id, id_len) < 0)
       {
          current = current->next[i]; // moving to next node
       }
@@ -124,16 +289,16 @@ Node *list_insert(SkipList *list, char *citizen_id, char *first_name,
       exists. Therefore, we check if the next node has the same ID as our new node.
    */
 
-   // move to next node
-   current = current->next[0];
+   // move to next node (an ID appended at the tail has nothing after it)
+   current = at_tail ? NULL : current->next[0];
 
-   if (current != NULL && strcmp(current->citizen_id, citizen_id) == 0)
+   if (current != NULL && compare_node(current, key, citizen_id, id_len) == 0)
    {
       return NULL; // found duplicate, exit with failure
    }
 
    // get a random level for the new node
-   int new_level = random_level(list->max_level);
+   int new_level = random_level(list);
 
    // if the random level for the new node is higher than the
    // current highest level of the list, update the list level
@@ -145,61 +310,268 @@ Node *list_insert(SkipList *list, char *citizen_id, char *first_name,
          update[i] = list->head;
       }
 
-      list->level = new_level; // set new list level
+      __atomic_store_n(&list->level, new_level, __ATOMIC_RELEASE); // set new list level
    }
 
-   // allocating memory for the new node and filling in given data
-   Node *new_node = malloc(sizeof(Node));
-   new_node->citizen_id = strdup(citizen_id);
-   new_node->first_name = strdup(first_name);
-   new_node->last_name = strdup(last_name);
-   new_node->country = strdup(country);
-   new_node->age = age;
-   new_node->virus_name = strdup(virus_name);
-   new_node->vaccinated = strdup(vaccinated);
-   new_node->date = date ? strdup(date) : NULL;
-
-   // allocating space for next nodes according to the new level
-   new_node->next = malloc(sizeof(Node *) * (new_level + 1));
+   // allocating the new node together with its forward pointers and strings
+   Node *new_node = node_create(&list->arena, new_level + 1, record, list->packed_keys);
 
    // checking for memory allocation errors
-   if (new_node->next == NULL)
+   if (new_node == NULL)
    {
-      printf("Error while allocating memory");
       return NULL; // exit with failure
    }
 
    // linking the new node to each level using the update[] array
+   // the release store publishes the fully built node to concurrent readers
    for (int i = 0; i <= new_level; i++)
    {
       new_node->next[i] = update[i]->next[i];
-      update[i]->next[i] = new_node;
+      __atomic_store_n(&update[i]->next[i], new_node, __ATOMIC_RELEASE);
+
+      // a node with nothing after it is the new end of that level
+      if (new_node->next[i] == NULL)
+         list->tail[i] = new_node;
    }
 
+   // the next insert can start where this one ended
+   for (int i = 0; i <= list->max_level; i++)
+   {
+      finger[i] = i <= new_level ? new_node : (i <= list->level ? update[i] : list->head);
+   }
+   list->finger_valid = 1;
+
+   grow_max_level(list, __atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED));
    return new_node;
 }
 
+// find_position(...) fills preds[] and succs[] with the nodes around citizen_id on every level
+// on levels top and below
+static void find_position(SkipList *list, int top, uint64_t key, const char *citizen_id, size_t id_len,
+                          Node **preds, Node **succs)
+{
+   Node *current = list->head;
+
+   for (int i = top; i >= 0; i--)
+   {
+      Node *next = next_of(current, i);
+      while (next != NULL && compare_node(next, key, citizen_id, id_len) < 0)
+      {
+         current = next;
+         next = next_of(current, i);
+      }
+      preds[i] = current;
+      succs[i] = next;
+   }
+}
+
+// implementing list_insert_concurrent(...) to insert while other threads insert into
+// (and search) the same list, returns NULL for a duplicate ID like list_insert(...)
+Node *list_insert_concurrent(SkipList *list, const Record *record)
+{
+   const char *citizen_id = record->citizen_id.str;
+   size_t id_len = record->citizen_id.len;
+   uint64_t key = list->packed_keys ? list_pack_key(citizen_id, id_len) : LIST_NO_KEY;
+   Node *preds[LIST_MAX_LEVEL + 1];
+   Node *succs[LIST_MAX_LEVEL + 1];
+   Node *new_node = NULL;
+   int new_level = 0;
+
+   // another thread may raise the cap meanwhile, the positions are only found up to this one
+   int top = __atomic_load_n(&list->max_level, __ATOMIC_RELAXED);
+
+   while (1)
+   {
+      find_position(list, top, key, citizen_id, id_len, preds, succs);
+
+      // a duplicate wins even if we already built our node (its arena space is simply unused)
+      if (succs[0] != NULL && compare_node(succs[0], key, citizen_id, id_len) == 0)
+      {
+         return NULL;
+      }
+
+      // building the node once, the arena is the only thing writers share
+      if (new_node == NULL)
+      {
+         pthread_mutex_lock(&list->arena_lock);
+         new_level = random_level(list);
+         if (new_level > top)
+            new_level = top;
+         new_node = node_create(&list->arena, new_level + 1, record, list->packed_keys);
+         pthread_mutex_unlock(&list->arena_lock);
+
+         if (new_node == NULL)
+            return NULL;
+      }
+
+      // the node becomes visible once it is linked on the base level
+      new_node->next[0] = succs[0];
+      if (__atomic_compare_exchange_n(&preds[0]->next[0], &succs[0], new_node, false,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      {
+         break;
+      }
+      // someone linked a node between preds[0] and succs[0], so we look again
+   }
+
+   // linking the upper levels, each one is only a shortcut so they may lag behind
+   for (int i = 1; i <= new_level; i++)
+   {
+      while (1)
+      {
+         new_node->next[i] = succs[i];
+         if (__atomic_compare_exchange_n(&preds[i]->next[i], &succs[i], new_node, false,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+         {
+            break;
+         }
+         find_position(list, top, key, citizen_id, id_len, preds, succs);
+      }
+   }
+
+   // raising the list level if this node is the new tallest
+   int level = __atomic_load_n(&list->level, __ATOMIC_RELAXED);
+   while (new_level > level &&
+          !__atomic_compare_exchange_n(&list->level, &level, new_level, false,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+   {
+   }
+
+   // the tails are not tracked under concurrent inserts, list_append(...) finds them again
+   list->tail_valid = 0;
+   list->finger_valid = 0;
+
+   grow_max_level(list, __atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED));
+   return new_node;
+}
+
+// implementing list_append(...) to add a record whose ID is larger than every ID in the list
+// the node is linked behind the tail of each of its levels, so no search is needed
+// the record's strings are stored as given (not copied), so they must outlive the list
+Node *list_append(SkipList *list, const Node *record)
+{
+   // finding the tails again if concurrent inserts may have moved them
+   if (!list->tail_valid)
+   {
+      Node *current = list->head;
+      for (int i = list->max_level; i >= 0; i--)
+      {
+         while (current->next[i] != NULL)
+            current = current->next[i];
+         list->tail[i] = current;
+      }
+      list->tail_valid = 1;
+   }
+
+   size_t id_len = strlen(record->citizen_id);
+   uint64_t key = list->packed_keys ? list_pack_key(record->citizen_id, id_len) : LIST_NO_KEY;
+
+   // refusing records that would break the order
+   if (list->tail[0] != list->head && compare_node(list->tail[0], key, record->citizen_id, id_len) >= 0)
+   {
+      return NULL;
+   }
+
+   int new_level = random_level(list);
+   Node *new_node = alloc_node(list, new_level);
+
+   if (new_node == NULL)
+   {
+      return NULL;
+   }
+
+   struct Node **next = new_node->next;
+   *new_node = *record;
+   new_node->next = next;
+   new_node->key = key;
+
+   if (new_level > list->level)
+   {
+      __atomic_store_n(&list->level, new_level, __ATOMIC_RELEASE);
+   }
+
+   for (int i = 0; i <= new_level; i++)
+   {
+      new_node->next[i] = NULL;
+      __atomic_store_n(&list->tail[i]->next[i], new_node, __ATOMIC_RELEASE);
+      list->tail[i] = new_node;
+   }
+
+   // every tail comes before any larger ID, so they also make a valid finger
+   memcpy(list->finger, list->tail, sizeof(Node *) * (list->max_level + 1));
+   list->finger_valid = 1;
+
+   grow_max_level(list, __atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED));
+   return new_node;
+}
+
+// implementing list_remove(...) to unlink the record with citizen_id, returns it or NULL
+// the node stays in the arena with its forward pointers untouched, so a reader standing
+// on it when it is unlinked still walks on to the rest of the list
+Node *list_remove(SkipList *list, const char *citizen_id)
+{
+   size_t id_len = strlen(citizen_id);
+   uint64_t key = list->packed_keys ? list_pack_key(citizen_id, id_len) : LIST_NO_KEY;
+   Node *preds[LIST_MAX_LEVEL + 1];
+   Node *succs[LIST_MAX_LEVEL + 1];
+
+   find_position(list, list->level, key, citizen_id, id_len, preds, succs);
+
+   Node *target = succs[0];
+   if (target == NULL || compare_node(target, key, citizen_id, id_len) != 0)
+   {
+      return NULL;
+   }
+
+   // unlinking from the top down, so the node leaves the shortcuts before the base level
+   for (int i = list->level; i >= 0; i--)
+   {
+      if (succs[i] != target)
+         continue;
+
+      __atomic_store_n(&preds[i]->next[i], target->next[i], __ATOMIC_RELEASE);
+
+      // a tail or finger on the node moves back to its predecessor, which keeps it valid
+      if (list->tail[i] == target)
+         list->tail[i] = preds[i];
+      if (list->finger[i] == target)
+         list->finger[i] = preds[i];
+   }
+
+   __atomic_sub_fetch(&list->count, 1, __ATOMIC_RELAXED);
+   return target;
+}
+
 // implementing list_search(...) to search for records in the skip list
-Node *list_search(SkipList *list, char *citizen_id)
+Node *list_search(SkipList *list, const char *citizen_id)
 {
+   size_t id_len = strlen(citizen_id);
+   uint64_t key = list->packed_keys ? list_pack_key(citizen_id, id_len) : LIST_NO_KEY;
    Node *current = list->head; // start at the head of the list
+   uint64_t steps = 0;         // nodes compared against on the way down
+   int top = __atomic_load_n(&list->level, __ATOMIC_ACQUIRE);
 
    // go through the levels starting from the highest level
-   for (int i = list->level; i >= 0; i--)
+   for (int i = top; i >= 0; i--)
    {
       // continue as long as there is a node ahead and its ID is less than the current node
-      while (current->next[i] != NULL &&
-             strcmp(current->next[i]->citizen_id, citizen_id) < 0)
+      Node *next;
+      while ((next = next_of(current, i)) != NULL &&
+             (steps++, compare_node(next, key, citizen_id, id_len) < 0))
       {
-         current = current->next[i]; // move to next node
+         current = next; // move to next node
       }
    }
 
+   METRIC_ADD(list->searches, 1);
+   METRIC_ADD(list->search_steps, steps);
+   METRIC_ADD(list->search_levels, top + 1);
+
    // move to the next node (because we stop at the node that has ID strictly less than the next node)
-   current = current->next[0];
+   current = next_of(current, 0);
 
    // check if the ID matches
-   if (current != NULL && strcmp(current->citizen_id, citizen_id) == 0)
+   if (current != NULL && compare_node(current, key, citizen_id, id_len) == 0)
    {
       return current; // return current node if ID matches
    }
@@ -207,6 +579,142 @@ Node *list_search(SkipList *list, char *citizen_id)
    return NULL; // return NULL if ID does not match
 }
 
+// implementing list_seek(...) to find the first record whose ID is not smaller than citizen_id
+// walking on from it with list_next(...) gives a range scan
+Node *list_seek(SkipList *list, const char *citizen_id)
+{
+   size_t id_len = strlen(citizen_id);
+   uint64_t key = list->packed_keys ? list_pack_key(citizen_id, id_len) : LIST_NO_KEY;
+   Node *current = list->head;
+
+   for (int i = __atomic_load_n(&list->level, __ATOMIC_ACQUIRE); i >= 0; i--)
+   {
+      Node *next;
+      while ((next = next_of(current, i)) != NULL && compare_node(next, key, citizen_id, id_len) < 0)
+      {
+         current = next;
+      }
+   }
+
+   return next_of(current, 0);
+}
+
+// defining the state of one search that list_search_batch(...) is advancing
+typedef struct
+{
+   const Field *key; // the ID being searched for
+   uint64_t packed;  // its packed key
+   Node *current;    // the last node known to have a smaller ID
+   int level;        // the level the search is currently on
+   Node **result;    // where the answer is stored
+} Descent;
+
+// implementing list_search_batch(...) to run count searches interleaved with each other
+// each round moves every unfinished search one step and prefetches the node it will
+// look at next, so by the time the search comes back to it, the node is in cache
+void list_search_batch(SkipList *list, const Field *keys, size_t count, Node **results)
+{
+   Descent window[LIST_BATCH_WINDOW];
+   int top = __atomic_load_n(&list->level, __ATOMIC_ACQUIRE);
+   size_t next_key = 0;
+   int active = 0;
+   uint64_t steps = 0; // nodes compared against by every search of the batch
+
+   while (next_key < count || active > 0)
+   {
+      // refilling the window with new searches
+      while (active < LIST_BATCH_WINDOW && next_key < count)
+      {
+         Descent *d = &window[active++];
+         d->key = &keys[next_key];
+         d->packed = list->packed_keys ? list_pack_key(d->key->str, d->key->len) : LIST_NO_KEY;
+         d->result = &results[next_key];
+         d->current = list->head;
+         d->level = top;
+         __builtin_prefetch(next_of(list->head, top));
+         next_key++;
+      }
+
+      // one step for every search in the window
+      for (int i = 0; i < active;)
+      {
+         Descent *d = &window[i];
+         Node *next = next_of(d->current, d->level);
+         steps += next != NULL;
+
+         if (next != NULL && compare_node(next, d->packed, d->key->str, d->key->len) < 0)
+         {
+            // moving right and prefetching the node we will compare against next time
+            d->current = next;
+            Node *ahead = next_of(next, d->level);
+            if (ahead != NULL)
+               __builtin_prefetch(ahead);
+            i++;
+         }
+         else if (d->level > 0)
+         {
+            // dropping down a level, the candidate there is fetched ahead of time too
+            d->level--;
+            Node *ahead = next_of(d->current, d->level);
+            if (ahead != NULL)
+               __builtin_prefetch(ahead);
+            i++;
+         }
+         else
+         {
+            // the search ended, next is the only node that can hold the ID
+            *d->result = (next != NULL && compare_node(next, d->packed, d->key->str, d->key->len) == 0) ? next : NULL;
+            window[i] = window[--active]; // the last search takes this slot
+         }
+      }
+   }
+
+   METRIC_ADD(list->searches, count);
+   METRIC_ADD(list->search_steps, steps);
+   METRIC_ADD(list->search_levels, (top + 1) * count);
+}
+
+// implementing list_pack_key(...) to turn an ID of up to LIST_KEY_DIGITS digits into
+// its packed key, or LIST_NO_KEY when it has to be compared as a string
+uint64_t list_pack_key(const char *citizen_id, size_t len)
+{
+   if (len == 0 || len > LIST_KEY_DIGITS)
+   {
+      return LIST_NO_KEY;
+   }
+
+   uint64_t key = 0;
+   for (size_t i = 0; i < len; i++)
+   {
+      unsigned digit = (unsigned char)citizen_id[i] - '0';
+      if (digit > 9)
+         return LIST_NO_KEY;
+
+      // a digit is stored plus one, so a shorter ID (trailing zeros) sorts first
+      key |= (uint64_t)(digit + 1) << (60 - 4 * i);
+   }
+
+   return key;
+}
+
+// implementing list_first(...) to start an in-order walk, safe during concurrent inserts
+Node *list_first(SkipList *list)
+{
+   return next_of(list->head, 0);
+}
+
+// implementing list_next(...) to continue an in-order walk
+Node *list_next(Node *node)
+{
+   return next_of(node, 0);
+}
+
+// implementing list_memory(...) to report how many bytes the list has reserved
+size_t list_memory(SkipList *list)
+{
+   return sizeof(SkipList) + list->arena.bytes_reserved;
+}
+
 void list_print(SkipList *list)
 {
    printf("Skip List (%d levels):\n\n", list->level);
@@ -1,39 +1,108 @@
 #ifndef SKIP_LIST_H
 #define SKIP_LIST_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "arena.h"
+#include "record.h"
+
+#define LIST_BATCH_WINDOW 16 // searches list_search_batch(...) keeps in flight at once
+#define LIST_KEY_DIGITS 16    // longest numeric ID that fits in a packed key
+#define LIST_NO_KEY UINT64_MAX // packed key of an ID that is not numeric or is too long
+#define LIST_MIN_LEVEL 5       // level cap of a new list
+#define LIST_MAX_LEVEL 32      // highest level any list can grow to
+
 // defining the Node structure for our skip list
 typedef struct Node
 {
+   uint64_t key; // citizen_id packed so that comparing keys orders IDs like strcmp(...)
+
    // data fields for a citizen's vaccination record
-   char *citizen_id; // key for sorting
-   char *first_name;
-   char *last_name;
-   char *country;
-   int age;
-   char *virus_name;
-   char *vaccinated;
-   char *date;
-   struct Node **next;
+   const char *citizen_id; // key for sorting, the citizen's ID string when the record has a citizen
+   struct Citizen *citizen; // names, country and age, shared by the citizen's records of every virus
+   int32_t day; // vaccination date as a day number (see date.h), DATE_NONE when there is none
+   const char *virus_name; // interned
+   const char *vaccinated; // interned
+   struct Node **next; // forward pointers, allocated right behind the node
 } Node;
 
 // defining the structure for our SkipList
 typedef struct
 {
-   int max_level; // maximum number of levels allowed
+   int max_level; // highest level a new node may get, grows with count (about log2 of it)
    int level;     // current highest level
    Node *head;    // a pointer to the head node
+   Node **tail;   // the last node on every level, used by list_append(...)
+   int tail_valid; // cleared when concurrent inserts may have moved a tail
+   Node **finger; // per level, the last node before the previously inserted ID's successor
+   int finger_valid; // cleared when an insert other than list_insert(...) may have moved the finger
+   size_t count;  // number of records stored
+   uint64_t rng;  // state of the list's random generator, only touched by inserting threads
+   uint64_t searches;     // searches run on the list
+   uint64_t search_steps; // nodes those searches compared against (the search path length)
+   uint64_t search_levels; // levels those searches went down
+   int packed_keys; // 0 compares every ID as a string (LIST_STRING_KEYS set, for benchmarking)
+   Arena arena;   // owns every node, forward array and per-record string
+   pthread_mutex_t arena_lock; // taken by list_insert_concurrent(...) around arena use
 } SkipList;
 
 /*
 function prototypes
 */
-SkipList *list_create(int max_level); // function to create a new skip list
-void list_delete(SkipList *list);     // function to delete an existing skip list
-Node *list_insert(SkipList *list, char *citizen_id, char *first_name,
-                  char *last_name, char *country, int age,
-                  char *virus_name, char *vaccinated, char *date); // function to insert a new node (record)
-Node *list_search(SkipList *list, char *citizen_id);               // function to search through the skip list
+Node *node_create(Arena *arena, int levels, const Record *record,
+                  int packed_keys);   // function to copy a record into an arena node with levels forward pointers
+SkipList *list_create(uint64_t seed); // function to create a new skip list, seed 0 picks one from the clock
+void list_delete(SkipList *list);      // function to delete an existing skip list
+Node *list_insert(SkipList *list, const Record *record);            // function to insert a new node (record)
+Node *list_insert_concurrent(SkipList *list, const Record *record); // function to insert while other threads use the list
+Node *list_append(SkipList *list, const Node *record);             // function to add a record with the largest ID in O(1)
+Node *list_remove(SkipList *list, const char *citizen_id);         // function to unlink a record, returns it
+Node *list_search(SkipList *list, const char *citizen_id);         // function to search through the skip list
+Node *list_seek(SkipList *list, const char *citizen_id);           // function to find the first record with an ID >= citizen_id
+void list_search_batch(SkipList *list, const Field *keys,
+                       size_t count, Node **results);              // function to search many keys with interleaved descents
+Node *list_first(SkipList *list);                                  // function to get the record with the smallest ID
+Node *list_next(Node *node);                                       // function to get the record after node
 void list_print(SkipList *list);                                   // function to print the skip list
-int random_level(int max_level);                                   // function to get a random level to start search
+size_t list_memory(SkipList *list);                                // function to get the bytes reserved by the list
+uint64_t list_pack_key(const char *citizen_id, size_t len);        // function to pack a numeric ID into an integer key
+int random_level(SkipList *list);                                  // function to get a random level for a new node
+
+/*
+ID comparisons, shared with the B+-tree in bptree.c
+*/
+
+// compare_key(...) orders a node's NUL-terminated key against a key slice of len characters
+// exactly like strcmp(...) would if the slice were NUL-terminated
+static inline int compare_key(const char *node_key, const char *key, size_t len)
+{
+   int result = strncmp(node_key, key, len);
+
+   if (result != 0)
+      return result;
+
+   return node_key[len] != '\0'; // equal prefix, so the longer key sorts last
+}
+
+// compare_node(...) orders a node against a search key, using the packed keys when
+// both sides have one and the strings otherwise
+static inline int compare_node(const Node *node, uint64_t key, const char *citizen_id, size_t len)
+{
+   if (node->key != LIST_NO_KEY && key != LIST_NO_KEY)
+      return (node->key > key) - (node->key < key);
+
+   return compare_key(node->citizen_id, citizen_id, len);
+}
+
+// compare_nodes(...) orders two nodes of the same list
+static inline int compare_nodes(const Node *a, const Node *b)
+{
+   if (a->key != LIST_NO_KEY && b->key != LIST_NO_KEY)
+      return (a->key > b->key) - (a->key < b->key);
+
+   return strcmp(a->citizen_id, b->citizen_id);
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,647 @@
+/*
+This is the snapshot.c file that saves every virus (its bloom filter bits and its
+records in citizen ID order, plus its YES/NO tallies and the NO records behind
+them) into one binary file, and loads it back.
+
+Loading maps the file and builds the structures around the mapping instead of
+parsing text: the bloom filters use the saved bits in place, and the records'
+strings point straight into the string pool, so only the index nodes and the
+citizen-table entries (which borrow the pool's names) have to be allocated. Because the records are saved in order, every record is appended
+behind the last one of its index without searching. Restart cost is therefore mostly page faults.
+
+A snapshot with the wrong magic, version, size or checksum is rejected.
+*/
+
+// importing relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "intern.h"
+#include "citizen_table.h"
+#include "writer.h"
+
+// align64(...) rounds an offset up to the next multiple of 64
+static uint64_t align64(uint64_t offset)
+{
+   return (offset + 63) & ~(uint64_t)63;
+}
+
+// rotate(...) rotates a 64-bit value left by r bits
+static inline uint64_t rotate(uint64_t x, int r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+// checksum(...) hashes a buffer 32 bytes at a time with four independent lanes,
+// so it runs at several GB/s and is not the bottleneck of a restart
+static uint64_t checksum(const unsigned char *data, size_t len)
+{
+   const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+   uint64_t lane[4] = {prime, prime ^ 1, prime ^ 2, prime ^ 3};
+   uint64_t word;
+
+   while (len >= 32)
+   {
+      for (int i = 0; i < 4; i++)
+      {
+         memcpy(&word, data + i * 8, 8);
+         lane[i] = rotate((lane[i] ^ word) * prime, 31);
+      }
+      data += 32;
+      len -= 32;
+   }
+
+   // folding the remaining bytes into the first lane
+   while (len > 0)
+   {
+      lane[0] = rotate((lane[0] ^ *data++) * prime, 31);
+      len--;
+   }
+
+   uint64_t hash = lane[0] ^ rotate(lane[1], 17) ^ rotate(lane[2], 29) ^ rotate(lane[3], 47);
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdULL;
+   hash ^= hash >> 33;
+   return hash;
+}
+
+// defining the string pool as it is being planned or written
+// interned strings are shared, so they get one offset no matter how often they appear
+typedef struct
+{
+   uint64_t size;          // bytes planned (pass 1) or written (pass 2) so far
+   const char **keys;      // interned strings already given an offset
+   uint64_t *offsets;      // the offsets given to them
+   size_t slots;           // size of the two arrays (a power of two)
+   size_t used;
+} StringPool;
+
+// pool_slot(...) finds the slot of an interned string pointer
+static size_t pool_slot(StringPool *pool, const char *key)
+{
+   size_t i = ((uintptr_t)key >> 3) * 0x9e3779b97f4a7c15ULL >> 20 & (pool->slots - 1);
+
+   while (pool->keys[i] != NULL && pool->keys[i] != key)
+   {
+      i = (i + 1) & (pool->slots - 1);
+   }
+
+   return i;
+}
+
+// pool_grow(...) doubles the interned-string table
+static int pool_grow(StringPool *pool)
+{
+   StringPool bigger = *pool;
+   bigger.slots = pool->slots ? pool->slots * 2 : 256;
+   bigger.keys = calloc(bigger.slots, sizeof(char *));
+   bigger.offsets = malloc(bigger.slots * sizeof(uint64_t));
+
+   if (bigger.keys == NULL || bigger.offsets == NULL)
+   {
+      free(bigger.keys);
+      free(bigger.offsets);
+      return -1;
+   }
+
+   for (size_t i = 0; i < pool->slots; i++)
+   {
+      if (pool->keys[i] != NULL)
+      {
+         size_t j = pool_slot(&bigger, pool->keys[i]);
+         bigger.keys[j] = pool->keys[i];
+         bigger.offsets[j] = pool->offsets[i];
+      }
+   }
+
+   free(pool->keys);
+   free(pool->offsets);
+   *pool = bigger;
+   return 0;
+}
+
+// pool_add(...) gives str its pool offset; out is NULL while planning and is the pool
+// writer in the second pass, where only the first copy of an interned string is written
+static uint64_t pool_add(StringPool *pool, const char *str, int interned, Writer *out)
+{
+   size_t len = strlen(str) + 1;
+
+   if (interned)
+   {
+      if ((pool->used + 1) * 2 > pool->slots && pool_grow(pool) != 0)
+         interned = 0; // out of memory, the string is simply stored again
+   }
+
+   if (interned)
+   {
+      size_t i = pool_slot(pool, str);
+
+      // already given an offset: in pass 2, the string was written when it was first seen
+      if (pool->keys[i] != NULL)
+      {
+         return pool->offsets[i];
+      }
+
+      pool->keys[i] = str;
+      pool->offsets[i] = pool->size;
+      pool->used++;
+   }
+
+   uint64_t offset = pool->size;
+   if (out != NULL)
+      writer_put(out, str, len);
+   pool->size += len;
+   return offset;
+}
+
+// pool_reset(...) empties the pool so the second pass hands out the same offsets again
+static void pool_reset(StringPool *pool)
+{
+   free(pool->keys);
+   free(pool->offsets);
+   memset(pool, 0, sizeof(StringPool));
+}
+
+// defining where add_record(...) puts the strings and records of a scan
+typedef struct
+{
+   StringPool *pool;
+   Writer *out;
+   Writer *records;
+} PoolTarget;
+
+// add_record(...) adds the strings of one record to the pool (and writes the record)
+static int add_record(const Node *node, void *ctx)
+{
+   PoolTarget *target = ctx;
+   SnapshotRecord record;
+
+   memset(&record, 0, sizeof(record));
+   record.citizen_id = pool_add(target->pool, node->citizen_id, 0, target->out);
+   record.first_name = pool_add(target->pool, node->citizen->first_name, 0, target->out);
+   record.last_name = pool_add(target->pool, node->citizen->last_name, 0, target->out);
+   record.country = pool_add(target->pool, node->citizen->country, 1, target->out);
+   record.virus_name = pool_add(target->pool, node->virus_name, 1, target->out);
+   record.vaccinated = pool_add(target->pool, node->vaccinated, 1, target->out);
+   record.day = node->day;
+   record.age = node->citizen->age;
+
+   if (target->records != NULL)
+      writer_put(target->records, (const char *)&record, sizeof(record));
+   return 0;
+}
+
+// add_counts(...) adds the country of one row of tallies to the pool (and writes the row)
+static int add_counts(const char *country, const PopulationCounts *counts, void *ctx)
+{
+   PoolTarget *target = ctx;
+   SnapshotCounts row;
+
+   memset(&row, 0, sizeof(row));
+   row.country = pool_add(target->pool, country, 1, target->out);
+   memcpy(row.yes, counts->yes, sizeof(row.yes));
+   memcpy(row.no, counts->no, sizeof(row.no));
+
+   if (target->records != NULL)
+      writer_put(target->records, (const char *)&row, sizeof(row));
+   return 0;
+}
+
+// add_unvaccinated(...) adds the strings of one NO record to the pool (and writes the record)
+static void add_unvaccinated(const Unvaccinated *no, void *ctx)
+{
+   PoolTarget *target = ctx;
+   SnapshotUnvaccinated row;
+
+   memset(&row, 0, sizeof(row));
+   row.citizen_id = pool_add(target->pool, no->citizen_id, 0, target->out);
+   row.country = pool_add(target->pool, no->country, 1, target->out);
+   row.age = no->age;
+
+   if (target->records != NULL)
+      writer_put(target->records, (const char *)&row, sizeof(row));
+}
+
+// add_strings(...) walks every string of every virus in one fixed order, once to plan
+// the offsets (writing the records) and once to write the pool itself
+static void add_strings(StringPool *pool, const SnapshotEntry *entries, int count,
+                        Writer *out, Writer *records, uint64_t *name_offsets)
+{
+   PoolTarget target = {pool, out, records};
+
+   for (int v = 0; v < count; v++)
+   {
+      name_offsets[v] = pool_add(pool, entries[v].name, 0, out);
+   }
+
+   for (int v = 0; v < count; v++)
+   {
+      index_scan(entries[v].index, NULL, NULL, add_record, &target);
+   }
+
+   for (int v = 0; v < count; v++)
+   {
+      population_scan(entries[v].population, add_counts, &target);
+   }
+
+   for (int v = 0; v < count; v++)
+   {
+      unvaccinated_scan(entries[v].unvaccinated, add_unvaccinated, &target);
+   }
+}
+
+// pad(...) writes zero bytes until *position reaches target
+static void pad(Writer *out, uint64_t *position, uint64_t target)
+{
+   while (*position < target)
+   {
+      writer_putc(out, '\0');
+      (*position)++;
+   }
+}
+
+// implementing snapshot_save(...) to write every virus to path
+// the snapshot is written to path.tmp and renamed over path once complete
+int snapshot_save(const char *path, const SnapshotEntry *entries, int count)
+{
+   char temp_path[strlen(path) + 5];
+   snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+   int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0)
+   {
+      return -1;
+   }
+
+   // laying out the table, the filters and the record arrays
+   SnapshotVirus table[count > 0 ? count : 1];
+   uint64_t name_offsets[count > 0 ? count : 1];
+   uint64_t position = align64(sizeof(SnapshotHeader) + count * sizeof(SnapshotVirus));
+
+   memset(table, 0, sizeof(table));
+   for (int v = 0; v < count; v++)
+   {
+      table[v].bloom_offset = position;
+      table[v].bloom_bits = entries[v].bloom->size;
+      table[v].bloom_hashes = entries[v].bloom->num_hashes;
+      table[v].bloom_layout = entries[v].bloom->layout;
+      position += bloom_bytes(entries[v].bloom->size, entries[v].bloom->layout); // a whole number of 64-byte blocks
+   }
+
+   // the records of every virus follow the filters, one array after the other
+   for (int v = 0; v < count; v++)
+   {
+      table[v].records_offset = position;
+      table[v].record_count = index_count(entries[v].index);
+      position += table[v].record_count * sizeof(SnapshotRecord);
+   }
+
+   // and the tallies of every virus follow the records
+   for (int v = 0; v < count; v++)
+   {
+      table[v].counts_offset = position;
+      table[v].country_count = population_countries(entries[v].population);
+      position += table[v].country_count * sizeof(SnapshotCounts);
+   }
+
+   // then the NO records of every virus, the pool comes last
+   for (int v = 0; v < count; v++)
+   {
+      table[v].unvaccinated_offset = position;
+      table[v].unvaccinated_count = unvaccinated_count(entries[v].unvaccinated);
+      position += table[v].unvaccinated_count * sizeof(SnapshotUnvaccinated);
+   }
+
+   SnapshotHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+   header.version = SNAPSHOT_VERSION;
+   header.byte_order = SNAPSHOT_BYTE_ORDER;
+   header.virus_count = count;
+   header.pool_offset = position;
+
+   Writer out;
+   if (writer_init(&out, fd, WRITER_DEFAULT_SIZE) != 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   // the header is written again at the end, once the checksum is known
+   StringPool pool;
+   memset(&pool, 0, sizeof(pool));
+   uint64_t written = 0;
+
+   writer_put(&out, (const char *)&header, sizeof(header));
+   written += sizeof(header);
+   writer_put(&out, (const char *)table, count * sizeof(SnapshotVirus));
+   written += count * sizeof(SnapshotVirus);
+
+   for (int v = 0; v < count; v++)
+   {
+      pad(&out, &written, table[v].bloom_offset);
+      uint64_t bytes = bloom_bytes(entries[v].bloom->size, entries[v].bloom->layout);
+      writer_put(&out, (const char *)entries[v].bloom->bits, bytes);
+      written += bytes;
+   }
+
+   // pass 1: writing the records and tallies (in virus order) with their planned string offsets
+   add_strings(&pool, entries, count, NULL, &out, name_offsets);
+   header.pool_size = pool.size;
+   pool_reset(&pool);
+
+   // pass 2: writing the pool itself, in the same order so the offsets line up
+   add_strings(&pool, entries, count, &out, NULL, name_offsets);
+   pool_reset(&pool);
+
+   header.file_size = header.pool_offset + header.pool_size;
+   writer_close(&out);
+
+   // the names were only known after planning, so the table is written again
+   for (int v = 0; v < count; v++)
+   {
+      table[v].name = name_offsets[v];
+   }
+
+   int result = out.failed ? -1 : 0;
+   if (result == 0 &&
+       pwrite(fd, table, count * sizeof(SnapshotVirus), sizeof(header)) != (ssize_t)(count * sizeof(SnapshotVirus)))
+   {
+      result = -1;
+   }
+
+   // checksumming the finished payload through a mapping of the file
+   if (result == 0 && header.file_size > sizeof(header))
+   {
+      void *data = mmap(NULL, header.file_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (data == MAP_FAILED)
+      {
+         result = -1;
+      }
+      else
+      {
+         header.checksum = checksum((const unsigned char *)data + sizeof(header),
+                                    header.file_size - sizeof(header));
+         munmap(data, header.file_size);
+      }
+   }
+
+   if (result == 0 && pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+   {
+      result = -1;
+   }
+
+   // making sure the data is on disk before the rename makes it the snapshot
+   if (result == 0 && fsync(fd) != 0)
+   {
+      result = -1;
+   }
+
+   close(fd);
+
+   if (result == 0 && rename(temp_path, path) != 0)
+   {
+      result = -1;
+   }
+
+   if (result != 0)
+   {
+      unlink(temp_path);
+   }
+
+   return result;
+}
+
+// fail(...) stores an error message for the caller
+static void fail(char *error, size_t error_size, const char *message)
+{
+   snprintf(error, error_size, "%s", message);
+}
+
+// implementing snapshot_load(...) to map a snapshot and rebuild every virus it holds
+// the returned Snapshot must stay open until every filter and index it built is deleted
+// a non-zero seed gives each skip list seed ^ bloom_hash(name), like list_seed_for(...) in main.c
+Snapshot *snapshot_load(const char *path, SnapshotEntry **entries_out, int *count_out, IndexKind kind,
+                        uint64_t seed, char *error, size_t error_size)
+{
+   int fd = open(path, O_RDONLY);
+   struct stat info;
+
+   if (fd < 0 || fstat(fd, &info) != 0)
+   {
+      if (fd >= 0)
+         close(fd);
+      fail(error, error_size, "cannot open snapshot");
+      return NULL;
+   }
+
+   if ((size_t)info.st_size < sizeof(SnapshotHeader))
+   {
+      close(fd);
+      fail(error, error_size, "snapshot is truncated");
+      return NULL;
+   }
+
+   // a private writable mapping lets the filters take new bits later (copy on write)
+   size_t size = info.st_size;
+   unsigned char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (data == MAP_FAILED)
+   {
+      fail(error, error_size, "cannot map snapshot");
+      return NULL;
+   }
+
+   SnapshotHeader *header = (SnapshotHeader *)data;
+   SnapshotVirus *table = (SnapshotVirus *)(data + sizeof(SnapshotHeader));
+   const char *message = NULL;
+
+   // rejecting anything that is not exactly a snapshot this build can read
+   if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+      message = "not a snapshot file";
+   else if (header->byte_order != SNAPSHOT_BYTE_ORDER)
+      message = "snapshot was written on a machine with a different byte order";
+   else if (header->version != SNAPSHOT_VERSION)
+      message = "snapshot format version is not supported";
+   else if (header->file_size != size)
+      message = "snapshot size does not match its header";
+   else if (header->pool_offset > size || header->pool_size != size - header->pool_offset ||
+            header->pool_size == 0 || data[size - 1] != '\0')
+      message = "snapshot string pool is damaged";
+   else if (sizeof(SnapshotHeader) + (uint64_t)header->virus_count * sizeof(SnapshotVirus) > header->pool_offset)
+      message = "snapshot virus table is damaged";
+   else if (checksum(data + sizeof(SnapshotHeader), size - sizeof(SnapshotHeader)) != header->checksum)
+      message = "snapshot checksum mismatch";
+
+   int count = message ? 0 : header->virus_count;
+   SnapshotEntry *entries = calloc(count > 0 ? count : 1, sizeof(SnapshotEntry));
+   const char *pool = (const char *)data + header->pool_offset;
+
+   if (message == NULL && entries == NULL)
+      message = "out of memory";
+
+   // building each virus around the mapped bits and strings
+   int built = 0;
+   for (int v = 0; v < count && message == NULL; v++)
+   {
+      SnapshotVirus *entry = &table[v];
+      BloomLayout layout = entry->bloom_layout == BLOOM_BLOCKED || entry->bloom_layout == BLOOM_COUNTING
+                              ? (BloomLayout)entry->bloom_layout
+                              : BLOOM_STANDARD;
+
+      // every range is checked by subtracting from pool_offset, so no sum can overflow
+      if (entry->name >= header->pool_size ||
+          entry->bloom_offset % 64 != 0 || entry->bloom_bits == 0 || entry->bloom_bits % BLOOM_BLOCK_BITS != 0 ||
+          entry->bloom_offset > header->pool_offset ||
+          bloom_bytes(entry->bloom_bits, layout) > header->pool_offset - entry->bloom_offset ||
+          entry->bloom_hashes < 1 || entry->bloom_hashes > BLOOM_MAX_HASHES ||
+          entry->records_offset % 64 != 0 || entry->records_offset > header->pool_offset ||
+          entry->record_count > (header->pool_offset - entry->records_offset) / sizeof(SnapshotRecord) ||
+          entry->counts_offset % 64 != 0 || entry->counts_offset > header->pool_offset ||
+          entry->country_count > (header->pool_offset - entry->counts_offset) / sizeof(SnapshotCounts) ||
+          entry->unvaccinated_offset % 8 != 0 || entry->unvaccinated_offset > header->pool_offset ||
+          entry->unvaccinated_count >
+             (header->pool_offset - entry->unvaccinated_offset) / sizeof(SnapshotUnvaccinated))
+      {
+         message = "snapshot virus entry is damaged";
+         break;
+      }
+
+      entries[v].name = pool + entry->name;
+      entries[v].bloom = bloom_wrap(data + entry->bloom_offset, entry->bloom_bits, entry->bloom_hashes, layout);
+      entries[v].index = index_create(kind, seed ? seed ^ bloom_hash(entries[v].name, strlen(entries[v].name)) : 0);
+      entries[v].population = population_create();
+      entries[v].unvaccinated = unvaccinated_create();
+      built = v + 1;
+
+      if (entries[v].bloom == NULL || entries[v].index == NULL || entries[v].population == NULL ||
+          entries[v].unvaccinated == NULL)
+      {
+         message = "out of memory";
+         break;
+      }
+
+      SnapshotRecord *records = (SnapshotRecord *)(data + entry->records_offset);
+      for (uint64_t r = 0; r < entry->record_count; r++)
+      {
+         SnapshotRecord *record = &records[r];
+         Record person;
+         Node node;
+
+         if (record->citizen_id >= header->pool_size || record->first_name >= header->pool_size ||
+             record->last_name >= header->pool_size || record->country >= header->pool_size ||
+             record->virus_name >= header->pool_size || record->vaccinated >= header->pool_size)
+         {
+            message = "snapshot record is damaged";
+            break;
+         }
+
+         // the pool ends with a NUL, so every offset inside it starts a terminated string,
+         // which the citizen table borrows instead of copying
+         memset(&person, 0, sizeof(person));
+         person.citizen_id.str = pool + record->citizen_id;
+         person.citizen_id.len = strlen(person.citizen_id.str);
+         person.first_name.str = pool + record->first_name;
+         person.first_name.len = strlen(person.first_name.str);
+         person.last_name.str = pool + record->last_name;
+         person.last_name.len = strlen(person.last_name.str);
+         person.country.str = pool + record->country;
+         person.country.len = strlen(person.country.str);
+         person.age = record->age;
+
+         node.citizen = citizen_table_add(&person, 1);
+         if (node.citizen == NULL)
+         {
+            message = "out of memory";
+            break;
+         }
+
+         node.citizen_id = node.citizen->citizen_id;
+         node.virus_name = intern(pool + record->virus_name, strlen(pool + record->virus_name));
+         node.vaccinated = intern(pool + record->vaccinated, strlen(pool + record->vaccinated));
+         node.day = record->day;
+
+         if (index_append(entries[v].index, &node) == NULL)
+         {
+            message = "snapshot records are out of order";
+            break;
+         }
+      }
+
+      SnapshotCounts *rows = (SnapshotCounts *)(data + entry->counts_offset);
+      for (uint64_t c = 0; c < entry->country_count && message == NULL; c++)
+      {
+         PopulationCounts counts;
+
+         if (rows[c].country >= header->pool_size)
+         {
+            message = "snapshot tallies are damaged";
+            break;
+         }
+
+         memcpy(counts.yes, rows[c].yes, sizeof(counts.yes));
+         memcpy(counts.no, rows[c].no, sizeof(counts.no));
+         const char *country = intern(pool + rows[c].country, strlen(pool + rows[c].country));
+         if (country == NULL || population_add_counts(entries[v].population, country, &counts) != 0)
+            message = "out of memory";
+      }
+
+      // the NO records borrow their IDs from the pool like the citizens do
+      SnapshotUnvaccinated *nos = (SnapshotUnvaccinated *)(data + entry->unvaccinated_offset);
+      for (uint64_t n = 0; n < entry->unvaccinated_count && message == NULL; n++)
+      {
+         if (nos[n].citizen_id >= header->pool_size || nos[n].country >= header->pool_size)
+         {
+            message = "snapshot NO records are damaged";
+            break;
+         }
+
+         const char *citizen_id = pool + nos[n].citizen_id;
+         const char *country = intern(pool + nos[n].country, strlen(pool + nos[n].country));
+         if (country == NULL ||
+             unvaccinated_add(entries[v].unvaccinated, citizen_id, strlen(citizen_id), country, nos[n].age, 1) < 0)
+            message = "out of memory";
+      }
+   }
+
+   Snapshot *snapshot = message ? NULL : malloc(sizeof(Snapshot));
+
+   if (snapshot == NULL)
+   {
+      // undoing everything built before the problem was found
+      for (int v = 0; v < built; v++)
+      {
+         if (entries[v].bloom)
+            bloom_delete(entries[v].bloom);
+         if (entries[v].index)
+            index_delete(entries[v].index);
+         if (entries[v].population)
+            population_delete(entries[v].population);
+         if (entries[v].unvaccinated)
+            unvaccinated_delete(entries[v].unvaccinated);
+      }
+      free(entries);
+      munmap(data, size);
+      fail(error, error_size, message ? message : "out of memory");
+      return NULL;
+   }
+
+   snapshot->data = data;
+   snapshot->size = size;
+   *entries_out = entries;
+   *count_out = count;
+   return snapshot;
+}
+
+// implementing snapshot_close(...) to unmap a snapshot
+void snapshot_close(Snapshot *snapshot)
+{
+   munmap(snapshot->data, snapshot->size);
+   free(snapshot);
+}
@@ -0,0 +1,118 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bloom_filter.h"
+#include "index.h"
+#include "population.h"
+#include "unvaccinated.h"
+
+#define SNAPSHOT_MAGIC "VACSNAP"  // the first 8 bytes of every snapshot (with the NUL)
+#define SNAPSHOT_VERSION 7        // bumped whenever the layout below changes
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL // reads back differently on a machine of the other byte order
+
+/*
+On-disk layout (every section 64-byte aligned). Integers are stored in the byte order
+of the machine that wrote the snapshot; byte_order records it, and a machine of the
+other byte order rejects the file instead of converting it:
+
+   SnapshotHeader
+   SnapshotVirus[virus_count]
+   for every virus: the raw bloom filter bits (4-bit counters for the counting layout)
+   for every virus: SnapshotRecord[record_count] in citizen ID order
+   for every virus: SnapshotCounts[country_count], its YES/NO tallies per country
+   for every virus: SnapshotUnvaccinated[unvaccinated_count], its NO records, in no order
+   string pool: every string NUL-terminated, records refer to them by offset
+
+The checksum covers every byte after the header.
+*/
+
+// defining the fixed-size header at the start of a snapshot
+typedef struct
+{
+   char magic[8];         // SNAPSHOT_MAGIC
+   uint32_t version;      // SNAPSHOT_VERSION
+   uint32_t virus_count;  // entries in the virus table
+   uint64_t file_size;    // total size of the file
+   uint64_t checksum;     // checksum of bytes [sizeof(SnapshotHeader), file_size)
+   uint64_t pool_offset;  // where the string pool starts
+   uint64_t pool_size;    // bytes in the string pool
+   uint64_t byte_order;   // SNAPSHOT_BYTE_ORDER as the saving machine stores it
+   uint64_t reserved;     // zero, keeps the header at 64 bytes
+} SnapshotHeader;
+
+// defining one entry of the virus table
+typedef struct
+{
+   uint64_t name;           // pool offset of the virus name
+   uint64_t bloom_offset;   // where the filter bits start
+   uint64_t bloom_bits;     // number of bits (or counters) in the filter
+   uint32_t bloom_hashes;   // probes per record
+   uint32_t bloom_layout;   // a BloomLayout value
+   uint64_t records_offset; // where the record array starts
+   uint64_t record_count;   // records in the array
+   uint64_t counts_offset;  // where the tallies start
+   uint64_t country_count;  // countries in the tallies
+   uint64_t unvaccinated_offset; // where the NO records start
+   uint64_t unvaccinated_count;  // NO records in the array
+} SnapshotVirus;
+
+// defining one record, every string is a pool offset
+typedef struct
+{
+   uint64_t citizen_id;
+   uint64_t first_name;
+   uint64_t last_name;
+   uint64_t country;
+   uint64_t virus_name;
+   uint64_t vaccinated;
+   int32_t day; // day number of the vaccination date, DATE_NONE when there is no date
+   int32_t age;
+   uint64_t reserved;
+} SnapshotRecord;
+
+// defining the tallies of one country, the unvaccinated records are only kept here
+typedef struct
+{
+   uint64_t country; // pool offset of the country
+   uint64_t yes[POPULATION_AGE_BANDS];
+   uint64_t no[POPULATION_AGE_BANDS];
+   uint64_t reserved[3]; // zero, keeps a row at 192 bytes so sections stay 64-byte aligned
+} SnapshotCounts;
+
+// defining one NO record, with what it was counted under in the tallies
+typedef struct
+{
+   uint64_t citizen_id; // pool offset
+   uint64_t country;    // pool offset
+   int32_t age;
+   int32_t reserved;    // zero
+} SnapshotUnvaccinated;
+
+// defining a virus as handed to snapshot_save(...) and returned by snapshot_load(...)
+typedef struct
+{
+   const char *name;
+   BloomFilter *bloom;
+   Index *index;
+   Population *population; // the tallies, without the vaccinations by day (the records have the days)
+   UnvaccinatedSet *unvaccinated; // the NO records behind the tallies' NO counts
+} SnapshotEntry;
+
+// defining an opened snapshot, the structures it built point into its mapping
+typedef struct
+{
+   void *data;   // the mapping
+   size_t size;  // its length
+} Snapshot;
+
+/*
+function prototypes
+*/
+int snapshot_save(const char *path, const SnapshotEntry *entries, int count);   // function to write a snapshot, 0 on success
+Snapshot *snapshot_load(const char *path, SnapshotEntry **entries, int *count, IndexKind kind,
+                        uint64_t seed, char *error, size_t error_size);         // function to map a snapshot and rebuild every virus
+void snapshot_close(Snapshot *snapshot);                                       // function to unmap a snapshot once its structures are gone
+
+#endif
@@ -0,0 +1,227 @@
+/*
+This is the unvaccinated.c file that remembers the NO records of a virus. They are
+not stored in the virus's index (nothing lists or checks them), only counted in its
+tallies, so without them an update or delete could not tell which NO to take back.
+Every record keeps its citizen ID, country and age, which is all the tallies need.
+
+The set is an open-addressing table keyed by citizen ID; a removed entry's slot
+is refilled by moving back the entries after it, so lookups never meet tombstones.
+Entries live in an arena; a removed one stays there until the set is deleted.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "unvaccinated.h"
+#include "bloom_filter.h"
+
+// implementing unvaccinated_create(...) to create a set with no records
+UnvaccinatedSet *unvaccinated_create(void)
+{
+   UnvaccinatedSet *set = calloc(1, sizeof(UnvaccinatedSet));
+
+   // checking if memory was allocated successfully
+   if (set == NULL)
+   {
+      printf("Error while allocating memory");
+      return NULL;
+   }
+
+   arena_init(&set->arena);
+   pthread_mutex_init(&set->lock, NULL);
+   return set;
+}
+
+// implementing unvaccinated_delete(...) to release the set and every entry
+void unvaccinated_delete(UnvaccinatedSet *set)
+{
+   free(set->slots);
+   arena_free(&set->arena);
+   pthread_mutex_destroy(&set->lock);
+   free(set);
+}
+
+// find_slot(...) returns the slot holding the ID, or the empty slot where it belongs
+static size_t find_slot(const UnvaccinatedSet *set, uint64_t hash, const char *citizen_id, size_t len)
+{
+   size_t mask = set->slot_count - 1;
+   size_t i = hash & mask;
+   const Unvaccinated *entry;
+
+   // linear probing until we hit the ID or an empty slot
+   while ((entry = set->slots[i]) != NULL &&
+          !(strncmp(entry->citizen_id, citizen_id, len) == 0 && entry->citizen_id[len] == '\0'))
+   {
+      i = (i + 1) & mask;
+   }
+
+   return i;
+}
+
+// grow(...) rehashes the set into a table twice the size (called with the lock held)
+static int grow(UnvaccinatedSet *set)
+{
+   size_t new_count = set->slot_count ? set->slot_count * 2 : UNVACCINATED_INITIAL_SLOTS;
+   Unvaccinated **bigger = calloc(new_count, sizeof(Unvaccinated *));
+
+   // checking if memory was allocated successfully
+   if (bigger == NULL)
+   {
+      printf("Error while allocating memory");
+      return -1;
+   }
+
+   Unvaccinated **old = set->slots;
+   size_t old_count = set->slot_count;
+   set->slots = bigger;
+   set->slot_count = new_count;
+
+   for (size_t i = 0; i < old_count; i++)
+   {
+      if (old[i] != NULL)
+      {
+         const char *id = old[i]->citizen_id;
+         size_t len = strlen(id);
+         bigger[find_slot(set, bloom_hash(id, len), id, len)] = old[i];
+      }
+   }
+
+   free(old);
+   return 0;
+}
+
+// implementing unvaccinated_add(...) to remember a citizen's NO record under the country and
+// age it was counted with; a citizen who has one already keeps it and 0 is returned
+// with borrow set the ID is a NUL-terminated string that outlives the set, and is not copied
+int unvaccinated_add(UnvaccinatedSet *set, const char *citizen_id, size_t len, const char *country, int age,
+                     int borrow)
+{
+   uint64_t hash = bloom_hash(citizen_id, len);
+   int result = -1;
+
+   pthread_mutex_lock(&set->lock);
+
+   // keeping the table at most half full so probe sequences stay short
+   if ((set->count + 1) * 2 > set->slot_count && grow(set) != 0)
+   {
+      pthread_mutex_unlock(&set->lock);
+      return -1;
+   }
+
+   size_t slot = find_slot(set, hash, citizen_id, len);
+
+   if (set->slots[slot] != NULL)
+   {
+      result = 0;
+   }
+   else
+   {
+      Unvaccinated *entry = arena_alloc(&set->arena, sizeof(Unvaccinated), _Alignof(Unvaccinated));
+      const char *id = borrow ? citizen_id : arena_strndup(&set->arena, citizen_id, len);
+
+      if (entry != NULL && id != NULL)
+      {
+         entry->citizen_id = id;
+         entry->country = country;
+         entry->age = age;
+         set->slots[slot] = entry;
+         set->count++;
+         result = 1;
+      }
+   }
+
+   pthread_mutex_unlock(&set->lock);
+   return result;
+}
+
+// implementing unvaccinated_find(...) to copy a citizen's NO record into record
+int unvaccinated_find(UnvaccinatedSet *set, const char *citizen_id, size_t len, Unvaccinated *record)
+{
+   int result = -1;
+
+   pthread_mutex_lock(&set->lock);
+   if (set->slot_count > 0)
+   {
+      const Unvaccinated *entry = set->slots[find_slot(set, bloom_hash(citizen_id, len), citizen_id, len)];
+      if (entry != NULL)
+      {
+         if (record != NULL)
+            *record = *entry;
+         result = 0;
+      }
+   }
+   pthread_mutex_unlock(&set->lock);
+
+   return result;
+}
+
+// implementing unvaccinated_remove(...) to take a citizen's NO record out, copying it into record
+// (record's citizen_id is only valid until the set is deleted)
+int unvaccinated_remove(UnvaccinatedSet *set, const char *citizen_id, size_t len, Unvaccinated *record)
+{
+   int result = -1;
+
+   pthread_mutex_lock(&set->lock);
+   if (set->slot_count > 0)
+   {
+      size_t mask = set->slot_count - 1;
+      size_t hole = find_slot(set, bloom_hash(citizen_id, len), citizen_id, len);
+
+      if (set->slots[hole] != NULL)
+      {
+         if (record != NULL)
+            *record = *set->slots[hole];
+         set->slots[hole] = NULL;
+         set->count--;
+         result = 0;
+
+         // moving back every entry after the hole that could no longer be reached from its home slot
+         for (size_t i = (hole + 1) & mask; set->slots[i] != NULL; i = (i + 1) & mask)
+         {
+            const char *id = set->slots[i]->citizen_id;
+            size_t home = bloom_hash(id, strlen(id)) & mask;
+
+            if (hole <= i ? (home > hole && home <= i) : (home > hole || home <= i))
+               continue;
+
+            set->slots[hole] = set->slots[i];
+            set->slots[i] = NULL;
+            hole = i;
+         }
+      }
+   }
+   pthread_mutex_unlock(&set->lock);
+
+   return result;
+}
+
+// implementing unvaccinated_scan(...) to hand every record to visit, under the lock
+void unvaccinated_scan(UnvaccinatedSet *set, UnvaccinatedVisitor visit, void *ctx)
+{
+   pthread_mutex_lock(&set->lock);
+   for (size_t i = 0; i < set->slot_count; i++)
+   {
+      if (set->slots[i] != NULL)
+         visit(set->slots[i], ctx);
+   }
+   pthread_mutex_unlock(&set->lock);
+}
+
+// implementing unvaccinated_count(...) to count the records
+size_t unvaccinated_count(UnvaccinatedSet *set)
+{
+   pthread_mutex_lock(&set->lock);
+   size_t count = set->count;
+   pthread_mutex_unlock(&set->lock);
+   return count;
+}
+
+// implementing unvaccinated_memory(...) to report what the set costs
+size_t unvaccinated_memory(UnvaccinatedSet *set)
+{
+   pthread_mutex_lock(&set->lock);
+   size_t bytes = sizeof(UnvaccinatedSet) + set->slot_count * sizeof(Unvaccinated *) + set->arena.bytes_reserved;
+   pthread_mutex_unlock(&set->lock);
+   return bytes;
+}
@@ -0,0 +1,49 @@
+#ifndef UNVACCINATED_H
+#define UNVACCINATED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "arena.h"
+
+#define UNVACCINATED_INITIAL_SLOTS 64 // slots of the first hash table (a power of two)
+
+// defining one unvaccinated record, what it was counted under in the virus's tallies
+typedef struct
+{
+   const char *citizen_id;
+   const char *country; // interned
+   int age;
+} Unvaccinated;
+
+// defining the unvaccinated (NO) records of one virus, hashed by citizen ID, so a change
+// can take back exactly the NO it replaces; the records themselves are not indexed
+typedef struct
+{
+   Unvaccinated **slots; // open addressing, NULL for an empty slot
+   size_t slot_count;    // a power of two, 0 before the first record
+   size_t count;
+   Arena arena;          // the entries and the IDs they copied
+   pthread_mutex_t lock; // the loading thread and queries may use the set at once
+} UnvaccinatedSet;
+
+// defining the callback unvaccinated_scan(...) hands every record to
+typedef void (*UnvaccinatedVisitor)(const Unvaccinated *record, void *ctx);
+
+/*
+function prototypes
+*/
+UnvaccinatedSet *unvaccinated_create(void);                           // function to create an empty set
+void unvaccinated_delete(UnvaccinatedSet *set);                       // function to delete a set
+int unvaccinated_add(UnvaccinatedSet *set, const char *citizen_id, size_t len,
+                     const char *country, int age, int borrow);       // function to add a record, 1 if added and 0 if the ID is there already
+int unvaccinated_find(UnvaccinatedSet *set, const char *citizen_id, size_t len,
+                      Unvaccinated *record);                          // function to read a citizen's record, -1 if there is none
+int unvaccinated_remove(UnvaccinatedSet *set, const char *citizen_id, size_t len,
+                        Unvaccinated *record);                        // function to take a citizen's record out, -1 if there is none
+void unvaccinated_scan(UnvaccinatedSet *set, UnvaccinatedVisitor visit,
+                       void *ctx);                                    // function to visit every record, in no order
+size_t unvaccinated_count(UnvaccinatedSet *set);                      // function to get the number of records
+size_t unvaccinated_memory(UnvaccinatedSet *set);                     // function to get the bytes held by the set
+
+#endif
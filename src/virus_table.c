@@ -0,0 +1,208 @@
+/*
+This is the virus_table.c file that keeps every virus in an open-addressing hash
+table keyed by name, plus an array in creation order so viruses also have a
+dense index (used by the parallel loader and the batch queries).
+
+Both grow without limit. As in intern.c, readers take no lock: a table or array
+is only ever replaced (never changed in place) when it grows, and the old ones
+are kept until virus_table_clear(), so a reader holding an old one can still use
+it. Additions are rare and must be serialized by the caller.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "virus_table.h"
+
+#define VIRUS_TABLE_INITIAL_SLOTS 64 // the hash table starts with this many slots (a power of two)
+
+// defining one generation of the hash table
+typedef struct VirusSlots
+{
+   struct VirusSlots *older; // the table this one replaced, freed by virus_table_clear()
+   size_t slot_count;        // number of slots (a power of two)
+   Virus *slots[];           // the viruses, NULL for an empty slot
+} VirusSlots;
+
+// defining one generation of the creation-order array
+typedef struct VirusArray
+{
+   struct VirusArray *older; // the array this one replaced, freed by virus_table_clear()
+   int capacity;             // number of entries
+   Virus *items[];
+} VirusArray;
+
+static VirusSlots *table = NULL;   // the current hash table, read without a lock
+static VirusArray *by_index = NULL; // the current creation-order array, read without a lock
+static int virus_count = 0;        // viruses published, raised only once a virus is reachable
+
+// hash_name(...) is the 64-bit FNV-1a hash, plenty for short names
+static uint64_t hash_name(const char *name, size_t len)
+{
+   uint64_t hash = 0xcbf29ce484222325ULL;
+
+   for (size_t i = 0; i < len; i++)
+   {
+      hash ^= (unsigned char)name[i];
+      hash *= 0x100000001b3ULL;
+   }
+
+   return hash;
+}
+
+// find_slot(...) returns the slot holding name, or the empty slot where it belongs
+static size_t find_slot(VirusSlots *current, const char *name, size_t len, Virus **entry_out)
+{
+   size_t mask = current->slot_count - 1;
+   size_t i = hash_name(name, len) & mask;
+   Virus *entry;
+
+   // linear probing until we hit the name or an empty slot
+   while ((entry = __atomic_load_n(&current->slots[i], __ATOMIC_ACQUIRE)) != NULL &&
+          !(entry->len == len && memcmp(entry->name, name, len) == 0))
+   {
+      i = (i + 1) & mask;
+   }
+
+   *entry_out = entry;
+   return i;
+}
+
+// grow_slots(...) builds a hash table twice the size and publishes it
+static int grow_slots(void)
+{
+   size_t new_count = table ? table->slot_count * 2 : VIRUS_TABLE_INITIAL_SLOTS;
+   VirusSlots *bigger = calloc(1, sizeof(VirusSlots) + new_count * sizeof(Virus *));
+
+   // checking if memory was allocated successfully
+   if (bigger == NULL)
+   {
+      printf("Error while allocating memory");
+      return -1;
+   }
+
+   bigger->slot_count = new_count;
+   bigger->older = table;
+   Virus *entry;
+
+   for (size_t i = 0; table != NULL && i < table->slot_count; i++)
+   {
+      if (table->slots[i] != NULL)
+         bigger->slots[find_slot(bigger, table->slots[i]->name, table->slots[i]->len, &entry)] = table->slots[i];
+   }
+
+   __atomic_store_n(&table, bigger, __ATOMIC_RELEASE);
+   return 0;
+}
+
+// grow_array(...) builds a creation-order array twice the size and publishes it
+static int grow_array(void)
+{
+   int new_capacity = by_index ? by_index->capacity * 2 : VIRUS_TABLE_INITIAL_SLOTS;
+   VirusArray *bigger = calloc(1, sizeof(VirusArray) + new_capacity * sizeof(Virus *));
+
+   // checking if memory was allocated successfully
+   if (bigger == NULL)
+   {
+      printf("Error while allocating memory");
+      return -1;
+   }
+
+   bigger->capacity = new_capacity;
+   bigger->older = by_index;
+   if (by_index != NULL)
+      memcpy(bigger->items, by_index->items, virus_count * sizeof(Virus *));
+
+   __atomic_store_n(&by_index, bigger, __ATOMIC_RELEASE);
+   return 0;
+}
+
+// implementing virus_table_find(...) to look up a virus by the first len characters of name
+Virus *virus_table_find(const char *name, size_t len)
+{
+   VirusSlots *current = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+   Virus *result = NULL;
+
+   if (current != NULL)
+      find_slot(current, name, len, &result);
+
+   return result;
+}
+
+// implementing virus_table_add(...) to make a fully set up virus visible to readers
+// the caller makes sure no other thread is adding and that the name is not taken yet
+int virus_table_add(Virus *virus)
+{
+   // keeping the table at most half full so probe sequences stay short
+   if ((table == NULL || (size_t)(virus_count + 1) * 2 > table->slot_count) && grow_slots() != 0)
+   {
+      return -1;
+   }
+
+   if ((by_index == NULL || virus_count >= by_index->capacity) && grow_array() != 0)
+   {
+      return -1;
+   }
+
+   Virus *entry;
+   size_t slot = find_slot(table, virus->name, virus->len, &entry);
+
+   virus->index = virus_count;
+   by_index->items[virus_count] = virus;
+   __atomic_store_n(&table->slots[slot], virus, __ATOMIC_RELEASE);
+
+   // publishing the index only once the virus can be reached through it
+   __atomic_store_n(&virus_count, virus_count + 1, __ATOMIC_RELEASE);
+   return virus->index;
+}
+
+// implementing virus_table_get(...) to get a virus by its index
+Virus *virus_table_get(int index)
+{
+   return __atomic_load_n(&by_index, __ATOMIC_ACQUIRE)->items[index];
+}
+
+// implementing virus_table_count(...) to get how many viruses can be read
+int virus_table_count(void)
+{
+   return __atomic_load_n(&virus_count, __ATOMIC_ACQUIRE);
+}
+
+// implementing virus_table_memory(...) to report what the table costs
+size_t virus_table_memory(void)
+{
+   size_t bytes = 0;
+
+   for (VirusSlots *t = table; t != NULL; t = t->older)
+   {
+      bytes += sizeof(VirusSlots) + t->slot_count * sizeof(Virus *);
+   }
+   for (VirusArray *a = by_index; a != NULL; a = a->older)
+   {
+      bytes += sizeof(VirusArray) + a->capacity * sizeof(Virus *);
+   }
+
+   return bytes;
+}
+
+// implementing virus_table_clear(...) to release every generation of the table
+// the viruses themselves belong to the caller; no other thread may use the table
+void virus_table_clear(void)
+{
+   while (table != NULL)
+   {
+      VirusSlots *older = table->older;
+      free(table);
+      table = older;
+   }
+
+   while (by_index != NULL)
+   {
+      VirusArray *older = by_index->older;
+      free(by_index);
+      by_index = older;
+   }
+
+   virus_count = 0;
+}
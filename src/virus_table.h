@@ -0,0 +1,42 @@
+#ifndef VIRUS_TABLE_H
+#define VIRUS_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bloom_filter.h"
+#include "index.h"
+#include "date_index.h"
+#include "population.h"
+#include "unvaccinated.h"
+#include "column_store.h"
+#include "metrics.h"
+
+// defining the structure for a virus
+typedef struct
+{
+   char *name;
+   size_t len;                 // strlen(name), compared before the characters
+   int index;                  // position in creation order, given by virus_table_add(...)
+   BloomFilter *bloom;
+   Index *records;             // the records in citizen ID order, in the backend chosen with -i
+   DateIndex *dates;           // the dated records by vaccination date
+   Population *population;     // YES/NO counts by country and age band, vaccinations by day
+   UnvaccinatedSet *unvaccinated; // the NO records by citizen ID, so changes can take back the right NO
+   BloomFilter *retired_bloom; // a filter replaced while queries may still read it, freed at exit
+   ColumnStore *columns;       // the records as columns, built by the first filter query (see columns_for(...))
+   uint64_t removals;          // records taken out so far, which a column store is stamped with
+   uint64_t counted;           // vaccinated records seen by the pre-scan
+   VirusMetrics metrics;       // check outcomes and load/check latencies, shown by stats
+} Virus;
+
+/*
+function prototypes
+*/
+Virus *virus_table_find(const char *name, size_t len); // function to find a virus by name without locking
+int virus_table_add(Virus *virus);                     // function to publish a complete virus, its index on success
+Virus *virus_table_get(int index);                     // function to get the virus created index-th
+int virus_table_count(void);                           // function to get the number of published viruses
+size_t virus_table_memory(void);                       // function to get the bytes held by the table
+void virus_table_clear(void);                          // function to release the table (not the viruses)
+
+#endif
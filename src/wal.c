@@ -0,0 +1,431 @@
+/*
+This is the wal.c file that implements the write-ahead log of insert, update and
+delete commands (-w), so the changes made at the prompt survive a restart.
+
+A change is applied in memory first and then appended to the log: appending only
+copies the entry into a buffer under a mutex, and a flusher thread writes out
+whatever has piled up since its last write with one write(...) and one fdatasync(...)
+(group commit). Unless someone waits for a group, the flusher lets it build up for
+WAL_COMMIT_DELAY_US first, so a stream of changes costs a few hundred fsyncs a
+second rather than one per change or two, and its rate stays close to that of the
+in-memory updates. wal_wait(...) blocks until a given entry is on disk for callers
+that must not acknowledge a change before that; a waiting caller has its group
+written at once, and the entries appended while that fsync runs ride on the next.
+
+On a restart the log is replayed on top of its base (the input file or snapshot it
+was started on), and compaction saves a snapshot of the current state and starts an
+empty log naming that snapshot as its new base.
+*/
+
+// importing relevant libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "bloom_filter.h"
+
+// entry_checksum(...) hashes an entry's text together with its op and size
+static uint64_t entry_checksum(uint32_t op, const char *text, size_t len)
+{
+   return bloom_hash(text, len) ^ ((uint64_t)op << 32 | len) * 0x9e3779b97f4a7c15ULL;
+}
+
+// write_all(...) writes len bytes, retrying short writes
+static int write_all(int fd, const char *data, size_t len)
+{
+   while (len > 0)
+   {
+      ssize_t written = write(fd, data, len);
+      if (written < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+      data += written;
+      len -= written;
+   }
+
+   return 0;
+}
+
+// read_all(...) reads up to len bytes and returns how many it got, -1 on error
+static ssize_t read_all(int fd, char *data, size_t len)
+{
+   size_t got = 0;
+
+   while (got < len)
+   {
+      ssize_t n = read(fd, data + got, len - got);
+      if (n < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+      if (n == 0)
+         break;
+      got += n;
+   }
+
+   return got;
+}
+
+// describe_base(...) fills a header with the absolute path and size of a base file
+static int describe_base(const char *base, WalHeader *header)
+{
+   char resolved[PATH_MAX];
+   struct stat st;
+
+   if (realpath(base, resolved) == NULL || stat(resolved, &st) != 0 || strlen(resolved) >= WAL_BASE_LEN)
+   {
+      return -1;
+   }
+
+   memset(header, 0, sizeof(WalHeader));
+   memcpy(header->magic, WAL_MAGIC, sizeof(header->magic));
+   header->version = WAL_VERSION;
+   header->base_size = st.st_size;
+   strcpy(header->base, resolved);
+   return 0;
+}
+
+// create_log(...) writes a log that holds only a header to path and syncs it
+static int create_log(const char *path, const WalHeader *header)
+{
+   int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+   if (fd < 0)
+   {
+      return -1;
+   }
+
+   if (write_all(fd, (const char *)header, sizeof(WalHeader)) != 0 || fsync(fd) != 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+// flusher(...) is the thread that writes and syncs every group of appended entries
+static void *flusher(void *arg)
+{
+   Wal *wal = arg;
+
+   pthread_mutex_lock(&wal->lock);
+   while (1)
+   {
+      while (wal->len == 0 && !wal->stop)
+      {
+         pthread_cond_wait(&wal->work, &wal->lock);
+      }
+
+      if (wal->len == 0)
+      {
+         break; // stopping, and nothing is left to write
+      }
+
+      // letting the group grow unless it is already large or someone waits for it
+      if (!wal->stop && wal->waiters == 0 && wal->len < WAL_GROUP_BYTES)
+      {
+         struct timespec until;
+         clock_gettime(CLOCK_REALTIME, &until);
+         until.tv_nsec += WAL_COMMIT_DELAY_US * 1000L;
+         if (until.tv_nsec >= 1000000000L)
+         {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+         }
+         pthread_cond_timedwait(&wal->work, &wal->lock, &until);
+      }
+
+      // taking the whole buffer, appenders carry on in the spare one meanwhile
+      char *group = wal->buffer;
+      size_t len = wal->len;
+      uint64_t last = wal->appended;
+      size_t group_size = wal->size;
+      int fd = wal->fd;
+      wal->buffer = wal->spare;
+      wal->size = wal->spare_size;
+      wal->spare = group;
+      wal->spare_size = group_size;
+      wal->len = 0;
+      wal->flushing = 1;
+      pthread_mutex_unlock(&wal->lock);
+
+      int result = wal->failed ? -1 : write_all(fd, group, len);
+      if (result == 0)
+         result = fdatasync(fd);
+
+      pthread_mutex_lock(&wal->lock);
+      if (result == 0)
+      {
+         wal->durable = last;
+         wal->bytes += len;
+         wal->syncs++;
+      }
+      else
+      {
+         wal->failed = 1;
+      }
+      wal->flushing = 0;
+      pthread_cond_broadcast(&wal->done);
+   }
+   pthread_mutex_unlock(&wal->lock);
+
+   return NULL;
+}
+
+// wait_idle(...) waits, with the lock held, until every appended entry has been written
+static void wait_idle(Wal *wal)
+{
+   wal->waiters++;
+   while ((wal->len > 0 || wal->flushing) && !wal->failed)
+   {
+      pthread_cond_signal(&wal->work);
+      pthread_cond_wait(&wal->done, &wal->lock);
+   }
+   wal->waiters--;
+}
+
+// implementing wal_open(...) to open the log at path, or start one on base if there is
+// none; a log started on another base (or on this one before it changed) is refused
+Wal *wal_open(const char *path, const char *base, char *error, size_t error_size)
+{
+   WalHeader expected, found;
+
+   if (describe_base(base, &expected) != 0)
+   {
+      snprintf(error, error_size, "cannot read the base file %s", base);
+      return NULL;
+   }
+
+   Wal *wal = calloc(1, sizeof(Wal));
+   if (wal == NULL || (wal->path = strdup(path)) == NULL)
+   {
+      snprintf(error, error_size, "out of memory");
+      free(wal);
+      return NULL;
+   }
+
+   wal->fd = open(path, O_RDWR);
+   if (wal->fd < 0 && errno == ENOENT)
+   {
+      wal->fd = create_log(path, &expected);
+   }
+   else if (wal->fd >= 0)
+   {
+      if (read_all(wal->fd, (char *)&found, sizeof(found)) != sizeof(found) ||
+          memcmp(found.magic, WAL_MAGIC, sizeof(found.magic)) != 0 || found.version != WAL_VERSION)
+      {
+         snprintf(error, error_size, "not a log of this version");
+         close(wal->fd);
+         free(wal->path);
+         free(wal);
+         return NULL;
+      }
+
+      if (strncmp(found.base, expected.base, WAL_BASE_LEN) != 0 || found.base_size != expected.base_size)
+      {
+         snprintf(error, error_size, "the log applies to %.*s (%llu bytes)", WAL_BASE_LEN, found.base,
+                  (unsigned long long)found.base_size);
+         close(wal->fd);
+         free(wal->path);
+         free(wal);
+         return NULL;
+      }
+   }
+
+   if (wal->fd < 0)
+   {
+      snprintf(error, error_size, "%s", strerror(errno));
+      free(wal->path);
+      free(wal);
+      return NULL;
+   }
+
+   wal->bytes = sizeof(WalHeader);
+   wal->size = wal->spare_size = WAL_BUFFER_SIZE;
+   wal->buffer = malloc(wal->size);
+   wal->spare = malloc(wal->spare_size);
+   pthread_mutex_init(&wal->lock, NULL);
+   pthread_cond_init(&wal->work, NULL);
+   pthread_cond_init(&wal->done, NULL);
+
+   if (wal->buffer == NULL || wal->spare == NULL || pthread_create(&wal->flusher, NULL, flusher, wal) != 0)
+   {
+      snprintf(error, error_size, "out of memory");
+      close(wal->fd);
+      free(wal->buffer);
+      free(wal->spare);
+      free(wal->path);
+      free(wal);
+      return NULL;
+   }
+
+   return wal;
+}
+
+// implementing wal_replay(...) to hand every entry to visit and count them into entries;
+// the log is cut after the last complete entry, so new entries follow it
+int wal_replay(Wal *wal, WalVisitor visit, void *ctx, uint64_t *entries)
+{
+   char text[WAL_MAX_ENTRY];
+   WalEntry entry;
+   off_t offset = sizeof(WalHeader);
+
+   *entries = 0;
+   if (lseek(wal->fd, offset, SEEK_SET) < 0)
+   {
+      return -1;
+   }
+
+   // a short read, an impossible size or a bad checksum marks a torn write
+   while (read_all(wal->fd, (char *)&entry, sizeof(entry)) == sizeof(entry) &&
+          entry.size <= WAL_MAX_ENTRY && entry.op >= WAL_INSERT && entry.op <= WAL_DELETE &&
+          read_all(wal->fd, text, entry.size) == (ssize_t)entry.size &&
+          entry.checksum == entry_checksum(entry.op, text, entry.size))
+   {
+      if (visit((WalOp)entry.op, text, entry.size, ctx) != 0)
+      {
+         return -1;
+      }
+
+      offset += sizeof(entry) + entry.size;
+      (*entries)++;
+   }
+
+   if (ftruncate(wal->fd, offset) != 0 || lseek(wal->fd, offset, SEEK_SET) < 0)
+   {
+      return -1;
+   }
+
+   pthread_mutex_lock(&wal->lock);
+   wal->bytes = offset;
+   pthread_mutex_unlock(&wal->lock);
+   return 0;
+}
+
+// implementing wal_append(...) to queue a change for the next group commit
+uint64_t wal_append(Wal *wal, WalOp op, const char *text, size_t len)
+{
+   WalEntry entry = {(uint32_t)len, (uint32_t)op, entry_checksum(op, text, len)};
+   uint64_t sequence = 0;
+
+   if (len > WAL_MAX_ENTRY)
+   {
+      return 0;
+   }
+
+   pthread_mutex_lock(&wal->lock);
+
+   // growing the buffer when the disk falls behind, rather than blocking the caller
+   size_t needed = wal->len + sizeof(entry) + len;
+   if (needed > wal->size)
+   {
+      size_t size = wal->size * 2 > needed ? wal->size * 2 : needed;
+      char *bigger = realloc(wal->buffer, size);
+      if (bigger != NULL)
+      {
+         wal->buffer = bigger;
+         wal->size = size;
+      }
+   }
+
+   if (!wal->failed && needed <= wal->size)
+   {
+      // waking the flusher for the first entry of a group and once the group is large,
+      // it sleeps through the rest
+      size_t before = wal->len;
+      memcpy(wal->buffer + wal->len, &entry, sizeof(entry));
+      memcpy(wal->buffer + wal->len + sizeof(entry), text, len);
+      wal->len = needed;
+      sequence = ++wal->appended;
+      if (before == 0 || (before < WAL_GROUP_BYTES && needed >= WAL_GROUP_BYTES))
+         pthread_cond_signal(&wal->work);
+   }
+
+   pthread_mutex_unlock(&wal->lock);
+   return sequence;
+}
+
+// implementing wal_wait(...) to block until the entry numbered sequence is on disk
+int wal_wait(Wal *wal, uint64_t sequence)
+{
+   pthread_mutex_lock(&wal->lock);
+   wal->waiters++;
+   pthread_cond_signal(&wal->work);
+   while (wal->durable < sequence && !wal->failed)
+   {
+      pthread_cond_wait(&wal->done, &wal->lock);
+   }
+   wal->waiters--;
+   int result = wal->durable >= sequence ? 0 : -1;
+   pthread_mutex_unlock(&wal->lock);
+
+   return result;
+}
+
+// implementing wal_reset(...) to replace the log with an empty one on base, once base holds
+// every change logged so far; the new log is written beside the old one and renamed over it,
+// so a crash leaves either the old base and log or the new ones
+// (the caller must not apply changes between writing base and this call)
+int wal_reset(Wal *wal, const char *base)
+{
+   WalHeader header;
+   char temp_path[PATH_MAX];
+
+   if (describe_base(base, &header) != 0 ||
+       snprintf(temp_path, sizeof(temp_path), "%s.tmp", wal->path) >= (int)sizeof(temp_path))
+   {
+      return -1;
+   }
+
+   pthread_mutex_lock(&wal->lock);
+   wait_idle(wal);
+
+   int fd = wal->failed ? -1 : create_log(temp_path, &header);
+   if (fd < 0 || rename(temp_path, wal->path) != 0)
+   {
+      if (fd >= 0)
+      {
+         close(fd);
+         unlink(temp_path);
+      }
+      pthread_mutex_unlock(&wal->lock);
+      return -1;
+   }
+
+   close(wal->fd);
+   wal->fd = fd;
+   wal->bytes = sizeof(WalHeader);
+   pthread_mutex_unlock(&wal->lock);
+   return 0;
+}
+
+// implementing wal_close(...) to commit the entries still queued, stop the flusher and free the log
+void wal_close(Wal *wal)
+{
+   pthread_mutex_lock(&wal->lock);
+   wal->stop = 1;
+   pthread_cond_signal(&wal->work);
+   pthread_mutex_unlock(&wal->lock);
+   pthread_join(wal->flusher, NULL);
+
+   close(wal->fd);
+   pthread_mutex_destroy(&wal->lock);
+   pthread_cond_destroy(&wal->work);
+   pthread_cond_destroy(&wal->done);
+   free(wal->buffer);
+   free(wal->spare);
+   free(wal->path);
+   free(wal);
+}
@@ -0,0 +1,97 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define WAL_MAGIC "VACWAL1"   // the first 8 bytes of every log (with the NUL)
+#define WAL_VERSION 1         // bumped whenever the layout below changes
+#define WAL_BASE_LEN 1024     // longest path of the base a log can name
+#define WAL_MAX_ENTRY 4096    // longest text one entry may carry
+#define WAL_BUFFER_SIZE (1 << 16) // bytes an appender may buffer before the buffer grows
+#define WAL_GROUP_BYTES (1 << 15) // a group this large is written without waiting for more
+#define WAL_COMMIT_DELAY_US 2000  // how long a group may grow while nobody waits for it
+
+/*
+On-disk layout:
+
+   WalHeader
+   entries: WalEntry followed by size bytes of text, one after the other
+
+An entry's text is what the user typed after the command (the record fields for
+insert and update, "<citizen_id> <virus>" for delete), so a replay goes through the
+same parsing as the prompt. A log only applies on top of the base it names (the
+input file or snapshot it was started on, with that base's size); the first entry
+whose checksum does not match, and everything after it, is a write that never
+completed and is cut off when the log is opened.
+*/
+
+// defining the changes a log records
+typedef enum
+{
+   WAL_INSERT = 1,
+   WAL_UPDATE = 2,
+   WAL_DELETE = 3
+} WalOp;
+
+// defining the fixed-size header at the start of a log
+typedef struct
+{
+   char magic[8];       // WAL_MAGIC
+   uint32_t version;    // WAL_VERSION
+   uint32_t reserved;   // zero
+   uint64_t base_size;  // size of the base file when the log was started
+   char base[WAL_BASE_LEN]; // absolute path of the base file
+} WalHeader;
+
+// defining the header of one entry
+typedef struct
+{
+   uint32_t size;      // bytes of text after the header
+   uint32_t op;        // a WalOp value
+   uint64_t checksum;  // hash of op and text
+} WalEntry;
+
+// defining the callback a replay hands every entry to, non-zero stops the replay
+typedef int (*WalVisitor)(WalOp op, const char *text, size_t len, void *ctx);
+
+// defining an open log
+// appenders copy their entry into buffer[] under the lock and a flusher thread writes
+// and fsyncs whatever has piled up, so one fsync commits every entry appended meanwhile
+typedef struct
+{
+   int fd;
+   char *path;
+   char *buffer;       // entries appended and not yet handed to the flusher
+   size_t len;
+   size_t size;
+   char *spare;        // the buffer the flusher is writing out
+   size_t spare_size;
+   uint64_t appended;  // sequence number of the last entry appended
+   uint64_t durable;   // sequence number of the last entry known to be on disk
+   uint64_t bytes;     // bytes in the file
+   uint64_t syncs;     // fsyncs done, each one commits a group of entries
+   int failed;         // set once a write or fsync fails, the log takes no more entries
+   int stop;           // set by wal_close(...) to end the flusher
+   int flushing;       // set while the flusher runs
+   int waiters;        // callers blocked until their entry is on disk
+   pthread_t flusher;
+   pthread_mutex_t lock;
+   pthread_cond_t work; // signalled when entries are appended
+   pthread_cond_t done; // broadcast when a group is on disk
+} Wal;
+
+/*
+function prototypes
+*/
+Wal *wal_open(const char *path, const char *base, char *error,
+              size_t error_size);                                   // function to open (or start) the log of a base
+int wal_replay(Wal *wal, WalVisitor visit, void *ctx,
+               uint64_t *entries);                                  // function to replay every entry before the first append, 0 on success
+uint64_t wal_append(Wal *wal, WalOp op, const char *text, size_t len); // function to log a change, returns its sequence number (0 on failure)
+int wal_wait(Wal *wal, uint64_t sequence);                          // function to wait until an entry is on disk, 0 on success
+int wal_reset(Wal *wal, const char *base);                          // function to start an empty log on a new base (compaction), 0 on success
+void wal_close(Wal *wal);                                           // function to commit what is pending and close the log
+
+#endif
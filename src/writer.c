@@ -0,0 +1,109 @@
+/*
+This is the writer.c file that implements a buffered output writer. Output is
+formatted by hand into one large buffer and written with write(...) only when
+the buffer is full, which is far cheaper than one printf(...) per line.
+*/
+
+// importing relevant libraries
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "writer.h"
+
+// implementing writer_init(...) to set up a writer with a buffer of size bytes
+int writer_init(Writer *writer, int fd, size_t size)
+{
+   writer->fd = fd;
+   writer->len = 0;
+   writer->size = size ? size : WRITER_DEFAULT_SIZE;
+   writer->failed = 0;
+   writer->buf = malloc(writer->size);
+
+   return writer->buf == NULL ? -1 : 0;
+}
+
+// implementing writer_flush(...) to hand everything pending to the kernel
+int writer_flush(Writer *writer)
+{
+   size_t done = 0;
+
+   while (done < writer->len && !writer->failed)
+   {
+      ssize_t written = write(writer->fd, writer->buf + done, writer->len - done);
+
+      // retrying writes interrupted by a signal, giving up on real errors
+      if (written < 0)
+      {
+         if (errno != EINTR)
+            writer->failed = 1;
+         continue;
+      }
+
+      done += written;
+   }
+
+   writer->len = 0;
+   return writer->failed ? -1 : 0;
+}
+
+// implementing writer_put(...) to append len bytes, flushing when the buffer fills up
+void writer_put(Writer *writer, const char *str, size_t len)
+{
+   while (len > 0)
+   {
+      if (writer->len == writer->size)
+         writer_flush(writer);
+
+      size_t room = writer->size - writer->len;
+      size_t chunk = len < room ? len : room;
+
+      memcpy(writer->buf + writer->len, str, chunk);
+      writer->len += chunk;
+      str += chunk;
+      len -= chunk;
+   }
+}
+
+// implementing writer_puts(...) to append a NUL-terminated string
+void writer_puts(Writer *writer, const char *str)
+{
+   writer_put(writer, str, strlen(str));
+}
+
+// implementing writer_putc(...) to append a single character
+void writer_putc(Writer *writer, char c)
+{
+   if (writer->len == writer->size)
+      writer_flush(writer);
+
+   writer->buf[writer->len++] = c;
+}
+
+// implementing writer_put_int(...) to format a number without going through printf(...)
+void writer_put_int(Writer *writer, long long value)
+{
+   char digits[24];
+   int i = sizeof(digits);
+   unsigned long long magnitude = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+
+   // writing digits from the right end of the scratch buffer
+   do
+   {
+      digits[--i] = '0' + magnitude % 10;
+      magnitude /= 10;
+   } while (magnitude > 0);
+
+   if (value < 0)
+      digits[--i] = '-';
+
+   writer_put(writer, digits + i, sizeof(digits) - i);
+}
+
+// implementing writer_close(...) to flush the last bytes and free the buffer
+void writer_close(Writer *writer)
+{
+   writer_flush(writer);
+   free(writer->buf);
+   writer->buf = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WRITER_DEFAULT_SIZE (1 << 20) // a 1 MB buffer turns millions of lines into a few write(...) calls
+
+// defining a buffered writer on top of a file descriptor
+typedef struct
+{
+   int fd;        // where the buffer is flushed to
+   char *buf;     // pending output
+   size_t len;    // bytes pending in buf
+   size_t size;   // capacity of buf
+   int failed;    // set once a write(...) fails, later output is dropped
+} Writer;
+
+/*
+function prototypes
+*/
+int writer_init(Writer *writer, int fd, size_t size);               // function to set up a writer, 0 on success
+void writer_put(Writer *writer, const char *str, size_t len);       // function to append len bytes
+void writer_puts(Writer *writer, const char *str);                  // function to append a NUL-terminated string
+void writer_putc(Writer *writer, char c);                           // function to append one character
+void writer_put_int(Writer *writer, long long value);               // function to append a number in decimal
+int writer_flush(Writer *writer);                                   // function to write out everything pending, 0 on success
+void writer_close(Writer *writer);                                  // function to flush and release the buffer
+
+#endif
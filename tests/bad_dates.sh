@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# checking that every loader stops at a YES record whose date is not a real day, instead of
+# loading it without its date, and that -x logs the line as a bad date and loads the rest
+# usage: tests/bad_dates.sh [path to vaccinationManager]
+
+PROGRAM=${1:-./vaccinationManager}
+INPUT=$(mktemp)
+REJECTS=$(mktemp)
+trap 'rm -f "$INPUT" "$REJECTS"' EXIT
+
+# a valid record, one vaccinated on a day that does not exist, and another valid one
+printf '1 A B Greece 50 COVID YES 2021-01-05\n2 C D Greece 50 COVID YES 2021-02-30\n3 E F Greece 50 COVID YES 2021-01-06\n' > "$INPUT"
+
+failed=0
+
+# expect(...) loads the file with the given options and looks for a line of the output
+expect() {
+    local options="$1" wanted="$2"
+
+    if ! printf 'exit\n' | "$PROGRAM" $options "$INPUT" | grep -qF "$wanted"; then
+        echo "FAIL: [$options] expected: $wanted"
+        failed=1
+    fi
+}
+
+for options in "" "-m" "-j 4" "-b" "-a"; do
+    expect "$options" "Record format is invalid (line 2)"
+done
+
+expect "-x $REJECTS" "1 bad date"
+if ! grep -qF "2	date	2 C D Greece 50 COVID YES 2021-02-30" "$REJECTS"; then
+    echo "FAIL: -x did not log line 2 as a bad date"
+    failed=1
+fi
+
+if [ $failed -eq 0 ]; then
+    echo "bad dates: all checks passed"
+fi
+exit $failed
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# checking that insert, update and delete keep the YES/NO tallies of stats exact,
+# also for NO records, which are counted but not stored in the index
+# usage: tests/no_tallies.sh [path to vaccinationManager]
+
+PROGRAM=${1:-./vaccinationManager}
+INPUT=$(mktemp)
+trap 'rm -f "$INPUT"' EXIT
+
+# one vaccinated and one unvaccinated citizen of the same country and age band
+printf '1 A B Greece 50 COVID YES 2021-01-05\n2 C D Greece 50 COVID NO\n' > "$INPUT"
+
+failed=0
+
+# expect(...) runs one command against a fresh load and compares the stats line that follows it
+expect() {
+    local command="$1" wanted="$2"
+    local got
+    got=$(printf '%s\nstats COVID Greece\nexit\n' "$command" | "$PROGRAM" "$INPUT" | grep -o 'COVID in Greece: .*')
+
+    if [ "$got" != "$wanted" ]; then
+        echo "FAIL: $command"
+        echo "   expected: $wanted"
+        echo "   got:      $got"
+        failed=1
+    fi
+}
+
+# a new citizen's YES takes no NO away from another citizen
+expect "update 3 E F Greece 55 COVID YES 2021-02-01" "COVID in Greece: 2 of 3 citizens vaccinated (66.7%)"
+# an update of a NO to a NO replaces it instead of adding a second one
+expect "update 2 C D Greece 50 COVID NO" "COVID in Greece: 1 of 2 citizens vaccinated (50.0%)"
+# a NO can be deleted, and its count goes with it
+expect "delete 2 COVID" "COVID in Greece: 1 of 1 citizens vaccinated (100.0%)"
+# an insert for a citizen who has a NO already is refused, not counted twice
+expect "insert 2 C D Greece 50 COVID NO" "COVID in Greece: 1 of 2 citizens vaccinated (50.0%)"
+# a NO turned into a YES moves the citizen from one tally to the other
+expect "update 2 C D Greece 50 COVID YES 2021-03-01" "COVID in Greece: 2 of 2 citizens vaccinated (100.0%)"
+# and a YES turned into a NO does the reverse
+expect "update 1 A B Greece 50 COVID NO" "COVID in Greece: 0 of 2 citizens vaccinated (0.0%)"
+
+if [ $failed -eq 0 ]; then
+    echo "NO tallies: all checks passed"
+fi
+exit $failed